@@ -5,7 +5,7 @@
 #include <bb_rtc.h>
 
 BBRTC rtc;
-const char *szRTCType[] = {"None", "BM8563", "DS3231", "RV-3032", "PCF85063A"};
+const char *szRTCType[] = {"None", "BM8563", "DS3231", "RV-3032", "PCF85063A", "DS1307", "DS3232", "MCP7940N", "PCF2129"};
 
 void TestPassFail(bool bPass, int *pPass)
 {
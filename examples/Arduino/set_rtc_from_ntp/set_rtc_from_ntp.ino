@@ -11,7 +11,7 @@ int iTimeOffset; // offset in seconds
 
 BBRTC rtc;
 const char *szDays[] = {"Sunday", "Monday", "Tuesday", "Wednesday", "Thursday", "Friday", "Saturday"};
-const char *szRTCType[] = {"None", "BM8563", "DS3231", "RV-3032", "PCF85063A"};
+const char *szRTCType[] = {"None", "BM8563", "DS3231", "RV-3032", "PCF85063A", "DS1307", "DS3232", "MCP7940N", "PCF2129"};
 const char* ssid     = "MEO-B970C0-2G&5G";
 const char* password = "19b59e2bf7";
 
@@ -0,0 +1,82 @@
+//
+// Cost of the bit banged I2C engine in pin operations
+// A simulated DS3231 is wired to simulated GPIO pins and the library is
+// run through BBRTCBitBang, so the pin calls made for each byte on the
+// wire can be counted without a board. Each workload is run with the
+// clock stretching check on and off, and with a slave which stretches
+// the clock after every byte.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <bb_rtc.h>
+#include <bb_rtc_bitbang.h>
+
+BBRTCSimTransport sim;
+BBRTCTransportAdapter<BBRTCBitBang<BBRTCSimGPIO> > bus;
+BBRTC rtc;
+
+static int64_t NowNs(void)
+{
+struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+} /* NowNs() */
+
+//
+// Run one API iCount times and report what it cost on the pins
+//
+void RunTest(const char *szName, int iOp, int iCount)
+{
+BBRTCSimGPIO *pGPIO = &bus.transport.gpio;
+struct tm t;
+int i;
+int64_t i64Start, i64Ns;
+
+	pGPIO->clearCounts();
+	i64Start = NowNs();
+	for (i=0; i<iCount; i++) {
+		switch (iOp) {
+			case 0: rtc.getTime(&t); break;
+			case 1: rtc.getStatus(); break;
+			case 2: rtc.setTime(&t); break;
+		}
+	}
+	i64Ns = NowNs() - i64Start;
+	printf("  %-10s %8.2f %8.1f %10.1f %6u\n", szName,
+		(double)pGPIO->getOps() / (double)pGPIO->getBytes(),
+		(double)pGPIO->getBytes() / (double)iCount,
+		(double)i64Ns / (double)iCount, pGPIO->getErrors());
+} /* RunTest() */
+
+int main(int argc, char *argv[])
+{
+int i, iCount = 100000;
+struct tm t;
+const char *szSetup[3] = {"stretch check on", "stretch check off", "slave stretches 4 reads"};
+
+	if (argc > 1) iCount = atoi(argv[1]);
+	if (iCount < 1) iCount = 1;
+	sim.addDevice(RTC_DS3231);
+	bus.transport.gpio.attach(&sim);
+	bus.transport.init(0, 1, 0); // no pacing; measure the engine itself
+	if (rtc.init(&bus) != RTC_SUCCESS) {
+		printf("The simulated RTC wasn't found\n");
+		return -1;
+	}
+	rtc.getTime(&t);
+	for (i=0; i<3; i++) {
+		bus.transport.setStretchTimeout((i == 1) ? 0 : RTC_BB_STRETCH);
+		bus.transport.gpio.setStretch((i == 2) ? 4 : 0);
+		printf("%s\n", szSetup[i]);
+		printf("  %-10s %8s %8s %10s %6s\n", "API", "ops/byte", "bytes", "ns/call", "errors");
+		RunTest("getTime", 0, iCount);
+		RunTest("getStatus", 1, iCount);
+		RunTest("setTime", 2, iCount);
+	}
+	return 0;
+} /* main() */
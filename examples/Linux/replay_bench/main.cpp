@@ -0,0 +1,101 @@
+//
+// Record the bus traffic of a fixed workload on a real board, then replay
+// it on any Linux machine to compare the transaction count and wall time
+// of different versions of the library
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <bb_rtc.h>
+
+#define RING_SIZE 4096
+RTC_TRACE ring[RING_SIZE];
+BBRTCI2CTransport i2c;
+BBRTCSimTransport sim;
+BBRTCTraceTransport trace;
+BBRTCReplayTransport replay;
+BBRTC rtc;
+
+void ShowHelp(void)
+{
+	printf("replay_bench - record and replay RTC bus traffic\n");
+	printf("written by Larry Bank\n\n");
+	printf("Usage:\n");
+	printf("replay_bench record <i2c bus> <file> - run the workload on a real RTC and save the trace\n");
+	printf("replay_bench sim <file> - same, with a simulated DS3231\n");
+	printf("replay_bench replay <file> [notime] - run the workload against a saved trace\n");
+} /* ShowHelp() */
+
+static int64_t NowUs(void)
+{
+struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+} /* NowUs() */
+
+//
+// The workload has to be the same for recording and playback
+//
+int RunWorkload(BBRTCTransport *pTransport)
+{
+int i;
+struct tm t;
+RTC_SNAPSHOT snap;
+
+	if (rtc.init(pTransport) != RTC_SUCCESS) {
+		printf("No supported RTC found\n");
+		return -1;
+	}
+	for (i=0; i<100; i++) rtc.getTime(&t);
+	for (i=0; i<100; i++) rtc.getSnapshot(&snap);
+	for (i=0; i<10; i++) rtc.getTemp();
+	rtc.getStatus();
+	return 0;
+} /* RunWorkload() */
+
+int main(int argc, char *argv[])
+{
+int64_t i64Start, i64Time;
+
+	if (argc >= 4 && strcmp(argv[1], "record") == 0) {
+		i2c.init(atoi(argv[2]), -1, true, 100000);
+		trace.init(&i2c, ring, RING_SIZE);
+	} else if (argc >= 3 && strcmp(argv[1], "sim") == 0) {
+		sim.addDevice(RTC_DS3231);
+		trace.init(&sim, ring, RING_SIZE);
+	} else if (argc >= 3 && strcmp(argv[1], "replay") == 0) {
+		if (replay.loadTrace(argv[2]) != RTC_SUCCESS) {
+			printf("Error loading %s\n", argv[2]);
+			return -1;
+		}
+		replay.setTiming(argc < 4 || strcmp(argv[3], "notime") != 0);
+		i64Start = NowUs();
+		if (RunWorkload(&replay) != 0) return -1;
+		i64Time = NowUs() - i64Start;
+		printf("%u transactions (%d recorded), %d divergences", replay.getTransactions(), replay.getPosition() + replay.getRemaining(), replay.getDivergences());
+		if (replay.getFirstDivergence() >= 0)
+			printf(" (first at transfer %d)", replay.getFirstDivergence());
+		printf("\nwall time %lldus, recorded bus time %lldus\n", (long long)i64Time, (long long)replay.getBusTimeUs());
+		return (replay.getDivergences() == 0 && replay.getRemaining() == 0) ? 0 : 1;
+	} else {
+		ShowHelp();
+		return 0;
+	}
+	trace.enable(true);
+	i64Start = NowUs();
+	if (RunWorkload(&trace) != 0) return -1;
+	i64Time = NowUs() - i64Start;
+	trace.enable(false);
+	printf("%u transactions, wall time %lldus\n", trace.getTotal(), (long long)i64Time);
+	if (trace.getTotal() > RING_SIZE) printf("Warning: the ring overflowed; the start of the trace is missing\n");
+	if (trace.saveTrace(argv[argc-1]) != RTC_SUCCESS) {
+		printf("Error saving %s\n", argv[argc-1]);
+		return -1;
+	}
+	return 0;
+} /* main() */
@@ -0,0 +1,512 @@
+//
+// rtc_tool - an hwclock-like utility built on BBRTC
+// Runs one or more commands (from the command line or a script) over a
+// single open RTC handle, with plain or JSON Lines output. With --bench
+// each command is repeated and its latency and bus traffic reported, to
+// profile a board in the field.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <strings.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <time.h>
+#include <getopt.h>
+#include <bb_rtc.h>
+#include <bb_rtc_fleet.h>
+
+#define MAX_ARGS 8
+#define MAX_FIELDS 12
+#define MAX_LINE 1024
+#define MAX_VALUE 128 // longest field value (all of the feature names take 110)
+
+const char *szRTCType[] = {"None", "PCF8563", "DS3231", "RV-3032", "PCF85063A", "DS1307", "DS3232", "MCP7940N", "PCF2129"};
+const char *szCaps[] = {"time", "alarm", "alarm2", "alarm_repeat", "countdown", "clkout", "temp", "vbackup",
+	"epoch", "stop", "registers", "irq_wait", "ram", "trim", "temp_event"};
+const uint8_t u8SimAddr[] = {0, RTC_PCF8563_ADDR, RTC_DS3231_ADDR, RTC_RV3032_ADDR, RTC_PCF85063A_ADDR,
+	RTC_DS1307_ADDR, RTC_DS3232_ADDR, RTC_MCP7940N_ADDR, RTC_PCF2129_ADDR};
+const char *szFired[] = {"alarm1", "alarm2", "timer", "update", "temp_high", "temp_low"};
+const char *szBusError[] = {"ok", "failed", "bus timeout", "no ACK", "bus stuck", "device gone"}; // RTC_xxx
+
+//
+// Passes every call on to the real bus and counts them
+//
+class CountBus : public BBRTCTransport
+{
+public:
+	BBRTCTransport *pBus;
+	uint32_t u32Xfers, u32Bytes;
+
+	CountBus() : pBus(NULL), u32Xfers(0), u32Bytes(0) {}
+	int probe(uint8_t u8Addr) { u32Xfers++; return pBus->probe(u8Addr); }
+	int read(uint8_t u8Addr, uint8_t *pData, int iLen) { u32Xfers++; u32Bytes += iLen; return pBus->read(u8Addr, pData, iLen); }
+	int write(uint8_t u8Addr, uint8_t *pData, int iLen) { u32Xfers++; u32Bytes += iLen; return pBus->write(u8Addr, pData, iLen); }
+	int readRegister(uint8_t u8Addr, uint8_t u8Reg, uint8_t *pData, int iLen) { u32Xfers++; u32Bytes += iLen + 1; return pBus->readRegister(u8Addr, u8Reg, pData, iLen); }
+	uintptr_t getBusKey() { return pBus->getBusKey(); }
+	int recover() { return pBus->recover(); }
+	int setTimeout(int iMs) { return pBus->setTimeout(iMs); }
+}; // class CountBus
+
+//
+// The output of one command as key/value pairs
+//
+typedef struct _tagfield
+{
+	const char *szKey;
+	char szValue[MAX_VALUE];
+	bool bString; // quoted in JSON
+} FIELD;
+
+typedef struct _tagresult
+{
+	int iFields;
+	FIELD fields[MAX_FIELDS];
+	char szError[64];
+} RESULT;
+
+BBRTCI2CTransport i2c;
+BBRTCSimTransport sim;
+CountBus bus;
+BBRTC rtc;
+bool bJSON = false;
+bool bKernel = false;
+
+void ShowHelp(void)
+{
+	printf("rtc_tool - read, set and profile an RTC\n");
+	printf("written by Larry Bank\n\n");
+	printf("Usage: rtc_tool [options] <command> [args] [\\; <command> ...]\n");
+	printf(" -b, --bus <n>       I2C bus number (default 1)\n");
+	printf(" -d, --dev <path>    use the kernel driver (e.g. /dev/rtc0)\n");
+	printf(" -s, --sim <type>    use a simulated device (DS3231, RV3032, PCF8563, ...)\n");
+	printf(" -f, --file <script> run the commands in a file, one per line (- = stdin)\n");
+	printf(" -j, --json          one JSON object per command\n");
+	printf(" -n, --bench <n>     run each command n times; report latency and bus traffic\n");
+	printf(" -t, --deadline <ms> give up on a command after about this long on a bad bus\n\n");
+	printf("Commands (times are UTC, YYYY-MM-DDTHH:MM:SS):\n");
+	printf(" info                       device type and capabilities\n");
+	printf(" get                        read the time\n");
+	printf(" set <time|now>             set the time\n");
+	printf(" systohc                    set the RTC from the system clock at a second boundary\n");
+	printf(" hctosys                    set the system clock from the RTC (needs root)\n");
+	printf(" compare                    system clock - RTC, measured at an RTC second edge\n");
+	printf(" alarm[2] <second|minute|hour|time|day|date> [wday|mday] [HH:MM:SS]\n");
+	printf(" countdown <ms>             countdown alarm\n");
+	printf(" clear                      clear and disable the alarms\n");
+	printf(" wait [ms]                  wait for an alarm to fire\n");
+	printf(" status                     running and alarm flags\n");
+	printf(" snapshot                   time, status, temperature and fired sources in one read\n");
+	printf(" temp                       temperature\n");
+	printf(" freq <hz|off>              CLKOUT frequency\n");
+	printf(" recover                    free a stuck bus and check the RTC is back\n");
+	printf(" sleep <ms>                 pause (for scripts)\n");
+} /* ShowHelp() */
+
+static int64_t NowNs(clockid_t clk)
+{
+struct timespec ts;
+
+	clock_gettime(clk, &ts);
+	return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+} /* NowNs() */
+
+static void AddField(RESULT *pR, const char *szKey, bool bString, const char *szFormat, ...) __attribute__((format(printf, 4, 5)));
+static void AddField(RESULT *pR, const char *szKey, bool bString, const char *szFormat, ...)
+{
+va_list args;
+FIELD *pF;
+
+	if (pR->iFields >= MAX_FIELDS) return;
+	pF = &pR->fields[pR->iFields++];
+	pF->szKey = szKey;
+	pF->bString = bString;
+	va_start(args, szFormat);
+	vsnprintf(pF->szValue, sizeof(pF->szValue), szFormat, args);
+	va_end(args);
+} /* AddField() */
+
+static int Fail(RESULT *pR, const char *szError)
+{
+	strncpy(pR->szError, szError, sizeof(pR->szError) - 1);
+	return RTC_ERROR;
+} /* Fail() */
+
+static void AddTime(RESULT *pR, const char *szKey, const struct tm *pTime)
+{
+	AddField(pR, szKey, true, "%04d-%02d-%02dT%02d:%02d:%02dZ", pTime->tm_year + 1900, pTime->tm_mon + 1,
+		pTime->tm_mday, pTime->tm_hour, pTime->tm_min, pTime->tm_sec);
+} /* AddTime() */
+
+//
+// Parse YYYY-MM-DDTHH:MM:SS[Z] (or "now" for the system time)
+//
+static int ParseTime(const char *szTime, struct tm *pTime)
+{
+time_t tt;
+
+	memset(pTime, 0, sizeof(struct tm));
+	if (strcmp(szTime, "now") == 0) {
+		tt = time(NULL);
+		gmtime_r(&tt, pTime);
+		return RTC_SUCCESS;
+	}
+	if (sscanf(szTime, "%d-%d-%dT%d:%d:%d", &pTime->tm_year, &pTime->tm_mon, &pTime->tm_mday,
+		&pTime->tm_hour, &pTime->tm_min, &pTime->tm_sec) != 6) return RTC_ERROR;
+	if (pTime->tm_year < 2000 || pTime->tm_year > 2099 || pTime->tm_mon < 1 || pTime->tm_mon > 12 ||
+		pTime->tm_mday < 1 || pTime->tm_mday > 31 || pTime->tm_hour > 23 || pTime->tm_min > 59 || pTime->tm_sec > 59)
+		return RTC_ERROR;
+	pTime->tm_year -= 1900;
+	pTime->tm_mon -= 1;
+	tt = timegm(pTime); // fills in the day of the week
+	gmtime_r(&tt, pTime);
+	return RTC_SUCCESS;
+} /* ParseTime() */
+
+static int ParseClock(const char *szTime, struct tm *pTime)
+{
+	if (sscanf(szTime, "%d:%d:%d", &pTime->tm_hour, &pTime->tm_min, &pTime->tm_sec) != 3) return RTC_ERROR;
+	return (pTime->tm_hour < 24 && pTime->tm_min < 60 && pTime->tm_sec < 60) ? RTC_SUCCESS : RTC_ERROR;
+} /* ParseClock() */
+
+static void AddStatus(RESULT *pR, int iStatus)
+{
+	AddField(pR, "running", false, "%s", (iStatus & STATUS_RUNNING) ? "true" : "false");
+	AddField(pR, "alarm1", false, "%s", (iStatus & STATUS_IRQ1_TRIGGERED) ? "true" : "false");
+	AddField(pR, "alarm2", false, "%s", (iStatus & STATUS_IRQ2_TRIGGERED) ? "true" : "false");
+	if (rtc.getCaps() & RTC_CAP_TEMP_EVENT)
+		AddField(pR, "temp_event", false, "%s", (iStatus & STATUS_TEMP_TRIGGERED) ? "true" : "false");
+} /* AddStatus() */
+
+static int CmdAlarm(RESULT *pR, int iArgs, char **pArgs)
+{
+static const char *szTypes[] = {"second", "minute", "hour", "time", "day", "date"};
+struct tm t;
+int i, iType, iArg = 2;
+bool bSecond = (strcmp(pArgs[0], "alarm2") == 0);
+
+	if (iArgs < 2) return Fail(pR, "missing alarm type");
+	for (iType=0; iType<6; iType++) {
+		if (strcmp(pArgs[1], szTypes[iType]) == 0) break;
+	}
+	if (iType == 6) return Fail(pR, "unknown alarm type");
+	if (bSecond && iType == ALARM_SECOND) return Fail(pR, "alarm2 has no per second alarm");
+	if (!(rtc.getCaps() & ((bSecond) ? RTC_CAP_ALARM2 : RTC_CAP_ALARM))) return Fail(pR, "not supported");
+	memset(&t, 0, sizeof(t));
+	if (iType == ALARM_DAY || iType == ALARM_DATE) {
+		if (iArgs < 4) return Fail(pR, "usage: alarm day|date <wday|mday> HH:MM:SS");
+		i = atoi(pArgs[2]);
+		if (iType == ALARM_DAY) {
+			if (i < 0 || i > 6) return Fail(pR, "day of the week is 0-6 (Sunday = 0)");
+			t.tm_wday = i;
+		} else {
+			if (i < 1 || i > 31) return Fail(pR, "day of the month is 1-31");
+			t.tm_mday = i;
+		}
+		iArg = 3;
+	}
+	if (iType >= ALARM_HOUR) {
+		if (iArgs <= iArg || ParseClock(pArgs[iArg], &t) != RTC_SUCCESS) return Fail(pR, "missing or bad HH:MM:SS");
+		AddField(pR, "at", true, "%02d:%02d:%02d", t.tm_hour, t.tm_min, t.tm_sec);
+	} else if (iArgs > 2) { // the second (or minute) within the period
+		if (iType == ALARM_SECOND) t.tm_sec = atoi(pArgs[2]);
+		else t.tm_min = atoi(pArgs[2]);
+	}
+	if (bSecond) iType += ALARM2_MINUTE - ALARM_MINUTE;
+	rtc.setAlarm((uint8_t)iType, &t);
+	AddField(pR, "type", true, "%s", pArgs[1]);
+	return RTC_SUCCESS;
+} /* CmdAlarm() */
+
+//
+// Run one command
+// returns RTC_SUCCESS or RTC_ERROR (with the reason in pR->szError)
+//
+int RunCommand(RESULT *pR, int iArgs, char **pArgs)
+{
+const char *szCmd = pArgs[0];
+struct tm t;
+RTC_SNAPSHOT snap;
+RTC_EDGE edge;
+RTC_FLEET_RESULT fr;
+BBRTCFleet fleet;
+struct timespec ts;
+char szList[MAX_VALUE];
+uint64_t u64Actual;
+int64_t i64Ns;
+int i, rc, iCaps = rtc.getCaps();
+
+	pR->iFields = 0;
+	pR->szError[0] = 0;
+	if (strcmp(szCmd, "info") == 0) {
+		AddField(pR, "type", true, "%s", (bKernel) ? "kernel" : szRTCType[rtc.getType()]);
+		AddField(pR, "caps", true, "0x%04x", iCaps);
+		szList[0] = 0;
+		for (i=0; i<(int)(sizeof(szCaps)/sizeof(char *)); i++) {
+			if (!(iCaps & (1 << i))) continue;
+			if (strlen(szList) + strlen(szCaps[i]) + 2 >= sizeof(szList)) break;
+			if (szList[0]) strcat(szList, ",");
+			strcat(szList, szCaps[i]);
+		}
+		AddField(pR, "features", true, "%s", szList);
+	} else if (strcmp(szCmd, "get") == 0) {
+		rc = rtc.getTime(&t);
+		if (rc != RTC_SUCCESS) return Fail(pR, szBusError[rc]);
+		AddTime(pR, "time", &t);
+		AddField(pR, "epoch", false, "%u", BBRTC::timeToEpoch(&t));
+	} else if (strcmp(szCmd, "set") == 0) {
+		if (iArgs < 2 || ParseTime(pArgs[1], &t) != RTC_SUCCESS) return Fail(pR, "missing or bad time");
+		rc = rtc.setTime(&t);
+		if (rc != RTC_SUCCESS) return Fail(pR, szBusError[rc]);
+		AddTime(pR, "time", &t);
+	} else if (strcmp(szCmd, "systohc") == 0) {
+		if (fleet.add(&rtc) != RTC_SUCCESS) return Fail(pR, "can't set the time");
+		if (fleet.setTime(NULL, 50) != RTC_SUCCESS) return Fail(pR, "write failed");
+		fleet.getResult(0, &fr);
+		AddField(pR, "skew_us", false, "%.1f", (double)fr.i64SkewNs / 1000.0);
+	} else if (strcmp(szCmd, "hctosys") == 0 || strcmp(szCmd, "compare") == 0) {
+		if (rtc.waitForSecond(&edge, 2500) != RTC_SUCCESS) return Fail(pR, "no second edge seen");
+		if (szCmd[0] == 'h') { // the system time is the edge + the time since
+			i64Ns = (int64_t)edge.u32Epoch * 1000000000LL + NowNs(CLOCK_MONOTONIC) - edge.i64MonoNs;
+			ts.tv_sec = (time_t)(i64Ns / 1000000000LL);
+			ts.tv_nsec = (long)(i64Ns % 1000000000LL);
+			if (clock_settime(CLOCK_REALTIME, &ts) != 0) return Fail(pR, "clock_settime failed (not root?)");
+			BBRTC::epochToTime(edge.u32Epoch, &t);
+			AddTime(pR, "time", &t);
+		} else {
+			AddField(pR, "offset_ms", false, "%.3f", (double)(edge.i64RealNs - (int64_t)edge.u32Epoch * 1000000000LL) / 1000000.0);
+		}
+		AddField(pR, "uncertainty_ms", false, "%.3f", (double)edge.i32UncertaintyNs / 1000000.0);
+	} else if (strcmp(szCmd, "alarm") == 0 || strcmp(szCmd, "alarm2") == 0) {
+		return CmdAlarm(pR, iArgs, pArgs);
+	} else if (strcmp(szCmd, "countdown") == 0) {
+		if (iArgs < 2 || atoi(pArgs[1]) <= 0) return Fail(pR, "missing or bad period");
+		if (rtc.setCountdownMs((uint32_t)atoi(pArgs[1]), &u64Actual) != RTC_SUCCESS) return Fail(pR, "not supported");
+		AddField(pR, "actual_us", false, "%llu", (unsigned long long)u64Actual);
+	} else if (strcmp(szCmd, "clear") == 0) {
+		rtc.clearAlarms();
+	} else if (strcmp(szCmd, "wait") == 0) {
+		rc = rtc.waitForAlarm((iArgs > 1) ? atoi(pArgs[1]) : -1);
+		if (rc == RTC_ERROR) return Fail(pR, "wait failed");
+		if (rc != RTC_SUCCESS && rc != RTC_TIMEOUT) return Fail(pR, szBusError[rc]);
+		AddField(pR, "fired", false, "%s", (rc == RTC_SUCCESS) ? "true" : "false");
+	} else if (strcmp(szCmd, "status") == 0) {
+		i = rtc.getStatus();
+		if (rtc.getLastError() != RTC_SUCCESS) return Fail(pR, szBusError[rtc.getLastError()]);
+		AddStatus(pR, i);
+	} else if (strcmp(szCmd, "snapshot") == 0) {
+		rc = rtc.getSnapshot(&snap);
+		if (rc != RTC_SUCCESS) return Fail(pR, szBusError[rc]);
+		AddTime(pR, "time", &snap.tmTime);
+		AddStatus(pR, snap.iStatus);
+		if (iCaps & RTC_CAP_TEMP) AddField(pR, "temp_c", false, "%.2f", (double)snap.iTemp / 4.0);
+		for (i=0; i<6; i++) {
+			if (snap.u8Fired & (1 << i)) AddField(pR, szFired[i], false, "true");
+		}
+	} else if (strcmp(szCmd, "temp") == 0) {
+		if (!(iCaps & RTC_CAP_TEMP)) return Fail(pR, "not supported");
+		i = rtc.getTemp();
+		if (rtc.getLastError() != RTC_SUCCESS) return Fail(pR, szBusError[rtc.getLastError()]);
+		AddField(pR, "temp_c", false, "%.2f", (double)i / 4.0);
+	} else if (strcmp(szCmd, "freq") == 0) {
+		if (iArgs < 2) return Fail(pR, "missing frequency");
+		if (!(iCaps & RTC_CAP_CLKOUT)) return Fail(pR, "not supported");
+		i = (strcmp(pArgs[1], "off") == 0) ? -1 : atoi(pArgs[1]);
+		rtc.setFreq(i);
+		AddField(pR, "hz", false, "%d", i);
+	} else if (strcmp(szCmd, "recover") == 0) {
+		if (bKernel) return Fail(pR, "not supported");
+		rc = rtc.recover();
+		if (rc != RTC_SUCCESS) return Fail(pR, szBusError[rc]);
+		AddField(pR, "recoveries", false, "%u", rtc.getRecoveries());
+	} else if (strcmp(szCmd, "sleep") == 0) {
+		if (iArgs < 2) return Fail(pR, "missing time");
+		usleep((useconds_t)atoi(pArgs[1]) * 1000);
+	} else {
+		return Fail(pR, "unknown command");
+	}
+	return RTC_SUCCESS;
+} /* RunCommand() */
+
+static void PrintResult(const char *szCmd, int rc, RESULT *pR)
+{
+int i;
+
+	if (bJSON) {
+		printf("{\"cmd\":\"%s\",\"ok\":%s", szCmd, (rc == RTC_SUCCESS) ? "true" : "false");
+		if (rc != RTC_SUCCESS) printf(",\"error\":\"%s\"", pR->szError);
+		for (i=0; i<pR->iFields; i++) {
+			if (pR->fields[i].bString) printf(",\"%s\":\"%s\"", pR->fields[i].szKey, pR->fields[i].szValue);
+			else printf(",\"%s\":%s", pR->fields[i].szKey, pR->fields[i].szValue);
+		}
+		printf("}\n");
+	} else {
+		printf("%s:", szCmd);
+		if (rc != RTC_SUCCESS) printf(" error: %s", pR->szError);
+		for (i=0; i<pR->iFields; i++) {
+			printf(" %s=%s", pR->fields[i].szKey, pR->fields[i].szValue);
+		}
+		printf("\n");
+	}
+	fflush(stdout);
+} /* PrintResult() */
+
+static int CompareNs(const void *a, const void *b)
+{
+	int64_t i64A = *(const int64_t *)a, i64B = *(const int64_t *)b;
+	return (i64A > i64B) - (i64A < i64B);
+} /* CompareNs() */
+
+//
+// Split a line into words and run it (iBench times when benchmarking)
+// returns RTC_SUCCESS or RTC_ERROR
+//
+int RunLine(char *szLine, int iBench)
+{
+char *pArgs[MAX_ARGS], *pSave = NULL, *p;
+int i, iArgs = 0, rc = RTC_SUCCESS, iFailed = 0;
+int64_t *pNs, i64Start, i64Sum = 0;
+uint32_t u32Xfers, u32Bytes;
+RESULT result;
+
+	p = strchr(szLine, '#'); // comment
+	if (p) *p = 0;
+	for (p = strtok_r(szLine, " \t\r\n", &pSave); p && iArgs < MAX_ARGS; p = strtok_r(NULL, " \t\r\n", &pSave)) {
+		pArgs[iArgs++] = p;
+	}
+	if (iArgs == 0) return RTC_SUCCESS;
+	if (iBench <= 0) {
+		rc = RunCommand(&result, iArgs, pArgs);
+		PrintResult(pArgs[0], rc, &result);
+		return rc;
+	}
+	pNs = (int64_t *)malloc(iBench * sizeof(int64_t));
+	if (pNs == NULL) return RTC_ERROR;
+	u32Xfers = bus.u32Xfers;
+	u32Bytes = bus.u32Bytes;
+	for (i=0; i<iBench; i++) {
+		i64Start = NowNs(CLOCK_MONOTONIC);
+		if (RunCommand(&result, iArgs, pArgs) != RTC_SUCCESS) iFailed++;
+		pNs[i] = NowNs(CLOCK_MONOTONIC) - i64Start;
+		i64Sum += pNs[i];
+	}
+	qsort(pNs, iBench, sizeof(int64_t), CompareNs);
+	if (iFailed) rc = RTC_ERROR;
+	result.iFields = 0;
+	AddField(&result, "runs", false, "%d", iBench);
+	AddField(&result, "failed", false, "%d", iFailed);
+	AddField(&result, "mean_us", false, "%.1f", (double)i64Sum / iBench / 1000.0);
+	AddField(&result, "min_us", false, "%.1f", (double)pNs[0] / 1000.0);
+	AddField(&result, "p50_us", false, "%.1f", (double)pNs[iBench / 2] / 1000.0);
+	AddField(&result, "p99_us", false, "%.1f", (double)pNs[(int)((int64_t)iBench * 99 / 100)] / 1000.0);
+	AddField(&result, "max_us", false, "%.1f", (double)pNs[iBench - 1] / 1000.0);
+	if (!bKernel) {
+		AddField(&result, "xfers_per_run", false, "%.2f", (double)(bus.u32Xfers - u32Xfers) / iBench);
+		AddField(&result, "bytes_per_run", false, "%.2f", (double)(bus.u32Bytes - u32Bytes) / iBench);
+	}
+	free(pNs);
+	PrintResult(pArgs[0], rc, &result);
+	return rc;
+} /* RunLine() */
+
+//
+// Run a line of commands separated by ';'
+// returns the number which failed
+//
+int RunCommands(char *szText, int iBench)
+{
+char *p, *pSave = NULL;
+int iFailed = 0;
+
+	for (p = strtok_r(szText, ";", &pSave); p; p = strtok_r(NULL, ";", &pSave)) {
+		if (RunLine(p, iBench) != RTC_SUCCESS) iFailed++;
+	}
+	return iFailed;
+} /* RunCommands() */
+
+int main(int argc, char *argv[])
+{
+static const struct option longOpts[] = {
+	{"bus", required_argument, NULL, 'b'},
+	{"dev", required_argument, NULL, 'd'},
+	{"sim", required_argument, NULL, 's'},
+	{"file", required_argument, NULL, 'f'},
+	{"json", no_argument, NULL, 'j'},
+	{"bench", required_argument, NULL, 'n'},
+	{"deadline", required_argument, NULL, 't'},
+	{"help", no_argument, NULL, 'h'},
+	{NULL, 0, NULL, 0}
+};
+char szLine[MAX_LINE];
+const char *szDev = NULL, *szSim = NULL, *szScript = NULL;
+int i, c, iBus = 1, iBench = 0, iDeadline = 0, iFailed = 0, iLen;
+FILE *f;
+
+	while ((c = getopt_long(argc, argv, "b:d:s:f:jn:t:h", longOpts, NULL)) != -1) {
+		switch (c) {
+			case 'b': iBus = atoi(optarg); break;
+			case 'd': szDev = optarg; break;
+			case 's': szSim = optarg; break;
+			case 'f': szScript = optarg; break;
+			case 'j': bJSON = true; break;
+			case 'n': iBench = atoi(optarg); break;
+			case 't': iDeadline = atoi(optarg); break;
+			default: ShowHelp(); return 0;
+		}
+	}
+	if (optind >= argc && szScript == NULL) {
+		ShowHelp();
+		return 0;
+	}
+	if (szDev) {
+		bKernel = true;
+		i = rtc.initRTCDev(szDev);
+	} else {
+		if (szSim) {
+			for (i=1; i<RTC_TYPE_COUNT; i++) { // e.g. "RV3032" or "RV-3032"
+				if (strcasecmp(szSim, szRTCType[i]) == 0) break;
+				if (i == RTC_RV3032 && strcasecmp(szSim, "RV3032") == 0) break;
+			}
+			if (i == RTC_TYPE_COUNT) {
+				fprintf(stderr, "Unknown device type %s\n", szSim);
+				return -1;
+			}
+			sim.addDevice(i);
+			sim.setLive(u8SimAddr[i], true); // tick along with the host clock
+			bus.pBus = &sim;
+		} else {
+			i2c.init(iBus, -1, true, 100000);
+			bus.pBus = &i2c;
+		}
+		i = rtc.init(&bus);
+	}
+	if (i != RTC_SUCCESS) {
+		fprintf(stderr, "No supported RTC found\n");
+		return -1;
+	}
+	if (iDeadline) rtc.setDeadline(iDeadline);
+	if (szScript) {
+		f = (strcmp(szScript, "-") == 0) ? stdin : fopen(szScript, "r");
+		if (f == NULL) {
+			fprintf(stderr, "Can't open %s\n", szScript);
+			return -1;
+		}
+		while (fgets(szLine, sizeof(szLine), f)) {
+			iFailed += RunCommands(szLine, iBench);
+		}
+		if (f != stdin) fclose(f);
+	}
+	// the rest of the command line
+	iLen = 0;
+	for (i=optind; i<argc; i++) {
+		if (iLen + (int)strlen(argv[i]) + 2 > MAX_LINE) {
+			fprintf(stderr, "Command line too long\n");
+			return -1;
+		}
+		iLen += sprintf(&szLine[iLen], "%s ", argv[i]);
+	}
+	if (iLen) iFailed += RunCommands(szLine, iBench);
+	return (iFailed) ? 1 : 0;
+} /* main() */
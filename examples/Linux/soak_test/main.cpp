@@ -0,0 +1,300 @@
+//
+// Soak test for tail latency under bus contention
+// Several threads hammer one RTC with time reads, status polls and alarm
+// re-arms while others keep the bus busy with traffic to a foreign
+// device. The bus is shared through a lock (as the kernel does for an
+// I2C adapter) and each transaction can be given a simulated duration
+// and random stalls. BBRTC isn't thread safe (it keeps the state of the
+// current call and does read-modify-write sequences), so the RTC threads
+// take a lock of their own around each call, as an application sharing
+// one BBRTC object would; the time spent waiting for it is counted. The
+// latency of every call is kept in a histogram per API and reported as
+// p50/p99/p99.9/max.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <atomic>
+#include <bb_rtc.h>
+
+#define MAX_THREADS 64
+// Histogram buckets: 1us resolution below 64us, then 32 per power of 2
+// (3% resolution) up to ~1000 seconds
+#define HIST_LINEAR 64
+#define HIST_SUB 32
+#define HIST_BUCKETS (HIST_LINEAR + HIST_SUB * 24)
+
+enum {
+	OP_GETTIME = 0,
+	OP_STATUS,
+	OP_REARM,
+	OP_FOREIGN,
+	OP_COUNT
+};
+const char *szOps[OP_COUNT] = {"getTime", "getStatus", "rearm", "foreign"};
+
+typedef struct _tagHist
+{
+	uint64_t u64Count[HIST_BUCKETS];
+	uint64_t u64Total, u64Sum, u64Max;
+} HIST;
+
+typedef struct _tagWorker
+{
+	pthread_t thread;
+	int iOp;
+	HIST hist;
+} WORKER;
+
+//
+// The shared bus: one transaction at a time, each taking the time of its
+// bytes at the bus speed, with an occasional stall on top
+//
+class SoakBus : public BBRTCTransport
+{
+public:
+	BBRTCTransport *pBus;
+	int iByteUs; // time of one byte on the wire (0 = don't simulate)
+	int iStallPermille, iStallUs; // chance and length of a stall
+	pthread_mutex_t mutex;
+
+	SoakBus() : pBus(NULL), iByteUs(0), iStallPermille(0), iStallUs(0) { pthread_mutex_init(&mutex, NULL); }
+	void busTime(int iBytes, unsigned int *pSeed)
+	{
+		int iUs = iBytes * iByteUs;
+		if (iStallPermille && (int)(rand_r(pSeed) % 1000) < iStallPermille) iUs += iStallUs;
+		if (iUs) usleep(iUs);
+	}
+	int probe(uint8_t u8Addr) { return locked(0, u8Addr, 0, NULL, 0); }
+	int read(uint8_t u8Addr, uint8_t *pData, int iLen) { return locked(1, u8Addr, 0, pData, iLen); }
+	int write(uint8_t u8Addr, uint8_t *pData, int iLen) { return locked(2, u8Addr, 0, pData, iLen); }
+	int readRegister(uint8_t u8Addr, uint8_t u8Reg, uint8_t *pData, int iLen) { return locked(3, u8Addr, u8Reg, pData, iLen); }
+	uintptr_t getBusKey() { return pBus->getBusKey(); }
+	int setTimeout(int iMs) { return pBus->setTimeout(iMs); }
+	int recover()
+	{
+		int rc;
+		pthread_mutex_lock(&mutex); // nobody else on the bus while it's reset
+		rc = pBus->recover();
+		pthread_mutex_unlock(&mutex);
+		return rc;
+	}
+
+private:
+	int locked(int iType, uint8_t u8Addr, uint8_t u8Reg, uint8_t *pData, int iLen)
+	{
+		static __thread unsigned int uSeed = 0;
+		int rc = 0;
+		if (uSeed == 0) uSeed = (unsigned int)(uintptr_t)&rc;
+		pthread_mutex_lock(&mutex);
+		busTime(iLen + ((iType == 3) ? 3 : 1), &uSeed); // address (+ register + restart)
+		switch (iType) {
+			case 0: rc = pBus->probe(u8Addr); break;
+			case 1: rc = pBus->read(u8Addr, pData, iLen); break;
+			case 2: rc = pBus->write(u8Addr, pData, iLen); break;
+			case 3: rc = pBus->readRegister(u8Addr, u8Reg, pData, iLen); break;
+		}
+		pthread_mutex_unlock(&mutex);
+		return rc;
+	}
+}; // class SoakBus
+
+BBRTCI2CTransport i2c;
+BBRTCSimTransport sim;
+SoakBus bus;
+BBRTC rtc;
+pthread_mutex_t rtcMutex = PTHREAD_MUTEX_INITIALIZER; // one call at a time
+WORKER workers[MAX_THREADS];
+int iWorkers;
+int iIntervalUs = 1000; // pause between calls of each thread
+int iForeignAddr = 0x50; // e.g. an AT24C32 EEPROM
+int iForeignLen = 32;
+std::atomic<bool> bRunning;
+
+void ShowHelp(void)
+{
+	printf("soak_test - RTC API latency under concurrent bus traffic\n");
+	printf("written by Larry Bank\n\n");
+	printf("Usage: soak_test [options]\n");
+	printf(" -b <i2c bus>  use a real RTC on this bus (default = a simulated DS3231)\n");
+	printf(" -d <seconds>  test duration (default 10)\n");
+	printf(" -t <n>        getTime() threads (default 2)\n");
+	printf(" -s <n>        getStatus() threads (default 1)\n");
+	printf(" -a <n>        alarm re-arm threads (default 1)\n");
+	printf(" -f <n>        foreign device threads (default 1)\n");
+	printf(" -F <addr>     foreign device address (default 0x50)\n");
+	printf(" -l <bytes>    foreign read length (default 32)\n");
+	printf(" -i <us>       pause between calls of each thread (default 1000)\n");
+	printf(" -k <kHz>      simulated bus speed (default 100 on the simulator, 0 = none)\n");
+	printf(" -p <permille> chance of a stall per transaction (default 0)\n");
+	printf(" -x <us>       length of a stall (default 20000)\n");
+} /* ShowHelp() */
+
+static int64_t NowNs(void)
+{
+struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+} /* NowNs() */
+
+static int Bucket(uint64_t u64Us)
+{
+int iShift = 0;
+
+	if (u64Us < HIST_LINEAR) return (int)u64Us;
+	while ((u64Us >> iShift) >= HIST_SUB * 2) iShift++; // top 6 bits
+	iShift = HIST_LINEAR + (iShift - 1) * HIST_SUB + (int)(u64Us >> iShift) - HIST_SUB;
+	return (iShift < HIST_BUCKETS) ? iShift : HIST_BUCKETS - 1;
+} /* Bucket() */
+
+// Largest value which falls in a bucket
+static uint64_t BucketMax(int iBucket)
+{
+int iShift;
+
+	if (iBucket < HIST_LINEAR) return (uint64_t)iBucket;
+	iBucket -= HIST_LINEAR;
+	iShift = iBucket / HIST_SUB + 1;
+	return ((uint64_t)(iBucket % HIST_SUB + HIST_SUB + 1) << iShift) - 1;
+} /* BucketMax() */
+
+static void Record(HIST *pHist, int64_t i64Ns)
+{
+uint64_t u64Us = (uint64_t)((i64Ns + 500) / 1000);
+
+	pHist->u64Count[Bucket(u64Us)]++;
+	pHist->u64Total++;
+	pHist->u64Sum += u64Us;
+	if (u64Us > pHist->u64Max) pHist->u64Max = u64Us;
+} /* Record() */
+
+static uint64_t Percentile(HIST *pHist, double dPct)
+{
+uint64_t u64Target, u64Seen = 0;
+int i;
+
+	if (pHist->u64Total == 0) return 0;
+	u64Target = (uint64_t)(dPct / 100.0 * (double)pHist->u64Total + 0.5);
+	if (u64Target < 1) u64Target = 1;
+	for (i=0; i<HIST_BUCKETS; i++) {
+		u64Seen += pHist->u64Count[i];
+		if (u64Seen >= u64Target) break;
+	}
+	if (i == HIST_BUCKETS) return pHist->u64Max;
+	return (BucketMax(i) < pHist->u64Max) ? BucketMax(i) : pHist->u64Max;
+} /* Percentile() */
+
+void *WorkerProc(void *pArg)
+{
+WORKER *pW = (WORKER *)pArg;
+struct tm t;
+uint8_t ucTemp[256];
+int64_t i64Start;
+
+	while (bRunning) {
+		i64Start = NowNs();
+		if (pW->iOp != OP_FOREIGN) pthread_mutex_lock(&rtcMutex);
+		switch (pW->iOp) {
+			case OP_GETTIME:
+				rtc.getTime(&t);
+				break;
+			case OP_STATUS:
+				rtc.getStatus();
+				break;
+			case OP_REARM:
+				rtc.clearAlarms(false);
+				if (rtc.getTime(&t) == RTC_SUCCESS) {
+					t.tm_min = (t.tm_min + 1) % 60;
+					rtc.setAlarm(ALARM_TIME, &t);
+				}
+				break;
+			case OP_FOREIGN: // another driver reading its device
+				bus.readRegister((uint8_t)iForeignAddr, 0, ucTemp, iForeignLen);
+				break;
+		}
+		if (pW->iOp != OP_FOREIGN) pthread_mutex_unlock(&rtcMutex);
+		Record(&pW->hist, NowNs() - i64Start);
+		if (iIntervalUs) usleep(iIntervalUs);
+	}
+	return NULL;
+} /* WorkerProc() */
+
+int main(int argc, char *argv[])
+{
+int i, j, c, iSeconds = 10, iBus = -1, iKHz = -1;
+int iThreads[OP_COUNT] = {2, 1, 1, 1};
+HIST hist;
+
+	bus.iStallUs = 20000;
+	while ((c = getopt(argc, argv, "b:d:t:s:a:f:F:l:i:k:p:x:h")) != -1) {
+		switch (c) {
+			case 'b': iBus = atoi(optarg); break;
+			case 'd': iSeconds = atoi(optarg); break;
+			case 't': iThreads[OP_GETTIME] = atoi(optarg); break;
+			case 's': iThreads[OP_STATUS] = atoi(optarg); break;
+			case 'a': iThreads[OP_REARM] = atoi(optarg); break;
+			case 'f': iThreads[OP_FOREIGN] = atoi(optarg); break;
+			case 'F': iForeignAddr = (int)strtol(optarg, NULL, 0); break;
+			case 'l': iForeignLen = atoi(optarg); break;
+			case 'i': iIntervalUs = atoi(optarg); break;
+			case 'k': iKHz = atoi(optarg); break;
+			case 'p': bus.iStallPermille = atoi(optarg); break;
+			case 'x': bus.iStallUs = atoi(optarg); break;
+			default: ShowHelp(); return 0;
+		}
+	}
+	if (iForeignLen < 1 || iForeignLen > 256) iForeignLen = 32;
+	if (iBus >= 0) { // real hardware; the bus takes the time it takes
+		i2c.init(iBus, -1, true, 100000);
+		bus.pBus = &i2c;
+		if (iKHz < 0) iKHz = 0;
+	} else {
+		sim.addDevice(RTC_DS3231);
+		bus.pBus = &sim; // the foreign device doesn't exist, but its reads still use the bus
+		if (iKHz < 0) iKHz = 100;
+	}
+	bus.iByteUs = (iKHz > 0) ? 9000 / iKHz : 0; // 9 bit times per byte
+	if (rtc.init(&bus) != RTC_SUCCESS) {
+		printf("No supported RTC found\n");
+		return -1;
+	}
+	bRunning = true;
+	iWorkers = 0;
+	for (i=0; i<OP_COUNT; i++) {
+		for (j=0; j<iThreads[i] && iWorkers < MAX_THREADS; j++) {
+			memset(&workers[iWorkers], 0, sizeof(WORKER));
+			workers[iWorkers].iOp = i;
+			pthread_create(&workers[iWorkers].thread, NULL, WorkerProc, &workers[iWorkers]);
+			iWorkers++;
+		}
+	}
+	printf("%d threads for %d seconds, %dkHz bus, %d/1000 stalls of %dus\n", iWorkers, iSeconds, iKHz, bus.iStallPermille, bus.iStallUs);
+	sleep(iSeconds);
+	bRunning = false;
+	for (i=0; i<iWorkers; i++) {
+		pthread_join(workers[i].thread, NULL);
+	}
+	printf("%-10s %10s %8s %8s %8s %8s %8s   (us)\n", "API", "calls", "mean", "p50", "p99", "p99.9", "max");
+	for (i=0; i<OP_COUNT; i++) { // merge the threads of each API
+		memset(&hist, 0, sizeof(hist));
+		for (j=0; j<iWorkers; j++) {
+			if (workers[j].iOp != i) continue;
+			for (c=0; c<HIST_BUCKETS; c++) hist.u64Count[c] += workers[j].hist.u64Count[c];
+			hist.u64Total += workers[j].hist.u64Total;
+			hist.u64Sum += workers[j].hist.u64Sum;
+			if (workers[j].hist.u64Max > hist.u64Max) hist.u64Max = workers[j].hist.u64Max;
+		}
+		if (hist.u64Total == 0) continue;
+		printf("%-10s %10llu %8llu %8llu %8llu %8llu %8llu\n", szOps[i], (unsigned long long)hist.u64Total,
+			(unsigned long long)(hist.u64Sum / hist.u64Total), (unsigned long long)Percentile(&hist, 50.0),
+			(unsigned long long)Percentile(&hist, 99.0), (unsigned long long)Percentile(&hist, 99.9),
+			(unsigned long long)hist.u64Max);
+	}
+	return 0;
+} /* main() */
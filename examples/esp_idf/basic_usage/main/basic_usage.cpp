@@ -13,7 +13,7 @@ BBRTC rtc;
 #define SDA_PIN 21
 #define SCL_PIN 22
 // Declare ASCII names for each of the supported RTC types
-const char *szType[] = {"Unknown", "PCF8563", "DS3231", "RV3032", "PCF85063A"};
+const char *szType[] = {"Unknown", "PCF8563", "DS3231", "RV3032", "PCF85063A", "DS1307", "DS3232", "MCP7940N", "PCF2129"};
 
 extern "C" {
 void app_main();
@@ -26,7 +26,7 @@ BBRTC rtc;
 #define RTC_SDA 21
 #define RTC_SCL 22
 // Declare ASCII names for each of the supported RTC types
-const char *szType[] = {"Unknown", "PCF8563", "DS3231", "RV3032", "PCF85063A"};
+const char *szType[] = {"Unknown", "PCF8563", "DS3231", "RV3032", "PCF85063A", "DS1307", "DS3232", "MCP7940N", "PCF2129"};
 
 extern "C" {
 void app_main();
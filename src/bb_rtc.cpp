@@ -22,11 +22,59 @@
 #endif
 
 #ifdef __LINUX__
+// Second edge detection timing
+#define RTC_EDGE_GUARD_NS 3000000 // start tight polling 3ms early
+#define RTC_EDGE_COARSE_US 10000 // poll interval while the phase is unknown
+#define RTC_EDGE_MAX_ERR_NS 1000000 // accept edges known to +/-1ms
+#define RTC_EDGE_IRQ_NS 100000 // nominal interrupt to user space latency
+// Discovery scan
+#define RTC_DISCOVER_BUSES 64 // most /dev/i2c-N adapters scanned
+#define RTC_DISCOVER_PER_BUS 8 // most RTCs reported per adapter
+#include <pthread.h>
+#include <dirent.h>
+#include <errno.h>
+#include <linux/i2c.h>
+
+static int64_t rtcClockNs(clockid_t id)
+{
+struct timespec ts;
+
+    clock_gettime(id, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+} /* rtcClockNs() */
+
 #include "linux_io.inl"
+#include "linux_rtcdev.inl"
+#ifdef __SSE2__ // x86 hosts decoding logged registers in bulk
+#include <emmintrin.h>
+#endif
 #endif
 
 //#define LOGGING
 
+//
+// Milliseconds from a free running clock (for the call deadlines)
+//
+static uint32_t rtcMillis(void)
+{
+#ifdef __LINUX__
+    return (uint32_t)(rtcClockNs(CLOCK_MONOTONIC) / 1000000);
+#elif defined(ARDUINO)
+    return millis();
+#else
+    return (uint32_t)(esp_timer_get_time() / 1000);
+#endif
+} /* rtcMillis() */
+//
+// The RTC_xxx code of a failed transfer (see BBRTCTransport)
+//
+static int rtcErrorCode(int rc)
+{
+    if (rc == 0) return RTC_NACK;
+    if (rc < 0 && rc >= -RTC_NO_DEVICE) return -rc;
+    return RTC_ERROR;
+} /* rtcErrorCode() */
+
 void BBRTC::logmsg(const char *msg)
 {
 #ifdef LOGGING
@@ -39,16 +87,854 @@ void BBRTC::logmsg(const char *msg)
 #endif
 } /* logmsg() */
 
+//
+// Default batched transfer; backends which can queue multiple transactions
+// more efficiently can override it
+// returns the number of transfers which succeeded
+//
+int BBRTCTransport::transfer(RTC_XFER *pList, int iCount)
+{
+int i, iGood = 0;
+
+    for (i=0; i<iCount; i++) {
+        RTC_XFER *pX = &pList[i];
+        switch (pX->u8Type) {
+            case RTC_XFER_WRITE:
+                pX->iResult = write(pX->u8Addr, pX->pData, pX->iLen);
+                break;
+            case RTC_XFER_READ:
+                pX->iResult = read(pX->u8Addr, pX->pData, pX->iLen);
+                break;
+            case RTC_XFER_READREG:
+                pX->iResult = readRegister(pX->u8Addr, pX->u8Reg, pX->pData, pX->iLen);
+                break;
+            default: // RTC_XFER_PROBE
+                pX->iResult = probe(pX->u8Addr);
+                break;
+        }
+        if (pX->iResult > 0) iGood++;
+    }
+    return iGood;
+} /* transfer() */
+
+#ifdef ARDUINO
+//
+// Free a stuck bus by clocking SCL by hand until the slave lets go of SDA
+// (9 clocks at most finish its byte and the NACK), send a STOP and set
+// the bus up again. u32Speed is 0 when other code set up the bus, in which
+// case it's left alone.
+// returns RTC_SUCCESS, RTC_BUS_STUCK or RTC_ERROR
+//
+static int I2CRecover(BBI2C *pI2C, uint32_t u32Speed)
+{
+int i, rc;
+
+    if (u32Speed == 0 || pI2C->iSDA == 0xff || pI2C->iSCL == 0xff) return RTC_ERROR; // not ours or default pins
+    pinMode(pI2C->iSDA, INPUT_PULLUP);
+    pinMode(pI2C->iSCL, INPUT_PULLUP);
+    for (i=0; i<9 && digitalRead(pI2C->iSDA) == LOW; i++) {
+        pinMode(pI2C->iSCL, OUTPUT); // drive SCL low
+        digitalWrite(pI2C->iSCL, LOW);
+        delayMicroseconds(5);
+        pinMode(pI2C->iSCL, INPUT_PULLUP); // and release it
+        delayMicroseconds(5);
+    }
+    // STOP = SDA going high while SCL is high
+    pinMode(pI2C->iSCL, OUTPUT);
+    digitalWrite(pI2C->iSCL, LOW);
+    pinMode(pI2C->iSDA, OUTPUT);
+    digitalWrite(pI2C->iSDA, LOW);
+    delayMicroseconds(5);
+    pinMode(pI2C->iSCL, INPUT_PULLUP);
+    delayMicroseconds(5);
+    pinMode(pI2C->iSDA, INPUT_PULLUP);
+    delayMicroseconds(5);
+    rc = (digitalRead(pI2C->iSDA) == HIGH && digitalRead(pI2C->iSCL) == HIGH) ? RTC_SUCCESS : RTC_BUS_STUCK;
+    I2CInit(pI2C, u32Speed);
+    return rc;
+} /* I2CRecover() */
+
+static int I2CSetTimeout(BBI2C *pI2C, int iMs)
+{
+    (void)pI2C; (void)iMs;
+    return RTC_ERROR; // BitBang_I2C has no transfer timeout
+} /* I2CSetTimeout() */
+#endif // ARDUINO
+
+//
+// Platform I2C transport methods
+// These are thin wrappers around the target-specific I/O functions
+//
+void BBRTCI2CTransport::init(int iSDA, int iSCL, bool bWire, uint32_t u32Speed)
+{
+    memset(&_bb, 0, sizeof(_bb));
+    _bb.iSDA = iSDA;
+    _bb.iSCL = iSCL;
+    _bb.bWire = bWire;
+    _u32Speed = u32Speed;
+    I2CInit(&_bb, u32Speed); // initialize the bit bang library
+} /* init() */
+
+//
+// Use a bus set up by other code; it's never reset by recover() since
+// that would pull it out from under its owner
+//
+void BBRTCI2CTransport::setBB(const BBI2C *pBB)
+{
+    memcpy(&_bb, pBB, sizeof(BBI2C));
+    _u32Speed = 0; // not ours (and no speed from an earlier init())
+} /* setBB() */
+
+int BBRTCI2CTransport::probe(uint8_t u8Addr)
+{
+    return I2CTest(&_bb, u8Addr);
+} /* probe() */
+
+int BBRTCI2CTransport::read(uint8_t u8Addr, uint8_t *pData, int iLen)
+{
+    return I2CRead(&_bb, u8Addr, pData, iLen);
+} /* read() */
+
+int BBRTCI2CTransport::write(uint8_t u8Addr, uint8_t *pData, int iLen)
+{
+    return I2CWrite(&_bb, u8Addr, pData, iLen);
+} /* write() */
+
+int BBRTCI2CTransport::readRegister(uint8_t u8Addr, uint8_t u8Reg, uint8_t *pData, int iLen)
+{
+    return I2CReadRegister(&_bb, u8Addr, u8Reg, pData, iLen);
+} /* readRegister() */
+
+int BBRTCI2CTransport::recover()
+{
+    return I2CRecover(&_bb, _u32Speed); // 0 = not ours to reset
+} /* recover() */
+
+int BBRTCI2CTransport::setTimeout(int iMs)
+{
+    return I2CSetTimeout(&_bb, iMs);
+} /* setTimeout() */
+
+//
+// Remember a mux and, after invalidate(), close every other mux used on
+// the bus; after a recovery or a change behind our back any of them may
+// still have a channel open and cause address conflicts with u8Mux
+//
+void BBRTCMuxBus::closeOthers(uint8_t u8Mux)
+{
+uint8_t u8Ctrl;
+int i;
+
+    for (i=0; i<_iMuxes && _u8Muxes[i] != u8Mux; i++) {}
+    if (i == _iMuxes && _iMuxes < RTC_MUX_MAX) _u8Muxes[_iMuxes++] = u8Mux;
+    if (!_bStale) return;
+    for (i=0; i<_iMuxes; i++) {
+        if (_u8Muxes[i] == u8Mux) continue;
+        u8Ctrl = 0;
+        _pBus->write(_u8Muxes[i], &u8Ctrl, 1);
+        _u32Switches++;
+    }
+    _bStale = false;
+} /* closeOthers() */
+//
+// Enable one channel of a TCA9548A/PCA9548 mux (-1 = none)
+// Nothing is written if that channel is already the one selected
+// returns > 0 for success, <= 0 for failure
+//
+int BBRTCMuxBus::select(uint8_t u8Mux, int iChannel)
+{
+uint8_t u8Ctrl;
+int rc;
+
+    if (_pBus == NULL || iChannel >= RTC_MUX_CHANNELS) return 0;
+    closeOthers(u8Mux);
+    if (_iChannel >= 0 && u8Mux == _u8Mux && iChannel == _iChannel) return 1;
+    if (_iChannel >= 0 && u8Mux != _u8Mux) { // close the other mux first
+        u8Ctrl = 0;
+        _pBus->write(_u8Mux, &u8Ctrl, 1);
+        _u32Switches++;
+    }
+    u8Ctrl = (iChannel < 0) ? 0 : (uint8_t)(1 << iChannel);
+    rc = _pBus->write(u8Mux, &u8Ctrl, 1);
+    _u32Switches++;
+    _u8Mux = u8Mux;
+    _iChannel = (rc > 0 && iChannel >= 0) ? iChannel : -1;
+    return rc;
+} /* select() */
+//
+// Read the same registers from a device on several channels of a mux
+// (e.g. the time of a bank of RTCs at the same address) as 1 batched
+// transfer. Channel n's data goes to pData[n*iLen]; with iLen == 0 the
+// devices are only probed. The channels are visited in order starting
+// with the one already selected, so it doesn't need a control write.
+// returns a bit mask of the channels which answered
+//
+int BBRTCMuxBus::sweep(uint8_t u8Mux, uint8_t u8Channels, uint8_t u8Addr, uint8_t u8Reg, uint8_t *pData, int iLen)
+{
+RTC_XFER xfer[RTC_MUX_CHANNELS * 2 + 1];
+uint8_t u8Ctrl[RTC_MUX_CHANNELS + 1];
+int8_t i8Chan[RTC_MUX_CHANNELS * 2 + 1];
+int i, j, iCount = 0, iFirst = 0, iLast = -1, iFound = 0;
+
+    if (_pBus == NULL || u8Channels == 0 || (iLen > 0 && pData == NULL)) return 0;
+    closeOthers(u8Mux);
+    memset(xfer, 0, sizeof(xfer));
+    if (_iChannel >= 0 && u8Mux != _u8Mux) { // close the other mux first
+        u8Ctrl[RTC_MUX_CHANNELS] = 0;
+        xfer[iCount].u8Type = RTC_XFER_WRITE;
+        xfer[iCount].u8Addr = _u8Mux;
+        xfer[iCount].pData = &u8Ctrl[RTC_MUX_CHANNELS];
+        xfer[iCount].iLen = 1;
+        i8Chan[iCount++] = -1;
+    } else if (_iChannel >= 0 && (u8Channels & (1 << _iChannel))) {
+        iFirst = _iChannel; // already selected
+    }
+    for (j=0; j<RTC_MUX_CHANNELS; j++) {
+        i = (iFirst + j) % RTC_MUX_CHANNELS;
+        if (!(u8Channels & (1 << i))) continue;
+        if (j != 0 || i != _iChannel || u8Mux != _u8Mux) {
+            u8Ctrl[i] = (uint8_t)(1 << i);
+            xfer[iCount].u8Type = RTC_XFER_WRITE;
+            xfer[iCount].u8Addr = u8Mux;
+            xfer[iCount].pData = &u8Ctrl[i];
+            xfer[iCount].iLen = 1;
+            i8Chan[iCount++] = -1;
+        }
+        xfer[iCount].u8Type = (iLen > 0) ? RTC_XFER_READREG : RTC_XFER_PROBE;
+        xfer[iCount].u8Addr = u8Addr;
+        xfer[iCount].u8Reg = u8Reg;
+        xfer[iCount].pData = (iLen > 0) ? &pData[i * iLen] : NULL;
+        xfer[iCount].iLen = iLen;
+        i8Chan[iCount++] = (int8_t)i;
+    }
+    _pBus->transfer(xfer, iCount);
+    for (i=0; i<iCount; i++) {
+        if (i8Chan[i] < 0) { // control write
+            _u32Switches++;
+            if (xfer[i].pData != &u8Ctrl[RTC_MUX_CHANNELS])
+                iLast = (xfer[i].iResult > 0) ? i8Chan[i+1] : -2;
+        } else if (xfer[i].iResult > 0) {
+            iFound |= (1 << i8Chan[i]);
+        }
+    }
+    if (iLast == -2) { // a control write failed; the mux state is unknown
+        _iChannel = -1;
+    } else if (iLast >= 0) {
+        _u8Mux = u8Mux;
+        _iChannel = iLast;
+    }
+    return iFound;
+} /* sweep() */
+
+//
+// Mux channel transport methods
+//
+void BBRTCMuxTransport::init(BBRTCMuxBus *pMuxBus, uint8_t u8Mux, int iChannel)
+{
+    _pMuxBus = pMuxBus;
+    _u8Mux = u8Mux;
+    _iChannel = iChannel;
+} /* init() */
+
+int BBRTCMuxTransport::probe(uint8_t u8Addr)
+{
+    if (_pMuxBus == NULL || _pMuxBus->select(_u8Mux, _iChannel) <= 0) return 0;
+    return _pMuxBus->getBus()->probe(u8Addr);
+} /* probe() */
+
+int BBRTCMuxTransport::read(uint8_t u8Addr, uint8_t *pData, int iLen)
+{
+    if (_pMuxBus == NULL || _pMuxBus->select(_u8Mux, _iChannel) <= 0) return 0;
+    return _pMuxBus->getBus()->read(u8Addr, pData, iLen);
+} /* read() */
+
+int BBRTCMuxTransport::write(uint8_t u8Addr, uint8_t *pData, int iLen)
+{
+    if (_pMuxBus == NULL || _pMuxBus->select(_u8Mux, _iChannel) <= 0) return 0;
+    return _pMuxBus->getBus()->write(u8Addr, pData, iLen);
+} /* write() */
+
+int BBRTCMuxTransport::readRegister(uint8_t u8Addr, uint8_t u8Reg, uint8_t *pData, int iLen)
+{
+    if (_pMuxBus == NULL || _pMuxBus->select(_u8Mux, _iChannel) <= 0) return 0;
+    return _pMuxBus->getBus()->readRegister(u8Addr, u8Reg, pData, iLen);
+} /* readRegister() */
+
+//
+// Recover the bus the mux is on; the mux may have been reset along with
+// it and the other muxes may still have a channel open, so all of them
+// are set up again on the next transfer
+//
+int BBRTCMuxTransport::recover()
+{
+    if (_pMuxBus == NULL || _pMuxBus->getBus() == NULL) return RTC_ERROR;
+    _pMuxBus->invalidate();
+    return _pMuxBus->getBus()->recover();
+} /* recover() */
+
+//
+// The whole list goes to the same channel, so select it once
+//
+int BBRTCMuxTransport::transfer(RTC_XFER *pList, int iCount)
+{
+int i;
+
+    if (_pMuxBus == NULL || _pMuxBus->select(_u8Mux, _iChannel) <= 0) {
+        for (i=0; i<iCount; i++) pList[i].iResult = 0;
+        return 0;
+    }
+    return _pMuxBus->getBus()->transfer(pList, iCount);
+} /* transfer() */
+
+#ifndef ARDUINO // Arduino provides these for constant tables in FLASH
+#define PROGMEM
+#define memcpy_P memcpy
+#endif
+
+#define BCD(n) ((uint8_t)((((n) / 10) << 4) | ((n) % 10)))
+#define UNBCD(n) ((((n) >> 4) & 0xf) * 10 + ((n) & 0xf))
+
+//
+// Register maps of the supported devices in auto-detection order
+// Devices which share an address are told apart by the register test
+// (the first 4 values after the capabilities); they're listed so that a
+// test can't disturb a device which would match a later entry.
+//
+static const RTC_CHIP_DESC rtcChips[] PROGMEM = {
+  { // DS1307 - 56 bytes of RAM where the DS3231 has read-only temperature bits
+    RTC_DS1307, RTC_DS1307, RTC_DS1307_ADDR, RTC_DESC_12H | RTC_DESC_STOP_RMW,
+    RTC_CAP_TIME | RTC_CAP_CLKOUT | RTC_CAP_STOP | RTC_CAP_REGISTERS | RTC_CAP_RAM,
+    0x12, 0x2a, 0x3f, 0x2a, // RAM at 0x12
+    0, 1, 0, 0, // time at 0, Sunday = 1
+    0x00, 0x80, // CH (clock halt) bit of the seconds register
+    0x00, 1, {0, 0x80}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0},
+    0, // no temperature sensor
+    0, 0, {0, 0, 0}, // the oscillator is started with the CH bit
+    RTC_ALM_NONE, {0, 0}, 0, {0, 0}, 0, 0, 0,
+    0x07, 0x13, 0x10, 0x00, {0, 12, 13, 15, -1, -1, -1, -1}, // SQWE + RS1:0
+    0x08, 56,
+    {0x07, 0, 0}, {1, 0, 0}, // control
+    RTC_TRIM_NONE, 0, 0
+  },
+  { // DS3232 - DS3231 with SRAM at 0x14-0xFF
+    RTC_DS3232, RTC_DS3231, RTC_DS3232_ADDR, RTC_DESC_CENTURY | RTC_DESC_12H,
+    RTC_CAP_TIME | RTC_CAP_ALARM | RTC_CAP_ALARM2 | RTC_CAP_ALARM_REPEAT | RTC_CAP_COUNTDOWN | RTC_CAP_CLKOUT | RTC_CAP_TEMP | RTC_CAP_STOP | RTC_CAP_REGISTERS | RTC_CAP_TRIM | RTC_CAP_RAM,
+    0x14, 0xa5, 0xff, 0xa5, // SRAM
+    0, 1, 0, 0,
+    0x0e, 0x80, // EOSC
+    0x0f, 1, {0, 0x80}, {0, 0x01}, {0, 0x02}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, // OSF, A1F, A2F
+    0x11, // temperature MSB, LSB
+    0x0e, 1, {0x1c, 0, 0}, // oscillator on, alarms on the INT pin
+    RTC_ALM_CHIP, {0x07, 0x0b}, 0x0e, {0x01, 0x02}, 0, 0, 0,
+    0, 0, 0, 0, {-1, -1, -1, -1, -1, -1, -1, -1},
+    0x14, 236,
+    {0x07, 0x10, 0}, {8, 1, 0}, // alarms + control, aging
+    RTC_TRIM_TWOS8, 0x10, -100 // aging offset, ~0.1ppm per LSB (+ = slower)
+  },
+  { // DS3231 - the temperature LSB register has 6 read-only zero bits
+    RTC_DS3231, RTC_DS3231, RTC_DS3231_ADDR, RTC_DESC_CENTURY | RTC_DESC_12H,
+    RTC_CAP_TIME | RTC_CAP_ALARM | RTC_CAP_ALARM2 | RTC_CAP_ALARM_REPEAT | RTC_CAP_COUNTDOWN | RTC_CAP_CLKOUT | RTC_CAP_TEMP | RTC_CAP_STOP | RTC_CAP_REGISTERS | RTC_CAP_TRIM,
+    0x12, 0x00, 0x3f, 0x00, // read only
+    0, 1, 0, 0,
+    0x0e, 0x80,
+    0x0f, 1, {0, 0x80}, {0, 0x01}, {0, 0x02}, {0, 0}, {0, 0}, {0, 0}, {0, 0},
+    0x11,
+    0x0e, 1, {0x1c, 0, 0},
+    RTC_ALM_CHIP, {0x07, 0x0b}, 0x0e, {0x01, 0x02}, 0, 0, 0,
+    0, 0, 0, 0, {-1, -1, -1, -1, -1, -1, -1, -1},
+    0, 0,
+    {0x07, 0x10, 0}, {8, 1, 0},
+    RTC_TRIM_TWOS8, 0x10, -100
+  },
+  { // RV3032 - writable temperature threshold register
+    RTC_RV3032, RTC_RV3032, RTC_RV3032_ADDR, RTC_DESC_TEMP_LSB | RTC_DESC_HUNDREDTHS,
+    RTC_CAP_TIME | RTC_CAP_ALARM | RTC_CAP_ALARM_REPEAT | RTC_CAP_COUNTDOWN | RTC_CAP_CLKOUT | RTC_CAP_TEMP | RTC_CAP_VBACKUP | RTC_CAP_EPOCH | RTC_CAP_STOP | RTC_CAP_REGISTERS | RTC_CAP_RAM | RTC_CAP_TEMP_EVENT,
+    0x17, 0x55, 0xff, 0x55, // THigh
+    1, 0, 0, 0, // time at 1 (0 = 100ths), Sunday = 0
+    0x11, 0x01, // STOP
+    0x0d, 1, {0, 0}, {0, 0x08}, {0, 0}, {0, 0x10}, {0, 0x20}, {0, 0x80}, {0, 0x40}, // AF, TF, UF, THF, TLF
+    0x0e, // temperature LSB, MSB
+    0xc0, 1, {0x10, 0, 0}, // PMU: direct switchover, no trickle charge
+    RTC_ALM_CHIP, {0x08, 0}, 0x11, {0x08, 0}, 0, 0, 0,
+    0, 0, 0, 0, {-1, -1, -1, -1, -1, -1, -1, -1},
+    0x40, 16,
+    {0x08, 0x10, 0xc0}, {5, 8, 4}, // alarm + timer, control + thresholds, EEPROM PMU-CLKOUT2
+    RTC_TRIM_NONE, 0, 0 // the offset lives in EEPROM
+  },
+  { // PCF2129 - aging offset register with 4 writable bits
+    RTC_PCF2129, RTC_PCF2129, RTC_PCF2129_ADDR, RTC_DESC_PCF_ORDER,
+    RTC_CAP_TIME | RTC_CAP_ALARM | RTC_CAP_ALARM_REPEAT | RTC_CAP_COUNTDOWN | RTC_CAP_CLKOUT | RTC_CAP_STOP | RTC_CAP_REGISTERS,
+    0x19, 0xf5, 0xff, 0x05,
+    3, 0, 0, 0,
+    0x00, 0x20, // STOP
+    0x00, 2, {0, 0x20}, {1, 0x10}, {0, 0}, {1, 0x80}, {0, 0}, {0, 0}, {0, 0}, // STOP, AF, MSF
+    0,
+    0x00, 3, {0, 0, 0}, // clock on, 24 hour mode, standard battery switchover
+    RTC_ALM_PCF, {0x0a, 0}, 0x01, {0x02, 0}, 0x00, 0x01, 0x02, // AIE, SI, MI
+    0x0f, 0x07, 0x00, 0x07, {15, 14, 13, 12, 11, 10, 0, -1}, // COF
+    0, 0,
+    {0x00, 0x0a, 0x19}, {3, 8, 1}, // control, alarm + CLKOUT + watchdog, aging
+    RTC_TRIM_NONE, 0, 0 // TCXO
+  },
+  { // PCF85063A - 1 byte of RAM where the PCF8563 has the minutes
+    RTC_PCF85063A, RTC_PCF85063A, RTC_PCF85063A_ADDR, RTC_DESC_PCF_ORDER,
+    RTC_CAP_TIME | RTC_CAP_ALARM | RTC_CAP_ALARM_REPEAT | RTC_CAP_COUNTDOWN | RTC_CAP_STOP | RTC_CAP_REGISTERS | RTC_CAP_TRIM | RTC_CAP_RAM,
+    0x03, 0xaa, 0xff, 0xaa,
+    4, 1, 0, 0,
+    0x00, 0x20,
+    0x00, 2, {0, 0x20}, {1, 0x40}, {0, 0}, {1, 0x08}, {0, 0}, {0, 0}, {0, 0},
+    0,
+    0x00, 2, {0, 0, 0}, // normal mode, clock on, alarms off
+    RTC_ALM_CHIP, {0x0b, 0}, 0x01, {0x80, 0}, 0x01, 0x10, 0x20, // AIE, SI, MI
+    0, 0, 0, 0, {-1, -1, -1, -1, -1, -1, -1, -1},
+    0x03, 1,
+    {0x00, 0x0b, 0}, {3, 7, 0}, // control + offset, alarm + timer
+    RTC_TRIM_TWOS7, 0x02, 4340 // offset register, 4.34ppm per LSB in mode 0
+  },
+  { // PCF8563/BM8563 - whatever else answers at 0x51
+    RTC_PCF8563, RTC_PCF8563, RTC_PCF8563_ADDR, RTC_DESC_PCF_ORDER | RTC_DESC_CENTURY,
+    RTC_CAP_TIME | RTC_CAP_ALARM | RTC_CAP_ALARM_REPEAT | RTC_CAP_COUNTDOWN | RTC_CAP_CLKOUT | RTC_CAP_STOP | RTC_CAP_REGISTERS,
+    0, 0, 0, 0, // no test
+    2, 1, 0, 0,
+    0x00, 0x20,
+    0x00, 2, {0, 0x20}, {1, 0x08}, {0, 0}, {1, 0x04}, {0, 0}, {0, 0}, {0, 0},
+    0,
+    0x00, 2, {0, 0, 0},
+    RTC_ALM_CHIP, {0x09, 0}, 0x01, {0x02, 0}, 0, 0, 0,
+    0, 0, 0, 0, {-1, -1, -1, -1, -1, -1, -1, -1},
+    0, 0,
+    {0x00, 0x09, 0}, {2, 7, 0}, // control, alarm + CLKOUT + timer
+    RTC_TRIM_NONE, 0, 0
+  },
+  { // MCP7940N - 64 bytes of SRAM
+    RTC_MCP7940N, RTC_MCP7940N, RTC_MCP7940N_ADDR, RTC_DESC_12H | RTC_DESC_STOP_RMW | RTC_DESC_STOP_CLEAR | RTC_DESC_RUN_HIGH,
+    RTC_CAP_TIME | RTC_CAP_ALARM | RTC_CAP_ALARM2 | RTC_CAP_ALARM_REPEAT | RTC_CAP_COUNTDOWN | RTC_CAP_CLKOUT | RTC_CAP_STOP | RTC_CAP_REGISTERS | RTC_CAP_TRIM | RTC_CAP_RAM,
+    0x20, 0xa5, 0xff, 0xa5,
+    0, 1, 0x80, 0x08, // ST (oscillator start), VBATEN (battery backup)
+    0x00, 0x80, // ST
+    0x03, 0x12, {0, 0x20}, {0x0a, 0x08}, {0x11, 0x08}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, // OSCRUN, ALM0IF, ALM1IF
+    0,
+    0, 0, {0, 0, 0}, // ST and VBATEN are set by configure()
+    RTC_ALM_MCP, {0x0a, 0x11}, 0x07, {0x10, 0x20}, 0, 0, 0, // ALM0EN, ALM1EN
+    0x07, 0x43, 0x40, 0x00, {0, 12, 13, 15, -1, -1, -1, -1}, // SQWEN + SQWFS1:0
+    0x20, 64,
+    {0x07, 0x0a, 0x11}, {2, 6, 6}, // control + OSCTRIM, alarm 0, alarm 1
+    RTC_TRIM_SIGNMAG, 0x08, 1017 // OSCTRIM, 2 clocks per minute per LSB
+  }
+};
+#define RTC_CHIP_COUNT (int)(sizeof(rtcChips) / sizeof(RTC_CHIP_DESC))
+
+//
+// Days since 1970-01-01 of a date in the proleptic Gregorian calendar
+// (iMonth = 1-12). These avoid timegm() which isn't available everywhere
+//
+static int32_t rtcDaysFromCivil(int iYear, int iMonth, int iDay)
+{
+int32_t iEra, iYoe, iDoy;
+
+    iYear -= (iMonth <= 2);
+    iEra = (iYear >= 0 ? iYear : iYear - 399) / 400;
+    iYoe = iYear - iEra * 400;
+    iDoy = (153 * (iMonth + (iMonth > 2 ? -3 : 9)) + 2) / 5 + iDay - 1;
+    return iEra * 146097 + iYoe * 365 + iYoe/4 - iYoe/100 + iDoy - 719468;
+} /* rtcDaysFromCivil() */
+
+static void rtcCivilFromDays(int32_t iDays, struct tm *pTime)
+{
+int32_t iEra, iDoe, iYoe, iDoy, iMp, iYear;
+
+    pTime->tm_wday = (int)(((iDays % 7) + 11) % 7); // 1970-01-01 was a Thursday
+    iDays += 719468;
+    iEra = (iDays >= 0 ? iDays : iDays - 146096) / 146097;
+    iDoe = iDays - iEra * 146097;
+    iYoe = (iDoe - iDoe/1460 + iDoe/36524 - iDoe/146096) / 365;
+    iYear = iYoe + iEra * 400;
+    iDoy = iDoe - (365*iYoe + iYoe/4 - iYoe/100);
+    iMp = (5*iDoy + 2) / 153;
+    pTime->tm_mday = (int)(iDoy - (153*iMp + 2)/5 + 1);
+    pTime->tm_mon = (int)(iMp < 10 ? iMp + 2 : iMp - 10); // 0-11
+    pTime->tm_year = (int)(iYear + (pTime->tm_mon <= 1)) - 1900;
+} /* rtcCivilFromDays() */
+
+//
+// Hours register (or alarm hours) to 0-23; bit 6 selects 12-hour mode
+//
+static int rtcUnbcdHour(uint8_t u8Hour, bool b12H)
+{
+    if (b12H && (u8Hour & 64)) { // 12 hour format, bit 5 = PM
+        return ((u8Hour & 0x1f) == 0x12 ? 0 : UNBCD(u8Hour & 0x1f)) + ((u8Hour & 32) ? 12 : 0);
+    }
+    return UNBCD(u8Hour & 0x3f);
+} /* rtcUnbcdHour() */
+
+//
+// First second of the day (from iFrom on) whose hour, minute and second
+// match the alarm; -1 if there's none left
+//
+static int32_t rtcAlarmSecond(const RTC_ALARM_INFO *pInfo, int32_t iFrom)
+{
+int iHour, iMin, iSec;
+int32_t iSecs;
+
+    for (iHour = (int)(iFrom / 3600); iHour < 24; iHour++) {
+        if ((pInfo->u8Match & RTC_MATCH_HOUR) && iHour != pInfo->tmMatch.tm_hour) continue;
+        for (iMin = 0; iMin < 60; iMin++) {
+            if ((pInfo->u8Match & RTC_MATCH_MIN) && iMin != pInfo->tmMatch.tm_min) continue;
+            for (iSec = 0; iSec < 60; iSec++) {
+                if ((pInfo->u8Match & RTC_MATCH_SEC) && iSec != pInfo->tmMatch.tm_sec) continue;
+                iSecs = iHour * 3600L + iMin * 60 + iSec;
+                if (iSecs >= iFrom) return iSecs;
+            }
+        }
+    }
+    return -1;
+} /* rtcAlarmSecond() */
+
+//
+// Find the register map of a device type
+// returns false if the type isn't supported
+//
+static bool rtcFindDesc(int iType, RTC_CHIP_DESC *pDesc)
+{
+int i;
+
+    for (i=0; i<RTC_CHIP_COUNT; i++) {
+        memcpy_P(pDesc, &rtcChips[i], sizeof(RTC_CHIP_DESC));
+        if (pDesc->u8Type == iType) return true;
+    }
+    return false;
+} /* rtcFindDesc() */
+
+//
+// Compile a strftime-like format (%Y %y %m %d %H %M %S %w %%) into a list
+// of ops: < 0x80 = literal character, 0x80+n = the 2 digits of time
+// register n, RTC_FMT_CENTURY = "19"/"20", RTC_FMT_WDAY = weekday (0-6)
+// returns the number of ops or -1 if the format isn't supported
+//
+#define RTC_FMT_MAX 64
+#define RTC_FMT_CENTURY 0xf0
+#define RTC_FMT_WDAY 0xf1
+static int rtcFormatCompile(const RTC_CHIP_DESC *pDesc, const char *szFormat, uint8_t *pOps)
+{
+int iOps = 0;
+uint8_t u8Mday = (pDesc->u8Flags & RTC_DESC_PCF_ORDER) ? 0x83 : 0x84;
+
+    if (szFormat == NULL) szFormat = "%Y-%m-%dT%H:%M:%SZ"; // ISO-8601
+    while (*szFormat) {
+        if (iOps >= RTC_FMT_MAX - 1) return -1;
+        if ((uint8_t)*szFormat >= 0x80) return -1;
+        if (*szFormat != '%') {
+            pOps[iOps++] = (uint8_t)*szFormat++;
+            continue;
+        }
+        switch (szFormat[1]) {
+            case 'Y':
+                pOps[iOps++] = RTC_FMT_CENTURY;
+                pOps[iOps++] = 0x86;
+                break;
+            case 'y': pOps[iOps++] = 0x86; break;
+            case 'm': pOps[iOps++] = 0x85; break;
+            case 'd': pOps[iOps++] = u8Mday; break;
+            case 'H': pOps[iOps++] = 0x82; break;
+            case 'M': pOps[iOps++] = 0x81; break;
+            case 'S': pOps[iOps++] = 0x80; break;
+            case 'w': pOps[iOps++] = RTC_FMT_WDAY; break;
+            case '%': pOps[iOps++] = '%'; break;
+            default: return -1;
+        }
+        szFormat += 2;
+    }
+    return iOps;
+} /* rtcFormatCompile() */
+
+//
+// Bits of each time register which hold the BCD value (the weekday has its
+// own mask) and the limits of its binary value (the weekday isn't used);
+// the 8th entry pads them to a 64-bit lane
+//
+static const uint8_t u8TimeMask[8] = {0x7f, 0x7f, 0x3f, 0x3f, 0x3f, 0x1f, 0xff, 0};
+static const uint8_t u8TimeMin[8] = {0, 0, 0, 0, 0, 1, 0, 0};
+static const uint8_t u8TimeMax[8] = {59, 59, 23, 127, 127, 12, 99, 127};
+
+//
+// Mask off the control bits of the 7 time registers and turn them into
+// ASCII digit pairs (2 characters per register in pDigits). The nibbles of
+// all 7 registers are checked and converted together in 64-bit words.
+// returns false if any of them isn't a valid BCD number
+//
+static bool rtcUnpackBCD(const RTC_CHIP_DESC *pDesc, const uint8_t *pRegs, char *pDigits, int *piWday, bool *pbCentury)
+{
+uint64_t u64Regs = 0, u64Hi, u64Lo;
+int i, iWdayReg = (pDesc->u8Flags & RTC_DESC_PCF_ORDER) ? 4 : 3;
+uint8_t u8;
+
+    for (i=6; i>=0; i--) {
+        u8 = pRegs[i] & ((i == iWdayReg) ? 0x07 : u8TimeMask[i]);
+        if (i == 2 && (pDesc->u8Flags & RTC_DESC_12H) && (pRegs[2] & 64))
+            u8 = BCD(rtcUnbcdHour(pRegs[2], true));
+        u64Regs = (u64Regs << 8) | u8;
+    }
+    u64Hi = (u64Regs >> 4) & 0x0f0f0f0f0f0f0f0fULL;
+    u64Lo = u64Regs & 0x0f0f0f0f0f0f0f0fULL;
+    // adding 0x76 sets bit 7 of each byte holding a nibble above 9
+    if (((u64Hi + 0x7676767676767676ULL) | (u64Lo + 0x7676767676767676ULL)) & 0x8080808080808080ULL)
+        return false;
+    u64Hi |= 0x3030303030303030ULL; // to ASCII
+    u64Lo |= 0x3030303030303030ULL;
+    for (i=0; i<7; i++) {
+        pDigits[i*2] = (char)(u64Hi >> (i*8));
+        pDigits[i*2+1] = (char)(u64Lo >> (i*8));
+    }
+    *piWday = (pRegs[iWdayReg] & 7) - pDesc->u8WdayBase;
+    *pbCentury = !(pDesc->u8Flags & RTC_DESC_CENTURY) || (pRegs[5] & 0x80); // same as decodeTime()
+    return true;
+} /* rtcUnpackBCD() */
+
+//
+// Write the compiled format for one set of time registers
+// returns the length of the string or 0 if it doesn't fit
+//
+static int rtcFormatOps(const uint8_t *pOps, int iOps, const char *pDigits, int iWday, bool bCentury, char *szOut, int iLen)
+{
+int i, iOut = 0;
+uint8_t u8Op;
+
+    for (i=0; i<iOps; i++) {
+        u8Op = pOps[i];
+        if (iOut + ((u8Op < 0x80 || u8Op == RTC_FMT_WDAY) ? 1 : 2) >= iLen) { // no room
+            szOut[0] = 0;
+            return 0;
+        }
+        if (u8Op < 0x80) {
+            szOut[iOut++] = (char)u8Op;
+        } else if (u8Op == RTC_FMT_CENTURY) {
+            szOut[iOut++] = (bCentury) ? '2' : '1';
+            szOut[iOut++] = (bCentury) ? '0' : '9';
+        } else if (u8Op == RTC_FMT_WDAY) {
+            szOut[iOut++] = (char)('0' + (iWday & 7));
+        } else {
+            szOut[iOut++] = pDigits[(u8Op & 7) * 2];
+            szOut[iOut++] = pDigits[(u8Op & 7) * 2 + 1];
+        }
+    }
+    szOut[iOut] = 0;
+    return iOut;
+} /* rtcFormatOps() */
+
+//
+// Convert the 7 time registers to binary (in register order) and check
+// them; the weekday is left as 0
+// returns false if they don't hold a valid time
+//
+static bool rtcDecodeRegs(const RTC_CHIP_DESC *pDesc, const uint8_t *pRegs, uint8_t *pBin)
+{
+int i, iWdayReg = (pDesc->u8Flags & RTC_DESC_PCF_ORDER) ? 4 : 3;
+uint8_t u8;
+
+    for (i=0; i<7; i++) {
+        u8 = (i == iWdayReg) ? 0 : (pRegs[i] & u8TimeMask[i]);
+        if (i == 2 && (pDesc->u8Flags & RTC_DESC_12H) && (pRegs[2] & 64)) { // 12 hour format
+            u8 = pRegs[2] & 0x1f;
+            if (u8 == 0 || u8 > 0x12 || (u8 & 0xf) > 9) return false;
+            pBin[2] = (uint8_t)rtcUnbcdHour(pRegs[2], true);
+            continue;
+        }
+        if ((u8 & 0xf) > 9 || (u8 >> 4) > 9) return false;
+        pBin[i] = (uint8_t)UNBCD(u8);
+        if (pBin[i] < u8TimeMin[i] || pBin[i] > u8TimeMax[i]) return false;
+    }
+    return true;
+} /* rtcDecodeRegs() */
+
+#if defined(__LINUX__) && defined(__SSE2__)
+//
+// rtcDecodeRegs() for 2 sets of registers at a time
+// Each register gets a byte lane; the nibbles are split, checked and
+// combined (tens * 10 + units) in all 16 lanes at once. pMasks holds the
+// register masks, lower and upper limits (16 lanes each)
+// returns a bit for each set which is valid (bit 0 = pRegs0)
+//
+static int rtcDecodeRegs2(const RTC_CHIP_DESC *pDesc, const uint8_t *pRegs0, const uint8_t *pRegs1, const __m128i *pMasks, uint8_t *pBin)
+{
+uint64_t u64Regs[2];
+__m128i v, vHi, vLo, vBad, v0f = _mm_set1_epi8(0x0f), v9 = _mm_set1_epi8(9);
+int iMask;
+
+    if ((pDesc->u8Flags & RTC_DESC_12H) && ((pRegs0[2] | pRegs1[2]) & 64)) { // rare
+        return (rtcDecodeRegs(pDesc, pRegs0, pBin) ? 1 : 0) | (rtcDecodeRegs(pDesc, pRegs1, &pBin[8]) ? 2 : 0);
+    }
+    u64Regs[0] = u64Regs[1] = 0;
+    memcpy(&u64Regs[0], pRegs0, 7);
+    memcpy(&u64Regs[1], pRegs1, 7);
+    v = _mm_and_si128(_mm_loadu_si128((const __m128i *)u64Regs), pMasks[0]);
+    vHi = _mm_and_si128(_mm_srli_epi16(v, 4), v0f);
+    vLo = _mm_and_si128(v, v0f);
+    vBad = _mm_or_si128(_mm_cmpgt_epi8(vHi, v9), _mm_cmpgt_epi8(vLo, v9));
+    vHi = _mm_add_epi8(vHi, vHi); // tens * 2
+    v = _mm_add_epi8(_mm_add_epi8(vHi, vLo), _mm_add_epi8(_mm_add_epi8(vHi, vHi), _mm_add_epi8(vHi, vHi))); // * 10
+    // outside of the limits if clamping changes the value
+    vBad = _mm_or_si128(vBad, _mm_xor_si128(_mm_cmpeq_epi8(_mm_min_epu8(_mm_max_epu8(v, pMasks[1]), pMasks[2]), v), _mm_set1_epi8(-1)));
+    _mm_storeu_si128((__m128i *)pBin, v);
+    iMask = _mm_movemask_epi8(vBad);
+    return ((iMask & 0xff) ? 0 : 1) | ((iMask & 0xff00) ? 0 : 2);
+} /* rtcDecodeRegs2() */
+#endif // __SSE2__
+
+//
+// Turn a decoded set of time registers into an epoch or packed time
+// (0 if it isn't valid)
+// returns false for a date which doesn't exist (or can't be represented)
+//
+static bool rtcPackRegs(const RTC_CHIP_DESC *pDesc, const uint8_t *pRegs, const uint8_t *pBin, bool bPacked, uint32_t *pu32Out)
+{
+static const uint8_t u8MonthDays[12] = {31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+int iMday = (pDesc->u8Flags & RTC_DESC_PCF_ORDER) ? 3 : 4;
+int iYear = pBin[6] + ((!(pDesc->u8Flags & RTC_DESC_CENTURY) || (pRegs[5] & 0x80)) ? 2000 : 1900);
+int iMon = pBin[5];
+int iDay = pBin[iMday];
+
+    *pu32Out = 0;
+    if (iDay < 1 || iDay > u8MonthDays[iMon-1]) return false;
+    if (iMon == 2 && iDay == 29 && ((iYear & 3) || iYear == 1900)) return false; // not a leap year
+    if (bPacked) {
+        if (iYear < 2000 || iYear > 2063) return false;
+        *pu32Out = ((uint32_t)(iYear - 2000) << 26) | ((uint32_t)iMon << 22) | ((uint32_t)iDay << 17) |
+               ((uint32_t)pBin[2] << 12) | ((uint32_t)pBin[1] << 6) | pBin[0];
+        return true;
+    }
+    if (iYear < 1970) return false;
+    *pu32Out = (uint32_t)rtcDaysFromCivil(iYear, iMon, iDay) * 86400 + pBin[2] * 3600L + pBin[1] * 60 + pBin[0];
+    return true; // 1970-01-01T00:00:00 (0) is valid too
+} /* rtcPackRegs() */
+
 //
 // BBRTC class methods begin here
 //
 
+//
+// Convert between struct tm (UTC) and 32-bit UNIX epoch time without
+// depending on the C library (timegm() and gmtime_r() aren't available
+// on every target and the AVR time_t starts in 2000)
+//
+uint32_t BBRTC::timeToEpoch(const struct tm *pTime)
+{
+uint32_t tt;
+
+    tt = (uint32_t)rtcDaysFromCivil(pTime->tm_year + 1900, pTime->tm_mon + 1, pTime->tm_mday) * 86400;
+    tt += pTime->tm_hour * 3600L + pTime->tm_min * 60 + pTime->tm_sec;
+    return tt;
+} /* timeToEpoch() */
+
+void BBRTC::epochToTime(uint32_t tt, struct tm *pTime)
+{
+    memset(pTime, 0, sizeof(struct tm));
+    rtcCivilFromDays((int32_t)(tt / 86400), pTime);
+    tt %= 86400;
+    pTime->tm_hour = (int)(tt / 3600);
+    pTime->tm_min = (int)((tt / 60) % 60);
+    pTime->tm_sec = (int)(tt % 60);
+} /* epochToTime() */
+
+//
+// Format the raw time registers (as read by getRawTime()) of a device type
+// without converting them to a struct tm. szFormat takes %Y %y %m %d %H
+// %M %S %w and %% (NULL = ISO-8601, e.g. 2025-01-31T23:59:59Z)
+// returns the length of the string or 0 if the registers aren't valid BCD,
+// the format isn't supported or the buffer is too small
+//
+int BBRTC::formatTime(int iType, const uint8_t *pRegs, char *szOut, int iLen, const char *szFormat)
+{
+RTC_CHIP_DESC desc;
+uint8_t u8Ops[RTC_FMT_MAX];
+char cDigits[14];
+int iOps, iWday;
+bool bCentury;
+
+    if (szOut == NULL || iLen < 1) return 0;
+    szOut[0] = 0;
+    if (pRegs == NULL || !rtcFindDesc(iType, &desc)) return 0;
+    iOps = rtcFormatCompile(&desc, szFormat, u8Ops);
+    if (iOps < 0 || !rtcUnpackBCD(&desc, pRegs, cDigits, &iWday, &bCentury)) return 0;
+    return rtcFormatOps(u8Ops, iOps, cDigits, iWday, bCentury, szOut, iLen);
+} /* formatTime() */
+
+//
+// Format iCount stored sets of time registers (iStride bytes apart) into
+// strings iOutStride bytes apart; the format is only parsed once
+// Invalid entries are left as empty strings
+// returns the number which were formatted
+//
+int BBRTC::formatTimes(int iType, const uint8_t *pRegs, int iStride, int iCount, char *pOut, int iOutStride, const char *szFormat)
+{
+RTC_CHIP_DESC desc;
+uint8_t u8Ops[RTC_FMT_MAX];
+char cDigits[14];
+int i, iOps, iWday, iGood = 0;
+bool bCentury;
+
+    if (pRegs == NULL || pOut == NULL || iOutStride < 1 || !rtcFindDesc(iType, &desc)) return 0;
+    iOps = rtcFormatCompile(&desc, szFormat, u8Ops);
+    if (iOps < 0) return 0;
+    for (i=0; i<iCount; i++, pRegs += iStride, pOut += iOutStride) {
+        pOut[0] = 0;
+        if (!rtcUnpackBCD(&desc, pRegs, cDigits, &iWday, &bCentury)) continue;
+        if (rtcFormatOps(u8Ops, iOps, cDigits, iWday, bCentury, pOut, iOutStride)) iGood++;
+    }
+    return iGood;
+} /* formatTimes() */
+
+//
+// Decode iCount stored sets of time registers (iStride bytes apart) of a
+// device type into epoch times or, with bPacked, RTC_PACK_xxx values.
+// Each set is checked for valid BCD digits and a date which exists;
+// invalid ones are returned as 0 (so is 1970-01-01T00:00:00, which is
+// counted as valid). On x86 hosts two sets are decoded at a time with SSE2.
+// returns the number of valid sets
+//
+int BBRTC::decodeTimes(int iType, const uint8_t *pRegs, int iStride, int iCount, uint32_t *pOut, bool bPacked)
+{
+RTC_CHIP_DESC desc;
+uint8_t u8Bin[16];
+int i = 0, iGood = 0;
+
+    if (pRegs == NULL || pOut == NULL || !rtcFindDesc(iType, &desc)) return 0;
+#if defined(__LINUX__) && defined(__SSE2__)
+    uint8_t u8Vec[3][16];
+    __m128i vMasks[3];
+    int iValid, iWdayReg = (desc.u8Flags & RTC_DESC_PCF_ORDER) ? 4 : 3;
+    for (i=0; i<16; i++) { // register masks and limits for both sets
+        u8Vec[0][i] = ((i & 7) == iWdayReg) ? 0 : u8TimeMask[i & 7];
+        u8Vec[1][i] = u8TimeMin[i & 7];
+        u8Vec[2][i] = u8TimeMax[i & 7];
+    }
+    for (i=0; i<3; i++) vMasks[i] = _mm_loadu_si128((const __m128i *)u8Vec[i]);
+    for (i=0; i+1<iCount; i+=2, pRegs += iStride*2) {
+        iValid = rtcDecodeRegs2(&desc, pRegs, pRegs + iStride, vMasks, u8Bin);
+        pOut[i] = pOut[i+1] = 0;
+        if ((iValid & 1) && rtcPackRegs(&desc, pRegs, u8Bin, bPacked, &pOut[i])) iGood++;
+        if ((iValid & 2) && rtcPackRegs(&desc, pRegs + iStride, &u8Bin[8], bPacked, &pOut[i+1])) iGood++;
+    }
+#endif
+    for (; i<iCount; i++, pRegs += iStride) {
+        pOut[i] = 0;
+        if (rtcDecodeRegs(&desc, pRegs, u8Bin) && rtcPackRegs(&desc, pRegs, u8Bin, bPacked, &pOut[i])) iGood++;
+    }
+    return iGood;
+} /* decodeTimes() */
+
+BBRTC::~BBRTC()
+{
+#ifdef __LINUX__
+    if (_iRTCDev >= 0) close(_iRTCDev);
+#endif
+} /* ~BBRTC() */
+
 //
 // Return a pointer to the BBI2C structure used by the current class instance
 //
 BBI2C * BBRTC::getBB()
 {
-    return &_bb;
+    return _i2c.getBB();
 } /* getBB() */
 //
 // Return the RTC chip type (enumerated value - see bb_rtc.h)
@@ -58,6 +944,127 @@ int BBRTC::getType(void)
     return _iRTCType;
 } /* getType() */
 
+//
+// Return the RTC_CAP_xxx flags of the features available on this device
+// The kernel driver backend only exposes a subset of the chip's features
+//
+int BBRTC::getCaps(void)
+{
+#ifdef __LINUX__
+    if (_iRTCDev >= 0) return _iDevCaps;
+#endif
+    return _desc.u16Caps; // 0 if no device was found
+} /* getCaps() */
+
+//
+// Read-modify-write the bits of a register selected by u8Mask
+//
+void BBRTC::writeBits(uint8_t u8Reg, uint8_t u8Mask, uint8_t u8Value)
+{
+uint8_t ucTemp[2];
+
+    busReadReg(u8Reg, &ucTemp[1], 1);
+    ucTemp[0] = u8Reg;
+    ucTemp[1] = (ucTemp[1] & ~u8Mask) | (u8Value & u8Mask);
+    busWrite(ucTemp, 2);
+} /* writeBits() */
+
+//
+// Start timing a public call and clear its error
+//
+void BBRTC::startOp(void)
+{
+    _iLastError = RTC_SUCCESS;
+    _u32OpStart = rtcMillis();
+} /* startOp() */
+
+//
+// Write to or read the registers of the device with the retry policy
+// A failed transfer is tried again up to the retry count; a single NACK
+// is retried as is, anything else (or a NACK which repeats) recovers the
+// bus first. No retry starts once the call's deadline has passed. After
+// a transfer has failed for good, the rest of the call fails right away
+// so a dead bus doesn't cost a timeout for each transfer.
+// returns > 0 for success or -RTC_xxx (also kept for getLastError())
+//
+int BBRTC::busXfer(bool bWrite, uint8_t u8Reg, uint8_t *pData, int iLen)
+{
+int rc, iErr, iTry;
+
+    if (_iLastError != RTC_SUCCESS) return -_iLastError;
+    for (iTry=0; ; iTry++) {
+        if (bWrite) rc = _pTransport->write(_iRTCAddr, pData, iLen);
+        else rc = _pTransport->readRegister(_iRTCAddr, u8Reg, pData, iLen);
+        if (rc > 0) return rc;
+        iErr = rtcErrorCode(rc);
+        if (iTry >= _iRetries) break;
+        if (_iDeadlineMs && (int32_t)(rtcMillis() - _u32OpStart) >= _iDeadlineMs) break;
+        if (_bRecover && (iErr != RTC_NACK || iTry > 0)) {
+            rc = recoverBus();
+            if (rc != RTC_SUCCESS) {
+                iErr = rc;
+                break;
+            }
+        }
+    }
+    _iLastError = iErr;
+    return -iErr;
+} /* busXfer() */
+
+//
+// Free the bus, reopen the adapter and check that the device still
+// answers (it may have been reset by whatever upset the bus). Only reads
+// are used; the write test of detection isn't run on a bus which has
+// just failed.
+// returns RTC_SUCCESS or RTC_xxx
+//
+int BBRTC::recoverBus(void)
+{
+uint8_t u8Sec;
+int rc;
+
+    _u32Recoveries++;
+    rc = _pTransport->recover();
+    if (rc != RTC_SUCCESS) return rc;
+    rc = _pTransport->probe(_iRTCAddr);
+    if (rc > 0) {
+        if (_desc.u8IdMask && _desc.u8IdValue == 0) // read-only ID test
+            return (detectReg(&_desc)) ? RTC_SUCCESS : RTC_NO_DEVICE;
+        rc = _pTransport->readRegister(_iRTCAddr, _desc.u8TimeReg, &u8Sec, 1);
+        if (rc > 0) return RTC_SUCCESS;
+    }
+    rc = rtcErrorCode(rc);
+    return (rc == RTC_NACK) ? RTC_NO_DEVICE : rc;
+} /* recoverBus() */
+
+//
+// Recover the bus by hand (e.g. when an application watchdog sees the RTC
+// stop answering) and check that the device is back
+// returns RTC_SUCCESS or RTC_xxx
+//
+int BBRTC::recover(void)
+{
+    startOp();
+#ifdef __LINUX__
+    if (_iRTCDev >= 0) return RTC_ERROR; // the kernel driver owns the bus
+#endif
+    if (_iRTCType <= RTC_UNKNOWN) return RTC_ERROR;
+    _iLastError = recoverBus();
+    return _iLastError;
+} /* recover() */
+
+//
+// Limit how long a call can keep retrying and recovering (0 = no limit)
+// The transport's transfer timeout is set to the same value, so a call on
+// a dead bus gives up within about twice the deadline. On Linux this is
+// the adapter's I2C_TIMEOUT, which applies to every user of the bus.
+//
+void BBRTC::setDeadline(int iMs)
+{
+    _iDeadlineMs = (iMs < 0) ? 0 : iMs;
+    if (_pTransport) _pTransport->setTimeout(_iDeadlineMs);
+} /* setDeadline() */
+
 //
 // Enable or disable trickle charging
 // of the backup battery source
@@ -66,37 +1073,42 @@ void BBRTC::setVBackup(bool bCharge)
 {
 uint8_t ucTemp[4];
 
+    startOp();
+#ifdef __LINUX__
+    if (_iRTCDev >= 0) return; // not available through the kernel driver
+#endif
+
     if (_iRTCType != RTC_RV3032) return; // only supported on RVxxxx devices
 
     ucTemp[0] = 0x11;
     ucTemp[1] = 0x4; // event interrupt enabled
-    I2CWrite(&_bb, RTC_RV3032_ADDR, ucTemp, 2);
+    busWrite(ucTemp, 2);
     ucTemp[0] = 0x15;
     ucTemp[1] = 0x0; // event filter off
-    I2CWrite(&_bb, RTC_RV3032_ADDR, ucTemp, 2);
+    busWrite(ucTemp, 2);
     ucTemp[0] = 0x10; // control 1
     ucTemp[1] = 0x04; // EERD is disabled to allow modifying EEPROM values
-    I2CWrite(&_bb, RTC_RV3032_ADDR, ucTemp, 2);
+    busWrite(ucTemp, 2);
 
     if (bCharge) { // enable trickle charging on VBAT pin
          ucTemp[0] = 0x3d; // EEADDR, EEDATA
          ucTemp[1] = 0xc0; // eeprom PMU register
          ucTemp[2] = 0x11; // enable trickle charger and direct switching mode
-         I2CWrite(&_bb, RTC_RV3032_ADDR, ucTemp, 3);
+         busWrite(ucTemp, 3);
     } else { // disable trickle charging on VBAT pin (default)
          ucTemp[0] = 0x3d; // EEADDR, EEDATA
          ucTemp[1] = 0xc0; // eeprom PMU register
          ucTemp[2] = 0x00; // disable trickle charger and DSM (default value)
-         I2CWrite(&_bb, RTC_RV3032_ADDR, ucTemp, 3);   
+         busWrite(ucTemp, 3);   
     } // disable trickle charging
  // write the changed byte into EEPROM, then copy all EEPROM registers to RAM
     ucTemp[0] = 0x3f; // eeprom command
     ucTemp[1] = 0x21; // write 1 byte of EEPROM data
-    I2CWrite(&_bb, RTC_RV3032_ADDR, ucTemp, 2);
+    busWrite(ucTemp, 2);
     delay(10); // doc says 5-9ms to write one byte
     ucTemp[0] = 0x3f; // eeprom command
     ucTemp[1] = 0x12; // copy EEPROM to RAM backup registers
-    I2CWrite(&_bb, RTC_RV3032_ADDR, ucTemp, 2);
+    busWrite(ucTemp, 2);
     delay(64);
 } /* setVBackup() */
 
@@ -107,24 +1119,19 @@ void BBRTC::stop(void)
 {
 uint8_t ucTemp[4];
 
-    switch (_iRTCType) {
-        case RTC_DS3231:
-            ucTemp[0] = 0xe; // control
-            ucTemp[1] = 0x80; // set the EOSC bit (disables the clock)
-            I2CWrite(&_bb, _iRTCAddr, ucTemp, 2);
-            break;
-        case RTC_RV3032:
-            ucTemp[0] = 0x11; // Control 2
-            ucTemp[1] = 0x01; // set STOP bit
-            I2CWrite(&_bb, _iRTCAddr, ucTemp, 2);
-            break;
-        case RTC_PCF8563: // same logic for these 2
-        case RTC_PCF85063A:
-            ucTemp[0] = 0; // control_1
-            ucTemp[1] = 0x20; // set STOP bit
-            I2CWrite(&_bb, _iRTCAddr, ucTemp, 2);
-            break;
-    } // switch on RTC type
+    startOp();
+#ifdef __LINUX__
+    if (_iRTCDev >= 0) return; // not available through the kernel driver
+#endif
+
+    if (_desc.u8StopBit == 0) return;
+    if (_desc.u8Flags & RTC_DESC_STOP_RMW) { // the bit shares a register with the time
+        writeBits(_desc.u8StopReg, _desc.u8StopBit, (_desc.u8Flags & RTC_DESC_STOP_CLEAR) ? 0 : 0xff);
+    } else { // the rest of the control register goes to its default
+        ucTemp[0] = _desc.u8StopReg;
+        ucTemp[1] = _desc.u8StopBit; // set the EOSC/STOP bit
+        busWrite(ucTemp, 2);
+    }
 } /* stop() */
 
 //
@@ -134,11 +1141,8 @@ uint8_t ucTemp[4];
 int BBRTC::init(int iSDA, int iSCL, bool bWire, uint32_t u32Speed)
 {
   logmsg("Entering init");
-  memset(&_bb,0,sizeof(_bb));
-  _bb.iSDA = iSDA;
-  _bb.iSCL = iSCL;
-  _bb.bWire = bWire;
-  I2CInit(&_bb, u32Speed); // initialize the bit bang library
+  _i2c.init(iSDA, iSCL, bWire, u32Speed);
+  _pTransport = &_i2c;
   return initInternal();
 } /* init() */
 //
@@ -148,11 +1152,35 @@ int BBRTC::init(int iSDA, int iSCL, bool bWire, uint32_t u32Speed)
 int BBRTC::init(BBI2C *pBB)
 {
     if (pBB) {
-        memcpy(&_bb, pBB, sizeof(_bb));
+        _i2c.setBB(pBB);
+        _pTransport = &_i2c;
         return initInternal();
     }
     return RTC_ERROR;
 } /* setBB() */
+//
+// Use a caller-supplied transport (e.g. simulated or multiplexed)
+// The transport must remain valid for the lifetime of this instance
+//
+int BBRTC::init(BBRTCTransport *pTransport)
+{
+    if (pTransport) {
+        _pTransport = pTransport;
+        return initInternal();
+    }
+    return RTC_ERROR;
+} /* init() */
+//
+// Use an RTC behind channel iChannel of the mux at address u8Mux
+// The BBRTCMuxBus can be shared by all of the devices on the same bus
+//
+int BBRTC::init(BBRTCMuxBus *pMuxBus, uint8_t u8Mux, int iChannel)
+{
+    if (pMuxBus == NULL || iChannel < 0 || iChannel >= RTC_MUX_CHANNELS) return RTC_ERROR;
+    _mux.init(pMuxBus, u8Mux, iChannel);
+    _pTransport = &_mux;
+    return initInternal();
+} /* init() */
 
 //
 // I2C devices usually exist at fixed addresses or groups of addresses.
@@ -162,70 +1190,231 @@ int BBRTC::init(BBI2C *pBB)
 //
 int BBRTC::initInternal(void)
 {
-uint8_t ucTemp[4];
+  startOp();
+#ifdef __LINUX__
+  if (_iRTCDev >= 0) { // switching back to direct register access
+     close(_iRTCDev);
+     _iRTCDev = -1;
+  }
+#endif
+  if (detect() != RTC_SUCCESS) {
+     logmsg("no supported device found");
+     return RTC_ERROR;
+  }
+  configure();
+  return RTC_SUCCESS;
+} /* initInternal() */
+//
+// Run the register test of one device
+// A test value which doesn't read back as written is a read-only (or
+// missing) register. The original value is put back when it changed
+// so the test doesn't disturb RAM or a different device; nothing is
+// written if the original value couldn't be read. Before a write test
+// the time registers must hold BCD digits, so a different kind of
+// device at the address (e.g. an MPU6050 at 0x68) is left alone.
+//
+bool BBRTC::detectReg(const RTC_CHIP_DESC *pDesc)
+{
+uint8_t u8Old = 0, u8New, ucTemp[7];
+char szDigits[14];
+int iWday;
+bool bCentury;
+
+  if (pDesc->u8IdMask == 0) return true; // no test needed
+  if (pDesc->u8IdValue) { // write test
+     if (_pTransport->readRegister(pDesc->u8Addr, pDesc->u8TimeReg, ucTemp, 7) <= 0 ||
+         !rtcUnpackBCD(pDesc, ucTemp, szDigits, &iWday, &bCentury))
+        return false; // not an RTC (read-only check)
+     if (_pTransport->readRegister(pDesc->u8Addr, pDesc->u8IdReg, &u8Old, 1) <= 0)
+        return false; // we couldn't put it back
+     ucTemp[0] = pDesc->u8IdReg;
+     ucTemp[1] = pDesc->u8IdValue;
+     _pTransport->write(pDesc->u8Addr, ucTemp, 2);
+  }
+  u8New = 0xff;
+  _pTransport->readRegister(pDesc->u8Addr, pDesc->u8IdReg, &u8New, 1);
+  if (pDesc->u8IdValue && u8New != u8Old) { // restore it
+     ucTemp[0] = pDesc->u8IdReg;
+     ucTemp[1] = u8Old;
+     _pTransport->write(pDesc->u8Addr, ucTemp, 2);
+  }
+  return ((u8New & pDesc->u8IdMask) == pDesc->u8IdExpect);
+} /* detectReg() */
+//
+// Find the first device in the table which answers its address and
+// passes its register test. Nothing is configured here.
+// returns RTC_SUCCESS or RTC_ERROR
+//
+int BBRTC::detect(void)
+{
+RTC_CHIP_DESC desc;
+int i, iLastAddr = -1;
+bool bPresent = false;
 
   _iRTCType = -1;
-    
-  if (I2CTest(&_bb, RTC_DS3231_ADDR)) {
-     // Make sure it's really a DS3231 because other I2C devices
-     // use the same address (0x68)
-      I2CReadRegister(&_bb, RTC_DS3231_ADDR, 0x12, ucTemp, 1); // read temp reg
-      if ((ucTemp[0] & 0x3f) == 0) {
-          logmsg("Found DS3231");
-          _iRTCAddr = RTC_DS3231_ADDR;
-          _iRTCType = RTC_DS3231;
-      }
+  memset(&_desc, 0, sizeof(_desc));
+  for (i=0; i<RTC_CHIP_COUNT; i++) {
+     memcpy_P(&desc, &rtcChips[i], sizeof(desc));
+     if (desc.u8Addr != iLastAddr) { // the table is grouped by address
+        iLastAddr = desc.u8Addr;
+        bPresent = (_pTransport->probe(desc.u8Addr) > 0);
+     }
+     if (bPresent && detectReg(&desc)) {
+        memcpy(&_desc, &desc, sizeof(desc));
+        _iRTCType = desc.u8Type;
+        _iRTCAddr = desc.u8Addr;
+        return RTC_SUCCESS;
+     }
   }
-  if (_iRTCType == -1 && I2CTest(&_bb, RTC_RV3032_ADDR)) {
-     // The PCF85063A, PCF8563 and RV3032 all use the same I2C address (0x51)
-     // Try to write to the temperature threshold register to see
-     // which one is connected
-     ucTemp[0] = 0x17; // temp threshold high register
-     ucTemp[1] = 0x55; // random value to write
-     I2CWrite(&_bb, RTC_RV3032_ADDR, ucTemp, 2);
-     I2CReadRegister(&_bb, RTC_RV3032_ADDR, 0x17, ucTemp, 1);
-     if (ucTemp[0] == 0x55) {
-        logmsg("Found RV3032");
-        _iRTCAddr = RTC_RV3032_ADDR;
-        _iRTCType = RTC_RV3032;
-     } else { // it must be the PCF8563 or PCF85063A
-        ucTemp[0] = 0x3; // 1 byte of RAM in PCF85063A, minutes reg in BM8563
-        ucTemp[1] = 0xaa;
-        I2CWrite(&_bb, RTC_RV3032_ADDR, ucTemp, 2);
-        I2CReadRegister(&_bb, RTC_RV3032_ADDR, 0x03, ucTemp, 1);
-        if (ucTemp[0] == 0xaa) {
-            logmsg("Found PCF85063A");
-            _iRTCAddr = RTC_PCF85063A_ADDR;
-            _iRTCType = RTC_PCF85063A;
+  return RTC_ERROR;
+} /* detect() */
+#ifdef __LINUX__
+typedef struct _tagrtcdiscoverbus
+{
+  int iBus, iTimeoutMs;
+  int iFound;
+  RTC_FOUND found[RTC_DISCOVER_PER_BUS];
+} RTC_DISCOVER_BUS;
+//
+// Scan one adapter for RTCs (runs on its own thread)
+// Each address in the table is probed once and the entries at that
+// address are told apart with their register tests; nothing is configured
+//
+void * BBRTC::discoverBus(void *pArg)
+{
+RTC_DISCOVER_BUS *pBus = (RTC_DISCOVER_BUS *)pArg;
+RTC_CHIP_DESC desc;
+BBRTC rtc;
+BBI2C *pBB;
+char szName[32];
+unsigned long ulFuncs = 0;
+int i, iLastAddr = -1;
+bool bPresent = false, bFound = false;
+
+  pBB = rtc._i2c.getBB();
+  memset(pBB, 0, sizeof(BBI2C));
+  pBB->iSDA = (uint8_t)pBus->iBus;
+  snprintf(szName, sizeof(szName), "/dev/i2c-%d", pBus->iBus);
+  pBB->file_i2c = open(szName, O_RDWR);
+  if (pBB->file_i2c < 0) return NULL;
+  // Skip SMBus only adapters (e.g. the memory SPD bus of a PC); the
+  // register tests write to whatever answers at the RTC addresses
+  if (ioctl(pBB->file_i2c, I2C_FUNCS, &ulFuncs) < 0 || !(ulFuncs & I2C_FUNC_I2C)) {
+     close(pBB->file_i2c);
+     return NULL;
+  }
+  if (pBus->iTimeoutMs > 0) { // fail fast on a stuck or empty bus
+     ioctl(pBB->file_i2c, I2C_TIMEOUT, (pBus->iTimeoutMs + 9) / 10); // units of 10ms
+     ioctl(pBB->file_i2c, I2C_RETRIES, 0);
+  }
+  for (i=0; i<RTC_CHIP_COUNT && pBus->iFound < RTC_DISCOVER_PER_BUS; i++) {
+     memcpy_P(&desc, &rtcChips[i], sizeof(desc));
+     if (desc.u8Addr != iLastAddr) { // the table is grouped by address
+        iLastAddr = desc.u8Addr;
+        bFound = false;
+        if (ioctl(pBB->file_i2c, I2C_SLAVE, desc.u8Addr) < 0) {
+           bPresent = false;
+           if (errno == EBUSY) { // claimed by a kernel driver
+              pBus->found[pBus->iFound].iBus = pBus->iBus;
+              pBus->found[pBus->iFound].iType = RTC_UNKNOWN;
+              pBus->found[pBus->iFound].u8Addr = desc.u8Addr;
+              pBus->found[pBus->iFound].bKernel = true;
+              pBus->iFound++;
+           }
         } else {
-            logmsg("Found PCF8563");
-            _iRTCAddr = RTC_PCF8563_ADDR;
-            _iRTCType = RTC_PCF8563;
+           bPresent = (rtc._pTransport->probe(desc.u8Addr) > 0);
         }
      }
+     if (bPresent && !bFound && rtc.detectReg(&desc)) {
+        pBus->found[pBus->iFound].iBus = pBus->iBus;
+        pBus->found[pBus->iFound].iType = desc.u8Type;
+        pBus->found[pBus->iFound].u8Addr = desc.u8Addr;
+        pBus->found[pBus->iFound].bKernel = false;
+        pBus->iFound++;
+        bFound = true; // one device per address
+     }
   }
-  if (_iRTCType == -1) { // not found
-     logmsg("no supported device found");
-     return RTC_ERROR;
+  close(pBB->file_i2c);
+  return NULL;
+} /* discoverBus() */
+//
+// Find the RTCs on every I2C adapter (/dev/i2c-N) of the system
+// The adapters are scanned in parallel, so the whole scan takes about as
+// long as the slowest bus. With iTimeoutMs > 0 each adapter's transfer
+// timeout is set to it and its retries to 0 so a stuck bus can't hold up
+// the scan; these are adapter settings and stay in effect after the scan.
+// Pass the iBus of an entry to init() (as iSDA) to use it, or call
+// initRTCDev() for the ones a kernel driver owns.
+// returns the number of entries written to pList (in bus order)
+//
+int BBRTC::discover(RTC_FOUND *pList, int iMax, int iTimeoutMs)
+{
+RTC_DISCOVER_BUS *pBuses;
+pthread_t threads[RTC_DISCOVER_BUSES];
+bool bThread[RTC_DISCOVER_BUSES];
+DIR *pDir;
+struct dirent *pEntry;
+RTC_DISCOVER_BUS tmp;
+int i, j, iBus, iLen, iBuses = 0, iCount = 0;
+
+  if (pList == NULL || iMax < 1) return 0;
+  pDir = opendir("/dev");
+  if (pDir == NULL) return 0;
+  pBuses = (RTC_DISCOVER_BUS *)calloc(RTC_DISCOVER_BUSES, sizeof(RTC_DISCOVER_BUS));
+  if (pBuses == NULL) {
+     closedir(pDir);
+     return 0;
+  }
+  while (iBuses < RTC_DISCOVER_BUSES && (pEntry = readdir(pDir)) != NULL) {
+     iLen = 0;
+     if (sscanf(pEntry->d_name, "i2c-%d%n", &iBus, &iLen) == 1 && pEntry->d_name[iLen] == 0 && iBus >= 0 && iBus < 256) {
+        pBuses[iBuses].iBus = iBus;
+        pBuses[iBuses].iTimeoutMs = iTimeoutMs;
+        iBuses++;
+     }
+  }
+  closedir(pDir);
+  for (i=1; i<iBuses; i++) { // readdir() order is arbitrary
+     memcpy(&tmp, &pBuses[i], sizeof(tmp));
+     for (j=i; j>0 && pBuses[j-1].iBus > tmp.iBus; j--) {
+        memcpy(&pBuses[j], &pBuses[j-1], sizeof(tmp));
+     }
+     memcpy(&pBuses[j], &tmp, sizeof(tmp));
+  }
+  for (i=0; i<iBuses; i++) {
+     bThread[i] = (pthread_create(&threads[i], NULL, discoverBus, &pBuses[i]) == 0);
+     if (!bThread[i]) discoverBus(&pBuses[i]); // out of threads; scan it here
   }
+  for (i=0; i<iBuses; i++) {
+     if (bThread[i]) pthread_join(threads[i], NULL);
+     for (j=0; j<pBuses[i].iFound && iCount < iMax; j++) {
+        memcpy(&pList[iCount++], &pBuses[i].found[j], sizeof(RTC_FOUND));
+     }
+  }
+  free(pBuses);
+  return iCount;
+} /* discover() */
+#endif // __LINUX__
+//
+// Put the detected device into a known state: clock running,
+// alarms routed to the interrupt pin and battery backup enabled
+//
+void BBRTC::configure(void)
+{
+uint8_t ucTemp[4];
 
-  if (_iRTCType == RTC_DS3231) {
-    ucTemp[0] = 0xe; // control register
-    ucTemp[1] = 0x1c; // enable main oscillator and interrupt mode for alarms
-    I2CWrite(&_bb, _iRTCAddr, ucTemp, 2);
-  } else if (_iRTCType == RTC_RV3032) {
-    // Enable direct switchover mode to the backup battery (disabled on delivery)
-    ucTemp[0] = 0xc0; // EEPROM PMU
-    ucTemp[1] = 0x10; // enable direct VBACKUP switchover, disable trickle charge
-    I2CWrite(&_bb, _iRTCAddr, ucTemp, 2); 
-  } else { // PCF8563 and PCF85063A
-    ucTemp[0] = 0; // control_status_1
-    ucTemp[1] = 0; // normal mode, clock on, power-on-reset disabled
-    ucTemp[2] = 0; // disable all alarms
-    I2CWrite(&_bb, _iRTCAddr, ucTemp, 3);
+  if (_desc.u8InitLen) {
+     ucTemp[0] = _desc.u8InitReg;
+     memcpy(&ucTemp[1], _desc.u8Init, _desc.u8InitLen);
+     busWrite(ucTemp, 1 + _desc.u8InitLen);
   }
-  return RTC_SUCCESS;
-} /* init() */
+  if (_desc.u8Flags & RTC_DESC_STOP_RMW) { // start the oscillator
+     writeBits(_desc.u8StopReg, _desc.u8StopBit, (_desc.u8Flags & RTC_DESC_STOP_CLEAR) ? 0xff : 0);
+  }
+  if (_desc.u8WdaySet) { // e.g. VBATEN
+     writeBits(_desc.u8TimeReg + ((_desc.u8Flags & RTC_DESC_PCF_ORDER) ? 4 : 3), _desc.u8WdaySet, 0xff);
+  }
+} /* configure() */
 //
 // Enable/set the CLKOUT frequency (-1 = disable)
 //
@@ -234,17 +1423,35 @@ void BBRTC::setFreq(int iFreq)
 uint8_t c, ucTemp[4];
 int i;
 
+    startOp();
+#ifdef __LINUX__
+    if (_iRTCDev >= 0) return; // not available through the kernel driver
+#endif
+
+   if (_desc.u8ClkReg) { // frequency codes come from the descriptor
+      if (iFreq == -1) {
+         writeBits(_desc.u8ClkReg, _desc.u8ClkMask, _desc.u8ClkOff);
+         return;
+      }
+      for (i=0; i<8; i++) {
+         if (_desc.i8ClkLog2[i] >= 0 && (1L << _desc.i8ClkLog2[i]) == iFreq) {
+            writeBits(_desc.u8ClkReg, _desc.u8ClkMask, _desc.u8ClkOn | (uint8_t)i);
+            return;
+         }
+      }
+      return; // unsupported frequency
+   }
    if (_iRTCType == RTC_RV3032) {
       if (iFreq == -1) { // disable it
-          I2CReadRegister(&_bb, _iRTCAddr, 0xc0, &ucTemp[1], 1); // read control register
+          busReadReg(0xc0, &ucTemp[1], 1); // read control register
           ucTemp[0] = 0xc0; // write it back with NCLKE set to disable CLKOUT
           ucTemp[1] |= 0x40; // set NCLKE
-          I2CWrite(&_bb, _iRTCAddr, ucTemp, 2);
+          busWrite(ucTemp, 2);
       } else { // enable clock
-          I2CReadRegister(&_bb, _iRTCAddr, 0xc0, &ucTemp[1], 1); // read control register
+          busReadReg(0xc0, &ucTemp[1], 1); // read control register
           ucTemp[0] = 0xc0; // write it back with NCLKE set to disable CLKOUT
           ucTemp[1] &= ~0x40; // clear NCLKE
-          I2CWrite(&_bb, _iRTCAddr, ucTemp, 2);
+          busWrite(ucTemp, 2);
           c = 0; // default = 32768
           if (iFreq <= 32768) { // low speed
              ucTemp[0] = 0xc3; // CLKOUT control
@@ -252,7 +1459,7 @@ int i;
              else if (iFreq == 64) c = 2;
              else if (iFreq == 1) c = 3; // all other values will stay at 32k
              ucTemp[1] = c << 5; // bits 5+6 in 32k mode
-             I2CWrite(&_bb, _iRTCAddr, ucTemp, 2);
+             busWrite(ucTemp, 2);
           } else { // high speed
              ucTemp[0] = 0xc2; // HFD + CLKOUT control
              i = (iFreq / 8192000) - 1;
@@ -260,10 +1467,10 @@ int i;
              else if (i > 8191) i = 8191; // top 13 bits of freq up to 67Mhz
              ucTemp[1] = (uint8_t)(i & 0xff);
              ucTemp[2] = (uint8_t)(0x80 | ((i >> 8) & 0x1f));
-             I2CWrite(&_bb, _iRTCAddr, ucTemp, 3);
+             busWrite(ucTemp, 3);
           }
       }
-   } else if (_iRTCType == RTC_DS3231) {
+   } else if (_desc.u8Family == RTC_DS3231) {
        if (iFreq == -1) { // disable CLKOUT (allow interrupts)
           ucTemp[0] = 0xe;// control register
           ucTemp[1] = 0x4; // disable SQW and enable interrupts 
@@ -276,7 +1483,7 @@ int i;
           else if (iFreq == 8192) c = 3;
           ucTemp[1] = (c << 3); // enable SQW, disable interrupts
        }
-       I2CWrite(&_bb, _iRTCAddr, ucTemp, 2);
+       busWrite(ucTemp, 2);
    } else if (_iRTCType == RTC_PCF8563) {
        ucTemp[0] = 0xd; // CLKOUT control
        if (iFreq == -1)  { // disable CLKOUT
@@ -290,68 +1497,100 @@ int i;
              ucTemp[1] = 0x82;
           else ucTemp[1] = 0x83; // assume 1Hz
        }
-       I2CWrite(&_bb, _iRTCAddr, ucTemp, 2);
+       busWrite(ucTemp, 2);
    }
 } /* setFreq() */
 //
-// Retrieve the current power & irq status
-// The specific bits of the RTC register are mapped to predefined flags
-// so that all supported devices return the same status information
+// Translate the raw status register(s) into the common STATUS_xxx flags
+// pRegs points to the u8StatusLen registers starting at u8StatusReg
+// If pu8Fired is not NULL, it receives the RTC_FIRED_xxx source flags
 //
-int BBRTC::getStatus(void)
+int BBRTC::decodeStatus(const uint8_t *pRegs, uint8_t *pu8Fired)
 {
 int iStatus = 0;
-uint8_t ucTemp[4];
+uint8_t u8Fired = 0;
+bool bHalt;
 
-  if (_iRTCType == RTC_DS3231) {
-     I2CReadRegister(&_bb, _iRTCAddr, 0xf, ucTemp, 1); // read the status register
-     if (!(ucTemp[0] & 0x80)) // oscillator running/stopped
-        iStatus |= STATUS_RUNNING;
-     if (ucTemp[0] & 2)
-        iStatus |= STATUS_IRQ2_TRIGGERED;
-     if (ucTemp[0] & 1)
-        iStatus |= STATUS_IRQ1_TRIGGERED;
-  } else if (_iRTCType == RTC_RV3032) {
+  if (_desc.u8Halt[1] == 0) {
      iStatus |= STATUS_RUNNING; // oscillator is always running
-     I2CReadRegister(&_bb, _iRTCAddr, 0xd, ucTemp, 1); // read the status register
-     if (ucTemp[0] & 0x18) // alarm or countdown timer fired
-        iStatus |= STATUS_IRQ1_TRIGGERED;
-     //Serial.println(ucTemp[0], HEX);
-  } else if (_iRTCType == RTC_PCF8563) {
-     I2CReadRegister(&_bb, _iRTCAddr, 0x00, ucTemp, 2); // read control regs 1 & 2
-     if (!(ucTemp[0] & 0x20))
-        iStatus |= STATUS_RUNNING;
-     if (ucTemp[1] & (8 | 4))
-        iStatus |= STATUS_IRQ1_TRIGGERED; 
-  } else if (_iRTCType == RTC_PCF85063A) {
-     I2CReadRegister(&_bb, _iRTCAddr, 0x00, ucTemp, 2); // read control regs 1 & 2
-     if (!(ucTemp[0] & 0x20))
-        iStatus |= STATUS_RUNNING;
-     if (ucTemp[1] & (8 | 0x40))
-        iStatus |= STATUS_IRQ1_TRIGGERED;
+  } else {
+     bHalt = (pRegs[_desc.u8Halt[0]] & _desc.u8Halt[1]) != 0;
+     if (_desc.u8Flags & RTC_DESC_RUN_HIGH) bHalt = !bHalt;
+     if (!bHalt) iStatus |= STATUS_RUNNING;
+  }
+  if (pRegs[_desc.u8Alarm1[0]] & _desc.u8Alarm1[1]) {
+     iStatus |= STATUS_IRQ1_TRIGGERED;
+     u8Fired |= RTC_FIRED_ALARM1;
+  }
+  if (pRegs[_desc.u8Alarm2[0]] & _desc.u8Alarm2[1]) {
+     iStatus |= STATUS_IRQ2_TRIGGERED;
+     u8Fired |= RTC_FIRED_ALARM2;
+  }
+  if (pRegs[_desc.u8Timer[0]] & _desc.u8Timer[1]) { // countdown or periodic timer
+     iStatus |= STATUS_IRQ1_TRIGGERED;
+     u8Fired |= RTC_FIRED_TIMER;
+  }
+  if (pRegs[_desc.u8Update[0]] & _desc.u8Update[1])
+     u8Fired |= RTC_FIRED_UPDATE;
+  if (pRegs[_desc.u8TempHigh[0]] & _desc.u8TempHigh[1]) {
+     iStatus |= STATUS_TEMP_TRIGGERED;
+     u8Fired |= RTC_FIRED_TEMP_HIGH;
+  }
+  if (pRegs[_desc.u8TempLow[0]] & _desc.u8TempLow[1]) {
+     iStatus |= STATUS_TEMP_TRIGGERED;
+     u8Fired |= RTC_FIRED_TEMP_LOW;
   }
+  if (pu8Fired) *pu8Fired = u8Fired;
   return iStatus;
+} /* decodeStatus() */
+//
+// Retrieve the current power & irq status
+// The specific bits of the RTC register are mapped to predefined flags
+// so that all supported devices return the same status information
+//
+int BBRTC::getStatus(void)
+{
+uint8_t ucTemp[32];
+
+  startOp();
+#ifdef __LINUX__
+  if (_iRTCDev >= 0) return rtcDevGetStatus();
+#endif
+
+  if (_iRTCType <= RTC_UNKNOWN) return 0;
+  if (busReadReg(_desc.u8StatusReg, ucTemp, _desc.u8StatusLen) <= 0) return 0; // see getLastError()
+  return decodeStatus(ucTemp, NULL);
 } /* getStatus() */
 //
-// Get the UNIX epoch time
+// Get the UNIX epoch time (0 if it can't be read)
+// The RTC registers are taken as UTC (earlier versions went through
+// mktime() and applied the local time zone)
 // The RV3032 can return it directly, but we need to calculate it for
 // the other types of RTCs
 //
 uint32_t BBRTC::getEpoch(void)
 {
+    startOp();
+#ifdef __LINUX__
+    if (_iRTCDev >= 0) { // the kernel doesn't expose the RV3032 epoch register
+        struct tm tempTime;
+        if (getTimeInternal(&tempTime) != RTC_SUCCESS) return 0;
+        return (uint32_t)timegm(&tempTime);
+    }
+#endif
     uint32_t tt = 0;
     
     if (_iRTCType == RTC_RV3032) {
-        I2CReadRegister(&_bb, _iRTCAddr, 0x1b, (uint8_t *)&tt, sizeof(tt));
+        if (busReadReg(0x1b, (uint8_t *)&tt, sizeof(tt)) <= 0) tt = 0;
     } else { // all others
         struct tm tempTime;
-        getTime(&tempTime); // read the current time
-        tt = (uint32_t)mktime(&tempTime);
+        if (getTimeInternal(&tempTime) == RTC_SUCCESS) // read the current time (UTC)
+            tt = timeToEpoch(&tempTime);
     }
     return tt;
 } /* getEpoch() */
 //
-// Set the UNIX epoch time
+// Set the UNIX epoch time; the RTC registers are set to UTC
 // Only the RV3032 supports directly setting the epoch time
 // The other RTCs need it converted to a struct tm
 //
@@ -359,18 +1598,29 @@ void BBRTC::setEpoch(uint32_t tt)
 {
 uint8_t ucTemp[8];
 
+  startOp();
+#ifdef __LINUX__
+  if (_iRTCDev >= 0) {
+      struct tm tempTime;
+      time_t t = (time_t)tt;
+      gmtime_r(&t, &tempTime);
+      rtcDevSetTime(&tempTime);
+      return;
+  }
+#endif
+
   if (_iRTCType == RTC_RV3032) {
-    I2CReadRegister(&_bb, _iRTCAddr, 0x10, &ucTemp[1], 1); // read control register 2
+    busReadReg(0x10, &ucTemp[1], 1); // read control register 2
     ucTemp[0] = 0x10;
     ucTemp[1] |= 1; // set RESET BIT
-    I2CWrite(&_bb, _iRTCAddr, ucTemp, 2); // do a reset of seconds and prescaler
+    busWrite(ucTemp, 2); // do a reset of seconds and prescaler
     ucTemp[0] = 0x1b;
     memcpy(&ucTemp[1], (uint8_t *)&tt, sizeof(tt));
-    I2CWrite(&_bb, _iRTCAddr, ucTemp, 1+sizeof(tt)); // set time
+    busWrite(ucTemp, 1+sizeof(tt)); // set time
   } else { // For all others, convert epoch into struct tm
       struct tm tempTime;
-      memcpy(&tempTime, gmtime((const time_t *)&tt), sizeof(struct tm));
-      setTime(&tempTime);
+      epochToTime(tt, &tempTime);
+      setTimeInternal(&tempTime);
   }
 } /* setEpoch() */
 
@@ -384,15 +1634,32 @@ uint8_t ucTemp[8];
 // ALARM_DATE = When a specific day of the month and time match
 //
 void BBRTC::setAlarm(uint8_t type, struct tm *pTime)
+{
+  startOp();
+  setAlarmInternal(type, pTime);
+} /* setAlarm() */
+
+void BBRTC::setAlarmInternal(uint8_t type, struct tm *pTime)
 {
 uint8_t ucTemp[8];
 
-  if (_iRTCType == RTC_DS3231) {
+#ifdef __LINUX__
+  if (_iRTCDev >= 0) {
+      rtcDevSetAlarm(type, pTime);
+      return;
+  }
+#endif
+
+  if (_desc.u8AlarmLayout > RTC_ALM_CHIP) { // table driven
+      setMatchAlarm(type, pTime);
+      return;
+  }
+  if (_desc.u8Family == RTC_DS3231) {
     switch (type) {
       case ALARM_SECOND: // turn on repeating alarm for every second
         ucTemp[0] = 0xe; // control register
         ucTemp[1] = 0x1d; // enable alarm1 interrupt
-        I2CWrite(&_bb, _iRTCAddr, ucTemp, 2);
+        busWrite(ucTemp, 2);
         ucTemp[0] = 0x7; // starting register for alarm 1
         // seconds
         ucTemp[1] = ((pTime->tm_sec / 10) << 4);
@@ -401,18 +1668,18 @@ uint8_t ucTemp[8];
         ucTemp[2] = 0x80; // set bit 7 in the other 3 registers
         ucTemp[3] = 0x80;
         ucTemp[4] = 0x80;
-        I2CWrite(&_bb, _iRTCAddr, ucTemp, 5);
+        busWrite(ucTemp, 5);
         break;
       case ALARM_MINUTE: // turn on repeating alarm for every minute
         ucTemp[0] = 0xe; // control register
         ucTemp[1] = 0x1d; // enable alarm1 interrupt
-        I2CWrite(&_bb, _iRTCAddr, ucTemp, 2);
+        busWrite(ucTemp, 2);
         ucTemp[0] = 0x7; // starting register for alarm 1
         ucTemp[1] = 0x80; // disable seconds
         ucTemp[2] = ((pTime->tm_min / 10) << 4);
         ucTemp[2] |= (pTime->tm_min % 10);
         ucTemp[3] = ucTemp[4] = 0x80; // disable other alarm types
-        I2CWrite(&_bb, _iRTCAddr, ucTemp, 5);
+        busWrite(ucTemp, 5);
         break;
       case ALARM_TIME: // turn on alarm to match a specific time
       case ALARM_DAY: // turn on alarm for a specific day of the week
@@ -442,11 +1709,11 @@ uint8_t ucTemp[8];
           ucTemp[4] &= 0x7f;
         }
         // for matching the date, all bits are left as 0's (00000)
-        I2CWrite(&_bb, _iRTCAddr, ucTemp, 5);
+        busWrite(ucTemp, 5);
         ucTemp[0] = 0xe; // control register
         ucTemp[1] = 0x1d; // enable alarm1 interrupt
         ucTemp[2] = 0x00; // reset alarm status bits
-        I2CWrite(&_bb, _iRTCAddr, ucTemp, 3);
+        busWrite(ucTemp, 3);
         break;
       case ALARM2_MINUTE: // turn on repeating alarm for every minute
       case ALARM2_TIME: // turn on alarm to match a specific time
@@ -475,11 +1742,11 @@ uint8_t ucTemp[8];
         } else if (type == ALARM2_DAY || type == ALARM2_DATE) {
             ucTemp[3] &= 0x7f;
         }
-        I2CWrite(&_bb, _iRTCAddr, ucTemp, 4);
+        busWrite(ucTemp, 4);
         ucTemp[0] = 0xe; // control register
         ucTemp[1] = 0x1e; // enable alarm2 interrupt
         ucTemp[2] = 0x00; // reset alarm status bits
-        I2CWrite(&_bb, _iRTCAddr, ucTemp, 3);
+        busWrite(ucTemp, 3);
         break;
      } // switch on type
   } else if (_iRTCType == RTC_PCF8563) {
@@ -487,20 +1754,20 @@ uint8_t ucTemp[8];
       case ALARM_SECOND: // turn on repeating alarm for every second
         ucTemp[0] = 0x1; // control_status_2
         ucTemp[1] = 0x1; // enable timer & interrupt
-        I2CWrite(&_bb, _iRTCAddr, ucTemp, 2);
+        busWrite(ucTemp, 2);
         ucTemp[0] = 0xe; // timer control
         ucTemp[1] = 0x81; // enable timer for 1/64 second interval
         ucTemp[2] = 0x40; // timer count value (64 = 1 second)
-        I2CWrite(&_bb, _iRTCAddr, ucTemp, 3);
+        busWrite(ucTemp, 3);
         break;
       case ALARM_MINUTE: // turn on repeating timer for every minute
         ucTemp[0] = 0x1; // control_status_2
         ucTemp[1] = 0x1; // enable timer & interrupt
-        I2CWrite(&_bb, _iRTCAddr, ucTemp, 2);
+        busWrite(ucTemp, 2);
         ucTemp[0] = 0xe; // timer control
         ucTemp[1] = 0x82; // enable timer for 1 hz interval
         ucTemp[2] = 0x3c; // 60 = 1 minute
-        I2CWrite(&_bb, _iRTCAddr, ucTemp, 3);
+        busWrite(ucTemp, 3);
         break;
       case ALARM_TIME: // turn on alarm to match a specific time
       case ALARM_DAY: // turn on alarm for a specific day of the week
@@ -508,7 +1775,7 @@ uint8_t ucTemp[8];
         // disable timer
         ucTemp[0] = 0xe;
         ucTemp[1] = 0x00;
-        I2CWrite(&_bb, _iRTCAddr, ucTemp, 2);
+        busWrite(ucTemp, 2);
 // Values are stored as BCD
         ucTemp[0] = 0x9; // start at register 9
         // minutes
@@ -538,29 +1805,29 @@ uint8_t ucTemp[8];
         if (type == ALARM_DATE) {
           ucTemp[3] &= 0x7f;
         }
-        I2CWrite(&_bb, _iRTCAddr, ucTemp, 5);
+        busWrite(ucTemp, 5);
         // enable alarm
         ucTemp[0] = 0x1; // control_status_2
         ucTemp[1] = 0x2; // enable alarm & interrupt
-        I2CWrite(&_bb, _iRTCAddr, ucTemp, 2);
+        busWrite(ucTemp, 2);
         break;
      } // switch on alarm type
   } else if (_iRTCType == RTC_PCF85063A) {
-      I2CReadRegister(&_bb, _iRTCAddr, 0x01, &ucTemp[1], 1); // read contents of ctrl2 first
+      busReadReg(0x01, &ucTemp[1], 1); // read contents of ctrl2 first
       ucTemp[1] &= 0x7; // preserve clockout freq
     switch (type) {
 //      case ALARM_SECOND: // not supported
       case ALARM_MINUTE: // turn on repeating timer for every minute
         ucTemp[0] = 0x1; // control_status_2
         ucTemp[1] |= 0xa0; // enable minute timer & interrupt
-        I2CWrite(&_bb, _iRTCAddr, ucTemp, 2);
+        busWrite(ucTemp, 2);
         break;
       case ALARM_TIME: // turn on alarm to match a specific time
       case ALARM_DAY: // turn on alarm for a specific day of the week
       case ALARM_DATE: // turn on alarm for a specific date
         ucTemp[0] = 0x1; // control_status_2
         ucTemp[1] |= 0x80; // enable interrupt
-        I2CWrite(&_bb, _iRTCAddr, ucTemp, 2);
+        busWrite(ucTemp, 2);
 // Values are stored as BCD
         ucTemp[0] = 0xb; // start at register 11
         // seconds
@@ -593,7 +1860,7 @@ uint8_t ucTemp[8];
         } else if (type == ALARM_DAY) {
           ucTemp[5] &= 0x7f;
         }
-        I2CWrite(&_bb, _iRTCAddr, ucTemp, 6);
+        busWrite(ucTemp, 6);
         break;
      } // switch on alarm type
    } else if (_iRTCType == RTC_RV3032) {
@@ -609,7 +1876,7 @@ uint8_t ucTemp[8];
             }
             ucTemp[2] = 0x80; // disable hours alarm
             ucTemp[3] = 0x80; // disable date alarm
-            I2CWrite(&_bb, _iRTCAddr, ucTemp, 4);
+            busWrite(ucTemp, 4);
             break;
          case ALARM_HOUR: // repeats on a specific hour
             ucTemp[0] = 0x08; // minutes alarm
@@ -617,7 +1884,7 @@ uint8_t ucTemp[8];
             ucTemp[2] = ((pTime->tm_hour / 10) << 4);
             ucTemp[2] |= (pTime->tm_hour % 10);
             ucTemp[3] = 0x80; // disable date alarm
-            I2CWrite(&_bb, _iRTCAddr, ucTemp, 4);
+            busWrite(ucTemp, 4);
             break;
          case ALARM_TIME:
          case ALARM_DAY:
@@ -633,52 +1900,339 @@ uint8_t ucTemp[8];
                ucTemp[3] = ((pTime->tm_mday+1) / 10) << 4;
                ucTemp[3] |= ((pTime->tm_mday+1) % 10);
             }
-            I2CWrite(&_bb, _iRTCAddr, ucTemp, 4);
+            busWrite(ucTemp, 4);
             break;
       } // switch on alarm type
-      I2CReadRegister(&_bb, _iRTCAddr, 0x10, &ucTemp[1], 1); // read contents of ctrl1 first
+      busReadReg(0x10, &ucTemp[1], 1); // read contents of ctrl1 first
       ucTemp[1] &= ~0x8; // turn off countdown timer
       ucTemp[0] = 0x10;
-      I2CWrite(&_bb, _iRTCAddr, ucTemp, 2); // update ctrl1
+      busWrite(ucTemp, 2); // update ctrl1
       ucTemp[0] = 0x11; // Control 2
       ucTemp[1] = 0x08; // enable time interrupt and disable other int functions
-      I2CWrite(&_bb, _iRTCAddr, ucTemp, 2);
+      busWrite(ucTemp, 2);
    } // RV3032
-} /* setAlarm() */
+} /* setAlarmInternal() */
+//
+// Program the alarm registers of the table driven devices
+// RTC_ALM_PCF: each field has its own disable bit (bit 7)
+// RTC_ALM_MCP: a mask code in the weekday register selects the fields to
+// compare. It can't match a time of day without the date, so ALARM_TIME,
+// ALARM_DAY and ALARM_DATE are set to their next occurrence (one-shot).
+//
+void BBRTC::setMatchAlarm(uint8_t type, struct tm *pTime)
+{
+uint8_t ucTemp[8], u8Reg, u8En, u8Mask;
+int i, iAlarm = 0;
+int32_t iDay, iSecs;
+struct tm now, next;
+
+  if (type >= ALARM2_MINUTE) { // same types for the second alarm
+     iAlarm = 1;
+     type = type - ALARM2_MINUTE + ALARM_MINUTE;
+  }
+  u8Reg = _desc.u8AlarmReg[iAlarm];
+  u8En = _desc.u8AlarmEn[iAlarm];
+  if (u8Reg == 0) return; // no second alarm
+  if (type == ALARM_SECOND || type == ALARM_MINUTE) {
+     u8Mask = (type == ALARM_SECOND) ? _desc.u8TickSec : _desc.u8TickMin;
+     if (u8Mask) { // periodic interrupt
+        writeBits(_desc.u8TickReg, _desc.u8TickSec | _desc.u8TickMin, u8Mask);
+        return;
+     }
+  }
+  if (pTime == NULL && type != ALARM_MINUTE) return;
+  if (_desc.u8AlarmLayout == RTC_ALM_PCF) {
+     if (type == ALARM_SECOND || type == ALARM_MINUTE) return; // not supported
+     ucTemp[0] = u8Reg;
+     ucTemp[1] = BCD(pTime->tm_sec);
+     ucTemp[2] = BCD(pTime->tm_min);
+     ucTemp[3] = BCD(pTime->tm_hour);
+     ucTemp[4] = BCD(pTime->tm_mday) | 0x80; // disabled unless needed
+     ucTemp[5] = (uint8_t)(pTime->tm_wday + _desc.u8WdayBase) | 0x80;
+     if (type == ALARM_HOUR) { // at the start of the given hour
+        ucTemp[1] = ucTemp[2] = 0;
+     } else if (type == ALARM_DATE) {
+        ucTemp[4] &= 0x7f;
+     } else if (type == ALARM_DAY) {
+        ucTemp[5] &= 0x7f;
+     }
+     busWrite(ucTemp, 6);
+  } else { // RTC_ALM_MCP
+     if (type == ALARM_SECOND) return; // not supported
+     memset(&next, 0, sizeof(next));
+     if (type == ALARM_MINUTE) { // seconds match = once a minute
+        u8Mask = 0;
+        if (pTime) next.tm_sec = pTime->tm_sec;
+     } else if (type == ALARM_HOUR) { // hours match = once a day
+        u8Mask = 2;
+        next.tm_hour = pTime->tm_hour;
+     } else { // full match of the next occurrence
+        u8Mask = 7;
+        if (getTimeInternal(&now) != RTC_SUCCESS) return;
+        iDay = rtcDaysFromCivil(now.tm_year + 1900, now.tm_mon + 1, now.tm_mday);
+        iSecs = pTime->tm_hour * 3600L + pTime->tm_min * 60 + pTime->tm_sec;
+        if (iSecs <= now.tm_hour * 3600L + now.tm_min * 60 + now.tm_sec)
+           iDay++; // already passed today
+        for (i=0; i<400; i++) { // search forward for a matching day
+           rtcCivilFromDays(iDay, &next);
+           if ((type != ALARM_DAY || next.tm_wday == pTime->tm_wday) &&
+               (type != ALARM_DATE || next.tm_mday == pTime->tm_mday))
+              break;
+           iDay++;
+        }
+        next.tm_hour = pTime->tm_hour;
+        next.tm_min = pTime->tm_min;
+        next.tm_sec = pTime->tm_sec;
+     }
+     ucTemp[0] = u8Reg;
+     ucTemp[1] = BCD(next.tm_sec);
+     ucTemp[2] = BCD(next.tm_min);
+     ucTemp[3] = BCD(next.tm_hour);
+     ucTemp[4] = (u8Mask << 4) | (uint8_t)(next.tm_wday + _desc.u8WdayBase); // also clears the flag
+     ucTemp[5] = BCD(next.tm_mday);
+     ucTemp[6] = BCD(next.tm_mon + 1);
+     busWrite(ucTemp, 7);
+  }
+  // clear the old flag and enable the interrupt
+  if (iAlarm == 0 && _desc.u8Alarm1[1])
+     writeBits(_desc.u8StatusReg + _desc.u8Alarm1[0], _desc.u8Alarm1[1], 0);
+  if (iAlarm == 1 && _desc.u8Alarm2[1])
+     writeBits(_desc.u8StatusReg + _desc.u8Alarm2[0], _desc.u8Alarm2[1], 0);
+  writeBits(_desc.u8AlarmEnReg, u8En, u8En);
+} /* setMatchAlarm() */
+
+//
+// Read back how alarm 0 or 1 is programmed
+// Fields of the alarm registers which are disabled (or masked) aren't
+// compared; the devices with minute resolution (PCF8563, RV3032, DS3231
+// alarm 2) fire at second 0. Countdown timers aren't included.
+// returns RTC_SUCCESS or RTC_xxx
+//
+int BBRTC::getAlarm(int iAlarm, RTC_ALARM_INFO *pInfo)
+{
+    startOp();
+    return getAlarmInternal(iAlarm, pInfo);
+} /* getAlarm() */
+
+int BBRTC::getAlarmInternal(int iAlarm, RTC_ALARM_INFO *pInfo)
+{
+uint8_t ucTemp[8], ucStatus[32], u8Ctrl, u8Fired, u8Reg;
+const uint8_t *p;
+bool b12H = (_desc.u8Flags & RTC_DESC_12H) != 0;
+int i, iMask;
+
+    if (pInfo == NULL || iAlarm < 0 || iAlarm > 1) return RTC_ERROR;
+    memset(pInfo, 0, sizeof(RTC_ALARM_INFO));
+#ifdef __LINUX__
+    if (_iRTCDev >= 0) return (iAlarm == 0) ? rtcDevGetAlarm(pInfo) : RTC_ERROR;
+#endif
+    if (_iRTCType <= RTC_UNKNOWN || _desc.u8AlarmLayout == RTC_ALM_NONE) return RTC_ERROR;
+    u8Reg = _desc.u8AlarmReg[iAlarm];
+    if (u8Reg == 0) return RTC_ERROR; // no second alarm
+    if (busReadReg(u8Reg, ucTemp, 7) <= 0) return _iLastError;
+    if (busReadReg(_desc.u8AlarmEnReg, &u8Ctrl, 1) <= 0) return _iLastError;
+    pInfo->bEnabled = (u8Ctrl & _desc.u8AlarmEn[iAlarm]) != 0;
+    if (iAlarm == 0 && (_desc.u8TickSec | _desc.u8TickMin)) {
+        if (_desc.u8TickReg != _desc.u8AlarmEnReg) {
+            if (busReadReg(_desc.u8TickReg, &u8Ctrl, 1) <= 0) return _iLastError;
+        }
+        if (u8Ctrl & _desc.u8TickSec) pInfo->u8Tick |= RTC_TICK_SECOND;
+        if (u8Ctrl & _desc.u8TickMin) pInfo->u8Tick |= RTC_TICK_MINUTE;
+    }
+    if (busReadReg(_desc.u8StatusReg, ucStatus, _desc.u8StatusLen) <= 0) return _iLastError;
+    decodeStatus(ucStatus, &u8Fired);
+    pInfo->bFired = (u8Fired & ((iAlarm == 0) ? RTC_FIRED_ALARM1 : RTC_FIRED_ALARM2)) != 0;
+    p = ucTemp;
+    if (_desc.u8AlarmLayout == RTC_ALM_MCP) {
+        // the mask code in the weekday register selects the fields
+        iMask = (p[3] >> 4) & 7;
+        switch (iMask) {
+            case 0: pInfo->u8Match = RTC_MATCH_SEC; break;
+            case 1: pInfo->u8Match = RTC_MATCH_MIN; break;
+            case 2: pInfo->u8Match = RTC_MATCH_HOUR; break;
+            case 3: pInfo->u8Match = RTC_MATCH_WDAY; break;
+            case 4: pInfo->u8Match = RTC_MATCH_MDAY; break;
+            case 7: pInfo->u8Match = RTC_MATCH_SEC | RTC_MATCH_MIN | RTC_MATCH_HOUR | RTC_MATCH_WDAY | RTC_MATCH_MDAY | RTC_MATCH_MON; break;
+            default: pInfo->u8Match = RTC_MATCH_NEVER; break; // reserved
+        }
+        pInfo->tmMatch.tm_sec = UNBCD(p[0] & 0x7f);
+        pInfo->tmMatch.tm_min = UNBCD(p[1] & 0x7f);
+        pInfo->tmMatch.tm_hour = rtcUnbcdHour(p[2], b12H);
+        pInfo->tmMatch.tm_wday = (p[3] & 7) - _desc.u8WdayBase;
+        pInfo->tmMatch.tm_mday = UNBCD(p[4] & 0x3f);
+        pInfo->tmMatch.tm_mon = UNBCD(p[5] & 0x1f) - 1;
+    } else if (_desc.u8Family == RTC_DS3231) {
+        // bit 7 of each register masks the field; alarm 2 has no seconds
+        if (iAlarm == 1) {
+            memmove(&ucTemp[1], ucTemp, 3);
+            ucTemp[0] = 0; // fires at second 0
+        }
+        for (i=0; i<4; i++) {
+            if (!(p[i] & 0x80)) pInfo->u8Match |= (1 << i);
+        }
+        pInfo->tmMatch.tm_sec = UNBCD(p[0] & 0x7f);
+        pInfo->tmMatch.tm_min = UNBCD(p[1] & 0x7f);
+        pInfo->tmMatch.tm_hour = rtcUnbcdHour(p[2], b12H);
+        if (pInfo->u8Match & RTC_MATCH_WDAY) { // DY/DT selects the day of the week
+            if (!(p[3] & 0x40)) pInfo->u8Match ^= (RTC_MATCH_WDAY | RTC_MATCH_MDAY);
+        }
+        pInfo->tmMatch.tm_wday = (p[3] & 7) - _desc.u8WdayBase;
+        pInfo->tmMatch.tm_mday = UNBCD(p[3] & 0x3f);
+    } else { // bit 7 disables each field
+        if (_desc.u8Family == RTC_RV3032) { // min, hour, date
+            ucTemp[4] = 0x80; // no weekday
+            ucTemp[3] = ucTemp[2];
+            memmove(&ucTemp[1], ucTemp, 2);
+            ucTemp[0] = 0x80; // no seconds
+        } else if (_desc.u8Family == RTC_PCF8563) { // min, hour, date, weekday
+            memmove(&ucTemp[1], ucTemp, 4);
+            ucTemp[0] = 0x80;
+        }
+        for (i=0; i<5; i++) {
+            // sec, min, hour, mday, wday
+            if (!(p[i] & 0x80)) pInfo->u8Match |= (i < 3) ? (1 << i) : (i == 3) ? RTC_MATCH_MDAY : RTC_MATCH_WDAY;
+        }
+        pInfo->tmMatch.tm_sec = UNBCD(p[0] & 0x7f);
+        pInfo->tmMatch.tm_min = UNBCD(p[1] & 0x7f);
+        pInfo->tmMatch.tm_hour = UNBCD(p[2] & 0x3f);
+        pInfo->tmMatch.tm_mday = UNBCD(p[3] & 0x3f);
+        pInfo->tmMatch.tm_wday = (p[4] & 7) - _desc.u8WdayBase;
+        if (pInfo->u8Match == 0) { // the RV3032 fires every minute
+            pInfo->u8Match = (_desc.u8Family == RTC_RV3032) ? RTC_MATCH_SEC : RTC_MATCH_NEVER;
+        } else if (ucTemp[0] == 0x80) { // minute resolution
+            pInfo->u8Match |= RTC_MATCH_SEC;
+        }
+    }
+    return RTC_SUCCESS;
+} /* getAlarmInternal() */
+
+//
+// The time (UTC epoch) at which an alarm will next fire after u32After,
+// including any periodic interrupt reported in u8Tick
+// This only uses the calendar, so it can plan ahead from any time
+// returns 0 if it won't fire (disabled, or no match within 28 years)
+//
+uint32_t BBRTC::nextAlarm(const RTC_ALARM_INFO *pInfo, uint32_t u32After)
+{
+uint32_t u32Next = 0, u32Day;
+int32_t iSecs;
+struct tm tmDay, *pM;
+RTC_ALARM_INFO info;
+int i;
+
+    if (pInfo == NULL) return 0;
+    if (pInfo->u8Tick & RTC_TICK_SECOND) {
+        u32Next = u32After + 1;
+    } else if (pInfo->u8Tick & RTC_TICK_MINUTE) {
+        u32Next = (u32After / 60 + 1) * 60;
+    }
+    if (!pInfo->bEnabled || (pInfo->u8Match & RTC_MATCH_NEVER)) return u32Next;
+    memcpy(&info, pInfo, sizeof(info));
+    pM = &info.tmMatch;
+    // the flag is set when a match begins, so the fields below the lowest
+    // one compared are effectively 0 (e.g. an hour match fires at hh:00:00)
+    if (info.u8Match && !(info.u8Match & RTC_MATCH_SEC)) {
+        if (!(info.u8Match & RTC_MATCH_MIN)) {
+            if (!(info.u8Match & RTC_MATCH_HOUR)) {
+                info.u8Match |= RTC_MATCH_HOUR;
+                pM->tm_hour = 0;
+            }
+            info.u8Match |= RTC_MATCH_MIN;
+            pM->tm_min = 0;
+        }
+        info.u8Match |= RTC_MATCH_SEC;
+        pM->tm_sec = 0;
+    }
+    // values which can never match
+    if (((info.u8Match & RTC_MATCH_SEC) && (pM->tm_sec < 0 || pM->tm_sec > 59)) ||
+        ((info.u8Match & RTC_MATCH_MIN) && (pM->tm_min < 0 || pM->tm_min > 59)) ||
+        ((info.u8Match & RTC_MATCH_HOUR) && (pM->tm_hour < 0 || pM->tm_hour > 23)))
+        return u32Next;
+    u32Day = u32After / 86400;
+    iSecs = (int32_t)(u32After % 86400) + 1;
+    for (i=0; i<28*366 && u32Day < 0xffffffffUL / 86400; i++, u32Day++, iSecs = 0) {
+        if (u32Next && u32Day * 86400 >= u32Next) break; // the tick comes first
+        rtcCivilFromDays((int32_t)u32Day, &tmDay);
+        if ((info.u8Match & RTC_MATCH_WDAY) && tmDay.tm_wday != pM->tm_wday) continue;
+        if ((info.u8Match & RTC_MATCH_MDAY) && tmDay.tm_mday != pM->tm_mday) continue;
+        if ((info.u8Match & RTC_MATCH_MON) && tmDay.tm_mon != pM->tm_mon) continue;
+        if ((info.u8Match & RTC_MATCH_YEAR) && tmDay.tm_year != pM->tm_year) continue;
+        iSecs = rtcAlarmSecond(&info, iSecs);
+        if (iSecs >= 0) {
+            if (!u32Next || u32Day * 86400 + iSecs < u32Next) u32Next = u32Day * 86400 + iSecs;
+            break;
+        }
+    }
+    return u32Next;
+} /* nextAlarm() */
+
+//
+// When alarm 0 or 1 will next fire, from how it's programmed now
+// returns the UTC epoch time or 0 if it won't
+//
+uint32_t BBRTC::getNextAlarm(int iAlarm)
+{
+RTC_ALARM_INFO info;
+struct tm tmNow;
+
+    startOp();
+    if (getAlarmInternal(iAlarm, &info) != RTC_SUCCESS) return 0;
+    if (getTimeInternal(&tmNow) != RTC_SUCCESS) return 0; // the alarms compare the calendar registers
+    return nextAlarm(&info, timeToEpoch(&tmNow));
+} /* getNextAlarm() */
 
 //
 // Set a countdown alarm for N seconds
 //
 void BBRTC::setCountdownAlarm(int iSeconds)
+{
+  startOp();
+  setCountdownAlarmInternal(iSeconds);
+} /* setCountdownAlarm() */
+
+void BBRTC::setCountdownAlarmInternal(int iSeconds)
 {
 uint8_t ucTemp[4];
 
+#ifdef __LINUX__
+  if (_iRTCDev >= 0) { // use the absolute alarm N seconds from now
+     struct tm theTime;
+     time_t t;
+     if (rtcDevGetTime(&theTime) == RTC_SUCCESS) {
+        t = timegm(&theTime) + iSeconds;
+        gmtime_r(&t, &theTime);
+        rtcDevSetAlarm(ALARM_DATE, &theTime);
+     }
+     return;
+  }
+#endif
+
   if (_iRTCType == RTC_RV3032) {
      ucTemp[0] = 0xc; // upper 4 bits of countdown timer
      ucTemp[1] = (uint8_t)(iSeconds >> 8) & 0xf;
-     I2CWrite(&_bb, _iRTCAddr, ucTemp, 2);
+     busWrite(ucTemp, 2);
      ucTemp[0] = 0xb; // low byte of countdown timer
      ucTemp[1] = (uint8_t)iSeconds;
-     I2CWrite(&_bb, _iRTCAddr, ucTemp, 2);
+     busWrite(ucTemp, 2);
      // disable all time alarm registers
      ucTemp[0] = 0x8; // 8/9/A
      ucTemp[1] = ucTemp[2] = ucTemp[3] = 0x80; // disable min/hr/date
-     I2CWrite(&_bb, _iRTCAddr, ucTemp, 4);
+     busWrite(ucTemp, 4);
      // set up the clock frequency to use seconds as the period
-     I2CReadRegister(&_bb, _iRTCAddr, 0x10, &ucTemp[1], 3); // control reg 1/2/3
+     busReadReg(0x10, &ucTemp[1], 3); // control reg 1/2/3
      ucTemp[1] &= 0xfc; // control 1
      ucTemp[1] |= 0x0a; // enable TE (period countdown timer), set TD = 10 = 1Hz
      ucTemp[2] &= ~0x2c; // disable periodic/alarm and external interrupts
      ucTemp[2] |= 0x10; // enable countdown interrupt
      ucTemp[3] = 0; // disable backup switchover and all temperature interrupts
      ucTemp[0] = 0x10; // write all 3 control registers back
-     I2CWrite(&_bb, _iRTCAddr, ucTemp, 4); // start countdown timer
-  } else if (_iRTCType == RTC_DS3231) {
-  // The DS3231 doesn't have a countdown timer, but we can set an alarm
-  // to match hr/min/sec (unlike the RV3032)
+     busWrite(ucTemp, 4); // start countdown timer
+  } else if (_desc.u8Family == RTC_DS3231 || _desc.u8AlarmLayout > RTC_ALM_CHIP) {
+  // The DS3231 (and the table driven devices) don't have a countdown timer,
+  // but we can set an alarm to match hr/min/sec (unlike the RV3032)
      struct tm theTime;
      int iSecs; // seconds since midnight
-     getTime(&theTime);
+     if (getTimeInternal(&theTime) != RTC_SUCCESS) return;
      iSecs = theTime.tm_hour*3600;
      iSecs += (theTime.tm_min*60);
      iSecs += theTime.tm_sec;
@@ -691,7 +2245,7 @@ uint8_t ucTemp[4];
      theTime.tm_min = iSecs / 60;
      iSecs %= 60;
      theTime.tm_sec = iSecs;
-     setAlarm(ALARM_TIME, &theTime);
+     setAlarmInternal(ALARM_TIME, &theTime);
   } else if (_iRTCType == RTC_PCF85063A) {
       ucTemp[0] = 0x10; // timer value and mode (0x10, 0x11)
       ucTemp[2] = 4; // enable the countdown timer
@@ -702,7 +2256,7 @@ uint8_t ucTemp[4];
           ucTemp[2] |= 0x17;
       }
       ucTemp[1] = (uint8_t)iSeconds;
-      I2CWrite(&_bb, _iRTCAddr, ucTemp, 3);
+      busWrite(ucTemp, 3);
   } else if (_iRTCType == RTC_PCF8563) {
       ucTemp[0] = 0xe; // timer value and mode (0xe, 0xf)
       if (iSeconds > 255) { // have to divide the clock
@@ -712,12 +2266,108 @@ uint8_t ucTemp[4];
           ucTemp[1] = 0x82; // enable timer IRQ for freq of 1Hz
       }
       ucTemp[2] = (uint8_t)iSeconds;
-      I2CWrite(&_bb, _iRTCAddr, ucTemp, 3);
+      busWrite(ucTemp, 3);
       ucTemp[0] = 1; // control_status_2
       ucTemp[1] = 1; // enable timer interrupt
-      I2CWrite(&_bb, _iRTCAddr, ucTemp, 2);
+      busWrite(ucTemp, 2);
   }
-} /* setCountdownAlarm() */
+} /* setCountdownAlarmInternal() */
+
+//
+// Set a countdown alarm in microseconds
+// Chips with a countdown timer (RV3032, PCF8563, PCF85063A) get the
+// source (4096Hz, 64Hz, 1Hz or 1/60Hz) and count closest to the period,
+// preferring the slower source on a tie since it draws less current.
+// The others round up to whole seconds with setCountdownAlarm() (less
+// than a day unless it's a kernel driver).
+// The first period of the 1Hz and 1/60Hz sources can be short by up to
+// one tick since the timer isn't synchronized to the write.
+// pu64Actual receives the period programmed, in microseconds
+// returns RTC_SUCCESS, RTC_ERROR if the device has no countdown or a bus error
+//
+int BBRTC::setCountdown(uint64_t u64Us, uint64_t *pu64Actual)
+{
+// tick of each source in 1/64us (4096Hz = 244.140625us)
+static const uint64_t u64Tick[4] = {15625, 1000000, 64000000, 3840000000ULL};
+uint8_t ucTemp[4];
+uint64_t u64Target, u64Count, u64Err, u64BestErr = 0, u64BestCount = 0;
+int i, iMax, iSrc = -1;
+
+  startOp();
+  if (pu64Actual) *pu64Actual = 0;
+  if (u64Us == 0 || !(getCaps() & RTC_CAP_COUNTDOWN)) return RTC_ERROR;
+  if (_iRTCDev >= 0 || (_iRTCType != RTC_RV3032 && _iRTCType != RTC_PCF8563 && _iRTCType != RTC_PCF85063A)) {
+     u64Count = (u64Us + 999999) / 1000000; // whole seconds
+     if (u64Count > 0x7fffffff) u64Count = 0x7fffffff;
+     if (_iRTCDev < 0 && u64Count > 86399) u64Count = 86399; // the alarm matches the time of day
+     setCountdownAlarmInternal((int)u64Count);
+     if (pu64Actual) *pu64Actual = u64Count * 1000000;
+     return _iLastError;
+  }
+  iMax = (_iRTCType == RTC_RV3032) ? 4095 : 255;
+  u64Target = u64Us * 64;
+  for (i=0; i<4; i++) {
+     u64Count = (u64Target + u64Tick[i]/2) / u64Tick[i];
+     if (u64Count < 1) u64Count = 1;
+     if (u64Count > (uint64_t)iMax) u64Count = iMax;
+     u64Err = u64Count * u64Tick[i];
+     u64Err = (u64Err > u64Target) ? u64Err - u64Target : u64Target - u64Err;
+     if (iSrc < 0 || u64Err <= u64BestErr) {
+        iSrc = i;
+        u64BestErr = u64Err;
+        u64BestCount = u64Count;
+     }
+  }
+  if (pu64Actual) *pu64Actual = (u64BestCount * u64Tick[iSrc] + 32) / 64;
+  // stop the timer, load the count, then start it from the new source
+  if (_iRTCType == RTC_RV3032) {
+     writeBits(0x10, 0x0b, (uint8_t)iSrc); // control 1: TE off, TD
+     ucTemp[0] = 0xb; // timer value 0 and 1
+     ucTemp[1] = (uint8_t)u64BestCount;
+     ucTemp[2] = (uint8_t)(u64BestCount >> 8);
+     busWrite(ucTemp, 3);
+     writeBits(_desc.u8StatusReg + _desc.u8Timer[0], _desc.u8Timer[1], 0); // clear TF
+     writeBits(0x11, 0x10, 0x10); // control 2: TIE
+     writeBits(0x10, 0x08, 0x08); // TE
+  } else if (_iRTCType == RTC_PCF85063A) {
+     ucTemp[0] = 0x10; // timer value and mode
+     ucTemp[1] = (uint8_t)u64BestCount;
+     ucTemp[2] = (uint8_t)(iSrc << 3) | 0x03; // TCF, TIE, TI_TP (pulse)
+     busWrite(ucTemp, 3);
+     writeBits(_desc.u8StatusReg + _desc.u8Timer[0], _desc.u8Timer[1], 0); // clear TF
+     ucTemp[0] = 0x11;
+     ucTemp[1] = ucTemp[2] | 0x04; // TE
+     busWrite(ucTemp, 2);
+  } else { // PCF8563
+     ucTemp[0] = 0xe; // timer control and value
+     ucTemp[1] = (uint8_t)iSrc; // TD, TE off
+     ucTemp[2] = (uint8_t)u64BestCount;
+     busWrite(ucTemp, 3);
+     writeBits(0x01, 0x05, 0x01); // control_status_2: clear TF, TIE
+     ucTemp[0] = 0xe;
+     ucTemp[1] = 0x80 | (uint8_t)iSrc; // TE
+     busWrite(ucTemp, 2);
+  }
+  return _iLastError;
+} /* setCountdown() */
+//
+// Convert the raw temperature registers into celcius * 4
+// pRegs points to the MSB (DS3231) or LSB (RV3032) register
+//
+int BBRTC::decodeTemp(const uint8_t *pRegs)
+{
+int iTemp;
+
+  if (_desc.u8TempReg == 0) return 0; // no temperature sensor
+  if (_desc.u8Flags & RTC_DESC_TEMP_LSB) {
+    iTemp = pRegs[0] | (pRegs[1] << 8); // LSB, then MSB
+  } else {
+    iTemp = pRegs[0] << 8; // high byte
+    iTemp |= pRegs[1]; // low byte
+  }
+  iTemp >>= 6; // lower 2 bits are fraction; upper 8 bits = integer part
+  return iTemp;
+} /* decodeTemp() */
 //
 // Read the current internal temperature
 // Value is celcius * 4 (resolution of 0.25C)
@@ -725,169 +2375,568 @@ uint8_t ucTemp[4];
 int BBRTC::getTemp(void)
 {
 unsigned char ucTemp[2];
-int iTemp = 0; // PCF8563/85063A don't have a temperature sensor
-
-  if (_iRTCType == RTC_DS3231) {
-    I2CReadRegister(&_bb, _iRTCAddr, 0x11, ucTemp, 2); // MSB location
-    iTemp = ucTemp[0] << 8; // high byte
-    iTemp |= ucTemp[1]; // low byte
-    iTemp >>= 6; // lower 2 bits are fraction; upper 8 bits = integer part
-  } else if (_iRTCType == RTC_RV3032) {
-    I2CReadRegister(&_bb, _iRTCAddr, 0x0e, ucTemp, 2); // LSB, then MSB
-    iTemp = ucTemp[0] | (ucTemp[1] << 8);
-    iTemp >>= 6; // lower 2 bits are fraction upper 8 are integer
-  }
-  return iTemp; // no temperature sensor
+
+  startOp();
+#ifdef __LINUX__
+  if (_iRTCDev >= 0) return 0; // not available through the kernel driver
+#endif
+
+  if (_desc.u8TempReg == 0) return 0; // PCF8563/85063A don't have a temperature sensor
+  if (busReadReg(_desc.u8TempReg, ucTemp, 2) <= 0) return 0; // see getLastError()
+  return decodeTemp(ucTemp);
 } /* getTemp() */
 //
-// Set the current time/date from a struct tm
+// Encode a struct tm as the block written to the time registers
+// (the register address followed by the 7 BCD fields)
+// All of the supported devices store the 7 fields as BCD in consecutive
+// registers; only the order of the day fields and the century flag differ
+// returns the length of the block or 0 if there's no direct register
+// access (e.g. a kernel driver)
 //
-void BBRTC::setTime(struct tm *pTime)
+int BBRTC::encodeTime(const struct tm *pTime, uint8_t *pBlock)
 {
-unsigned char ucTemp[20];
-uint8_t i;
+uint8_t u8Wday, u8Mday;
 
-   if (_iRTCType == RTC_DS3231) {
-// Values are stored as BCD
-        ucTemp[0] = 0; // start at register 0
-        // seconds
-        ucTemp[1] = ((pTime->tm_sec / 10) << 4);
-        ucTemp[1] |= (pTime->tm_sec % 10);
-        // minutes
-        ucTemp[2] = ((pTime->tm_min / 10) << 4);
-        ucTemp[2] |= (pTime->tm_min % 10);
-        // hours (and set 24-hour format)
-        ucTemp[3] = ((pTime->tm_hour / 10) << 4);
-        ucTemp[3] |= (pTime->tm_hour % 10);
-        // day of the week
-        ucTemp[4] = pTime->tm_wday + 1;
-        // day of the month
-        ucTemp[5] = (pTime->tm_mday / 10) << 4;
-        ucTemp[5] |= (pTime->tm_mday % 10);
-        // month + century
-        i = pTime->tm_mon+1; // 1-12 on the RTC
-        ucTemp[6] = (i / 10) << 4;
-        ucTemp[6] |= (i % 10);
-        if (pTime->tm_year >= 100)
-           ucTemp[6] |= 0x80; // century bit
-        // year
-        ucTemp[7] = (((pTime->tm_year % 100)/10) << 4);
-        ucTemp[7] |= (pTime->tm_year % 10);
-    } else if (_iRTCType == RTC_PCF8563 || _iRTCType == RTC_PCF85063A) {
-        ucTemp[0] = (_iRTCType == RTC_PCF8563) ? 2:4; // start at register 2/4
-        // seconds
-        ucTemp[1] = ((pTime->tm_sec / 10) << 4);
-        ucTemp[1] |= (pTime->tm_sec % 10);
-        // minutes
-        ucTemp[2] = ((pTime->tm_min / 10) << 4);
-        ucTemp[2] |= (pTime->tm_min % 10);
-        // hours (and set 24-hour format)
-        ucTemp[3] = ((pTime->tm_hour / 10) << 4);
-        ucTemp[3] |= (pTime->tm_hour % 10);
-        // day of the week
-        ucTemp[5] = pTime->tm_wday + 1;
-        // day of the month
-        ucTemp[4] = (pTime->tm_mday / 10) << 4;
-        ucTemp[4] |= (pTime->tm_mday % 10);
-        // month + century
-        i = pTime->tm_mon+1; // 1-12 on the RTC
-        ucTemp[6] = (i / 10) << 4;
-        ucTemp[6] |= (i % 10);
-        if (pTime->tm_year >= 100 && _iRTCType == RTC_PCF8563)
-           ucTemp[6] |= 0x80; // century bit
-        // year
-        ucTemp[7] = (((pTime->tm_year % 100)/10) << 4);
-        ucTemp[7] |= (pTime->tm_year % 10);
-    } else if (_iRTCType == RTC_RV3032) {
-// Values are stored as BCD
-        ucTemp[0] = 1; // start at register 1
-        // seconds
-        ucTemp[1] = ((pTime->tm_sec / 10) << 4);
-        ucTemp[1] |= (pTime->tm_sec % 10);
-        // minutes
-        ucTemp[2] = ((pTime->tm_min / 10) << 4);
-        ucTemp[2] |= (pTime->tm_min % 10);
-        // hours
-        ucTemp[3] = ((pTime->tm_hour / 10) << 4);
-        ucTemp[3] |= (pTime->tm_hour % 10);
-        // day of the week
-        ucTemp[4] = pTime->tm_wday;
-        // day of the month
-        ucTemp[5] = (pTime->tm_mday / 10) << 4;
-        ucTemp[5] |= (pTime->tm_mday % 10);
-        // month
-        i = pTime->tm_mon+1; // 1-12 on the RTC
-        ucTemp[6] = (i / 10) << 4;
-        ucTemp[6] |= (i % 10);
-        // year
-        ucTemp[7] = (((pTime->tm_year % 100)/10) << 4);
-        ucTemp[7] |= (pTime->tm_year % 10);
-    }
-    I2CWrite(&_bb, _iRTCAddr, ucTemp, 8);
+#ifdef __LINUX__
+    if (_iRTCDev >= 0) return 0;
+#endif
+    if (_iRTCType <= RTC_UNKNOWN || pTime == NULL || pBlock == NULL) return 0;
+    pBlock[0] = _desc.u8TimeReg;
+    pBlock[1] = BCD(pTime->tm_sec) | _desc.u8SecSet;
+    pBlock[2] = BCD(pTime->tm_min);
+    pBlock[3] = BCD(pTime->tm_hour); // (and set 24-hour format)
+    u8Wday = (uint8_t)(pTime->tm_wday + _desc.u8WdayBase) | _desc.u8WdaySet;
+    u8Mday = BCD(pTime->tm_mday);
+    if (_desc.u8Flags & RTC_DESC_PCF_ORDER) {
+        pBlock[4] = u8Mday;
+        pBlock[5] = u8Wday;
+    } else {
+        pBlock[4] = u8Wday;
+        pBlock[5] = u8Mday;
+    }
+    pBlock[6] = BCD(pTime->tm_mon+1); // 1-12 on the RTC
+    if (pTime->tm_year >= 100 && (_desc.u8Flags & RTC_DESC_CENTURY))
+        pBlock[6] |= 0x80; // century bit
+    pBlock[7] = BCD(pTime->tm_year % 100);
+    return RTC_TIME_BLOCK;
+} /* encodeTime() */
+
+//
+// Write a block prepared by encodeTime()
+// Split from the encoding so the write can be timed precisely
+// returns RTC_SUCCESS or RTC_xxx
+//
+int BBRTC::writeTime(uint8_t *pBlock, int iLen)
+{
+    startOp();
+    if (_iRTCType <= RTC_UNKNOWN || iLen != RTC_TIME_BLOCK) return RTC_ERROR;
+    return (busWrite(pBlock, iLen) > 0) ? RTC_SUCCESS : _iLastError;
+} /* writeTime() */
+
+//
+// Set the current time/date from a struct tm
+// returns RTC_SUCCESS or RTC_xxx
+//
+int BBRTC::setTime(struct tm *pTime)
+{
+    startOp();
+    return setTimeInternal(pTime);
 } /* setTime() */
 
+int BBRTC::setTimeInternal(struct tm *pTime)
+{
+uint8_t ucTemp[RTC_TIME_BLOCK];
+int iLen;
+
+#ifdef __LINUX__
+   if (_iRTCDev >= 0) {
+       _iLastError = rtcDevSetTime(pTime);
+       return _iLastError;
+   }
+#endif
+    iLen = encodeTime(pTime, ucTemp);
+    if (iLen == 0) return RTC_ERROR;
+    return (busWrite(ucTemp, iLen) > 0) ? RTC_SUCCESS : _iLastError;
+} /* setTimeInternal() */
+
+//
+// Convert the 7 BCD time/date registers into a struct tm
+// pRegs points to the seconds register of the device
+//
+void BBRTC::decodeTime(const uint8_t *pRegs, struct tm *pTime)
+{
+uint8_t u8Wday, u8Mday;
+
+    memset(pTime, 0, sizeof(struct tm));
+    if (_iRTCType <= RTC_UNKNOWN) return;
+    // convert numbers from BCD (the upper bits of some are flags)
+    pTime->tm_sec = UNBCD(pRegs[0] & 0x7f);
+    pTime->tm_min = UNBCD(pRegs[1] & 0x7f);
+    // hours are stored in 24-hour format in the tm struct (12 AM = 0, 12 PM = 12)
+    pTime->tm_hour = rtcUnbcdHour(pRegs[2], (_desc.u8Flags & RTC_DESC_12H) != 0);
+    if (_desc.u8Flags & RTC_DESC_PCF_ORDER) {
+        u8Mday = pRegs[3];
+        u8Wday = pRegs[4];
+    } else {
+        u8Wday = pRegs[3];
+        u8Mday = pRegs[4];
+    }
+    pTime->tm_wday = (u8Wday & 7) - _desc.u8WdayBase; // day of the week (0-6)
+    pTime->tm_mday = UNBCD(u8Mday & 0x3f); // day of the month
+    pTime->tm_mon = UNBCD(pRegs[5] & 0x1f) - 1; // 0-11
+    if (_desc.u8Flags & RTC_DESC_CENTURY) {
+        pTime->tm_year = (pRegs[5] >> 7) * 100; // century
+    } else { // assume 20th century
+        pTime->tm_year = 100;
+    }
+    pTime->tm_year += UNBCD(pRegs[6]);
+} /* decodeTime() */
+//
+// Return the address of the seconds register (-1 if unknown)
+//
+int BBRTC::timeReg(void)
+{
+    return (_iRTCType > RTC_UNKNOWN) ? _desc.u8TimeReg : -1;
+} /* timeReg() */
 //
 // Read the current time/date into a struct tm
+// If the read fails, the struct is zeroed instead of being filled with
+// whatever was on the bus
+// returns RTC_SUCCESS or RTC_xxx
 //
-void BBRTC::getTime(struct tm *pTime)
+int BBRTC::getTime(struct tm *pTime)
+{
+    startOp();
+    return getTimeInternal(pTime);
+} /* getTime() */
+
+int BBRTC::getTimeInternal(struct tm *pTime)
 {
 unsigned char ucTemp[20];
+int iReg;
 
-    if (_iRTCType == RTC_DS3231) {
-        I2CReadRegister(&_bb, _iRTCAddr, 0, ucTemp, 7); // start of data registers
-        memset(pTime, 0, sizeof(struct tm));
-        // convert numbers from BCD
-        pTime->tm_sec = ((ucTemp[0] >> 4) * 10) + (ucTemp[0] & 0xf);
-        pTime->tm_min = ((ucTemp[1] >> 4) * 10) + (ucTemp[1] & 0xf);
-        // hours are stored in 24-hour format in the tm struct
-        if (ucTemp[2] & 64) { // 12 hour format
-            pTime->tm_hour = ucTemp[2] & 0xf;
-            pTime->tm_hour += ((ucTemp[2] >> 4) & 1) * 10;
-            pTime->tm_hour += ((ucTemp[2] >> 5) & 1) * 12; // AM/PM
-        } else { // 24 hour format
-            pTime->tm_hour = ((ucTemp[2] >> 4) * 10) + (ucTemp[2] & 0xf);
-        }
-        pTime->tm_wday = ucTemp[3] - 1; // day of the week (0-6)
-        // day of the month
-        pTime->tm_mday = ((ucTemp[4] >> 4) * 10) + (ucTemp[4] & 0xf);
-        // month
-        pTime->tm_mon = (((ucTemp[5] >> 4) & 1) * 10 + (ucTemp[5] & 0xf)) -1; // 0-11
-        pTime->tm_year = (ucTemp[5] >> 7) * 100; // century
-        pTime->tm_year += ((ucTemp[6] >> 4) * 10) + (ucTemp[6] & 0xf);
-    } else if (_iRTCType == RTC_PCF8563 || _iRTCType == RTC_PCF85063A) {
-        I2CReadRegister(&_bb, _iRTCAddr, (_iRTCType == RTC_PCF8563) ? 2 : 4, ucTemp, 7); // start of data registers
-        memset(pTime, 0, sizeof(struct tm));
-        // convert numbers from BCD
-        pTime->tm_sec = (((ucTemp[0] >> 4) & 7) * 10) + (ucTemp[0] & 0xf);
-        pTime->tm_min = ((ucTemp[1] >> 4) * 10) + (ucTemp[1] & 0xf);
-        // hours are stored in 24-hour format in the tm struct
-        pTime->tm_hour = ((ucTemp[2] >> 4) * 10) + (ucTemp[2] & 0xf);
-        pTime->tm_wday = ucTemp[4] - 1; // day of the week (0-6)
-        // day of the month
-        pTime->tm_mday = ((ucTemp[3] >> 4) * 10) + (ucTemp[3] & 0xf);
-        // month
-        pTime->tm_mon = (((ucTemp[5] >> 4) & 1) * 10 + (ucTemp[5] & 0xf)) -1; // 0-11
-        if (_iRTCType == RTC_PCF8563) {
-            pTime->tm_year = (ucTemp[5] >> 7) * 100; // century
-        } else { // assume 20th century
-            pTime->tm_year = 100;
-        }
-        pTime->tm_year += ((ucTemp[6] >> 4) * 10) + (ucTemp[6] & 0xf);
-    } else if (_iRTCType == RTC_RV3032) {
-        I2CReadRegister(&_bb, _iRTCAddr, 0x01, ucTemp, 7); // start of data registers
+#ifdef __LINUX__
+    if (_iRTCDev >= 0) {
+        _iLastError = rtcDevGetTime(pTime);
+        return _iLastError;
+    }
+#endif
+
+    iReg = timeReg();
+    if (iReg < 0) return RTC_ERROR;
+    if (busReadReg((uint8_t)iReg, ucTemp, 7) <= 0) { // start of data registers
         memset(pTime, 0, sizeof(struct tm));
-        // convert numbers from BCD
-        pTime->tm_sec = ((ucTemp[0] >> 4) * 10) + (ucTemp[0] & 0xf);
-        pTime->tm_min = ((ucTemp[1] >> 4) * 10) + (ucTemp[1] & 0xf);
-        pTime->tm_hour = ((ucTemp[2] >> 4) * 10) + (ucTemp[2] & 0xf);
-        pTime->tm_wday = (ucTemp[3] & 7); // day of the week (0-6)
-        // day of the month
-        pTime->tm_mday = ((ucTemp[4] >> 4) * 10) + (ucTemp[4] & 0xf);
-        // month
-        pTime->tm_mon = (((ucTemp[5] >> 4) & 1) * 10 + (ucTemp[5] & 0xf)) -1; // 0-11     
-        pTime->tm_year = 100 + ((ucTemp[6] >> 4) * 10) + (ucTemp[6] & 0xf);
+        return _iLastError;
     }
-} /* getTime() */
+    decodeTime(ucTemp, pTime);
+    return RTC_SUCCESS;
+} /* getTimeInternal() */
+//
+// Read the 7 time registers as they are (seconds first) for formatTime()
+// or to store in a log; getType() tells how to interpret them
+// returns RTC_SUCCESS or RTC_xxx
+//
+int BBRTC::getRawTime(uint8_t *pRegs)
+{
+    startOp();
+#ifdef __LINUX__
+    if (_iRTCDev >= 0) return RTC_ERROR; // the kernel only gives us the decoded time
+#endif
+    if (pRegs == NULL || _iRTCType <= RTC_UNKNOWN) return RTC_ERROR;
+    return (busReadReg(_desc.u8TimeReg, pRegs, 7) > 0) ? RTC_SUCCESS : _iLastError;
+} /* getRawTime() */
+//
+// Read the time, status, temperature and alarm flags in a single burst
+// The smallest register range which covers all of the fields is read
+// at once, so the values are coherent and cost only 1 bus transaction
+// returns RTC_SUCCESS or RTC_xxx
+//
+int BBRTC::getSnapshot(RTC_SNAPSHOT *pSnap)
+{
+uint8_t ucTemp[32];
+int iLen;
+
+    startOp();
+#ifdef __LINUX__
+    if (_iRTCDev >= 0 && pSnap) { // time and status are all we can get
+        memset(pSnap, 0, sizeof(RTC_SNAPSHOT));
+        pSnap->iStatus = rtcDevGetStatus();
+        return rtcDevGetTime(&pSnap->tmTime);
+    }
+#endif
+
+    if (pSnap == NULL) return RTC_ERROR;
+    memset(pSnap, 0, sizeof(RTC_SNAPSHOT));
+    if (_iRTCType <= RTC_UNKNOWN) return RTC_ERROR;
+    // e.g. DS3231 = time (0-6), alarms, control/status (E-F), aging, temp (11-12)
+    iLen = _desc.u8TimeReg + 7;
+    if (_desc.u8StatusReg + _desc.u8StatusLen > iLen) iLen = _desc.u8StatusReg + _desc.u8StatusLen;
+    if (_desc.u8TempReg && _desc.u8TempReg + 2 > iLen) iLen = _desc.u8TempReg + 2;
+    if (busReadReg(0, ucTemp, iLen) <= 0) return _iLastError;
+    decodeTime(&ucTemp[_desc.u8TimeReg], &pSnap->tmTime);
+    pSnap->iStatus = decodeStatus(&ucTemp[_desc.u8StatusReg], &pSnap->u8Fired);
+    pSnap->iTemp = decodeTemp(&ucTemp[_desc.u8TempReg]);
+    return RTC_SUCCESS;
+} /* getSnapshot() */
+//
+// Read from the battery backed user RAM of the device
+// iOffset is relative to the start of the RAM
+// returns RTC_SUCCESS or RTC_xxx
+//
+int BBRTC::readRAM(int iOffset, uint8_t *pData, int iLen)
+{
+int i;
+
+    startOp();
+#ifdef __LINUX__
+    if (_iRTCDev >= 0) return RTC_ERROR; // not available through the kernel driver
+#endif
+    if (pData == NULL || iOffset < 0 || iLen < 0 || iOffset + iLen > _desc.u8RamLen)
+        return RTC_ERROR;
+    while (iLen > 0) { // keep each transfer within the smallest I2C buffers
+        i = (iLen > 16) ? 16 : iLen;
+        if (busReadReg((uint8_t)(_desc.u8RamReg + iOffset), pData, i) <= 0)
+            return _iLastError;
+        pData += i; iOffset += i; iLen -= i;
+    }
+    return RTC_SUCCESS;
+} /* readRAM() */
+//
+// Write to the battery backed user RAM of the device
+// returns RTC_SUCCESS or RTC_xxx
+//
+int BBRTC::writeRAM(int iOffset, const uint8_t *pData, int iLen)
+{
+uint8_t ucTemp[17];
+int i;
+
+    startOp();
+#ifdef __LINUX__
+    if (_iRTCDev >= 0) return RTC_ERROR; // not available through the kernel driver
+#endif
+    if (pData == NULL || iOffset < 0 || iLen < 0 || iOffset + iLen > _desc.u8RamLen)
+        return RTC_ERROR;
+    while (iLen > 0) {
+        i = (iLen > 16) ? 16 : iLen;
+        ucTemp[0] = (uint8_t)(_desc.u8RamReg + iOffset);
+        memcpy(&ucTemp[1], pData, i);
+        if (busWrite(ucTemp, i+1) <= 0)
+            return _iLastError;
+        pData += i; iOffset += i; iLen -= i;
+    }
+    return RTC_SUCCESS;
+} /* writeRAM() */
+//
+// Status flags which share a configuration register with control bits and
+// aren't in the descriptor (PCF2129 timestamp, watchdog and battery flags)
+//
+static const uint8_t u8CfgFlags[][3] = {
+    {RTC_PCF2129, 0x00, 0x10}, // TSF1
+    {RTC_PCF2129, 0x01, 0x60}, // WDTF, TSF2
+    {RTC_PCF2129, 0x02, 0x0c} // BF, BLF
+};
+
+//
+// Status flag bits of a configuration register (e.g. AF and TF in control 2
+// of the PCF8563); they aren't part of the image and setConfig() writes them
+// back as they are so it neither restores stale flags nor clears new ones
+//
+static uint8_t rtcConfigFlags(const RTC_CHIP_DESC *pDesc, int iReg)
+{
+const uint8_t *pFlags[7] = {pDesc->u8Halt, pDesc->u8Alarm1, pDesc->u8Alarm2, pDesc->u8Timer, pDesc->u8Update, pDesc->u8TempHigh, pDesc->u8TempLow};
+uint8_t u8Mask = 0;
+int i;
+
+    for (i=0; i<7; i++) {
+        if (pFlags[i][1] && pDesc->u8StatusReg + pFlags[i][0] == iReg) u8Mask |= pFlags[i][1];
+    }
+    for (i=0; i<(int)(sizeof(u8CfgFlags) / sizeof(u8CfgFlags[0])); i++) {
+        if (u8CfgFlags[i][0] == pDesc->u8Type && u8CfgFlags[i][1] == iReg) u8Mask |= u8CfgFlags[i][2];
+    }
+    return u8Mask;
+} /* rtcConfigFlags() */
+
+//
+// Sum of the bytes of a configuration image (without the check byte)
+//
+static uint8_t rtcConfigSum(const RTC_CONFIG *pConfig)
+{
+uint8_t u8Sum;
+int i;
+
+    u8Sum = pConfig->u8Version + pConfig->u8Type + pConfig->u8Len;
+    for (i=0; i<pConfig->u8Len && i<RTC_CONFIG_MAX; i++) {
+        u8Sum += pConfig->u8Regs[i];
+    }
+    return u8Sum;
+} /* rtcConfigSum() */
+
+//
+// Read the configuration registers (alarms, timers, control, CLKOUT,
+// frequency trim and the EEPROM backed registers of the RV3032) in one
+// batch. The image can be stored and written to this or any other device
+// of the same type with setConfig(). The time, status flags and user RAM
+// aren't included; flags which share a register with configuration bits
+// read as 0 in the image.
+// returns RTC_SUCCESS or RTC_ERROR
+//
+int BBRTC::getConfig(RTC_CONFIG *pConfig)
+{
+int i, j, iLen = 0;
+
+    startOp();
+    if (getConfigInternal(pConfig) != RTC_SUCCESS) return RTC_ERROR;
+    for (i=0; i<3 && _desc.u8CfgLen[i]; i++) {
+        for (j=0; j<_desc.u8CfgLen[i]; j++) {
+            pConfig->u8Regs[iLen++] &= ~rtcConfigFlags(&_desc, _desc.u8CfgReg[i] + j);
+        }
+    }
+    pConfig->u8Check = 0xff - rtcConfigSum(pConfig);
+    return RTC_SUCCESS;
+} /* getConfig() */
+//
+// Read the configuration registers as they are (status flags included)
+//
+int BBRTC::getConfigInternal(RTC_CONFIG *pConfig)
+{
+RTC_XFER xfer[3];
+int i, iLen = 0;
+
+#ifdef __LINUX__
+    if (_iRTCDev >= 0) return RTC_ERROR; // not available through the kernel driver
+#endif
+    if (pConfig == NULL || _iRTCType <= RTC_UNKNOWN) return RTC_ERROR;
+    memset(pConfig, 0, sizeof(RTC_CONFIG));
+    for (i=0; i<3 && _desc.u8CfgLen[i]; i++) {
+        xfer[i].u8Type = RTC_XFER_READREG;
+        xfer[i].u8Addr = (uint8_t)_iRTCAddr;
+        xfer[i].u8Reg = _desc.u8CfgReg[i];
+        xfer[i].pData = &pConfig->u8Regs[iLen];
+        xfer[i].iLen = _desc.u8CfgLen[i];
+        iLen += _desc.u8CfgLen[i];
+    }
+    if (_pTransport->transfer(xfer, i) != i) return RTC_ERROR;
+    pConfig->u8Version = RTC_CONFIG_VERSION;
+    pConfig->u8Type = (uint8_t)_iRTCType;
+    pConfig->u8Len = (uint8_t)iLen;
+    pConfig->u8Check = 0xff - rtcConfigSum(pConfig);
+    return RTC_SUCCESS;
+} /* getConfigInternal() */
+
+//
+// Write a configuration image from getConfig()
+// Only the registers which differ are written, as a single batch of
+// bursts. Runs of changed registers separated by one or two unchanged
+// ones are joined since the extra bytes cost less than another
+// transaction. On the RV3032, changes to the EEPROM backed registers are
+// stored with a single EEPROM update. bKeepTrim leaves the frequency
+// trim of this device alone (it's usually calibrated for each unit).
+// Status flags in the configuration registers keep their current value.
+// returns RTC_SUCCESS or RTC_xxx
+//
+int BBRTC::setConfig(const RTC_CONFIG *pConfig, bool bKeepTrim)
+{
+RTC_CONFIG cur;
+RTC_XFER xfer[RTC_CONFIG_MAX];
+uint8_t u8Buf[RTC_CONFIG_MAX * 2];
+uint8_t u8Want[RTC_CONFIG_MAX], u8Ctrl = 0, u8Flags;
+int i, j, k, iReg, iLast, iBase, iCount, iUsed, iTrim = -1;
+bool bEEPROM;
+
+    startOp();
+    if (pConfig == NULL || pConfig->u8Version != RTC_CONFIG_VERSION || (uint8_t)(rtcConfigSum(pConfig) + pConfig->u8Check) != 0xff)
+        return RTC_ERROR;
+    if (getConfigInternal(&cur) != RTC_SUCCESS) return RTC_ERROR;
+    if (pConfig->u8Type != cur.u8Type || pConfig->u8Len != cur.u8Len) return RTC_ERROR;
+    if (bKeepTrim) {
+        if (_desc.u8TrimType != RTC_TRIM_NONE) iTrim = _desc.u8TrimReg;
+        else if (_desc.u8Family == RTC_RV3032) iTrim = 0xc1; // EEPROM offset
+        else if (_desc.u8Family == RTC_PCF2129) iTrim = 0x19; // aging offset
+    }
+    memcpy(u8Want, pConfig->u8Regs, pConfig->u8Len);
+    for (i=0; i<2; i++) { // registers, then the RV3032 EEPROM registers
+        iCount = iUsed = 0;
+        for (j=0, iBase=0; j<3 && _desc.u8CfgLen[j]; iBase += _desc.u8CfgLen[j++]) {
+            bEEPROM = (_desc.u8Family == RTC_RV3032 && _desc.u8CfgReg[j] >= 0xc0);
+            if (bEEPROM != (i == 1)) continue;
+            iLast = -1;
+            for (k=0; k<_desc.u8CfgLen[j]; k++) {
+                iReg = _desc.u8CfgReg[j] + k;
+                if (iReg == iTrim) u8Want[iBase+k] = cur.u8Regs[iBase+k];
+                u8Flags = rtcConfigFlags(&_desc, iReg);
+                u8Want[iBase+k] = (u8Want[iBase+k] & ~u8Flags) | (cur.u8Regs[iBase+k] & u8Flags);
+                if (iReg == 0x10 && _desc.u8Family == RTC_RV3032) u8Ctrl = u8Want[iBase+k];
+                if (u8Want[iBase+k] == cur.u8Regs[iBase+k]) continue;
+                if (iLast >= 0 && k - iLast <= 3) { // rewrite a gap of up to 2 registers
+                    while (++iLast < k) {
+                        u8Buf[iUsed++] = u8Want[iBase+iLast];
+                        xfer[iCount-1].iLen++;
+                    }
+                } else { // start a burst
+                    xfer[iCount].u8Type = RTC_XFER_WRITE;
+                    xfer[iCount].u8Addr = (uint8_t)_iRTCAddr;
+                    xfer[iCount].u8Reg = 0;
+                    xfer[iCount].pData = &u8Buf[iUsed];
+                    xfer[iCount].iLen = 1;
+                    u8Buf[iUsed++] = (uint8_t)iReg;
+                    iCount++;
+                }
+                u8Buf[iUsed++] = u8Want[iBase+k];
+                xfer[iCount-1].iLen++;
+                iLast = k;
+            }
+        }
+        if (iCount == 0) continue;
+        if (i == 1) { // keep the EEPROM from refreshing the registers while they're written
+            u8Buf[iUsed] = 0x10; // control 1
+            u8Buf[iUsed+1] = u8Ctrl | 0x04; // EERD
+            if (busWrite(&u8Buf[iUsed], 2) <= 0) return _iLastError;
+        }
+        if (_pTransport->transfer(xfer, iCount) != iCount) return RTC_ERROR;
+        if (i == 1) { // copy all of the configuration RAM to the EEPROM
+            u8Buf[0] = 0x3f; // EE command
+            u8Buf[1] = 0x11; // update all
+            if (busWrite(u8Buf, 2) <= 0) return _iLastError;
+            for (k=0; k<20; k++) { // takes up to ~46ms
+                delay(5);
+                if (busReadReg(0x0e, u8Buf, 1) > 0 && !(u8Buf[0] & 0x04)) // EEbusy
+                    break;
+            }
+            u8Buf[0] = 0x10;
+            u8Buf[1] = u8Ctrl;
+            if (busWrite(u8Buf, 2) <= 0) return _iLastError;
+            if (k == 20) return RTC_TIMEOUT; // the EEPROM never finished
+        }
+    }
+    return RTC_SUCCESS;
+} /* setConfig() */
+//
+// Speed the clock up (+) or slow it down (-) by i32PPB parts per billion
+// using the digital offset register. The value is rounded to the nearest
+// step the device supports and that is returned in pi32Applied.
+// returns RTC_SUCCESS or RTC_xxx
+//
+int BBRTC::setTrim(int32_t i32PPB, int32_t *pi32Applied)
+{
+int32_t i32Code, i32Max, i32Min;
+uint8_t ucTemp[2];
+
+    startOp();
+    if (_iRTCType <= RTC_UNKNOWN || _desc.u8TrimType == RTC_TRIM_NONE) return RTC_ERROR;
+#ifdef __LINUX__
+    if (_iRTCDev >= 0) return RTC_ERROR;
+#endif
+    // round to the nearest step
+    if ((i32PPB >= 0) == (_desc.i16TrimStep >= 0))
+        i32Code = (i32PPB + _desc.i16TrimStep / 2) / _desc.i16TrimStep;
+    else
+        i32Code = (i32PPB - _desc.i16TrimStep / 2) / _desc.i16TrimStep;
+    switch (_desc.u8TrimType) {
+        case RTC_TRIM_TWOS7:
+            i32Min = -64; i32Max = 63;
+            break;
+        case RTC_TRIM_TWOS8:
+            i32Min = -128; i32Max = 127;
+            break;
+        default: // RTC_TRIM_SIGNMAG
+            i32Min = -127; i32Max = 127;
+            break;
+    }
+    if (i32Code < i32Min) i32Code = i32Min;
+    else if (i32Code > i32Max) i32Code = i32Max;
+    ucTemp[0] = _desc.u8TrimReg;
+    switch (_desc.u8TrimType) {
+        case RTC_TRIM_TWOS7: // bit 7 = 0 selects the low power (2 hour) mode
+            ucTemp[1] = (uint8_t)(i32Code & 0x7f);
+            break;
+        case RTC_TRIM_TWOS8:
+            ucTemp[1] = (uint8_t)i32Code;
+            break;
+        default: // bit 7 set = add clocks (speed up)
+            ucTemp[1] = (uint8_t)((i32Code < 0) ? -i32Code : (i32Code | 0x80));
+            if (i32Code == 0) ucTemp[1] = 0;
+            break;
+    }
+    if (busWrite(ucTemp, 2) <= 0) return _iLastError;
+    if (pi32Applied) *pi32Applied = i32Code * _desc.i16TrimStep;
+    return RTC_SUCCESS;
+} /* setTrim() */
+//
+// Program the low and high temperature thresholds (whole degrees C) and
+// enable the events selected by u8Enable (RTC_FIRED_TEMP_xxx, 0 = off).
+// Each crossing sets a status flag, pulls the interrupt pin low and
+// latches the time; getStatus() reports STATUS_TEMP_TRIGGERED and
+// getTempEvent() returns the details. Only the RV3032 has this feature.
+// returns RTC_SUCCESS or RTC_xxx
+//
+int BBRTC::setTempThresholds(int iLow, int iHigh, uint8_t u8Enable)
+{
+uint8_t ucTemp[4], u8Ctrl = 0;
+
+    startOp();
+    if (_iRTCType <= RTC_UNKNOWN || !(_desc.u16Caps & RTC_CAP_TEMP_EVENT)) return RTC_ERROR;
+#ifdef __LINUX__
+    if (_iRTCDev >= 0) return RTC_ERROR;
+#endif
+    if (iLow < -128) iLow = -128;
+    if (iHigh > 127) iHigh = 127;
+    if (iLow > iHigh) return RTC_ERROR;
+    writeBits(0x12, 0x0f, 0); // disable while changing the thresholds
+    ucTemp[0] = 0x16; // TLow, THigh (two's complement)
+    ucTemp[1] = (uint8_t)(int8_t)iLow;
+    ucTemp[2] = (uint8_t)(int8_t)iHigh;
+    if (busWrite(ucTemp, 3) <= 0) return _iLastError;
+    // reset both time stamps and keep the most recent crossing
+    writeBits(0x13, 0x1b, 0x1b); // THR, TLR, THOW, TLOW
+    writeBits(_desc.u8StatusReg, 0xc0, 0); // clear THF, TLF
+    if (u8Enable & RTC_FIRED_TEMP_HIGH) u8Ctrl |= 0x0a; // THE, THIE
+    if (u8Enable & RTC_FIRED_TEMP_LOW) u8Ctrl |= 0x05; // TLE, TLIE
+    writeBits(0x12, 0x0f, u8Ctrl); // control 3
+    return RTC_SUCCESS;
+} /* setTempThresholds() */
+//
+// Read which thresholds were crossed, how often and when
+// bClear clears the flags and time stamps so that new events can be seen
+// returns RTC_SUCCESS or RTC_xxx
+//
+int BBRTC::getTempEvent(RTC_TEMP_EVENT *pEvent, bool bClear)
+{
+uint8_t ucTemp[16], u8Status;
+struct tm *pTime;
+int i;
+
+    startOp();
+    if (pEvent == NULL) return RTC_ERROR;
+    memset(pEvent, 0, sizeof(RTC_TEMP_EVENT));
+    if (_iRTCType <= RTC_UNKNOWN || !(_desc.u16Caps & RTC_CAP_TEMP_EVENT)) return RTC_ERROR;
+#ifdef __LINUX__
+    if (_iRTCDev >= 0) return RTC_ERROR;
+#endif
+    if (busReadReg(_desc.u8StatusReg, &u8Status, 1) <= 0) return _iLastError;
+    decodeStatus(&u8Status, &pEvent->u8Fired);
+    pEvent->u8Fired &= (RTC_FIRED_TEMP_HIGH | RTC_FIRED_TEMP_LOW);
+    // TLow count + sec/min/hour/date/month/year, then the same for THigh
+    if (busReadReg(0x18, ucTemp, 14) <= 0) return _iLastError;
+    pEvent->u8LowCount = ucTemp[0];
+    pEvent->u8HighCount = ucTemp[7];
+    for (i=0; i<2; i++) {
+        const uint8_t *p = &ucTemp[i*7 + 1];
+        pTime = (i == 0) ? &pEvent->tmLow : &pEvent->tmHigh;
+        if (ucTemp[i*7] == 0) continue; // no time stamp
+        pTime->tm_sec = UNBCD(p[0] & 0x7f);
+        pTime->tm_min = UNBCD(p[1] & 0x7f);
+        pTime->tm_hour = UNBCD(p[2] & 0x3f);
+        pTime->tm_mday = UNBCD(p[3] & 0x3f);
+        pTime->tm_mon = UNBCD(p[4] & 0x1f) - 1;
+        pTime->tm_year = 100 + UNBCD(p[5]);
+        epochToTime(timeToEpoch(pTime), pTime); // fill in the day of the week
+    }
+    if (bClear) {
+        writeBits(_desc.u8StatusReg, 0xc0, 0); // THF, TLF
+        writeBits(0x13, 0x18, 0x18); // THR, TLR
+    }
+    return RTC_SUCCESS;
+} /* getTempEvent() */
 //
 // Reset the "fired" bits for Alarm 1 and 2
 // Interrupts will not occur until these bits are cleared
@@ -896,37 +2945,215 @@ void BBRTC::clearAlarms(bool bDisable)
 {
 uint8_t ucTemp[4];
 
-  if (_iRTCType == RTC_DS3231)
+  startOp();
+#ifdef __LINUX__
+  if (_iRTCDev >= 0) {
+      rtcDevClear();
+      return;
+  }
+#endif
+
+  if (_desc.u8AlarmLayout > RTC_ALM_CHIP)
+  {
+    if (bDisable) {
+       writeBits(_desc.u8AlarmEnReg, _desc.u8AlarmEn[0] | _desc.u8AlarmEn[1], 0);
+       if (_desc.u8TickSec | _desc.u8TickMin)
+          writeBits(_desc.u8TickReg, _desc.u8TickSec | _desc.u8TickMin, 0);
+    }
+    // clear the fired flags
+    if (_desc.u8Alarm1[1])
+       writeBits(_desc.u8StatusReg + _desc.u8Alarm1[0], _desc.u8Alarm1[1], 0);
+    if (_desc.u8Alarm2[1])
+       writeBits(_desc.u8StatusReg + _desc.u8Alarm2[0], _desc.u8Alarm2[1], 0);
+    if (_desc.u8Timer[1])
+       writeBits(_desc.u8StatusReg + _desc.u8Timer[0], _desc.u8Timer[1], 0);
+    if (_desc.u8TempHigh[1] | _desc.u8TempLow[1]) // temperature events stay enabled
+       writeBits(_desc.u8StatusReg, _desc.u8TempHigh[1] | _desc.u8TempLow[1], 0);
+  }
+  else if (_desc.u8Family == RTC_DS3231)
   {
     ucTemp[0] = 0xe; // control register
     ucTemp[1] = 0x4; // disable alarm interrupt bits
     ucTemp[2] = 0x0; // clear A1F & A2F (alarm 1 or 2 fired) bit to allow it to fire again
-    I2CWrite(&_bb, _iRTCAddr, ucTemp, 3);
+    busWrite(ucTemp, 3);
   }
   else if (_iRTCType == RTC_PCF8563)
   {
     ucTemp[0] = 1; // control_status_2
     ucTemp[1] = 0; // disable all alarms
-    I2CWrite(&_bb, _iRTCAddr, ucTemp, 2);
+    busWrite(ucTemp, 2);
   }
   else if (_iRTCType == RTC_PCF85063A)
   {
-      I2CReadRegister(&_bb, _iRTCAddr, 1, &ucTemp[1], 1); // read reg value first
+      busReadReg(1, &ucTemp[1], 1); // read reg value first
       ucTemp[1] &= 7; // disable all alarm flags while leaving clockout bits
       ucTemp[0] = 1; // control_status_2
-      I2CWrite(&_bb, _iRTCAddr, ucTemp, 2);
+      busWrite(ucTemp, 2);
   }
   else if (_iRTCType == RTC_RV3032)
   {
     if (bDisable) {
-       I2CReadRegister(&_bb, _iRTCAddr, 0x11, &ucTemp[1], 1);
+       busReadReg(0x11, &ucTemp[1], 1);
        ucTemp[0] = 0x11; // control 2
        ucTemp[1] &= 0x81; // disable all alarms
-       I2CWrite(&_bb, _iRTCAddr, ucTemp, 2);
+       busWrite(ucTemp, 2);
     }
     ucTemp[0] = 0x0d; // status register
     ucTemp[1] = 0x00; // clear all flags
-    I2CWrite(&_bb, _iRTCAddr, ucTemp, 2);
+    busWrite(ucTemp, 2);
   }
 } /* clearAlarms() */
+//
+// Wait for an alarm, countdown timer or temperature event to fire
+// (-1 = wait forever)
+// The kernel driver backend blocks on the RTC interrupt; direct register
+// access polls the status register
+// returns RTC_SUCCESS, RTC_TIMEOUT or another RTC_xxx
+//
+int BBRTC::waitForAlarm(int iTimeoutMs)
+{
+int iElapsed = 0;
+
+#ifdef __LINUX__
+    if (_iRTCDev >= 0) return rtcDevWait(iTimeoutMs);
+#endif
+    if (_iRTCType <= RTC_UNKNOWN) return RTC_ERROR;
+    while (iTimeoutMs < 0 || iElapsed < iTimeoutMs) {
+        if (getStatus() & (STATUS_IRQ1_TRIGGERED | STATUS_IRQ2_TRIGGERED | STATUS_TEMP_TRIGGERED))
+            return RTC_SUCCESS;
+        if (_iLastError != RTC_SUCCESS) return _iLastError; // the bus is gone
+        delay(10);
+        iElapsed += 10;
+    }
+    return RTC_TIMEOUT;
+} /* waitForAlarm() */
+#ifdef __LINUX__
+//
+// Wait for the start of the next RTC second and timestamp it with the
+// host clocks. The kernel backend uses the update interrupt. With direct
+// register access, the seconds register is polled coarsely until the
+// phase of the RTC is known, then the library sleeps until just before
+// each predicted edge and polls it tightly. The edge lies between the
+// last read of the old second and the first read of the new one.
+// returns RTC_SUCCESS, RTC_TIMEOUT or another RTC_xxx
+//
+int BBRTC::waitForSecond(RTC_EDGE *pEdge, int iTimeoutMs)
+{
+uint8_t u8Sec, u8Prev;
+int64_t i64Start, i64A, i64B, i64PrevA, i64Phase, i64Edge = 0, i64Err = 0;
+int iReg;
+bool bTight = false;
+struct tm tmNow;
+int rc;
+
+    startOp();
+    if (pEdge == NULL) return RTC_ERROR;
+    if (_iRTCDev >= 0) return rtcDevWaitSecond(pEdge, iTimeoutMs);
+    iReg = timeReg();
+    if (iReg < 0) return RTC_ERROR;
+    i64Start = i64PrevA = rtcClockNs(CLOCK_MONOTONIC);
+    if (busReadReg((uint8_t)iReg, &u8Prev, 1) <= 0) return _iLastError;
+    i64B = rtcClockNs(CLOCK_MONOTONIC);
+    while (1) {
+        if (iTimeoutMs >= 0 && i64B - i64Start > (int64_t)iTimeoutMs * 1000000LL)
+            return RTC_TIMEOUT;
+        if (_i64EdgeNs) { // the phase is known; sleep until just before the edge
+            i64Phase = (i64B - _i64EdgeNs) % 1000000000LL;
+            if (i64Phase >= 1000000000LL - RTC_EDGE_GUARD_NS) {
+                bTight = true; // inside the window; poll without sleeping
+            } else if (bTight && i64Phase < RTC_EDGE_GUARD_NS + RTC_EDGE_COARSE_US * 1000LL) {
+                // the edge is late (by up to one coarse poll); keep polling
+            } else if (bTight) { // the edge didn't show up where expected
+                _i64EdgeNs = 0;
+                bTight = false;
+            } else {
+                usleep((useconds_t)((1000000000LL - RTC_EDGE_GUARD_NS - i64Phase) / 1000));
+            }
+        } else {
+            usleep(RTC_EDGE_COARSE_US);
+        }
+        i64A = rtcClockNs(CLOCK_MONOTONIC);
+        if (busReadReg((uint8_t)iReg, &u8Sec, 1) <= 0) return _iLastError;
+        i64B = rtcClockNs(CLOCK_MONOTONIC);
+        if (u8Sec != u8Prev) { // the second changed between the two reads
+            i64Edge = (i64PrevA + i64B) / 2;
+            i64Err = (i64B - i64PrevA) / 2;
+            bTight = false;
+            if (i64Err <= RTC_EDGE_MAX_ERR_NS) {
+                _i64EdgeNs = i64Edge;
+                break;
+            }
+            // a coarse edge; aim at the earliest time it could have happened
+            // so that the next sleep can't overshoot it
+            _i64EdgeNs = (i64Err <= 2 * RTC_EDGE_COARSE_US * 1000LL) ? i64PrevA : 0;
+        }
+        u8Prev = u8Sec;
+        i64PrevA = i64A;
+    } // while (1)
+    pEdge->i64MonoNs = i64Edge;
+    pEdge->i64RealNs = i64Edge + (rtcClockNs(CLOCK_REALTIME) - rtcClockNs(CLOCK_MONOTONIC));
+    pEdge->i32UncertaintyNs = (int32_t)i64Err;
+    rc = getTimeInternal(&tmNow); // the seconds after the edge
+    if (rc != RTC_SUCCESS) return rc;
+    pEdge->u32Epoch = (uint32_t)timegm(&tmNow);
+    return RTC_SUCCESS;
+} /* waitForSecond() */
+//
+// Read the RTC several times, bracketing each read with CLOCK_MONOTONIC,
+// and keep the one with the tightest bracket (like the PTP_SYS_OFFSET
+// ioctl does for NIC clocks). Devices with a 1/100 second counter read
+// it in the same burst; on the others the reading is in whole seconds
+// (use waitForSecond() to find the phase of those).
+// returns RTC_SUCCESS or RTC_xxx
+//
+int BBRTC::getCrossTimestamp(RTC_XTSTAMP *pTs, int iSamples)
+{
+uint8_t ucTemp[8], ucBest[8];
+int64_t i64A, i64B, i64Best = 0, i64Width = -1;
+int i, iReg, iLen;
+struct tm tmNow, tmBest;
+
+    startOp();
+    if (pTs == NULL || iSamples < 1) return RTC_ERROR;
+    memset(pTs, 0, sizeof(RTC_XTSTAMP));
+    memset(&tmNow, 0, sizeof(tmNow));
+    iReg = timeReg();
+    if (_iRTCDev < 0 && iReg < 0) return RTC_ERROR;
+    iLen = 7;
+    if (_iRTCDev < 0 && (_desc.u8Flags & RTC_DESC_HUNDREDTHS)) {
+        iReg--; // start at the hundredths
+        iLen++;
+    }
+    for (i=0; i<iSamples; i++) {
+        i64A = rtcClockNs(CLOCK_MONOTONIC);
+        if (_iRTCDev >= 0) {
+            if (rtcDevGetTime(&tmNow) != RTC_SUCCESS) return RTC_ERROR;
+        } else if (busReadReg((uint8_t)iReg, ucTemp, iLen) <= 0) {
+            return _iLastError;
+        }
+        i64B = rtcClockNs(CLOCK_MONOTONIC);
+        if (i64Width < 0 || i64B - i64A < i64Width) {
+            i64Width = i64B - i64A;
+            i64Best = (i64A + i64B) / 2;
+            memcpy(ucBest, ucTemp, iLen);
+            memcpy(&tmBest, &tmNow, sizeof(tmBest));
+        }
+    }
+    if (_iRTCDev < 0) {
+        decodeTime(&ucBest[iLen - 7], &tmBest);
+    }
+    pTs->u32Epoch = (uint32_t)timegm(&tmBest);
+    if (iLen == 8) {
+        pTs->i32SubNs = UNBCD(ucBest[0]) * 10000000;
+        pTs->i32ResNs = 10000000;
+    } else {
+        pTs->i32ResNs = 1000000000;
+    }
+    pTs->i64MonoNs = i64Best;
+    pTs->i64RealNs = i64Best + (rtcClockNs(CLOCK_REALTIME) - rtcClockNs(CLOCK_MONOTONIC));
+    pTs->i32UncertaintyNs = (int32_t)(i64Width / 2);
+    pTs->iSamples = iSamples;
+    return RTC_SUCCESS;
+} /* getCrossTimestamp() */
+#endif // __LINUX__
 
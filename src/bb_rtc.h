@@ -56,17 +56,53 @@ typedef struct _tagbbi2c
 
 #define RTC_SUCCESS 0
 #define RTC_ERROR 1
+#define RTC_TIMEOUT 2
+// Bus errors; transports return them negated (e.g. -RTC_NACK)
+#define RTC_NACK 3 // nothing acknowledged the transfer
+#define RTC_BUS_STUCK 4 // SDA or SCL is being held low
+#define RTC_NO_DEVICE 5 // the device didn't come back after a bus recovery
+#define RTC_RETRIES 2 // default retries of a failed transfer
 
 // I2C base address of the DS3231 RTC and AT24C32 EEPROM
 #define RTC_DS3231_ADDR 0x68
 #define RTC_RV3032_ADDR 0x51
 #define RTC_PCF8563_ADDR 0x51
 #define RTC_PCF85063A_ADDR 0x51
+#define RTC_DS1307_ADDR 0x68
+#define RTC_DS3232_ADDR 0x68
+#define RTC_MCP7940N_ADDR 0x6f
+#define RTC_PCF2129_ADDR 0x51
 
 // Status bits
 #define STATUS_RUNNING 1
 #define STATUS_IRQ1_TRIGGERED 2
 #define STATUS_IRQ2_TRIGGERED 4
+#define STATUS_TEMP_TRIGGERED 8
+
+// Capability flags returned by getCaps()
+#define RTC_CAP_TIME 0x0001 // get/set time and date
+#define RTC_CAP_ALARM 0x0002 // time/date match alarm
+#define RTC_CAP_ALARM2 0x0004 // second independent alarm
+#define RTC_CAP_ALARM_REPEAT 0x0008 // repeating per second/minute alarms
+#define RTC_CAP_COUNTDOWN 0x0010 // countdown alarm
+#define RTC_CAP_CLKOUT 0x0020 // square wave output (setFreq)
+#define RTC_CAP_TEMP 0x0040 // temperature sensor
+#define RTC_CAP_VBACKUP 0x0080 // backup battery charging
+#define RTC_CAP_EPOCH 0x0100 // native epoch time register
+#define RTC_CAP_STOP 0x0200 // clock can be stopped
+#define RTC_CAP_REGISTERS 0x0400 // direct register access (burst reads)
+#define RTC_CAP_IRQ_WAIT 0x0800 // waitForAlarm() is interrupt driven
+#define RTC_CAP_RAM 0x1000 // battery backed user RAM (readRAM/writeRAM)
+#define RTC_CAP_TRIM 0x2000 // digital frequency offset (setTrim)
+#define RTC_CAP_TEMP_EVENT 0x4000 // temperature threshold interrupts and time stamps
+
+// Alarm/timer sources reported in RTC_SNAPSHOT.u8Fired
+#define RTC_FIRED_ALARM1 1
+#define RTC_FIRED_ALARM2 2
+#define RTC_FIRED_TIMER 4
+#define RTC_FIRED_UPDATE 8
+#define RTC_FIRED_TEMP_HIGH 0x10
+#define RTC_FIRED_TEMP_LOW 0x20
 
 enum
 {
@@ -75,6 +111,10 @@ enum
   RTC_DS3231,
   RTC_RV3032,
   RTC_PCF85063A,
+  RTC_DS1307,
+  RTC_DS3232,
+  RTC_MCP7940N,
+  RTC_PCF2129,
   RTC_TYPE_COUNT
 };
 
@@ -93,36 +133,647 @@ enum {
   ALARM2_DATE,
 };
 
+// Fields an alarm compares (RTC_ALARM_INFO.u8Match)
+#define RTC_MATCH_SEC 0x01
+#define RTC_MATCH_MIN 0x02
+#define RTC_MATCH_HOUR 0x04
+#define RTC_MATCH_WDAY 0x08
+#define RTC_MATCH_MDAY 0x10
+#define RTC_MATCH_MON 0x20
+#define RTC_MATCH_YEAR 0x40
+#define RTC_MATCH_NEVER 0x80 // every field is disabled, so it can't fire
+
+// Periodic interrupts which also drive an alarm (RTC_ALARM_INFO.u8Tick)
+#define RTC_TICK_SECOND 1
+#define RTC_TICK_MINUTE 2
+
+// Length of the register block from encodeTime() (address + 7 registers)
+#define RTC_TIME_BLOCK 8
+
+// Fields of the packed times returned by decodeTimes() (years 2000-2063)
+// The values sort in time order
+#define RTC_PACK_YEAR(p) (2000 + (int)((p) >> 26))
+#define RTC_PACK_MON(p) (int)(((p) >> 22) & 15) // 1-12
+#define RTC_PACK_MDAY(p) (int)(((p) >> 17) & 31)
+#define RTC_PACK_HOUR(p) (int)(((p) >> 12) & 31)
+#define RTC_PACK_MIN(p) (int)(((p) >> 6) & 63)
+#define RTC_PACK_SEC(p) (int)((p) & 63)
+
+// Chip descriptor flags
+#define RTC_DESC_PCF_ORDER 0x01 // day of the month comes before day of the week
+#define RTC_DESC_CENTURY 0x02 // century flag in bit 7 of the month register
+#define RTC_DESC_12H 0x04 // hours register can be in 12-hour mode (bit 6)
+#define RTC_DESC_STOP_RMW 0x08 // stop bit shares its register with other data
+#define RTC_DESC_STOP_CLEAR 0x10 // stop bit is an oscillator enable (clear to stop)
+#define RTC_DESC_RUN_HIGH 0x20 // halt status bit reads 1 while running
+#define RTC_DESC_TEMP_LSB 0x40 // temperature LSB register comes first
+#define RTC_DESC_HUNDREDTHS 0x80 // BCD 1/100 seconds in the register before the time
+
+// Alarm register layouts
+enum {
+  RTC_ALM_NONE=0, // no alarms
+  RTC_ALM_CHIP, // programmed by chip-specific code
+  RTC_ALM_PCF, // sec/min/hour/mday/wday, bit 7 disables each field
+  RTC_ALM_MCP // sec/min/hour/wday+mask/mday/month (MCP79xx)
+};
+// Frequency offset (trim) register encodings
+enum {
+  RTC_TRIM_NONE = 0,
+  RTC_TRIM_TWOS7, // 7-bit two's complement in bits 6:0 (PCF85063A)
+  RTC_TRIM_TWOS8, // 8-bit two's complement (DS3231 aging offset)
+  RTC_TRIM_SIGNMAG // bit 7 = sign, bits 6:0 = magnitude (MCP7940N)
+};
+
+//
+// Register map and feature description of a supported RTC
+// The common functions (time, status, temperature, stop, RAM, detection
+// and the simpler alarm layouts) are driven entirely from this table
+// Offset/mask pairs refer to the bytes read from u8StatusReg
+//
+typedef struct _tagrtcchipdesc
+{
+  uint8_t u8Type; // RTC_xxx
+  uint8_t u8Family; // type whose chip-specific code this one shares
+  uint8_t u8Addr; // I2C address
+  uint8_t u8Flags; // RTC_DESC_xxx
+  uint16_t u16Caps; // RTC_CAP_xxx
+  uint8_t u8IdReg, u8IdValue, u8IdMask, u8IdExpect; // detection test (mask 0 = none)
+  uint8_t u8TimeReg; // seconds register; 7 time/date registers follow
+  uint8_t u8WdayBase; // value stored for Sunday
+  uint8_t u8SecSet, u8WdaySet; // control bits kept set in these registers
+  uint8_t u8StopReg, u8StopBit;
+  uint8_t u8StatusReg, u8StatusLen; // registers read by getStatus()
+  uint8_t u8Halt[2]; // oscillator stopped
+  uint8_t u8Alarm1[2], u8Alarm2[2], u8Timer[2], u8Update[2]; // fired flags
+  uint8_t u8TempHigh[2], u8TempLow[2]; // temperature threshold flags
+  uint8_t u8TempReg; // 0 = no temperature sensor
+  uint8_t u8InitReg, u8InitLen, u8Init[3]; // written by init()
+  uint8_t u8AlarmLayout; // RTC_ALM_xxx
+  uint8_t u8AlarmReg[2]; // first register of alarm 1 and 2
+  uint8_t u8AlarmEnReg, u8AlarmEn[2]; // interrupt enable bits of alarm 1 and 2
+  uint8_t u8TickReg, u8TickSec, u8TickMin; // once per second/minute interrupts
+  uint8_t u8ClkReg, u8ClkMask, u8ClkOn, u8ClkOff; // CLKOUT (reg 0 = chip-specific)
+  int8_t i8ClkLog2[8]; // log2(frequency) of each CLKOUT code (-1 = unused)
+  uint8_t u8RamReg, u8RamLen; // user RAM
+  uint8_t u8CfgReg[3], u8CfgLen[3]; // configuration registers (getConfig())
+  uint8_t u8TrimType, u8TrimReg; // RTC_TRIM_xxx, frequency offset register
+  int16_t i16TrimStep; // ppb the clock speeds up per LSB (- = slows down)
+} RTC_CHIP_DESC;
+
+#define RTC_CONFIG_VERSION 1
+#define RTC_CONFIG_MAX 32
+//
+// Image of the configuration registers of a device (see getConfig())
+// The registers are stored in the order of the chip's register map
+//
+typedef struct _tagrtcconfig
+{
+  uint8_t u8Version; // RTC_CONFIG_VERSION
+  uint8_t u8Type; // RTC_xxx of the device it was read from
+  uint8_t u8Len; // bytes used in u8Regs
+  uint8_t u8Check; // makes the bytes of the image sum to 0xff
+  uint8_t u8Regs[RTC_CONFIG_MAX];
+} RTC_CONFIG;
+
+//
+// Temperature threshold crossings latched by the RTC
+//
+typedef struct _tagrtctempevent
+{
+  uint8_t u8Fired; // RTC_FIRED_TEMP_HIGH and/or RTC_FIRED_TEMP_LOW
+  uint8_t u8HighCount, u8LowCount; // crossings since the time stamps were cleared
+  struct tm tmHigh, tmLow; // time of the last crossing (UTC)
+} RTC_TEMP_EVENT;
+
+//
+// An alarm as it's programmed in the RTC (see getAlarm())
+// It fires when all of the u8Match fields start to equal those of tmMatch
+// (u8Match = 0 means every second)
+//
+typedef struct _tagrtcalarminfo
+{
+  uint8_t u8Match; // RTC_MATCH_xxx
+  uint8_t u8Tick; // RTC_TICK_xxx interrupts enabled on the same pin
+  bool bEnabled; // the match interrupt is enabled
+  bool bFired; // the flag is set and hasn't been cleared
+  struct tm tmMatch; // values compared (tm_wday 0-6 = Sunday-Saturday)
+} RTC_ALARM_INFO;
+
+//
+// Everything getSnapshot() captures in a single burst read
+//
+typedef struct _tagrtcsnapshot
+{
+  struct tm tmTime; // current time/date
+  int iStatus; // same STATUS_xxx flags as getStatus()
+  int iTemp; // celcius * 4 (0 for devices without a sensor)
+  uint8_t u8Fired; // RTC_FIRED_xxx flags of the sources which fired
+} RTC_SNAPSHOT;
+
+// Transfer types for BBRTCTransport::transfer()
+enum {
+  RTC_XFER_WRITE=0,
+  RTC_XFER_READ,
+  RTC_XFER_READREG,
+  RTC_XFER_PROBE
+};
+
+//
+// One entry of a batched transfer list
+//
+typedef struct _tagrtcxfer
+{
+  uint8_t u8Type; // RTC_XFER_xxx
+  uint8_t u8Addr; // 7-bit I2C address
+  uint8_t u8Reg; // starting register (RTC_XFER_READREG only)
+  uint8_t *pData;
+  int iLen;
+  int iResult; // filled in by transfer(); > 0 means success
+} RTC_XFER;
+
+//
+// Abstract I2C transport
+// Each BBRTC instance talks to its device through one of these, so
+// different buses or backends can be mixed in the same program.
+// All methods return a value > 0 for success and <= 0 for failure; a
+// negative failure may carry the cause (-RTC_NACK, -RTC_TIMEOUT, ...)
+//
+class BBRTCTransport
+{
+public:
+    virtual ~BBRTCTransport() {}
+    virtual int probe(uint8_t u8Addr) = 0;
+    virtual int read(uint8_t u8Addr, uint8_t *pData, int iLen) = 0;
+    virtual int write(uint8_t u8Addr, uint8_t *pData, int iLen) = 0;
+    virtual int readRegister(uint8_t u8Addr, uint8_t u8Reg, uint8_t *pData, int iLen) = 0;
+    virtual int transfer(RTC_XFER *pList, int iCount);
+    // Transports with the same key share one bus (calls to them can't overlap)
+    virtual uintptr_t getBusKey() { return (uintptr_t)this; }
+    // Free a stuck bus (clock out SCL, STOP) and reopen the adapter
+    // returns RTC_SUCCESS (also when there's nothing to do) or RTC_xxx
+    virtual int recover() { return RTC_SUCCESS; }
+    // Longest a single transfer may wait for the bus (0 = backend default)
+    virtual int setTimeout(int iMs) { (void)iMs; return RTC_ERROR; }
+}; // class BBRTCTransport
+
+//
+// Static (CRTP) transport base
+// The derived class T provides doProbe/doRead/doWrite/doReadRegister (and
+// optionally doRecover) and every call is resolved at compile time with
+// no virtual dispatch.
+// Use BBRTCTransportAdapter<T> to plug one into a BBRTC instance.
+//
+template <class T>
+class BBRTCStaticTransport
+{
+public:
+    int probe(uint8_t u8Addr) { return static_cast<T *>(this)->doProbe(u8Addr); }
+    int read(uint8_t u8Addr, uint8_t *pData, int iLen) { return static_cast<T *>(this)->doRead(u8Addr, pData, iLen); }
+    int write(uint8_t u8Addr, uint8_t *pData, int iLen) { return static_cast<T *>(this)->doWrite(u8Addr, pData, iLen); }
+    int readRegister(uint8_t u8Addr, uint8_t u8Reg, uint8_t *pData, int iLen) { return static_cast<T *>(this)->doReadRegister(u8Addr, u8Reg, pData, iLen); }
+    int recover() { return static_cast<T *>(this)->doRecover(); }
+    int doRecover() { return RTC_SUCCESS; } // nothing to reset
+    int transfer(RTC_XFER *pList, int iCount)
+    {
+        int i, iGood = 0;
+        for (i=0; i<iCount; i++) {
+            RTC_XFER *pX = &pList[i];
+            switch (pX->u8Type) {
+                case RTC_XFER_WRITE:
+                    pX->iResult = write(pX->u8Addr, pX->pData, pX->iLen);
+                    break;
+                case RTC_XFER_READ:
+                    pX->iResult = read(pX->u8Addr, pX->pData, pX->iLen);
+                    break;
+                case RTC_XFER_READREG:
+                    pX->iResult = readRegister(pX->u8Addr, pX->u8Reg, pX->pData, pX->iLen);
+                    break;
+                default: // RTC_XFER_PROBE
+                    pX->iResult = probe(pX->u8Addr);
+                    break;
+            }
+            if (pX->iResult > 0) iGood++;
+        }
+        return iGood;
+    } /* transfer() */
+}; // class BBRTCStaticTransport
+
+//
+// Wraps a static transport in the virtual interface
+//
+template <class T>
+class BBRTCTransportAdapter : public BBRTCTransport
+{
+public:
+    T transport;
+    int probe(uint8_t u8Addr) { return transport.probe(u8Addr); }
+    int read(uint8_t u8Addr, uint8_t *pData, int iLen) { return transport.read(u8Addr, pData, iLen); }
+    int write(uint8_t u8Addr, uint8_t *pData, int iLen) { return transport.write(u8Addr, pData, iLen); }
+    int readRegister(uint8_t u8Addr, uint8_t u8Reg, uint8_t *pData, int iLen) { return transport.readRegister(u8Addr, u8Reg, pData, iLen); }
+    int transfer(RTC_XFER *pList, int iCount) { return transport.transfer(pList, iCount); }
+    int recover() { return transport.recover(); }
+}; // class BBRTCTransportAdapter
+
+//
+// The platform I2C transport (BitBang_I2C on Arduino, i2c-dev on Linux
+// and the I2C driver or bit banging on esp-idf)
+//
+class BBRTCI2CTransport : public BBRTCTransport
+{
+public:
+    BBRTCI2CTransport() : _u32Speed(0) {}
+    void init(int iSDA, int iSCL, bool bWire, uint32_t u32Speed);
+    BBI2C *getBB() { return &_bb; }
+    void setBB(const BBI2C *pBB);
+    int probe(uint8_t u8Addr);
+    int read(uint8_t u8Addr, uint8_t *pData, int iLen);
+    int write(uint8_t u8Addr, uint8_t *pData, int iLen);
+    int readRegister(uint8_t u8Addr, uint8_t u8Reg, uint8_t *pData, int iLen);
+    int recover();
+    int setTimeout(int iMs);
+#ifdef __LINUX__
+    uintptr_t getBusKey() { return _bb.iSDA; } // /dev/i2c-N
+#endif
+
+private:
+    BBI2C _bb;
+    uint32_t _u32Speed; // to bring the bus back up after a recovery
+}; // class BBRTCI2CTransport
+
+#define RTC_MUX_CHANNELS 8
+#define RTC_MUX_MAX 8 // muxes on one bus (the TCA9548A has 8 addresses)
+//
+// The TCA9548A/PCA9548 I2C muxes on one bus
+// Only one mux channel is enabled at a time and the last one selected is
+// cached, so consecutive transactions through the same channel don't pay
+// for another control register write. Call invalidate() if other code
+// changes the mux settings behind our back; every mux used so far is
+// then closed before the next channel is selected.
+//
+class BBRTCMuxBus
+{
+public:
+    BBRTCMuxBus(BBRTCTransport *pBus = NULL) : _pBus(pBus), _u8Mux(0), _iChannel(-1), _iMuxes(0), _bStale(false), _u32Switches(0) {}
+    void setBus(BBRTCTransport *pBus) { _pBus = pBus; _iMuxes = 0; invalidate(); }
+    BBRTCTransport *getBus() { return _pBus; }
+    int select(uint8_t u8Mux, int iChannel);
+    void invalidate() { _iChannel = -1; _bStale = true; }
+    uint32_t getSwitches() { return _u32Switches; }
+    int sweep(uint8_t u8Mux, uint8_t u8Channels, uint8_t u8Addr, uint8_t u8Reg, uint8_t *pData, int iLen);
+
+private:
+    void closeOthers(uint8_t u8Mux);
+    BBRTCTransport *_pBus;
+    uint8_t _u8Mux; // mux with a channel enabled
+    int _iChannel; // enabled channel (-1 = unknown)
+    uint8_t _u8Muxes[RTC_MUX_MAX]; // muxes used on this bus
+    int _iMuxes;
+    bool _bStale; // the channels of all of the muxes are unknown
+    uint32_t _u32Switches; // control register writes
+}; // class BBRTCMuxBus
+
+//
+// A device behind one channel of a mux
+// Selects the channel (if needed) before passing each call to the bus
+//
+class BBRTCMuxTransport : public BBRTCTransport
+{
+public:
+    BBRTCMuxTransport() : _pMuxBus(NULL), _u8Mux(0), _iChannel(0) {}
+    void init(BBRTCMuxBus *pMuxBus, uint8_t u8Mux, int iChannel);
+    int probe(uint8_t u8Addr);
+    int read(uint8_t u8Addr, uint8_t *pData, int iLen);
+    int write(uint8_t u8Addr, uint8_t *pData, int iLen);
+    int readRegister(uint8_t u8Addr, uint8_t u8Reg, uint8_t *pData, int iLen);
+    int transfer(RTC_XFER *pList, int iCount);
+    uintptr_t getBusKey() { return (_pMuxBus && _pMuxBus->getBus()) ? _pMuxBus->getBus()->getBusKey() : (uintptr_t)this; }
+    int recover();
+    int setTimeout(int iMs) { return (_pMuxBus && _pMuxBus->getBus()) ? _pMuxBus->getBus()->setTimeout(iMs) : RTC_ERROR; }
+
+private:
+    BBRTCMuxBus *_pMuxBus;
+    uint8_t _u8Mux;
+    int _iChannel;
+}; // class BBRTCMuxTransport
+
+#define RTC_SIM_MAX_DEVICES 8
+//
+// Simulated RTC devices held in memory
+// Useful for testing and benchmarking without hardware
+//
+class BBRTCSimTransport : public BBRTCTransport
+{
+public:
+    BBRTCSimTransport() : _iDevices(0), _u32Transactions(0), _u8MuxAddr(0), _u8MuxCtrl(0), _iFault(0), _iFaultCount(0), _u32Recoveries(0) {}
+    int addDevice(int iType, int iChannel = -1);
+    int addMux(uint8_t u8Addr);
+    uint8_t *getRegisters(uint8_t u8Addr);
+    int setTemperature(uint8_t u8Addr, int iTemp);
+    uint32_t getTransactions() { return _u32Transactions; }
+#ifdef __LINUX__
+    int setLive(uint8_t u8Addr, bool bLive, int iPPB = 0);
+#endif
+    int probe(uint8_t u8Addr);
+    int read(uint8_t u8Addr, uint8_t *pData, int iLen);
+    int write(uint8_t u8Addr, uint8_t *pData, int iLen);
+    int readRegister(uint8_t u8Addr, uint8_t u8Reg, uint8_t *pData, int iLen);
+    // Fail the next iCount transfers with iError (-1 = until recover())
+    void setFault(int iError, int iCount = -1) { _iFault = iError; _iFaultCount = iCount; }
+    int recover() { _iFaultCount = 0; _u32Recoveries++; return RTC_SUCCESS; }
+    uint32_t getRecoveries() { return _u32Recoveries; }
+
+private:
+    typedef struct _tagsimdev
+    {
+      uint8_t u8Addr, u8Type, u8Ptr;
+      int iChannel; // mux channel (-1 = directly on the bus)
+      int iRegCount;
+      uint8_t u8Regs[256];
+      bool bLive; // time registers follow the host clock
+      int iPPB; // rate error of the live clock (parts per billion)
+      int64_t i64BaseNs; // CLOCK_MONOTONIC when the time was last set
+      uint32_t u32BaseEpoch;
+    } SIMDEV;
+    SIMDEV *findDevice(uint8_t u8Addr, int iChannel = -2);
+    void liveRead(SIMDEV *pDev);
+    void liveWrite(SIMDEV *pDev, uint8_t u8Start, int iLen);
+    uint8_t writeMask(SIMDEV *pDev, uint8_t u8Reg);
+    bool fault(void);
+    int _iDevices;
+    uint32_t _u32Transactions;
+    uint8_t _u8MuxAddr, _u8MuxCtrl; // simulated TCA9548A
+    int _iFault, _iFaultCount; // injected bus error
+    uint32_t _u32Recoveries;
+    SIMDEV _dev[RTC_SIM_MAX_DEVICES];
+}; // class BBRTCSimTransport
+
+#define RTC_TRACE_DATA 32 // bytes of data kept for each transfer
+#define RTC_TRACE_MAGIC 0x54524242 // "BBRT" trace file signature
+#define RTC_TRACE_VERSION 1
+//
+// One transfer captured by BBRTCTraceTransport
+//
+typedef struct _tagrtctrace
+{
+  uint32_t u32Seq; // 1 + position in the ring once the entry is complete
+  uint32_t u32Sec, u32Usec; // when the transfer started
+  uint32_t u32DurUs; // how long it took
+  uint8_t u8Type; // RTC_XFER_xxx
+  uint8_t u8Addr;
+  uint8_t u8Reg; // RTC_XFER_READREG only
+  uint8_t u8Len; // bytes kept in u8Data
+  int16_t i16Len; // bytes requested
+  int16_t i16Result; // > 0 means success
+  uint8_t u8Data[RTC_TRACE_DATA];
+} RTC_TRACE;
+
+//
+// Callback used to write a pcap capture; returns the bytes written
+//
+typedef int (RTC_WRITE_CALLBACK)(void *pUser, const uint8_t *pData, int iLen);
+
+//
+// Records the traffic of another transport into a ring of RTC_TRACE
+// entries (supplied by the caller) which can be exported as a pcap file
+// with the Linux I2C link type for Wireshark. The oldest entries are
+// overwritten when the ring is full. Recording is lock-free, so transfers
+// from several threads can be captured while another thread exports.
+// While disabled, each call costs one extra test.
+//
+class BBRTCTraceTransport : public BBRTCTransport
+{
+public:
+    BBRTCTraceTransport() : _pBus(NULL), _pRing(NULL), _iCount(0), _u32Head(0), _bEnabled(false) {}
+    void init(BBRTCTransport *pBus, RTC_TRACE *pRing, int iCount);
+    void enable(bool bEnable) { _bEnabled = bEnable; }
+    bool isEnabled() { return _bEnabled; }
+    void clear();
+    uint32_t getTotal() { return __atomic_load_n(&_u32Head, __ATOMIC_ACQUIRE); }
+    int getRecords(RTC_TRACE *pOut, int iMax);
+    int writePcap(RTC_WRITE_CALLBACK *pfnWrite, void *pUser, uint8_t u8Bus = 0);
+#ifdef __LINUX__
+    int savePcap(const char *szFile, uint8_t u8Bus = 0);
+    int saveTrace(const char *szFile);
+#endif
+    int probe(uint8_t u8Addr);
+    int read(uint8_t u8Addr, uint8_t *pData, int iLen);
+    int write(uint8_t u8Addr, uint8_t *pData, int iLen);
+    int readRegister(uint8_t u8Addr, uint8_t u8Reg, uint8_t *pData, int iLen);
+    int transfer(RTC_XFER *pList, int iCount);
+    uintptr_t getBusKey() { return (_pBus) ? _pBus->getBusKey() : (uintptr_t)this; }
+    int recover() { return (_pBus) ? _pBus->recover() : RTC_ERROR; }
+    int setTimeout(int iMs) { return (_pBus) ? _pBus->setTimeout(iMs) : RTC_ERROR; }
+
+private:
+    void record(const RTC_XFER *pX, uint32_t u32Sec, uint32_t u32Usec, uint32_t u32DurUs);
+    bool getRecord(uint32_t u32Pos, RTC_TRACE *pOut);
+    BBRTCTransport *_pBus;
+    RTC_TRACE *_pRing;
+    int _iCount;
+    uint32_t _u32Head; // total number of entries started
+    volatile bool _bEnabled;
+}; // class BBRTCTraceTransport
+
+#ifdef __LINUX__
+#define RTC_REPLAY_RESYNC 8 // how far ahead to look for a matching transfer
+//
+// Plays back a capture from BBRTCTraceTransport (e.g. a session recorded
+// on a real board) so that the library can be run against it on a build
+// machine. Reads and probes return the recorded data and results, and
+// each call takes as long as the recorded one did (unless timing is
+// turned off). A call which doesn't match the next recorded transfer is
+// counted as a divergence; the playback skips ahead to the next match if
+// there is one nearby, otherwise the call fails.
+//
+class BBRTCReplayTransport : public BBRTCTransport
+{
+public:
+    BBRTCReplayTransport() : _pList(NULL), _pAlloc(NULL), _iCount(0) { rewind(); _bTiming = true; }
+    ~BBRTCReplayTransport();
+    void init(const RTC_TRACE *pList, int iCount);
+    int loadTrace(const char *szFile);
+    void setTiming(bool bTiming) { _bTiming = bTiming; }
+    void rewind();
+    int getPosition() { return _iPos; }
+    int getRemaining() { return _iCount - _iPos; }
+    uint32_t getTransactions() { return _u32Transactions; }
+    int getDivergences() { return _iDivergences; }
+    int getFirstDivergence() { return _iFirstDivergence; }
+    int64_t getBusTimeUs() { return _i64BusUs; }
+    int probe(uint8_t u8Addr);
+    int read(uint8_t u8Addr, uint8_t *pData, int iLen);
+    int write(uint8_t u8Addr, uint8_t *pData, int iLen);
+    int readRegister(uint8_t u8Addr, uint8_t u8Reg, uint8_t *pData, int iLen);
+
+private:
+    bool matches(const RTC_TRACE *pT, const RTC_XFER *pX);
+    const RTC_TRACE *next(const RTC_XFER *pX);
+    int play(RTC_XFER *pX);
+    const RTC_TRACE *_pList;
+    RTC_TRACE *_pAlloc; // list loaded from a file
+    int _iCount, _iPos;
+    bool _bTiming;
+    uint32_t _u32Transactions;
+    int _iDivergences, _iFirstDivergence; // (-1 = none)
+    int64_t _i64BusUs; // recorded time of the transfers played
+}; // class BBRTCReplayTransport
+#endif // __LINUX__
+
+#ifdef __LINUX__
+//
+// An RTC second boundary and the host clocks at that moment
+//
+typedef struct _tagrtcedge
+{
+  uint32_t u32Epoch; // RTC time (UTC) of the second which just started
+  int64_t i64RealNs; // CLOCK_REALTIME at the edge
+  int64_t i64MonoNs; // CLOCK_MONOTONIC at the edge
+  int32_t i32UncertaintyNs; // +/- error of the host timestamps
+} RTC_EDGE;
+//
+// An RTC reading paired with the host clocks at the moment it was taken
+// The RTC latched its registers somewhere within +/- i32UncertaintyNs of
+// the host timestamps; the reading itself is only as fine as i32ResNs
+//
+typedef struct _tagrtcxtstamp
+{
+  uint32_t u32Epoch; // RTC time (UTC), whole seconds
+  int32_t i32SubNs; // fraction of the second (0 without a sub-second counter)
+  int32_t i32ResNs; // resolution of the RTC reading
+  int64_t i64RealNs; // CLOCK_REALTIME at the middle of the tightest read
+  int64_t i64MonoNs; // CLOCK_MONOTONIC at the middle of the tightest read
+  int32_t i32UncertaintyNs; // +/- half the duration of the tightest read
+  int iSamples; // number of reads taken
+} RTC_XTSTAMP;
+//
+// An RTC found by BBRTC::discover()
+//
+typedef struct _tagrtcfound
+{
+  int iBus; // N of /dev/i2c-N (pass it to init() as iSDA)
+  int iType; // RTC_xxx (RTC_UNKNOWN when bKernel is set)
+  uint8_t u8Addr; // I2C address
+  bool bKernel; // a kernel driver owns the address; use initRTCDev()
+} RTC_FOUND;
+#endif
+
 class BBRTC
 {
 public:
-    BBRTC() {}
-    ~BBRTC() {};
+    BBRTC() : _iRTCType(RTC_UNKNOWN), _iRTCAddr(0), _iRTCDev(-1), _iDevCaps(0), _desc(), _i64EdgeNs(0), _pTransport(&_i2c), _iLastError(RTC_SUCCESS), _iRetries(RTC_RETRIES), _bRecover(true), _iDeadlineMs(0), _u32OpStart(0), _u32Recoveries(0) {}
+    ~BBRTC();
+    BBRTC(const BBRTC &) = delete; // owns the /dev/rtcN descriptor and its own transport
+    BBRTC &operator=(const BBRTC &) = delete;
     int getType();
+    int getCaps();
     int getStatus();
     BBI2C *getBB();
     int init(BBI2C *pBB);
+    int init(BBRTCTransport *pTransport);
     int init(int iSDA=-1, int iSCL=-1, bool bWire = true, uint32_t u32Speed = 100000);
+    int init(BBRTCMuxBus *pMuxBus, uint8_t u8Mux, int iChannel);
+#ifdef __LINUX__
+    int initRTCDev(const char *szDevice = "/dev/rtc0");
+    static int discover(RTC_FOUND *pList, int iMax, int iTimeoutMs = 100);
+#endif
+    BBRTCTransport *getTransport() { return _pTransport; }
+    void setTransport(BBRTCTransport *pTransport) { if (pTransport) _pTransport = pTransport; }
+    int getLastError() { return _iLastError; }
+    void setRetries(int iRetries, bool bRecover = true) { _iRetries = (iRetries < 0) ? 0 : iRetries; _bRecover = bRecover; }
+    void setDeadline(int iMs);
+    int recover();
+    uint32_t getRecoveries() { return _u32Recoveries; }
     void logmsg(const char *msg);
     void setFreq(int iFreq);
     void setVBackup(bool bCharge);
     void setAlarm(uint8_t type, struct tm *thetime);
+    int getAlarm(int iAlarm, RTC_ALARM_INFO *pInfo);
+    uint32_t getNextAlarm(int iAlarm = 0);
+    static uint32_t nextAlarm(const RTC_ALARM_INFO *pInfo, uint32_t u32After);
     int getTemp(void);
-    void setTime(struct tm *pTime);
-    void getTime(struct tm *pTime);
+    int setTime(struct tm *pTime);
+    int encodeTime(const struct tm *pTime, uint8_t *pBlock);
+    int writeTime(uint8_t *pBlock, int iLen);
+    int getTime(struct tm *pTime);
+    int getRawTime(uint8_t *pRegs);
+    static int formatTime(int iType, const uint8_t *pRegs, char *szOut, int iLen, const char *szFormat = NULL);
+    static int formatTimes(int iType, const uint8_t *pRegs, int iStride, int iCount, char *pOut, int iOutStride, const char *szFormat = NULL);
+    static int decodeTimes(int iType, const uint8_t *pRegs, int iStride, int iCount, uint32_t *pOut, bool bPacked = false);
+    int getSnapshot(RTC_SNAPSHOT *pSnap);
+    int readRAM(int iOffset, uint8_t *pData, int iLen);
+    int writeRAM(int iOffset, const uint8_t *pData, int iLen);
+    int getConfig(RTC_CONFIG *pConfig);
+    int setConfig(const RTC_CONFIG *pConfig, bool bKeepTrim = true);
+    int setTrim(int32_t i32PPB, int32_t *pi32Applied = NULL);
+    int setTempThresholds(int iLow, int iHigh, uint8_t u8Enable = RTC_FIRED_TEMP_HIGH | RTC_FIRED_TEMP_LOW);
+    int getTempEvent(RTC_TEMP_EVENT *pEvent, bool bClear = true);
     void setCountdownAlarm(int iSeconds);
+    int setCountdown(uint64_t u64Us, uint64_t *pu64Actual = NULL);
+    int setCountdownMs(uint32_t u32Ms, uint64_t *pu64Actual = NULL) { return setCountdown((uint64_t)u32Ms * 1000, pu64Actual); }
     void clearAlarms(bool bDisable = true);
+    int waitForAlarm(int iTimeoutMs = -1);
+#ifdef __LINUX__
+    int waitForSecond(RTC_EDGE *pEdge, int iTimeoutMs = 2000);
+    int getCrossTimestamp(RTC_XTSTAMP *pTs, int iSamples = 5);
+#endif
     uint32_t getEpoch();
     void setEpoch(uint32_t tt);
+    static uint32_t timeToEpoch(const struct tm *pTime);
+    static void epochToTime(uint32_t tt, struct tm *pTime);
     void stop();
 
 protected:
     int initInternal(void);
+    // the public calls without startOp(), for use inside another call
+    int getTimeInternal(struct tm *pTime);
+    int setTimeInternal(struct tm *pTime);
+    void setAlarmInternal(uint8_t type, struct tm *pTime);
+    void setCountdownAlarmInternal(int iSeconds);
+    int getAlarmInternal(int iAlarm, RTC_ALARM_INFO *pInfo);
+    int getConfigInternal(RTC_CONFIG *pConfig);
+    int detect(void);
+    void configure(void);
+    bool detectReg(const RTC_CHIP_DESC *pDesc);
+    void setMatchAlarm(uint8_t type, struct tm *pTime);
+    void writeBits(uint8_t u8Reg, uint8_t u8Mask, uint8_t u8Value);
+    void startOp(void);
+    int busXfer(bool bWrite, uint8_t u8Reg, uint8_t *pData, int iLen);
+    int busWrite(uint8_t *pData, int iLen) { return busXfer(true, 0, pData, iLen); }
+    int busReadReg(uint8_t u8Reg, uint8_t *pData, int iLen) { return busXfer(false, u8Reg, pData, iLen); }
+    int recoverBus(void);
+    void decodeTime(const uint8_t *pRegs, struct tm *pTime);
+    int decodeStatus(const uint8_t *pRegs, uint8_t *pu8Fired);
+    int decodeTemp(const uint8_t *pRegs);
+    int timeReg(void);
+#ifdef __LINUX__
+    int rtcDevGetTime(struct tm *pTime);
+    int rtcDevSetTime(struct tm *pTime);
+    int rtcDevSetAlarm(uint8_t type, struct tm *pTime);
+    int rtcDevGetAlarm(RTC_ALARM_INFO *pInfo);
+    int rtcDevGetStatus(void);
+    int rtcDevWait(int iTimeoutMs);
+    void rtcDevClear(void);
+    void rtcDevDrain(void);
+    int rtcDevWaitSecond(RTC_EDGE *pEdge, int iTimeoutMs);
+    static void *discoverBus(void *pArg);
+#endif
 
 private:
     int _iRTCType;
     int _iRTCAddr;
-    BBI2C _bb;
+    int _iRTCDev; // /dev/rtcN handle when using the kernel driver (Linux)
+    int _iDevCaps;
+    RTC_CHIP_DESC _desc; // register map of the detected chip
+    int64_t _i64EdgeNs; // CLOCK_MONOTONIC of the last second edge found
+    BBRTCTransport *_pTransport;
+    BBRTCI2CTransport _i2c;
+    BBRTCMuxTransport _mux;
+    int _iLastError; // RTC_xxx of the first transfer which failed in the last call
+    int _iRetries; // per transfer
+    bool _bRecover; // recover the bus before retrying
+    int _iDeadlineMs; // no retries after this long into a call (0 = none)
+    uint32_t _u32OpStart; // when the current call started (ms)
+    uint32_t _u32Recoveries;
 }; // class BBRTC
 
 #endif // __BB_RTC__
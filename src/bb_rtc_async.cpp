@@ -0,0 +1,512 @@
+//
+// BitBank RealTime Clock library (bb_rtc)
+// C++20 coroutine API and multi-device event loop
+// written by Larry Bank (bitbank@pobox.com)
+//
+// SPDX-FileCopyrightText: 2025 BitBank Software, Inc.
+// SPDX-License-Identifier: Apache-2.0
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===========================================================================
+#include "bb_rtc_async.h"
+#if defined(__LINUX__) && defined(__cpp_impl_coroutine)
+#include <poll.h>
+#include <sys/eventfd.h>
+
+#define RTC_IRQ_FLAGS (STATUS_IRQ1_TRIGGERED | STATUS_IRQ2_TRIGGERED | STATUS_TEMP_TRIGGERED)
+
+static int64_t asyncNowNs(void)
+{
+struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+} /* asyncNowNs() */
+
+//
+// A task has finished; return to the coroutine awaiting it or, for
+// a spawned task, free it and go back to the event loop
+//
+std::coroutine_handle<> BBRTCTask::promise_type::FinalAwaiter::await_suspend(std::coroutine_handle<promise_type> h) noexcept
+{
+promise_type *p = &h.promise();
+
+    if (p->hNext) return p->hNext;
+    if (p->pLoop) {
+        p->pLoop->taskDone(p);
+        h.destroy();
+    }
+    return std::noop_coroutine();
+} /* FinalAwaiter::await_suspend() */
+
+//
+// Hand the operation to the event loop
+// returns false if it already finished (the coroutine isn't suspended)
+//
+bool BBRTCAsyncOp::await_suspend(std::coroutine_handle<> h)
+{
+    hWaiter = h;
+    return pLoop->submit(this);
+} /* BBRTCAsyncOp::await_suspend() */
+
+BBRTCEventLoop::BBRTCEventLoop()
+{
+    _iEvent = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    _iTasks = 0;
+    _pTasks = _pReadyHead = _pReadyTail = NULL;
+    _pDoneHead = _pDoneTail = NULL;
+    _pTimers = NULL;
+    _iTimers = _iTimerSize = 0;
+    _iWorkers = 0;
+    pthread_mutex_init(&_mutex, NULL);
+} /* BBRTCEventLoop() */
+
+//
+// Stops the bus threads (after the calls already queued) and frees
+// any tasks which didn't finish
+//
+BBRTCEventLoop::~BBRTCEventLoop()
+{
+int i;
+BBRTCTask::promise_type *p;
+
+    for (i=0; i<_iWorkers; i++) {
+        pthread_mutex_lock(&_workers[i].mutex);
+        _workers[i].bStop = true;
+        pthread_cond_signal(&_workers[i].cond);
+        pthread_mutex_unlock(&_workers[i].mutex);
+        pthread_join(_workers[i].thread, NULL);
+        pthread_mutex_destroy(&_workers[i].mutex);
+        pthread_cond_destroy(&_workers[i].cond);
+    }
+    while (_pTasks) { // destroying a task frees the ones it's awaiting
+        p = _pTasks;
+        _pTasks = p->pNext;
+        std::coroutine_handle<BBRTCTask::promise_type>::from_promise(*p).destroy();
+    }
+    free(_pTimers);
+    if (_iEvent >= 0) close(_iEvent);
+    pthread_mutex_destroy(&_mutex);
+} /* ~BBRTCEventLoop() */
+
+//
+// Start a task the next time run() is called (or right away if this is
+// called from a task); the event loop owns it from now on
+//
+void BBRTCEventLoop::spawn(BBRTCTask &&task)
+{
+BBRTCTask::promise_type *p;
+
+    if (!task._h) return;
+    p = &task._h.promise();
+    task._h = nullptr;
+    p->pLoop = this;
+    p->pPrev = NULL;
+    p->pNext = _pTasks;
+    if (_pTasks) _pTasks->pPrev = p;
+    _pTasks = p;
+    if (_pReadyTail) _pReadyTail->pNextReady = p;
+    else _pReadyHead = p;
+    _pReadyTail = p;
+    _iTasks++;
+} /* spawn() */
+
+void BBRTCEventLoop::taskDone(BBRTCTask::promise_type *p)
+{
+    if (p->pPrev) p->pPrev->pNext = p->pNext;
+    else _pTasks = p->pNext;
+    if (p->pNext) p->pNext->pPrev = p->pPrev;
+    _iTasks--;
+} /* taskDone() */
+
+//
+// Run the tasks until they've all finished or iTimeoutMs has passed
+// (-1 = no limit)
+// returns RTC_SUCCESS, RTC_TIMEOUT or RTC_ERROR
+//
+int BBRTCEventLoop::run(int iTimeoutMs)
+{
+int64_t i64Now, i64End, i64Wait;
+BBRTCTask::promise_type *p;
+BBRTCAsyncOp *pOp, *pDone;
+struct pollfd pfd;
+uint64_t u64;
+
+    if (_iEvent < 0) return RTC_ERROR;
+    i64End = (iTimeoutMs < 0) ? -1 : asyncNowNs() + (int64_t)iTimeoutMs * 1000000LL;
+    while (1) {
+        while (_pReadyHead) { // start the new tasks
+            p = _pReadyHead;
+            _pReadyHead = p->pNextReady;
+            if (_pReadyHead == NULL) _pReadyTail = NULL;
+            std::coroutine_handle<BBRTCTask::promise_type>::from_promise(*p).resume();
+        }
+        if (_iTasks == 0) return RTC_SUCCESS;
+        i64Now = asyncNowNs();
+        if (i64End >= 0 && i64Now >= i64End) return RTC_TIMEOUT;
+        // sleep until a bus thread finishes something or the next timer
+        i64Wait = (i64End >= 0) ? i64End - i64Now : -1;
+        if (_iTimers && (i64Wait < 0 || _pTimers[0]->i64Timer - i64Now < i64Wait))
+            i64Wait = _pTimers[0]->i64Timer - i64Now;
+        if (i64Wait != 0) {
+            pfd.fd = _iEvent;
+            pfd.events = POLLIN;
+            i64Wait = (i64Wait < 0) ? -1 : (i64Wait + 999999) / 1000000; // ms
+            if (i64Wait > 0x7fffffff) i64Wait = 0x7fffffff;
+            poll(&pfd, 1, (int)i64Wait);
+        }
+        if (read(_iEvent, &u64, sizeof(u64)) > 0) {
+            pthread_mutex_lock(&_mutex);
+            pDone = _pDoneHead;
+            _pDoneHead = _pDoneTail = NULL;
+            pthread_mutex_unlock(&_mutex);
+            while (pDone) {
+                pOp = pDone;
+                pDone = pOp->pNext;
+                complete(pOp);
+            }
+        }
+        i64Now = asyncNowNs();
+        while ((pOp = nextTimer(i64Now)) != NULL) {
+            if (pOp->iOp == RTC_ASYNC_SLEEP) {
+                pOp->iResult = RTC_SUCCESS;
+                pOp->hWaiter.resume();
+            } else if (!queue(pOp)) { // poll the status again
+                pOp->hWaiter.resume();
+            }
+        }
+    }
+} /* run() */
+
+//
+// Find (or start) the thread for a bus
+// Once there are RTC_ASYNC_MAX_BUSES of them, buses share threads
+//
+BBRTCEventLoop::RTC_WORKER * BBRTCEventLoop::getWorker(uintptr_t uKey)
+{
+int i;
+RTC_WORKER *pW;
+
+    for (i=0; i<_iWorkers; i++) {
+        if (_workers[i].uKey == uKey) return &_workers[i];
+    }
+    if (_iWorkers == RTC_ASYNC_MAX_BUSES) {
+        return &_workers[(uKey ^ (uKey >> 7)) % RTC_ASYNC_MAX_BUSES];
+    }
+    pW = &_workers[_iWorkers];
+    pW->pLoop = this;
+    pW->uKey = uKey;
+    pW->pHead = pW->pTail = NULL;
+    pW->bStop = false;
+    pthread_mutex_init(&pW->mutex, NULL);
+    pthread_cond_init(&pW->cond, NULL);
+    if (pthread_create(&pW->thread, NULL, workerProc, pW) != 0) {
+        pthread_mutex_destroy(&pW->mutex);
+        pthread_cond_destroy(&pW->cond);
+        return NULL;
+    }
+    _iWorkers++;
+    return pW;
+} /* getWorker() */
+
+//
+// Runs the queued calls for one bus
+//
+void * BBRTCEventLoop::workerProc(void *pArg)
+{
+RTC_WORKER *pW = (RTC_WORKER *)pArg;
+BBRTCEventLoop *pLoop = pW->pLoop;
+BBRTCAsyncOp *pOp;
+BBRTC *pRTC;
+uint64_t u64 = 1;
+int64_t i64Left;
+
+    while (1) {
+        pthread_mutex_lock(&pW->mutex);
+        while (pW->pHead == NULL && !pW->bStop) {
+            pthread_cond_wait(&pW->cond, &pW->mutex);
+        }
+        pOp = pW->pHead;
+        if (pOp == NULL) { // stopped and nothing left
+            pthread_mutex_unlock(&pW->mutex);
+            break;
+        }
+        pW->pHead = pOp->pNext;
+        if (pW->pHead == NULL) pW->pTail = NULL;
+        pthread_mutex_unlock(&pW->mutex);
+
+        pRTC = pOp->pRTC;
+        pOp->iResult = RTC_SUCCESS;
+        switch (pOp->iOp) {
+            case RTC_ASYNC_GETTIME:
+                pOp->iResult = pRTC->getTime(pOp->pTime);
+                break;
+            case RTC_ASYNC_SETTIME:
+                pOp->iResult = pRTC->setTime(pOp->pTime);
+                break;
+            case RTC_ASYNC_SETALARM:
+                pRTC->setAlarm(pOp->u8Type, pOp->pTime);
+                pOp->iResult = pRTC->getLastError();
+                break;
+            case RTC_ASYNC_GETSTATUS:
+                pOp->iResult = pRTC->getStatus();
+                if (pRTC->getLastError() != RTC_SUCCESS) // not just "no flags"
+                    pOp->iResult = -pRTC->getLastError();
+                break;
+            case RTC_ASYNC_WAIT:
+                if (pRTC->getCaps() & RTC_CAP_IRQ_WAIT) { // block on the kernel driver
+                    i64Left = -1;
+                    if (pOp->i64Deadline >= 0) {
+                        i64Left = (pOp->i64Deadline - asyncNowNs()) / 1000000LL;
+                        if (i64Left < 0) i64Left = 0;
+                    }
+                    pOp->iResult = pRTC->waitForAlarm((int)i64Left);
+                } else {
+                    pOp->iResult = pRTC->getStatus();
+                    if (pRTC->getLastError() != RTC_SUCCESS)
+                        pOp->iResult = -pRTC->getLastError(); // complete() stops polling
+                }
+                break;
+            case RTC_ASYNC_CALL:
+                pOp->iResult = (*pOp->pfnCall)(pRTC, pOp->pUser);
+                break;
+        }
+        pOp->pNext = NULL;
+        pthread_mutex_lock(&pLoop->_mutex);
+        if (pLoop->_pDoneTail) pLoop->_pDoneTail->pNext = pOp;
+        else pLoop->_pDoneHead = pOp;
+        pLoop->_pDoneTail = pOp;
+        pthread_mutex_unlock(&pLoop->_mutex);
+        write(pLoop->_iEvent, &u64, sizeof(u64));
+    }
+    return NULL;
+} /* workerProc() */
+
+//
+// Queue a call on the thread for the device's bus
+// returns false if it couldn't be queued (iResult = RTC_ERROR)
+//
+bool BBRTCEventLoop::queue(BBRTCAsyncOp *pOp)
+{
+RTC_WORKER *pW;
+uintptr_t uKey;
+
+    if (pOp->pRTC == NULL) {
+        pOp->iResult = RTC_ERROR;
+        return false;
+    }
+    // kernel RTC devices can block in waitForAlarm(); give each its own thread
+    if (pOp->pRTC->getCaps() & RTC_CAP_IRQ_WAIT) uKey = (uintptr_t)pOp->pRTC;
+    else uKey = pOp->pRTC->getTransport()->getBusKey();
+    pW = getWorker(uKey);
+    if (pW == NULL) {
+        pOp->iResult = RTC_ERROR;
+        return false;
+    }
+    pOp->pNext = NULL;
+    pthread_mutex_lock(&pW->mutex);
+    if (pW->pTail) pW->pTail->pNext = pOp;
+    else pW->pHead = pOp;
+    pW->pTail = pOp;
+    pthread_cond_signal(&pW->cond);
+    pthread_mutex_unlock(&pW->mutex);
+    return true;
+} /* queue() */
+
+//
+// Start an operation
+// returns false if it finished right away
+//
+bool BBRTCEventLoop::submit(BBRTCAsyncOp *pOp)
+{
+    if (pOp->iOp == RTC_ASYNC_SLEEP) {
+        if (pOp->i64Timer < 0) {
+            pOp->iResult = RTC_SUCCESS;
+            return false;
+        }
+        if (addTimer(pOp)) return true;
+        pOp->iResult = RTC_ERROR;
+        return false;
+    }
+    return queue(pOp);
+} /* submit() */
+
+//
+// A bus thread finished a call; resume the coroutine waiting for it
+// Alarm waits poll again later unless the alarm fired, time ran out or
+// the status couldn't be read
+//
+void BBRTCEventLoop::complete(BBRTCAsyncOp *pOp)
+{
+int64_t i64Now;
+
+    if (pOp->iOp == RTC_ASYNC_WAIT && !(pOp->pRTC->getCaps() & RTC_CAP_IRQ_WAIT)) {
+        if (pOp->iResult < 0) { // bus error
+            pOp->iResult = -pOp->iResult;
+        } else if (pOp->iResult & RTC_IRQ_FLAGS) {
+            pOp->iResult = RTC_SUCCESS;
+        } else {
+            i64Now = asyncNowNs();
+            if (pOp->i64Deadline >= 0 && i64Now >= pOp->i64Deadline) {
+                pOp->iResult = RTC_TIMEOUT;
+            } else {
+                pOp->i64Timer = i64Now + (int64_t)pOp->iPollMs * 1000000LL;
+                if (pOp->i64Deadline >= 0 && pOp->i64Timer > pOp->i64Deadline)
+                    pOp->i64Timer = pOp->i64Deadline; // one last look
+                if (addTimer(pOp)) return;
+                pOp->iResult = RTC_ERROR;
+            }
+        }
+    }
+    pOp->hWaiter.resume();
+} /* complete() */
+
+//
+// Timers are kept in a binary heap ordered by i64Timer
+// returns false if there's no memory for another one
+//
+bool BBRTCEventLoop::addTimer(BBRTCAsyncOp *pOp)
+{
+int i, iParent;
+BBRTCAsyncOp **pNew;
+
+    if (_iTimers == _iTimerSize) {
+        pNew = (BBRTCAsyncOp **)realloc(_pTimers, (_iTimerSize + 64) * 2 * sizeof(BBRTCAsyncOp *));
+        if (pNew == NULL) return false;
+        _pTimers = pNew;
+        _iTimerSize = (_iTimerSize + 64) * 2;
+    }
+    i = _iTimers++;
+    while (i > 0) {
+        iParent = (i - 1) / 2;
+        if (_pTimers[iParent]->i64Timer <= pOp->i64Timer) break;
+        _pTimers[i] = _pTimers[iParent];
+        i = iParent;
+    }
+    _pTimers[i] = pOp;
+    return true;
+} /* addTimer() */
+
+//
+// Remove and return the earliest timer if it has expired
+//
+BBRTCAsyncOp * BBRTCEventLoop::nextTimer(int64_t i64Now)
+{
+BBRTCAsyncOp *pOp, *pLast;
+int i, iChild;
+
+    if (_iTimers == 0 || _pTimers[0]->i64Timer > i64Now) return NULL;
+    pOp = _pTimers[0];
+    pLast = _pTimers[--_iTimers];
+    i = 0;
+    while ((iChild = i * 2 + 1) < _iTimers) {
+        if (iChild + 1 < _iTimers && _pTimers[iChild + 1]->i64Timer < _pTimers[iChild]->i64Timer) iChild++;
+        if (pLast->i64Timer <= _pTimers[iChild]->i64Timer) break;
+        _pTimers[i] = _pTimers[iChild];
+        i = iChild;
+    }
+    if (_iTimers) _pTimers[i] = pLast;
+    return pOp;
+} /* nextTimer() */
+
+BBRTCAsyncOp BBRTCEventLoop::newOp(int iOp, BBRTC *pRTC)
+{
+BBRTCAsyncOp op;
+
+    op.pLoop = this;
+    op.pNext = NULL;
+    op.pRTC = pRTC;
+    op.iOp = iOp;
+    op.pTime = NULL;
+    op.u8Type = 0;
+    op.iPollMs = 0;
+    op.i64Deadline = op.i64Timer = -1;
+    op.pfnCall = NULL;
+    op.pUser = NULL;
+    op.iResult = RTC_ERROR;
+    return op;
+} /* newOp() */
+
+//
+// co_await returns RTC_SUCCESS (or RTC_ERROR if it couldn't be started)
+//
+BBRTCAsyncOp BBRTCEventLoop::getTime(BBRTC *pRTC, struct tm *pTime)
+{
+BBRTCAsyncOp op = newOp(RTC_ASYNC_GETTIME, pRTC);
+
+    op.pTime = pTime;
+    return op;
+} /* getTime() */
+
+BBRTCAsyncOp BBRTCEventLoop::setTime(BBRTC *pRTC, struct tm *pTime)
+{
+BBRTCAsyncOp op = newOp(RTC_ASYNC_SETTIME, pRTC);
+
+    op.pTime = pTime;
+    return op;
+} /* setTime() */
+
+BBRTCAsyncOp BBRTCEventLoop::setAlarm(BBRTC *pRTC, uint8_t u8Type, struct tm *pTime)
+{
+BBRTCAsyncOp op = newOp(RTC_ASYNC_SETALARM, pRTC);
+
+    op.u8Type = u8Type;
+    op.pTime = pTime;
+    return op;
+} /* setAlarm() */
+
+//
+// co_await returns the STATUS_xxx flags, or -RTC_xxx (e.g. -RTC_TIMEOUT)
+// if the status couldn't be read
+//
+BBRTCAsyncOp BBRTCEventLoop::getStatus(BBRTC *pRTC)
+{
+    return newOp(RTC_ASYNC_GETSTATUS, pRTC);
+} /* getStatus() */
+
+//
+// Wait for an alarm, countdown timer or temperature event to fire
+// (-1 = wait forever); the status is read every iPollMs
+// co_await returns RTC_SUCCESS, RTC_TIMEOUT or the RTC_xxx error of a
+// status read which failed
+//
+BBRTCAsyncOp BBRTCEventLoop::waitForAlarm(BBRTC *pRTC, int iTimeoutMs, int iPollMs)
+{
+BBRTCAsyncOp op = newOp(RTC_ASYNC_WAIT, pRTC);
+
+    op.iPollMs = (iPollMs < 1) ? 1 : iPollMs;
+    if (iTimeoutMs >= 0) op.i64Deadline = asyncNowNs() + (int64_t)iTimeoutMs * 1000000LL;
+    return op;
+} /* waitForAlarm() */
+
+//
+// Run pfnCall(pRTC, pUser) on the device's bus thread
+// co_await returns its return value
+//
+BBRTCAsyncOp BBRTCEventLoop::call(BBRTC *pRTC, RTC_ASYNC_CALLBACK *pfnCall, void *pUser)
+{
+BBRTCAsyncOp op = newOp(RTC_ASYNC_CALL, (pfnCall) ? pRTC : NULL);
+
+    op.pfnCall = pfnCall;
+    op.pUser = pUser;
+    return op;
+} /* call() */
+
+//
+// Suspend the task for iMs milliseconds without holding up the others
+//
+BBRTCAsyncOp BBRTCEventLoop::sleep(int iMs)
+{
+BBRTCAsyncOp op = newOp(RTC_ASYNC_SLEEP, NULL);
+
+    if (iMs > 0) op.i64Timer = asyncNowNs() + (int64_t)iMs * 1000000LL;
+    return op;
+} /* sleep() */
+#endif // __LINUX__ && __cpp_impl_coroutine
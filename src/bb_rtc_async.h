@@ -0,0 +1,182 @@
+#ifndef __BB_RTC_ASYNC__
+#define __BB_RTC_ASYNC__
+//
+// BitBank Realtime Clock Library
+// C++20 coroutine API and multi-device event loop (Linux only)
+// written by Larry Bank (bitbank@pobox.com)
+//
+// SPDX-FileCopyrightText: 2025 BitBank Software, Inc.
+// SPDX-License-Identifier: Apache-2.0
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===========================================================================
+//
+// I2C transfers block, so each bus gets a worker thread which runs the
+// BBRTC calls queued for the devices on it, one at a time. Coroutines run
+// on the thread which calls BBRTCEventLoop::run() and are resumed there
+// when their call completes, so any number of operations can be
+// outstanding without a thread per device. Alarm waits and sleeps are
+// timers in the loop and don't hold up the bus between polls.
+// Devices which share a bus are recognized by their transport's
+// getBusKey() (e.g. all of the channels of a BBRTCMuxBus).
+//
+// BBRTCTask blink(BBRTCEventLoop *pLoop, BBRTC *pRTC)
+// {
+//     struct tm now;
+//     co_await pLoop->getTime(pRTC, &now);
+//     co_return co_await pLoop->waitForAlarm(pRTC, 60000);
+// }
+//
+#include "bb_rtc.h"
+#if defined(__LINUX__) && defined(__cpp_impl_coroutine)
+#include <coroutine>
+#include <pthread.h>
+
+#define RTC_ASYNC_MAX_BUSES 32 // worker threads; more buses share them
+
+// Asynchronous operations
+enum {
+  RTC_ASYNC_GETTIME = 0,
+  RTC_ASYNC_SETTIME,
+  RTC_ASYNC_SETALARM,
+  RTC_ASYNC_GETSTATUS,
+  RTC_ASYNC_WAIT,
+  RTC_ASYNC_CALL,
+  RTC_ASYNC_SLEEP
+};
+
+class BBRTCEventLoop;
+
+//
+// Any other BBRTC work (e.g. setVBackup()) run on the bus thread by call()
+//
+typedef int (RTC_ASYNC_CALLBACK)(BBRTC *pRTC, void *pUser);
+
+//
+// A coroutine which returns an int (RTC_SUCCESS, RTC_ERROR, ...)
+// Start it with BBRTCEventLoop::spawn() or co_await it from another one
+//
+class BBRTCTask
+{
+public:
+    struct promise_type
+    {
+        BBRTCEventLoop *pLoop; // spawned (top level) tasks
+        std::coroutine_handle<> hNext; // coroutine awaiting this one
+        promise_type *pPrev, *pNext; // spawned tasks which haven't finished
+        promise_type *pNextReady; // spawned tasks which haven't started
+        int iResult;
+
+        promise_type() : pLoop(NULL), pPrev(NULL), pNext(NULL), pNextReady(NULL), iResult(RTC_SUCCESS) {}
+        BBRTCTask get_return_object() { return BBRTCTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        struct FinalAwaiter
+        {
+            bool await_ready() noexcept { return false; }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept;
+            void await_resume() noexcept {}
+        };
+        FinalAwaiter final_suspend() noexcept { return {}; }
+        void return_value(int iResult) { this->iResult = iResult; }
+        void unhandled_exception() { iResult = RTC_ERROR; }
+    };
+
+    BBRTCTask(BBRTCTask &&t) : _h(t._h) { t._h = nullptr; }
+    ~BBRTCTask() { if (_h) _h.destroy(); }
+    // co_await from another task
+    bool await_ready() { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> h) { _h.promise().hNext = h; return _h; }
+    int await_resume() { return _h.promise().iResult; }
+
+private:
+    friend class BBRTCEventLoop;
+    explicit BBRTCTask(std::coroutine_handle<promise_type> h) : _h(h) {}
+    BBRTCTask(const BBRTCTask &) = delete;
+    std::coroutine_handle<promise_type> _h;
+}; // class BBRTCTask
+
+//
+// One outstanding operation; lives in the frame of the awaiting coroutine
+//
+class BBRTCAsyncOp
+{
+public:
+    bool await_ready() { return false; }
+    bool await_suspend(std::coroutine_handle<> h);
+    int await_resume() { return iResult; }
+
+    BBRTCEventLoop *pLoop;
+    BBRTCAsyncOp *pNext; // queue link
+    std::coroutine_handle<> hWaiter;
+    BBRTC *pRTC;
+    int iOp; // RTC_ASYNC_xxx
+    struct tm *pTime;
+    uint8_t u8Type; // alarm type
+    int iPollMs;
+    int64_t i64Deadline, i64Timer; // CLOCK_MONOTONIC ns (-1 = none)
+    RTC_ASYNC_CALLBACK *pfnCall;
+    void *pUser;
+    int iResult;
+}; // class BBRTCAsyncOp
+
+class BBRTCEventLoop
+{
+public:
+    BBRTCEventLoop();
+    ~BBRTCEventLoop();
+    void spawn(BBRTCTask &&task);
+    int run(int iTimeoutMs = -1);
+    int getTasks(void) { return _iTasks; }
+    int getWorkers(void) { return _iWorkers; }
+    // awaitable versions of the BBRTC methods
+    BBRTCAsyncOp getTime(BBRTC *pRTC, struct tm *pTime);
+    BBRTCAsyncOp setTime(BBRTC *pRTC, struct tm *pTime);
+    BBRTCAsyncOp setAlarm(BBRTC *pRTC, uint8_t u8Type, struct tm *pTime);
+    BBRTCAsyncOp getStatus(BBRTC *pRTC);
+    BBRTCAsyncOp waitForAlarm(BBRTC *pRTC, int iTimeoutMs = -1, int iPollMs = 100);
+    BBRTCAsyncOp call(BBRTC *pRTC, RTC_ASYNC_CALLBACK *pfnCall, void *pUser = NULL);
+    BBRTCAsyncOp sleep(int iMs);
+
+private:
+    typedef struct _tagrtcworker
+    {
+        BBRTCEventLoop *pLoop;
+        uintptr_t uKey; // BBRTCTransport::getBusKey()
+        BBRTCAsyncOp *pHead, *pTail;
+        bool bStop;
+        pthread_t thread;
+        pthread_mutex_t mutex;
+        pthread_cond_t cond;
+    } RTC_WORKER;
+    friend class BBRTCAsyncOp;
+    friend struct BBRTCTask::promise_type::FinalAwaiter;
+    static void *workerProc(void *pArg);
+    void taskDone(BBRTCTask::promise_type *pTask);
+    BBRTCAsyncOp newOp(int iOp, BBRTC *pRTC);
+    bool submit(BBRTCAsyncOp *pOp);
+    bool queue(BBRTCAsyncOp *pOp);
+    void complete(BBRTCAsyncOp *pOp);
+    bool addTimer(BBRTCAsyncOp *pOp);
+    BBRTCAsyncOp *nextTimer(int64_t i64Now);
+    RTC_WORKER *getWorker(uintptr_t uKey);
+    int _iEvent; // eventfd signalled by the workers
+    int _iTasks; // spawned tasks which haven't finished
+    BBRTCTask::promise_type *_pTasks; // list of them
+    BBRTCTask::promise_type *_pReadyHead, *_pReadyTail; // tasks to start
+    pthread_mutex_t _mutex; // protects the done queue
+    BBRTCAsyncOp *_pDoneHead, *_pDoneTail;
+    BBRTCAsyncOp **_pTimers; // binary heap on i64Timer
+    int _iTimers, _iTimerSize;
+    RTC_WORKER _workers[RTC_ASYNC_MAX_BUSES];
+    int _iWorkers;
+}; // class BBRTCEventLoop
+
+#endif // __LINUX__ && __cpp_impl_coroutine
+#endif // __BB_RTC_ASYNC__
@@ -0,0 +1,162 @@
+//
+// BitBank RealTime Clock library (bb_rtc)
+// Simulated GPIO pins with an I2C slave for the bit banged engine
+// written by Larry Bank (bitbank@pobox.com)
+//
+// SPDX-FileCopyrightText: 2025 BitBank Software, Inc.
+// SPDX-License-Identifier: Apache-2.0
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===========================================================================
+#ifdef __LINUX__
+#include "bb_rtc_bitbang.h"
+
+void BBRTCSimGPIO::reset(void)
+{
+    _bMasterSDA = _bMasterSCL = _bSlaveSDA = true;
+    _bSDA = _bSCL = true;
+    _iHold = 0;
+    _iState = SIM_IDLE;
+    _iBit = 0;
+    _u8Shift = _u8Addr = _u8Out = 0;
+    _bAck = false;
+    _iLen = 0;
+    clearCounts();
+} /* reset() */
+
+//
+// Leave the slave in the middle of sending a 0x00 byte, holding SDA low
+// (as if the master had been reset during a read)
+//
+void BBRTCSimGPIO::stickSDA(void)
+{
+    _iState = SIM_READ;
+    _iBit = 1;
+    _u8Out = 0;
+    _bAck = true;
+    _bSlaveSDA = false;
+    update();
+} /* stickSDA() */
+
+//
+// Work out the line levels (wired AND of the master and the slave) after
+// a pin changed and pass any edge to the slave
+//
+void BBRTCSimGPIO::update(void)
+{
+bool bSDA, bSCL;
+
+    bSDA = _bMasterSDA && _bSlaveSDA;
+    bSCL = _bMasterSCL && _iHold == 0;
+    if (bSCL != _bSCL) {
+        _bSCL = bSCL;
+        _bSDA = bSDA;
+        if (bSCL) onRise();
+        else onFall();
+        _bSDA = _bMasterSDA && _bSlaveSDA; // the slave may have changed SDA
+    } else if (bSDA != _bSDA) {
+        _bSDA = bSDA;
+        if (bSCL) { // SDA changing while SCL is high
+            if (bSDA) onStop();
+            else onStart();
+        }
+    }
+} /* update() */
+
+//
+// Pass a complete write on to the bus
+//
+void BBRTCSimGPIO::flush(void)
+{
+    if (_iLen && _pBus->write(_u8Addr, _u8Buf, _iLen) <= 0) _u32Errors++;
+    _iLen = 0;
+} /* flush() */
+
+void BBRTCSimGPIO::onStart(void)
+{
+    if (_iState == SIM_WRITE) flush(); // repeated start
+    _iState = SIM_ADDR;
+    _iBit = 0;
+    _u8Shift = 0;
+    _bSlaveSDA = true;
+} /* onStart() */
+
+void BBRTCSimGPIO::onStop(void)
+{
+    if (_iState == SIM_WRITE) flush();
+    _iState = SIM_IDLE;
+    _bSlaveSDA = true;
+} /* onStop() */
+
+//
+// SCL rising: sample a data bit from the master or its ACK of a byte read
+//
+void BBRTCSimGPIO::onRise(void)
+{
+    if (_iState == SIM_IDLE) return;
+    if (_iBit < 8) {
+        if (_iState != SIM_READ) _u8Shift = (uint8_t)((_u8Shift << 1) | (_bSDA ? 1 : 0));
+    } else if (_iBit == 8 && _iState == SIM_READ) {
+        _bAck = !_bSDA;
+    }
+    _iBit++;
+} /* onRise() */
+
+//
+// SCL falling: the slave sets up its next bit on SDA
+//
+void BBRTCSimGPIO::onFall(void)
+{
+    if (_iState == SIM_IDLE) return;
+    if (_iBit == 8) { // a whole byte went by; the ACK clock is next
+        _u32Bytes++;
+        if (_iState == SIM_ADDR) {
+            _u8Addr = _u8Shift >> 1;
+            if (_pBus->probe(_u8Addr) > 0) {
+                _bSlaveSDA = false;
+                _iState = (_u8Shift & 1) ? SIM_READ : SIM_WRITE;
+                _bAck = true; // send the first byte
+                _iLen = 0;
+            } else { // nobody home; ignore the rest until the next START
+                _bSlaveSDA = true;
+                _iState = SIM_IDLE;
+            }
+        } else if (_iState == SIM_WRITE) {
+            if (_iLen < RTC_SIMGPIO_MAX) {
+                _u8Buf[_iLen++] = _u8Shift;
+                _bSlaveSDA = false;
+            } else {
+                _bSlaveSDA = true;
+                _u32Errors++;
+            }
+        } else { // SIM_READ; let the master ACK
+            _bSlaveSDA = true;
+        }
+    } else if (_iBit == 9) { // end of the ACK clock
+        _iBit = 0;
+        _u8Shift = 0;
+        _iHold = _iStretch; // clock stretching
+        _bSlaveSDA = true;
+        if (_iState == SIM_READ) {
+            if (_bAck) { // the master wants another byte
+                if (_pBus->read(_u8Addr, &_u8Out, 1) <= 0) {
+                    _u8Out = 0xff;
+                    _u32Errors++;
+                }
+                _bSlaveSDA = (_u8Out & 0x80) != 0;
+            } else {
+                _iState = SIM_IDLE; // NACK; the STOP is next
+            }
+        }
+    } else if (_iState == SIM_READ) {
+        _bSlaveSDA = ((_u8Out >> (7 - _iBit)) & 1) != 0;
+    }
+} /* onFall() */
+#endif // __LINUX__
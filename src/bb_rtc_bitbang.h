@@ -0,0 +1,311 @@
+#ifndef __BB_RTC_BITBANG__
+#define __BB_RTC_BITBANG__
+//
+// BitBank Realtime Clock Library
+// Bit banged I2C master for any pair of GPIO pins
+// written by Larry Bank (bitbank@pobox.com)
+//
+// SPDX-FileCopyrightText: 2025 BitBank Software, Inc.
+// SPDX-License-Identifier: Apache-2.0
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===========================================================================
+//
+// The engine is a static transport (see BBRTCStaticTransport) built on a
+// GPIO class G which configures the pins as open drain once in init() and
+// then only drives or releases them:
+//
+//   int init(int iSDA, int iSCL); // RTC_SUCCESS or RTC_ERROR
+//   void sdaLow(); void sdaHigh(); // drive low / release
+//   void sclLow(); void sclHigh();
+//   int sdaRead(); int sclRead(); // line levels
+//   uint32_t micros(); // free running microseconds (for calibration)
+//
+// Every call is resolved at compile time, so each edge costs whatever the
+// platform's cheapest pin write is. SDA is only written when it changes.
+// The half bit time is a spin loop calibrated against micros() for the
+// requested speed and can be tuned by hand. After each SCL release the
+// line is read back until the slave stops stretching it (or the stretch
+// timeout runs out); a timeout of 0 skips the read for buses without
+// clock stretching. readRegister() uses a repeated start. A START on a
+// bus which isn't idle fails with -RTC_BUS_STUCK and a stretch which
+// runs out with -RTC_TIMEOUT; doRecover() clocks a stuck slave free.
+// Use BBRTCTransportAdapter<BBRTCBitBang<G> > to plug it into a BBRTC.
+//
+#include "bb_rtc.h"
+
+#define RTC_BB_STRETCH 20000 // SCL reads before a stretch times out
+
+template <class G>
+class BBRTCBitBang : public BBRTCStaticTransport<BBRTCBitBang<G> >
+{
+public:
+    G gpio;
+    BBRTCBitBang() : _iHalf(0), _iStretch(RTC_BB_STRETCH), _bSDA(true), _u32Timeouts(0) {}
+
+    //
+    // Configure the pins and calibrate the timing for u32Speed (Hz)
+    // returns RTC_SUCCESS or RTC_ERROR
+    //
+    int init(int iSDA, int iSCL, uint32_t u32Speed = 100000)
+    {
+        if (gpio.init(iSDA, iSCL) != RTC_SUCCESS) return RTC_ERROR;
+        _bSDA = true;
+        setSpeed(u32Speed);
+        return RTC_SUCCESS;
+    } /* init() */
+
+    //
+    // Time the spin loop and size the half bit time for u32Speed
+    // (0 = as fast as the pins can go)
+    //
+    void setSpeed(uint32_t u32Speed)
+    {
+        uint32_t u32Start, u32Us;
+        _iHalf = 0;
+        if (u32Speed == 0) return;
+        u32Start = gpio.micros();
+        spin(RTC_BB_CALIBRATE);
+        u32Us = gpio.micros() - u32Start;
+        if (u32Us == 0) return; // no clock to calibrate against
+        _iHalf = (int)(((uint64_t)RTC_BB_CALIBRATE * 500000) / ((uint64_t)u32Us * u32Speed));
+    } /* setSpeed() */
+    void setHalfLoops(int iLoops) { _iHalf = (iLoops < 0) ? 0 : iLoops; }
+    int getHalfLoops(void) { return _iHalf; }
+    void setStretchTimeout(int iReads) { _iStretch = (iReads < 0) ? 0 : iReads; }
+    uint32_t getTimeouts(void) { return _u32Timeouts; }
+
+    int doProbe(uint8_t u8Addr)
+    {
+        int rc = start(u8Addr << 1);
+        stop();
+        return rc;
+    } /* doProbe() */
+
+    int doWrite(uint8_t u8Addr, uint8_t *pData, int iLen)
+    {
+        int i, rc = start(u8Addr << 1);
+        for (i=0; i<iLen && rc > 0; i++) {
+            rc = byteOut(pData[i]);
+        }
+        stop();
+        return (rc > 0) ? iLen : rc;
+    } /* doWrite() */
+
+    int doRead(uint8_t u8Addr, uint8_t *pData, int iLen)
+    {
+        int rc = start((u8Addr << 1) | 1);
+        if (rc > 0) rc = readBytes(pData, iLen);
+        stop();
+        return (rc > 0) ? iLen : rc;
+    } /* doRead() */
+
+    int doReadRegister(uint8_t u8Addr, uint8_t u8Reg, uint8_t *pData, int iLen)
+    {
+        int rc = start(u8Addr << 1);
+        if (rc > 0) rc = byteOut(u8Reg);
+        if (rc > 0) rc = restart((u8Addr << 1) | 1);
+        if (rc > 0) rc = readBytes(pData, iLen);
+        stop();
+        return (rc > 0) ? iLen : rc;
+    } /* doReadRegister() */
+
+    //
+    // Free a slave which is holding SDA low (e.g. it or the master was
+    // reset in the middle of a read): clock SCL until it lets go (9 clocks
+    // at most finish its byte and the NACK), then send a STOP
+    // returns RTC_SUCCESS or RTC_BUS_STUCK
+    //
+    int doRecover(void)
+    {
+        int i;
+        setSDA(true);
+        sclRise();
+        for (i=0; i<9 && !gpio.sdaRead(); i++) {
+            gpio.sclLow();
+            spin(_iHalf);
+            sclRise();
+            spin(_iHalf);
+        }
+        gpio.sclLow();
+        spin(_iHalf);
+        stop();
+        return (gpio.sdaRead() && gpio.sclRead()) ? RTC_SUCCESS : RTC_BUS_STUCK;
+    } /* doRecover() */
+
+private:
+    enum { RTC_BB_CALIBRATE = 20000 };
+    static void spin(int iLoops)
+    {
+        for (int i=0; i<iLoops; i++) {
+            __asm__ __volatile__("" ::: "memory"); // keep the loop
+        }
+    }
+    inline void setSDA(bool bHigh)
+    {
+        if (bHigh == _bSDA) return;
+        if (bHigh) gpio.sdaHigh();
+        else gpio.sdaLow();
+        _bSDA = bHigh;
+    }
+    // release SCL and wait for any clock stretching to end
+    inline int sclRise(void)
+    {
+        int i = _iStretch;
+        gpio.sclHigh();
+        if (i == 0) return 1;
+        while (!gpio.sclRead()) {
+            if (--i == 0) {
+                _u32Timeouts++;
+                return 0;
+            }
+        }
+        return 1;
+    }
+    // send 8 bits; returns 1 if the slave ACKed, 0 or -RTC_TIMEOUT if not
+    int byteOut(uint8_t u8)
+    {
+        int i, iAck;
+        for (i=0; i<8; i++) {
+            setSDA((u8 & 0x80) != 0);
+            u8 <<= 1;
+            spin(_iHalf);
+            if (!sclRise()) return -RTC_TIMEOUT;
+            spin(_iHalf);
+            gpio.sclLow();
+        }
+        setSDA(true); // let the slave drive the ACK
+        spin(_iHalf);
+        if (!sclRise()) return -RTC_TIMEOUT;
+        spin(_iHalf);
+        iAck = !gpio.sdaRead();
+        gpio.sclLow();
+        return iAck;
+    }
+    // receive a burst, ACKing all but the last byte
+    // returns 1 or -RTC_TIMEOUT if the slave stretched the clock too long
+    int readBytes(uint8_t *pData, int iLen)
+    {
+        int i, j;
+        uint8_t u8;
+        for (j=0; j<iLen; j++) {
+            setSDA(true);
+            u8 = 0;
+            for (i=0; i<8; i++) {
+                spin(_iHalf);
+                if (!sclRise()) return -RTC_TIMEOUT;
+                spin(_iHalf);
+                u8 = (u8 << 1) | (gpio.sdaRead() ? 1 : 0);
+                gpio.sclLow();
+            }
+            pData[j] = u8;
+            setSDA(j == iLen-1); // NACK the last one
+            spin(_iHalf);
+            if (!sclRise()) return -RTC_TIMEOUT;
+            spin(_iHalf);
+            gpio.sclLow();
+        }
+        return 1;
+    }
+    // from idle (both lines high): START + address byte
+    int start(uint8_t u8Addr)
+    {
+        if (!gpio.sdaRead() || !gpio.sclRead()) return -RTC_BUS_STUCK; // someone is holding the bus
+        setSDA(false);
+        spin(_iHalf);
+        gpio.sclLow();
+        return byteOut(u8Addr);
+    }
+    // with SCL low: repeated START + address byte
+    int restart(uint8_t u8Addr)
+    {
+        setSDA(true);
+        spin(_iHalf);
+        if (!sclRise()) return -RTC_TIMEOUT;
+        spin(_iHalf);
+        return start(u8Addr);
+    }
+    // with SCL low: STOP, leaving both lines released
+    void stop(void)
+    {
+        setSDA(false);
+        spin(_iHalf);
+        sclRise();
+        spin(_iHalf);
+        setSDA(true);
+        spin(_iHalf);
+    }
+    int _iHalf; // spin loops per half bit
+    int _iStretch; // SCL reads allowed for clock stretching (0 = don't check)
+    bool _bSDA; // level we're leaving SDA at
+    uint32_t _u32Timeouts; // clock stretches which ran out
+}; // class BBRTCBitBang
+
+#ifdef __LINUX__
+//
+// Simulated GPIO pins with an I2C slave on them (Linux)
+// The slave decodes the pin activity into START/STOP, bytes and ACKs and
+// passes complete transactions on to another transport (e.g. a
+// BBRTCSimTransport), so a BBRTCBitBang<BBRTCSimGPIO> can run the whole
+// library without a board. Every pin call is counted, which gives the
+// cost of the engine in pin operations per byte on the wire. The slave
+// can also stretch SCL after each byte, or be left holding SDA low in
+// the middle of a read (stickSDA()) to test bus recovery.
+//
+#define RTC_SIMGPIO_MAX 256 // longest write passed on
+
+class BBRTCSimGPIO
+{
+public:
+    BBRTCSimGPIO() : _pBus(NULL), _iStretch(0) { reset(); }
+    void attach(BBRTCTransport *pBus) { _pBus = pBus; }
+    void setStretch(int iReads) { _iStretch = (iReads < 0) ? 0 : iReads; }
+    int init(int iSDA, int iSCL) { (void)iSDA; (void)iSCL; reset(); return (_pBus) ? RTC_SUCCESS : RTC_ERROR; }
+    void sdaLow(void) { _u32Ops++; _bMasterSDA = false; update(); }
+    void sdaHigh(void) { _u32Ops++; _bMasterSDA = true; update(); }
+    void sclLow(void) { _u32Ops++; _bMasterSCL = false; update(); }
+    void sclHigh(void) { _u32Ops++; _bMasterSCL = true; update(); }
+    int sdaRead(void) { _u32Ops++; return _bSDA; }
+    int sclRead(void)
+    {
+        _u32Ops++;
+        if (_iHold && --_iHold == 0) update(); // the slave lets go
+        return _bSCL;
+    }
+    uint32_t micros(void) { return 0; } // run flat out
+    uint32_t getOps(void) { return _u32Ops; }
+    uint32_t getBytes(void) { return _u32Bytes; }
+    uint32_t getErrors(void) { return _u32Errors; }
+    void clearCounts(void) { _u32Ops = _u32Bytes = _u32Errors = 0; }
+    void stickSDA(void);
+
+private:
+    enum { SIM_IDLE = 0, SIM_ADDR, SIM_WRITE, SIM_READ };
+    void reset(void);
+    void update(void);
+    void onStart(void);
+    void onStop(void);
+    void onRise(void);
+    void onFall(void);
+    void flush(void);
+    BBRTCTransport *_pBus;
+    bool _bMasterSDA, _bMasterSCL, _bSlaveSDA; // false = pulling low
+    bool _bSDA, _bSCL; // line levels
+    int _iStretch, _iHold; // SCL reads the slave holds the clock for
+    int _iState, _iBit;
+    uint8_t _u8Shift, _u8Addr, _u8Out;
+    bool _bAck; // master ACKed the last byte read
+    int _iLen;
+    uint8_t _u8Buf[RTC_SIMGPIO_MAX];
+    uint32_t _u32Ops, _u32Bytes, _u32Errors;
+}; // class BBRTCSimGPIO
+#endif // __LINUX__
+
+#endif // __BB_RTC_BITBANG__
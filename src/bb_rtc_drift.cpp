@@ -0,0 +1,278 @@
+//
+// BitBang RealTime Clock library (bb_rtc)
+// Online drift monitor
+// written by Larry Bank (bitbank@pobox.com)
+//
+// SPDX-FileCopyrightText: 2025 BitBank Software, Inc.
+// SPDX-License-Identifier: Apache-2.0
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===========================================================================
+#ifdef __LINUX__
+#include "bb_rtc_drift.h"
+#include <math.h>
+#include <stdlib.h>
+
+// A sample this far from the fit means the RTC time was changed
+#define RTC_DRIFT_STEP_NS 500000000.0
+
+static int compareDouble(const void *a, const void *b)
+{
+double d = *(const double *)a - *(const double *)b;
+
+    return (d < 0.0) ? -1 : (d > 0.0);
+} /* compareDouble() */
+
+static double median(double *pList, int iCount)
+{
+    qsort(pList, iCount, sizeof(double), compareDouble);
+    if (iCount & 1) return pList[iCount/2];
+    return (pList[iCount/2 - 1] + pList[iCount/2]) / 2.0;
+} /* median() */
+
+BBRTCDriftMonitor::BBRTCDriftMonitor()
+{
+    _pRTC = NULL;
+    _iInterval = 60;
+    _iWindow = 32;
+    _iCount = _iHead = 0;
+    _dMaxPPM = 20.0; // typical crystal tolerance at 25C
+    _dMaxOffsetNs = 1e9;
+    _dSlope = _dIntercept = _dJitter = _dOffset = 0.0;
+    _i64BaseMono = _i64LastReal = 0;
+    _u32BaseEpoch = 0;
+    _bRunning = false;
+    pthread_mutex_init(&_mutex, NULL);
+    pthread_cond_init(&_cond, NULL);
+} /* BBRTCDriftMonitor() */
+
+//
+// Set the thresholds for the out-of-spec flag
+//
+void BBRTCDriftMonitor::setLimits(double dMaxPPM, double dMaxOffsetNs)
+{
+    pthread_mutex_lock(&_mutex);
+    _dMaxPPM = dMaxPPM;
+    _dMaxOffsetNs = dMaxOffsetNs;
+    pthread_mutex_unlock(&_mutex);
+} /* setLimits() */
+
+//
+// Start sampling the RTC every iIntervalSec seconds
+// The fit uses the last iWindow samples
+// returns RTC_SUCCESS or RTC_ERROR
+//
+int BBRTCDriftMonitor::start(BBRTC *pRTC, int iIntervalSec, int iWindow)
+{
+    if (_bRunning || pRTC == NULL || iIntervalSec < 1) return RTC_ERROR;
+    if (iWindow < 3) iWindow = 3;
+    if (iWindow > RTC_DRIFT_MAX_WINDOW) iWindow = RTC_DRIFT_MAX_WINDOW;
+    _pRTC = pRTC;
+    _iInterval = iIntervalSec;
+    pthread_mutex_lock(&_mutex);
+    _iWindow = iWindow;
+    _iCount = _iHead = 0;
+    pthread_mutex_unlock(&_mutex);
+    _bRunning = true;
+    if (pthread_create(&_thread, NULL, threadProc, this) != 0) {
+        _bRunning = false;
+        return RTC_ERROR;
+    }
+    return RTC_SUCCESS;
+} /* start() */
+
+void BBRTCDriftMonitor::stop(void)
+{
+    if (!_bRunning) return;
+    pthread_mutex_lock(&_mutex);
+    _bRunning = false;
+    pthread_cond_signal(&_cond);
+    pthread_mutex_unlock(&_mutex);
+    pthread_join(_thread, NULL);
+} /* stop() */
+
+//
+// Add an edge measurement; this can also be called directly (e.g. with
+// the edges from BBRTCRefclock) instead of running the thread
+// returns RTC_SUCCESS or RTC_ERROR
+//
+int BBRTCDriftMonitor::addSample(const RTC_EDGE *pEdge)
+{
+int i, iLast;
+double dY, dX;
+
+    if (pEdge == NULL) return RTC_ERROR;
+    pthread_mutex_lock(&_mutex);
+    if (_iCount == 0) {
+        _i64BaseMono = pEdge->i64MonoNs;
+        _u32BaseEpoch = pEdge->u32Epoch;
+    }
+    // RTC - monotonic relative to the origin (keeps the doubles precise)
+    dY = (double)(((int64_t)pEdge->u32Epoch - _u32BaseEpoch) * 1000000000LL - (pEdge->i64MonoNs - _i64BaseMono));
+    if (_iCount >= 2) { // check for a step (the RTC time was set)
+        dX = (double)(pEdge->i64MonoNs - _i64BaseMono) / 1e9;
+        if (fabs(dY - (_dIntercept + _dSlope * dX)) > RTC_DRIFT_STEP_NS) {
+            _iCount = _iHead = 0;
+            _i64BaseMono = pEdge->i64MonoNs;
+            _u32BaseEpoch = pEdge->u32Epoch;
+            dY = 0.0;
+        }
+    } else if (_iCount == 1) {
+        iLast = (_iHead + RTC_DRIFT_MAX_WINDOW - 1) % RTC_DRIFT_MAX_WINDOW;
+        if (fabs(dY - _dY[iLast]) > RTC_DRIFT_STEP_NS) {
+            _iCount = _iHead = 0;
+            _i64BaseMono = pEdge->i64MonoNs;
+            _u32BaseEpoch = pEdge->u32Epoch;
+            dY = 0.0;
+        }
+    }
+    i = _iHead;
+    _i64Mono[i] = pEdge->i64MonoNs;
+    _dY[i] = dY;
+    _iHead = (_iHead + 1) % RTC_DRIFT_MAX_WINDOW;
+    if (_iCount < _iWindow) _iCount++;
+    _dOffset = (double)((int64_t)pEdge->u32Epoch * 1000000000LL - pEdge->i64RealNs);
+    _i64LastReal = pEdge->i64RealNs;
+    fit();
+    pthread_mutex_unlock(&_mutex);
+    return RTC_SUCCESS;
+} /* addSample() */
+
+//
+// Theil-Sen fit of the window (called with the mutex held)
+//
+void BBRTCDriftMonitor::fit(void)
+{
+double dX[RTC_DRIFT_MAX_WINDOW], dY[RTC_DRIFT_MAX_WINDOW], dR[RTC_DRIFT_MAX_WINDOW];
+int i, j, k, n = 0;
+
+    // gather the window, oldest first, relative to the origin
+    for (i=0; i<_iCount; i++) {
+        k = (_iHead + RTC_DRIFT_MAX_WINDOW - _iCount + i) % RTC_DRIFT_MAX_WINDOW;
+        dX[i] = (double)(_i64Mono[k] - _i64BaseMono) / 1e9;
+        dY[i] = _dY[k];
+    }
+    if (_iCount < 2) {
+        _dSlope = 0.0;
+        _dIntercept = (_iCount) ? dY[0] : 0.0;
+        _dJitter = 0.0;
+        return;
+    }
+    for (i=0; i<_iCount-1; i++) {
+        for (j=i+1; j<_iCount; j++) {
+            if (dX[j] - dX[i] > 1e-3)
+                _dSlopes[n++] = (dY[j] - dY[i]) / (dX[j] - dX[i]);
+        }
+    }
+    _dSlope = (n) ? median(_dSlopes, n) : 0.0;
+    for (i=0; i<_iCount; i++)
+        dR[i] = dY[i] - _dSlope * dX[i];
+    _dIntercept = median(dR, _iCount);
+    for (i=0; i<_iCount; i++)
+        dR[i] = fabs(dY[i] - (_dIntercept + _dSlope * dX[i]));
+    _dJitter = median(dR, _iCount);
+} /* fit() */
+
+//
+// Frequency error in parts per million (+ = RTC runs fast)
+//
+double BBRTCDriftMonitor::getPPM(void)
+{
+double d;
+
+    pthread_mutex_lock(&_mutex);
+    d = _dSlope / 1000.0; // ns per second = ppb
+    pthread_mutex_unlock(&_mutex);
+    return d;
+} /* getPPM() */
+
+//
+// Predict the RTC - CLOCK_REALTIME offset (ns) at the given realtime
+//
+double BBRTCDriftMonitor::predictOffset(int64_t i64RealNs)
+{
+double d;
+
+    pthread_mutex_lock(&_mutex);
+    d = _dOffset + _dSlope * (double)(i64RealNs - _i64LastReal) / 1e9;
+    pthread_mutex_unlock(&_mutex);
+    return d;
+} /* predictOffset() */
+
+//
+// Seconds from the last sample until the predicted offset exceeds the
+// offset limit (0 if it already has, -1 if it never will)
+//
+int64_t BBRTCDriftMonitor::timeToLimit(void)
+{
+int64_t i64;
+double dLimit;
+
+    pthread_mutex_lock(&_mutex);
+    if (fabs(_dOffset) >= _dMaxOffsetNs) {
+        i64 = 0;
+    } else if (fabs(_dSlope) < 1e-3) {
+        i64 = -1;
+    } else {
+        dLimit = (_dSlope > 0.0) ? _dMaxOffsetNs : -_dMaxOffsetNs;
+        i64 = (int64_t)((dLimit - _dOffset) / _dSlope);
+        if (i64 < 0) i64 = -1; // moving away from the limit
+    }
+    pthread_mutex_unlock(&_mutex);
+    return i64;
+} /* timeToLimit() */
+
+bool BBRTCDriftMonitor::isOutOfSpec(void)
+{
+RTC_DRIFT drift;
+
+    getDrift(&drift);
+    return drift.bOutOfSpec;
+} /* isOutOfSpec() */
+
+//
+// Return the current estimate
+// returns RTC_SUCCESS or RTC_ERROR if there isn't enough data yet
+//
+int BBRTCDriftMonitor::getDrift(RTC_DRIFT *pDrift)
+{
+    if (pDrift == NULL) return RTC_ERROR;
+    pthread_mutex_lock(&_mutex);
+    pDrift->dPPM = _dSlope / 1000.0;
+    pDrift->dOffsetNs = _dOffset;
+    pDrift->dJitterNs = _dJitter;
+    pDrift->i64LastRealNs = _i64LastReal;
+    pDrift->iSamples = _iCount;
+    pDrift->bOutOfSpec = (_iCount >= 3 && fabs(pDrift->dPPM) > _dMaxPPM) || (_iCount && fabs(_dOffset) > _dMaxOffsetNs);
+    pthread_mutex_unlock(&_mutex);
+    return (_iCount >= 2) ? RTC_SUCCESS : RTC_ERROR;
+} /* getDrift() */
+
+void * BBRTCDriftMonitor::threadProc(void *pArg)
+{
+BBRTCDriftMonitor *pThis = (BBRTCDriftMonitor *)pArg;
+RTC_EDGE edge;
+struct timespec ts;
+
+    while (pThis->_bRunning) {
+        if (pThis->_pRTC->waitForSecond(&edge, 2000) == RTC_SUCCESS)
+            pThis->addSample(&edge);
+        // sleep until the next interval (or until stop() is called)
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += pThis->_iInterval - 1; // waitForSecond() takes up to 1s
+        pthread_mutex_lock(&pThis->_mutex);
+        if (pThis->_bRunning && pThis->_iInterval > 1)
+            pthread_cond_timedwait(&pThis->_cond, &pThis->_mutex, &ts);
+        pthread_mutex_unlock(&pThis->_mutex);
+    }
+    return NULL;
+} /* threadProc() */
+
+#endif // __LINUX__
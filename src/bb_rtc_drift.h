@@ -0,0 +1,80 @@
+#ifndef __BB_RTC_DRIFT__
+#define __BB_RTC_DRIFT__
+//
+// BitBank Realtime Clock Library
+// Online drift monitor (Linux only)
+// written by Larry Bank (bitbank@pobox.com)
+//
+// SPDX-FileCopyrightText: 2025 BitBank Software, Inc.
+// SPDX-License-Identifier: Apache-2.0
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===========================================================================
+//
+// A background thread periodically timestamps an RTC second edge against
+// CLOCK_REALTIME and CLOCK_MONOTONIC. The frequency error comes from a
+// Theil-Sen (median of pairwise slopes) fit of the RTC vs. monotonic time
+// over a sliding window, so a few bad samples don't skew it. The offset is
+// measured against CLOCK_REALTIME.
+//
+#include "bb_rtc.h"
+#include <pthread.h>
+
+#define RTC_DRIFT_MAX_WINDOW 64
+
+//
+// Current state of the drift estimate
+//
+typedef struct _tagrtcdrift
+{
+  double dPPM; // frequency error (+ = RTC runs fast)
+  double dOffsetNs; // RTC - CLOCK_REALTIME at the last sample
+  double dJitterNs; // median absolute residual of the fit
+  int64_t i64LastRealNs; // CLOCK_REALTIME of the last sample
+  int iSamples; // samples in the window
+  bool bOutOfSpec; // |ppm| or |offset| exceeds the limits
+} RTC_DRIFT;
+
+class BBRTCDriftMonitor
+{
+public:
+    BBRTCDriftMonitor();
+    ~BBRTCDriftMonitor() { stop(); }
+    int start(BBRTC *pRTC, int iIntervalSec = 60, int iWindow = 32);
+    void stop(void);
+    void setLimits(double dMaxPPM, double dMaxOffsetNs);
+    int addSample(const RTC_EDGE *pEdge);
+    int getDrift(RTC_DRIFT *pDrift);
+    double getPPM(void);
+    double predictOffset(int64_t i64RealNs);
+    int64_t timeToLimit(void);
+    bool isOutOfSpec(void);
+
+private:
+    static void *threadProc(void *pArg);
+    void fit(void);
+    BBRTC *_pRTC;
+    int _iInterval, _iWindow, _iCount, _iHead;
+    double _dMaxPPM, _dMaxOffsetNs;
+    double _dSlope, _dIntercept, _dJitter; // y = ns of RTC - monotonic vs. x = seconds
+    int64_t _i64BaseMono; // x/y origin
+    uint32_t _u32BaseEpoch;
+    int64_t _i64Mono[RTC_DRIFT_MAX_WINDOW];
+    double _dY[RTC_DRIFT_MAX_WINDOW];
+    double _dOffset; // last RTC - realtime offset
+    double _dSlopes[RTC_DRIFT_MAX_WINDOW * (RTC_DRIFT_MAX_WINDOW-1) / 2];
+    int64_t _i64LastReal;
+    volatile bool _bRunning;
+    pthread_t _thread;
+    pthread_mutex_t _mutex;
+    pthread_cond_t _cond;
+}; // class BBRTCDriftMonitor
+
+#endif // __BB_RTC_DRIFT__
@@ -0,0 +1,188 @@
+//
+// BitBank RealTime Clock library (bb_rtc)
+// Synchronized time setting for many RTCs
+// written by Larry Bank (bitbank@pobox.com)
+//
+// SPDX-FileCopyrightText: 2025 BitBank Software, Inc.
+// SPDX-License-Identifier: Apache-2.0
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===========================================================================
+#ifdef __LINUX__
+#include "bb_rtc_fleet.h"
+#include <errno.h>
+
+// Sleep until this long before the release, then spin on the clock
+#define RTC_FLEET_SPIN_NS 300000LL
+
+static int64_t fleetNowNs(void)
+{
+struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+} /* fleetNowNs() */
+
+//
+// Add an (initialized) device to the group
+// returns RTC_SUCCESS or RTC_ERROR
+//
+int BBRTCFleet::add(BBRTC *pRTC)
+{
+uint8_t u8Block[RTC_TIME_BLOCK];
+struct tm tmTest;
+int i;
+
+    if (pRTC == NULL || _iCount >= RTC_FLEET_MAX || !(pRTC->getCaps() & RTC_CAP_TIME)) return RTC_ERROR;
+    for (i=0; i<_iCount; i++) {
+        if (_pRTC[i] == pRTC) return RTC_ERROR; // already added
+    }
+    // devices on the same bus are written by the same thread; kernel
+    // drivers (no register block) each get their own
+    memset(&tmTest, 0, sizeof(tmTest));
+    tmTest.tm_mday = 1;
+    if (pRTC->encodeTime(&tmTest, u8Block)) _uKey[_iCount] = pRTC->getTransport()->getBusKey();
+    else _uKey[_iCount] = (uintptr_t)pRTC;
+    for (i=0; i<_iCount; i++) {
+        if (_uKey[i] == _uKey[_iCount]) break;
+    }
+    _iBus[_iCount] = (i < _iCount) ? _iBus[i] : _iBuses++;
+    _pRTC[_iCount] = pRTC;
+    _iLen[_iCount] = 0;
+    memset(&_result[_iCount], 0, sizeof(RTC_FLEET_RESULT));
+    _iCount++;
+    return RTC_SUCCESS;
+} /* add() */
+
+//
+// Writes the staged blocks of the devices on one bus at the release time
+//
+void * BBRTCFleet::busProc(void *pArg)
+{
+RTC_FLEET_BUS *pBus = (RTC_FLEET_BUS *)pArg;
+BBRTCFleet *pThis = pBus->pFleet;
+RTC_FLEET_RESULT *pR;
+struct timespec ts;
+int64_t i64Wake, i64Start, i64End;
+int i;
+
+    pthread_mutex_lock(&pThis->_mutex);
+    pThis->_iWaiting++;
+    pthread_cond_broadcast(&pThis->_cond);
+    while (!pThis->_bGo) {
+        pthread_cond_wait(&pThis->_cond, &pThis->_mutex);
+    }
+    pthread_mutex_unlock(&pThis->_mutex);
+    if (pThis->_bAbort) return NULL;
+    i64Wake = pThis->_i64ReleaseNs - RTC_FLEET_SPIN_NS;
+    ts.tv_sec = (time_t)(i64Wake / 1000000000LL);
+    ts.tv_nsec = (long)(i64Wake % 1000000000LL);
+    while (clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &ts, NULL) == EINTR) {}
+    while (fleetNowNs() < pThis->_i64ReleaseNs) {}
+    for (i=0; i<pThis->_iCount; i++) {
+        if (pThis->_iBus[i] != pBus->iBus) continue;
+        pR = &pThis->_result[i];
+        i64Start = fleetNowNs();
+        if (pThis->_iLen[i]) {
+            pR->iResult = pThis->_pRTC[i]->writeTime(pThis->_u8Block[i], pThis->_iLen[i]);
+        } else { // kernel driver
+            pR->iResult = pThis->_pRTC[i]->setTime(&pThis->_tmSet);
+        }
+        i64End = fleetNowNs();
+        pR->iBus = pBus->iBus;
+        pR->i64SkewNs = i64End - pThis->_i64ReleaseNs;
+        pR->i32WriteNs = (int32_t)(i64End - i64Start);
+    }
+    return NULL;
+} /* busProc() */
+
+//
+// Set every device to the same time at the next CLOCK_REALTIME second
+// boundary at least iLeadMs away (to leave time to start the threads)
+// pTime is the time they're set to; NULL = the system time (UTC) of the
+// boundary
+// returns RTC_SUCCESS or RTC_ERROR if any of the writes failed
+//
+int BBRTCFleet::setTime(const struct tm *pTime, int iLeadMs)
+{
+int i, iStarted, rc = RTC_SUCCESS;
+
+    if (_iCount == 0) return RTC_ERROR;
+    if (iLeadMs < 1) iLeadMs = 1;
+    _i64ReleaseNs = fleetNowNs() + (int64_t)iLeadMs * 1000000LL;
+    _i64ReleaseNs = (_i64ReleaseNs / 1000000000LL + 1) * 1000000000LL;
+    if (pTime) {
+        memcpy(&_tmSet, pTime, sizeof(struct tm));
+    } else {
+        BBRTC::epochToTime((uint32_t)(_i64ReleaseNs / 1000000000LL), &_tmSet);
+    }
+    for (i=0; i<_iCount; i++) { // stage the register blocks
+        _iLen[i] = _pRTC[i]->encodeTime(&_tmSet, _u8Block[i]);
+        _result[i].iResult = RTC_ERROR;
+    }
+    pthread_mutex_init(&_mutex, NULL);
+    pthread_cond_init(&_cond, NULL);
+    _iWaiting = 0;
+    _bGo = _bAbort = false;
+    for (iStarted=0; iStarted<_iBuses; iStarted++) {
+        _bus[iStarted].pFleet = this;
+        _bus[iStarted].iBus = iStarted;
+        if (pthread_create(&_bus[iStarted].thread, NULL, busProc, &_bus[iStarted]) != 0) break;
+    }
+    pthread_mutex_lock(&_mutex);
+    while (_iWaiting < iStarted) {
+        pthread_cond_wait(&_cond, &_mutex);
+    }
+    // a bus without a thread can't be released with the others; write nothing
+    _bAbort = (iStarted < _iBuses);
+    _bGo = true;
+    pthread_cond_broadcast(&_cond);
+    pthread_mutex_unlock(&_mutex);
+    for (i=0; i<iStarted; i++) {
+        pthread_join(_bus[i].thread, NULL);
+    }
+    pthread_cond_destroy(&_cond);
+    pthread_mutex_destroy(&_mutex);
+    for (i=0; i<_iCount; i++) {
+        if (_result[i].iResult != RTC_SUCCESS) rc = RTC_ERROR;
+    }
+    return rc;
+} /* setTime() */
+
+//
+// The outcome of the last setTime() for the device added as number iDevice
+// returns RTC_SUCCESS or RTC_ERROR
+//
+int BBRTCFleet::getResult(int iDevice, RTC_FLEET_RESULT *pResult)
+{
+    if (iDevice < 0 || iDevice >= _iCount || pResult == NULL) return RTC_ERROR;
+    memcpy(pResult, &_result[iDevice], sizeof(RTC_FLEET_RESULT));
+    return RTC_SUCCESS;
+} /* getResult() */
+
+//
+// Difference between the first and last write to finish (successfully)
+// in the last setTime()
+//
+int64_t BBRTCFleet::getSpreadNs(void)
+{
+int64_t i64Min = 0, i64Max = 0;
+int i;
+bool bFirst = true;
+
+    for (i=0; i<_iCount; i++) {
+        if (_result[i].iResult != RTC_SUCCESS) continue;
+        if (bFirst || _result[i].i64SkewNs < i64Min) i64Min = _result[i].i64SkewNs;
+        if (bFirst || _result[i].i64SkewNs > i64Max) i64Max = _result[i].i64SkewNs;
+        bFirst = false;
+    }
+    return i64Max - i64Min;
+} /* getSpreadNs() */
+#endif // __LINUX__
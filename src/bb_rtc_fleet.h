@@ -0,0 +1,84 @@
+#ifndef __BB_RTC_FLEET__
+#define __BB_RTC_FLEET__
+//
+// BitBank Realtime Clock Library
+// Synchronized time setting for many RTCs (Linux only)
+// written by Larry Bank (bitbank@pobox.com)
+//
+// SPDX-FileCopyrightText: 2025 BitBank Software, Inc.
+// SPDX-License-Identifier: Apache-2.0
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===========================================================================
+//
+// Writing the seconds register restarts the RTC's divider chain, so a
+// device starts its new second when the write completes. Setting the
+// devices one after another leaves each a little behind the last.
+// setTime() encodes the register block for every device ahead of time,
+// starts a thread for each bus (BBRTCTransport::getBusKey()) and, once
+// they're all waiting, releases them at the next CLOCK_REALTIME second
+// boundary. Devices on different buses are written at the same moment;
+// the ones sharing a bus are written back to back. The time at which each
+// write finished is reported so the remaining skew can be checked.
+//
+#include "bb_rtc.h"
+#include <pthread.h>
+
+#define RTC_FLEET_MAX 64
+
+//
+// How the write to one device went
+//
+typedef struct _tagrtcfleetresult
+{
+  int iResult; // RTC_SUCCESS or RTC_xxx
+  int iBus; // index of the thread which wrote it
+  int64_t i64SkewNs; // end of the write - the second boundary
+  int32_t i32WriteNs; // duration of the write
+} RTC_FLEET_RESULT;
+
+class BBRTCFleet
+{
+public:
+    BBRTCFleet() : _iCount(0), _iBuses(0) {}
+    int add(BBRTC *pRTC);
+    void clear(void) { _iCount = _iBuses = 0; }
+    int getCount(void) { return _iCount; }
+    int getBuses(void) { return _iBuses; }
+    int setTime(const struct tm *pTime = NULL, int iLeadMs = 100);
+    int getResult(int iDevice, RTC_FLEET_RESULT *pResult);
+    int64_t getSpreadNs(void);
+
+private:
+    typedef struct _tagrtcfleetbus
+    {
+        BBRTCFleet *pFleet;
+        int iBus;
+        pthread_t thread;
+    } RTC_FLEET_BUS;
+    static void *busProc(void *pArg);
+    BBRTC *_pRTC[RTC_FLEET_MAX];
+    uintptr_t _uKey[RTC_FLEET_MAX]; // BBRTCTransport::getBusKey()
+    int _iBus[RTC_FLEET_MAX]; // thread of each device
+    uint8_t _u8Block[RTC_FLEET_MAX][RTC_TIME_BLOCK]; // staged registers
+    int _iLen[RTC_FLEET_MAX]; // 0 = use setTime()
+    RTC_FLEET_RESULT _result[RTC_FLEET_MAX];
+    struct tm _tmSet; // for devices without register access
+    int64_t _i64ReleaseNs; // CLOCK_REALTIME
+    // barrier: the threads wait until they've all started
+    pthread_mutex_t _mutex;
+    pthread_cond_t _cond;
+    int _iWaiting;
+    bool _bGo, _bAbort;
+    RTC_FLEET_BUS _bus[RTC_FLEET_MAX];
+    int _iCount, _iBuses;
+}; // class BBRTCFleet
+
+#endif // __BB_RTC_FLEET__
@@ -0,0 +1,151 @@
+//
+// BitBang RealTime Clock library (bb_rtc)
+// NTP shared memory refclock exporter
+// written by Larry Bank (bitbank@pobox.com)
+//
+// SPDX-FileCopyrightText: 2025 BitBank Software, Inc.
+// SPDX-License-Identifier: Apache-2.0
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===========================================================================
+#ifdef __LINUX__
+#include "bb_rtc_refclock.h"
+#include <sys/ipc.h>
+#include <sys/shm.h>
+
+//
+// Layout of the shared memory segment defined by ntpd's SHM driver
+//
+struct shmTime
+{
+  int mode; // 1 = use the count field to detect torn reads
+  volatile int count;
+  time_t clockTimeStampSec; // reference (RTC) time
+  int clockTimeStampUSec;
+  time_t receiveTimeStampSec; // system time when it was sampled
+  int receiveTimeStampUSec;
+  int leap;
+  int precision; // log2 of the precision in seconds
+  int nsamples;
+  volatile int valid;
+  unsigned clockTimeStampNSec;
+  unsigned receiveTimeStampNSec;
+  int dummy[8];
+};
+
+//
+// Attach to the SHM segment of the given unit and start sampling
+// Units 0 and 1 are only accessible by root (as ntpd expects)
+// returns RTC_SUCCESS or RTC_ERROR
+//
+int BBRTCRefclock::start(BBRTC *pRTC, int iUnit, int iPrecision)
+{
+    if (_bRunning || pRTC == NULL || iUnit < 0) return RTC_ERROR;
+    _iShmID = shmget(RTC_SHM_KEY + iUnit, sizeof(struct shmTime), IPC_CREAT | ((iUnit < 2) ? 0600 : 0666));
+    if (_iShmID < 0) return RTC_ERROR;
+    _pShm = (volatile struct shmTime *)shmat(_iShmID, NULL, 0);
+    if (_pShm == (void *)-1) {
+        _pShm = NULL;
+        return RTC_ERROR;
+    }
+    _pShm->mode = 1;
+    _pShm->valid = 0;
+    _pShm->precision = iPrecision;
+    _pShm->nsamples = 3;
+    _pRTC = pRTC;
+    _iPrecision = iPrecision;
+    _u32Samples = 0;
+    memset(&_lastEdge, 0, sizeof(_lastEdge));
+    pthread_mutex_init(&_mutex, NULL);
+    _bRunning = true;
+    if (pthread_create(&_thread, NULL, threadProc, this) != 0) {
+        _bRunning = false;
+        shmdt((const void *)_pShm);
+        _pShm = NULL;
+        return RTC_ERROR;
+    }
+    return RTC_SUCCESS;
+} /* start() */
+
+//
+// Stop the sampling thread and detach from the SHM segment
+// The segment itself is left for the NTP daemon
+//
+void BBRTCRefclock::stop(void)
+{
+    if (!_bRunning) return;
+    _bRunning = false;
+    pthread_join(_thread, NULL);
+    pthread_mutex_destroy(&_mutex);
+    if (_pShm) {
+        _pShm->valid = 0;
+        shmdt((const void *)_pShm);
+        _pShm = NULL;
+    }
+} /* stop() */
+
+//
+// Return the most recent edge written to the SHM segment
+// returns RTC_SUCCESS or RTC_ERROR if there isn't one yet
+//
+int BBRTCRefclock::getLastEdge(RTC_EDGE *pEdge)
+{
+    if (pEdge == NULL || _u32Samples == 0) return RTC_ERROR;
+    pthread_mutex_lock(&_mutex);
+    memcpy(pEdge, &_lastEdge, sizeof(RTC_EDGE));
+    pthread_mutex_unlock(&_mutex);
+    return RTC_SUCCESS;
+} /* getLastEdge() */
+
+//
+// Publish one sample using the mode 1 protocol:
+// bump count, write the fields, bump count again and then set valid
+//
+void BBRTCRefclock::writeSample(RTC_EDGE *pEdge)
+{
+int64_t i64Real = pEdge->i64RealNs;
+
+    _pShm->valid = 0;
+    _pShm->count++;
+    __sync_synchronize();
+    _pShm->clockTimeStampSec = (time_t)pEdge->u32Epoch; // the edge is at .000
+    _pShm->clockTimeStampUSec = 0;
+    _pShm->clockTimeStampNSec = 0;
+    _pShm->receiveTimeStampSec = (time_t)(i64Real / 1000000000LL);
+    _pShm->receiveTimeStampNSec = (unsigned)(i64Real % 1000000000LL);
+    _pShm->receiveTimeStampUSec = (int)(_pShm->receiveTimeStampNSec / 1000);
+    _pShm->leap = 0;
+    _pShm->precision = _iPrecision;
+    __sync_synchronize();
+    _pShm->count++;
+    _pShm->valid = 1;
+} /* writeSample() */
+
+void * BBRTCRefclock::threadProc(void *pArg)
+{
+BBRTCRefclock *pThis = (BBRTCRefclock *)pArg;
+RTC_EDGE edge;
+
+    while (pThis->_bRunning) {
+        // short timeout so that stop() doesn't wait long
+        if (pThis->_pRTC->waitForSecond(&edge, 1500) != RTC_SUCCESS) {
+            usleep(100000); // don't spin on a bus error
+            continue;
+        }
+        pThis->writeSample(&edge);
+        pthread_mutex_lock(&pThis->_mutex);
+        memcpy(&pThis->_lastEdge, &edge, sizeof(RTC_EDGE));
+        pthread_mutex_unlock(&pThis->_mutex);
+        pThis->_u32Samples++;
+    }
+    return NULL;
+} /* threadProc() */
+
+#endif // __LINUX__
@@ -0,0 +1,54 @@
+#ifndef __BB_RTC_REFCLOCK__
+#define __BB_RTC_REFCLOCK__
+//
+// BitBank Realtime Clock Library
+// NTP shared memory refclock exporter (Linux only)
+// written by Larry Bank (bitbank@pobox.com)
+//
+// SPDX-FileCopyrightText: 2025 BitBank Software, Inc.
+// SPDX-License-Identifier: Apache-2.0
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===========================================================================
+//
+// A background thread finds each RTC second edge (see BBRTC::waitForSecond)
+// and writes (rtc_time, host_time) samples into the shared memory segment
+// read by the SHM refclock driver of ntpd and chronyd, e.g. for chrony:
+//    refclock SHM 0 refid RTC precision 1e-3
+//
+#include "bb_rtc.h"
+#include <pthread.h>
+
+#define RTC_SHM_KEY 0x4e545030 // "NTP0"; unit N uses key + N
+
+class BBRTCRefclock
+{
+public:
+    BBRTCRefclock() : _pRTC(NULL), _pShm(NULL), _bRunning(false), _u32Samples(0) {}
+    ~BBRTCRefclock() { stop(); }
+    int start(BBRTC *pRTC, int iUnit = 0, int iPrecision = -10);
+    void stop(void);
+    uint32_t getSamples(void) { return _u32Samples; }
+    int getLastEdge(RTC_EDGE *pEdge);
+
+private:
+    static void *threadProc(void *pArg);
+    void writeSample(RTC_EDGE *pEdge);
+    BBRTC *_pRTC;
+    volatile struct shmTime *_pShm;
+    int _iShmID, _iPrecision;
+    volatile bool _bRunning;
+    volatile uint32_t _u32Samples;
+    RTC_EDGE _lastEdge;
+    pthread_t _thread;
+    pthread_mutex_t _mutex;
+}; // class BBRTCRefclock
+
+#endif // __BB_RTC_REFCLOCK__
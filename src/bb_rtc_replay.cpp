@@ -0,0 +1,205 @@
+//
+// BitBank RealTime Clock library (bb_rtc)
+// Replay transport for recorded bus traffic
+// written by Larry Bank (bitbank@pobox.com)
+//
+// SPDX-FileCopyrightText: 2025 BitBank Software, Inc.
+// SPDX-License-Identifier: Apache-2.0
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===========================================================================
+#ifdef __LINUX__
+#include "bb_rtc.h"
+
+//
+// Wait for the recorded duration of a transfer
+// Short waits spin on the clock since usleep() can't do a few microseconds
+//
+static void replayWait(uint32_t u32Us)
+{
+struct timespec ts;
+int64_t i64End, i64Now;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    i64End = (int64_t)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000 + u32Us;
+    if (u32Us > 2000) usleep(u32Us - 1000);
+    do {
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        i64Now = (int64_t)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+    } while (i64Now < i64End);
+} /* replayWait() */
+
+BBRTCReplayTransport::~BBRTCReplayTransport()
+{
+    free(_pAlloc);
+} /* ~BBRTCReplayTransport() */
+
+//
+// Play back a list of transfers (e.g. from BBRTCTraceTransport::getRecords())
+// The list must remain valid while it's being played
+//
+void BBRTCReplayTransport::init(const RTC_TRACE *pList, int iCount)
+{
+    free(_pAlloc);
+    _pAlloc = NULL;
+    _pList = pList;
+    _iCount = (pList) ? iCount : 0;
+    rewind();
+} /* init() */
+
+//
+// Load a file written by BBRTCTraceTransport::saveTrace()
+// returns RTC_SUCCESS or RTC_ERROR
+//
+int BBRTCReplayTransport::loadTrace(const char *szFile)
+{
+FILE *f;
+uint32_t u32Hdr[4];
+RTC_TRACE *pList;
+
+    f = fopen(szFile, "rb");
+    if (f == NULL) return RTC_ERROR;
+    if (fread(u32Hdr, sizeof(u32Hdr), 1, f) != 1 || u32Hdr[0] != RTC_TRACE_MAGIC ||
+        u32Hdr[1] != RTC_TRACE_VERSION || u32Hdr[2] != sizeof(RTC_TRACE)) {
+        fclose(f);
+        return RTC_ERROR;
+    }
+    pList = (RTC_TRACE *)malloc((u32Hdr[3] + 1) * sizeof(RTC_TRACE));
+    if (pList == NULL || fread(pList, sizeof(RTC_TRACE), u32Hdr[3], f) != u32Hdr[3]) {
+        free(pList);
+        fclose(f);
+        return RTC_ERROR;
+    }
+    fclose(f);
+    init(pList, (int)u32Hdr[3]);
+    _pAlloc = pList;
+    return RTC_SUCCESS;
+} /* loadTrace() */
+
+//
+// Start over from the first transfer and reset the statistics
+//
+void BBRTCReplayTransport::rewind(void)
+{
+    _iPos = 0;
+    _u32Transactions = 0;
+    _iDivergences = 0;
+    _iFirstDivergence = -1;
+    _i64BusUs = 0;
+} /* rewind() */
+
+//
+// Does the recorded transfer look like the one being requested?
+// Writes must carry the same data; reads the same register and length
+//
+bool BBRTCReplayTransport::matches(const RTC_TRACE *pT, const RTC_XFER *pX)
+{
+    if (pT->u8Type != pX->u8Type || pT->u8Addr != pX->u8Addr) return false;
+    switch (pX->u8Type) {
+        case RTC_XFER_WRITE:
+            if (pT->i16Len != pX->iLen) return false;
+            return (pT->u8Len == 0 || memcmp(pT->u8Data, pX->pData, pT->u8Len) == 0);
+        case RTC_XFER_READREG:
+            if (pT->u8Reg != pX->u8Reg) return false;
+            return (pT->i16Len == pX->iLen);
+        case RTC_XFER_READ:
+            return (pT->i16Len == pX->iLen);
+    }
+    return true; // RTC_XFER_PROBE
+} /* matches() */
+
+//
+// Find the recorded transfer which answers this call
+// returns NULL if the capture has no match for it
+//
+const RTC_TRACE * BBRTCReplayTransport::next(const RTC_XFER *pX)
+{
+int i;
+
+    for (i=_iPos; i<_iCount && i<_iPos + RTC_REPLAY_RESYNC; i++) {
+        if (matches(&_pList[i], pX)) {
+            if (i != _iPos) { // skipped some recorded transfers
+                _iDivergences++;
+                if (_iFirstDivergence < 0) _iFirstDivergence = _iPos;
+            }
+            _iPos = i + 1;
+            return &_pList[i];
+        }
+    }
+    _iDivergences++;
+    if (_iFirstDivergence < 0) _iFirstDivergence = _iPos;
+    return NULL;
+} /* next() */
+
+int BBRTCReplayTransport::play(RTC_XFER *pX)
+{
+const RTC_TRACE *pT;
+int iLen;
+
+    _u32Transactions++;
+    pT = next(pX);
+    if (pT == NULL) return 0; // NACK
+    if (_bTiming) replayWait(pT->u32DurUs);
+    _i64BusUs += pT->u32DurUs;
+    if (pT->i16Result > 0 && pX->pData && (pX->u8Type == RTC_XFER_READ || pX->u8Type == RTC_XFER_READREG)) {
+        iLen = (pT->u8Len < pX->iLen) ? pT->u8Len : pX->iLen;
+        memcpy(pX->pData, pT->u8Data, iLen);
+        if (pX->iLen > iLen) memset(&pX->pData[iLen], 0, pX->iLen - iLen); // not captured
+    }
+    return pT->i16Result;
+} /* play() */
+
+int BBRTCReplayTransport::probe(uint8_t u8Addr)
+{
+RTC_XFER x;
+
+    memset(&x, 0, sizeof(x));
+    x.u8Type = RTC_XFER_PROBE;
+    x.u8Addr = u8Addr;
+    return play(&x);
+} /* probe() */
+
+int BBRTCReplayTransport::read(uint8_t u8Addr, uint8_t *pData, int iLen)
+{
+RTC_XFER x;
+
+    memset(&x, 0, sizeof(x));
+    x.u8Type = RTC_XFER_READ;
+    x.u8Addr = u8Addr;
+    x.pData = pData;
+    x.iLen = iLen;
+    return play(&x);
+} /* read() */
+
+int BBRTCReplayTransport::write(uint8_t u8Addr, uint8_t *pData, int iLen)
+{
+RTC_XFER x;
+
+    memset(&x, 0, sizeof(x));
+    x.u8Type = RTC_XFER_WRITE;
+    x.u8Addr = u8Addr;
+    x.pData = pData;
+    x.iLen = iLen;
+    return play(&x);
+} /* write() */
+
+int BBRTCReplayTransport::readRegister(uint8_t u8Addr, uint8_t u8Reg, uint8_t *pData, int iLen)
+{
+RTC_XFER x;
+
+    memset(&x, 0, sizeof(x));
+    x.u8Type = RTC_XFER_READREG;
+    x.u8Addr = u8Addr;
+    x.u8Reg = u8Reg;
+    x.pData = pData;
+    x.iLen = iLen;
+    return play(&x);
+} /* readRegister() */
+#endif // __LINUX__
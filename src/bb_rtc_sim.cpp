@@ -0,0 +1,399 @@
+//
+// BitBang RealTime Clock library (bb_rtc)
+// Simulated RTC transport
+// written by Larry Bank (bitbank@pobox.com)
+//
+// SPDX-FileCopyrightText: 2025 BitBank Software, Inc.
+// SPDX-License-Identifier: Apache-2.0
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===========================================================================
+//
+// Each simulated device is a register file with an auto-incrementing
+// address pointer, the same way the real chips behave on the bus.
+// Only enough of each device's behavior is modeled to pass auto-detection
+// and to exercise the register traffic of the BBRTC class.
+//
+#include "bb_rtc.h"
+#include <string.h>
+
+#define BCD(n) ((uint8_t)((((n) / 10) << 4) | ((n) % 10)))
+#define UNBCD(n) ((((n) >> 4) & 0xf) * 10 + ((n) & 0xf))
+
+//
+// Register layout of each simulated device type
+//
+typedef struct _tagsimtype
+{
+  uint8_t u8Type, u8Addr;
+  int iRegCount;
+  uint8_t u8TimeReg; // seconds register
+  uint8_t u8WdayBase; // value stored for Sunday
+  bool bPCFOrder; // day of the month before day of the week
+  bool bCentury; // century flag in bit 7 of the month
+} SIMTYPE;
+
+static const SIMTYPE simTypes[] = {
+  {RTC_PCF8563, RTC_PCF8563_ADDR, 0x10, 2, 1, true, true},
+  {RTC_DS3231, RTC_DS3231_ADDR, 0x13, 0, 1, false, true},
+  {RTC_RV3032, RTC_RV3032_ADDR, 0x100, 1, 0, false, false},
+  {RTC_PCF85063A, RTC_PCF85063A_ADDR, 0x12, 4, 1, true, false},
+  {RTC_DS1307, RTC_DS1307_ADDR, 0x40, 0, 1, false, false},
+  {RTC_DS3232, RTC_DS3232_ADDR, 0x100, 0, 1, false, true},
+  {RTC_MCP7940N, RTC_MCP7940N_ADDR, 0x60, 0, 1, false, false},
+  {RTC_PCF2129, RTC_PCF2129_ADDR, 0x1a, 3, 0, true, false}
+};
+
+static const SIMTYPE *simType(int iType)
+{
+int i;
+
+    for (i=0; i<(int)(sizeof(simTypes) / sizeof(SIMTYPE)); i++) {
+        if (simTypes[i].u8Type == iType) return &simTypes[i];
+    }
+    return NULL;
+} /* simType() */
+
+//
+// Add a simulated RTC of the given type at its default address
+// iChannel puts it behind a channel of the simulated mux (see addMux())
+// The time registers start at 2025-01-01 00:00:00 (Wednesday)
+// returns RTC_SUCCESS or RTC_ERROR
+//
+int BBRTCSimTransport::addDevice(int iType, int iChannel)
+{
+SIMDEV *pDev;
+const SIMTYPE *pType = simType(iType);
+uint8_t *p;
+
+    if (_iDevices >= RTC_SIM_MAX_DEVICES || pType == NULL) return RTC_ERROR;
+    if (iChannel >= RTC_MUX_CHANNELS) return RTC_ERROR;
+    if (findDevice(pType->u8Addr, iChannel)) return RTC_ERROR; // address already used
+    pDev = &_dev[_iDevices];
+    memset(pDev, 0, sizeof(SIMDEV));
+    pDev->u8Type = (uint8_t)iType;
+    pDev->iChannel = (iChannel < 0) ? -1 : iChannel;
+    pDev->u8Addr = pType->u8Addr;
+    pDev->iRegCount = pType->iRegCount;
+    p = &pDev->u8Regs[pType->u8TimeReg];
+    p[(pType->bPCFOrder) ? 4 : 3] = 3 + pType->u8WdayBase; // Wednesday
+    p[(pType->bPCFOrder) ? 3 : 4] = 0x01; // date
+    p[5] = 0x01 | ((pType->bCentury) ? 0x80 : 0); // (century +) January
+    p[6] = 0x25; // year
+    switch (iType) {
+        case RTC_DS3231:
+        case RTC_DS3232:
+            pDev->u8Regs[0x11] = 25; // temperature MSB
+            pDev->u8Regs[0x12] = 0x40; // .25C
+            break;
+        case RTC_RV3032:
+            pDev->u8Regs[0xe] = 0x40; // .25C
+            pDev->u8Regs[0xf] = 25;
+            break;
+        case RTC_DS1307:
+            pDev->u8Regs[0] = 0x80; // powers up with the clock halted
+            break;
+        case RTC_PCF2129:
+            pDev->u8Regs[3] = 0x80; // OSF: oscillator stopped since power up
+            memset(&pDev->u8Regs[0xa], 0x80, 5); // alarms disabled
+            pDev->u8Regs[0x19] = 0x08; // aging offset (0ppm)
+            break;
+    }
+    _iDevices++;
+    return RTC_SUCCESS;
+} /* addDevice() */
+
+//
+// Add a simulated TCA9548A mux; its control register selects which of the
+// devices added with a channel number are visible on the bus
+// returns RTC_SUCCESS or RTC_ERROR
+//
+int BBRTCSimTransport::addMux(uint8_t u8Addr)
+{
+    if (_u8MuxAddr || findDevice(u8Addr)) return RTC_ERROR;
+    _u8MuxAddr = u8Addr;
+    _u8MuxCtrl = 0; // all channels off at power up
+    return RTC_SUCCESS;
+} /* addMux() */
+
+//
+// Return a pointer to the register file of the device at the given address
+// (NULL if there isn't one); devices behind the mux must be selected first
+//
+uint8_t * BBRTCSimTransport::getRegisters(uint8_t u8Addr)
+{
+SIMDEV *pDev = findDevice(u8Addr);
+
+    return (pDev) ? pDev->u8Regs : NULL;
+} /* getRegisters() */
+
+//
+// Change the temperature (1/4 degrees C) reported by a DS3231/DS3232/RV3032
+// On the RV3032 this also checks the thresholds: the flag is set and the
+// time stamp taken when the temperature is beyond an enabled one
+// returns RTC_SUCCESS or RTC_ERROR
+//
+int BBRTCSimTransport::setTemperature(uint8_t u8Addr, int iTemp)
+{
+SIMDEV *pDev = findDevice(u8Addr);
+uint8_t *p = (pDev) ? pDev->u8Regs : NULL;
+int iTS = -1;
+
+    if (pDev == NULL) return RTC_ERROR;
+    switch (pDev->u8Type) {
+        case RTC_DS3231:
+        case RTC_DS3232:
+            p[0x11] = (uint8_t)(int8_t)(iTemp >> 2);
+            p[0x12] = (uint8_t)((iTemp & 3) << 6);
+            return RTC_SUCCESS;
+        case RTC_RV3032:
+            break;
+        default:
+            return RTC_ERROR;
+    }
+    p[0xe] = (p[0xe] & 0x0f) | (uint8_t)((iTemp & 3) << 6); // 1/16C units
+    p[0xf] = (uint8_t)(int8_t)(iTemp >> 2);
+#ifdef __LINUX__
+    liveRead(pDev); // time stamp from the current time
+#endif
+    if ((p[0x12] & 0x08) && (iTemp >> 2) > (int8_t)p[0x17]) { // THE
+        p[0x0d] |= 0x80; // THF
+        iTS = 0x1f;
+    } else if ((p[0x12] & 0x04) && (iTemp >> 2) < (int8_t)p[0x16]) { // TLE
+        p[0x0d] |= 0x40; // TLF
+        iTS = 0x18;
+    }
+    if (iTS > 0) { // count the event and time stamp it
+        if (p[iTS] < 0xff) p[iTS]++;
+        if (p[iTS] == 1 || (p[0x13] & ((iTS == 0x18) ? 0x01 : 0x02))) { // TLOW, THOW
+            memcpy(&p[iTS+1], &p[1], 3); // seconds, minutes, hours
+            memcpy(&p[iTS+4], &p[5], 3); // date, month, year
+        }
+    }
+    return RTC_SUCCESS;
+} /* setTemperature() */
+
+//
+// Find the device at the given address on the given mux channel
+// The default (-2) finds the one visible with the current mux setting
+//
+BBRTCSimTransport::SIMDEV * BBRTCSimTransport::findDevice(uint8_t u8Addr, int iChannel)
+{
+int i;
+
+    for (i=0; i<_iDevices; i++) {
+        if (_dev[i].u8Addr != u8Addr) continue;
+        if (iChannel == -2) {
+            if (_dev[i].iChannel < 0 || (_u8MuxCtrl & (1 << _dev[i].iChannel)))
+                return &_dev[i];
+        } else if (_dev[i].iChannel == iChannel || iChannel < 0 || _dev[i].iChannel < 0) {
+            return &_dev[i]; // would collide with the new device
+        }
+    }
+    return NULL;
+} /* findDevice() */
+
+//
+// Bits of each register which can be changed by a write
+// Read-only registers are what the auto-detection logic depends on
+//
+uint8_t BBRTCSimTransport::writeMask(SIMDEV *pDev, uint8_t u8Reg)
+{
+    if (u8Reg >= pDev->iRegCount) return 0; // register doesn't exist
+    switch (pDev->u8Type) {
+        case RTC_DS3231:
+        case RTC_DS3232:
+            if (u8Reg == 0x11 || u8Reg == 0x12) return 0; // temperature
+            break;
+        case RTC_RV3032:
+            if (u8Reg == 0) return 0; // 100ths of a second
+            if (u8Reg == 0xe) return 0x0f; // temp LSB flags
+            if (u8Reg == 0xf) return 0; // temp MSB
+            if (u8Reg >= 0x18 && u8Reg <= 0x25) return 0; // temperature time stamps
+            break;
+        case RTC_PCF8563:
+            if (u8Reg == 3) return 0x7f; // minutes
+            break;
+        case RTC_MCP7940N:
+            if (u8Reg == 3 || u8Reg == 5) return 0xdf; // OSCRUN, LPYR
+            break;
+        case RTC_PCF2129:
+            if (u8Reg >= 0x13 && u8Reg <= 0x18) return 0; // timestamp
+            if (u8Reg == 0x19) return 0x0f; // aging offset
+            break;
+    }
+    return 0xff;
+} /* writeMask() */
+
+#ifdef __LINUX__
+//
+// Make the time registers of a simulated device run from the host clock
+// iPPB makes the simulated crystal run fast (+) or slow (-)
+// returns RTC_SUCCESS or RTC_ERROR
+//
+int BBRTCSimTransport::setLive(uint8_t u8Addr, bool bLive, int iPPB)
+{
+SIMDEV *pDev = findDevice(u8Addr);
+
+    if (pDev == NULL) return RTC_ERROR;
+    pDev->bLive = bLive;
+    pDev->iPPB = iPPB;
+    liveWrite(pDev, simType(pDev->u8Type)->u8TimeReg, 7); // start from the current registers
+    return RTC_SUCCESS;
+} /* setLive() */
+
+//
+// Update the time registers from the elapsed host time
+//
+void BBRTCSimTransport::liveRead(SIMDEV *pDev)
+{
+struct timespec ts;
+struct tm t;
+int64_t i64Elapsed;
+time_t tt;
+uint8_t *p;
+const SIMTYPE *pType;
+int iWday;
+
+    if (!pDev->bLive) return;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    i64Elapsed = (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec - pDev->i64BaseNs;
+    i64Elapsed += (i64Elapsed / 1000000) * pDev->iPPB / 1000; // crystal error
+    tt = (time_t)pDev->u32BaseEpoch + (time_t)(i64Elapsed / 1000000000LL);
+    gmtime_r(&tt, &t);
+    pType = simType(pDev->u8Type);
+    p = &pDev->u8Regs[pType->u8TimeReg];
+    p[0] = BCD(t.tm_sec) | (p[0] & 0x80); // keep the ST/CH/OSF flags
+    p[1] = BCD(t.tm_min);
+    p[2] = BCD(t.tm_hour);
+    iWday = (pType->bPCFOrder) ? 4 : 3;
+    p[iWday] = (uint8_t)(t.tm_wday + pType->u8WdayBase) | (p[iWday] & 0xf8);
+    p[(pType->bPCFOrder) ? 3 : 4] = BCD(t.tm_mday);
+    p[5] = BCD(t.tm_mon+1) | ((pType->bCentury && t.tm_year >= 100) ? 0x80 : 0);
+    p[6] = BCD(t.tm_year % 100);
+    if (pDev->u8Type == RTC_RV3032)
+        pDev->u8Regs[0] = BCD((int)((i64Elapsed / 10000000LL) % 100)); // 100ths
+} /* liveRead() */
+
+//
+// A write which touched the time registers restarts the live clock
+// (writing the seconds register resets the divider chain on real parts)
+//
+void BBRTCSimTransport::liveWrite(SIMDEV *pDev, uint8_t u8Start, int iLen)
+{
+struct timespec ts;
+struct tm t;
+const SIMTYPE *pType = simType(pDev->u8Type);
+int iBase = pType->u8TimeReg;
+uint8_t *p;
+
+    if (!pDev->bLive || u8Start > iBase + 6 || u8Start + iLen <= iBase) return;
+    p = &pDev->u8Regs[iBase];
+    memset(&t, 0, sizeof(t));
+    t.tm_sec = UNBCD(p[0] & 0x7f);
+    t.tm_min = UNBCD(p[1] & 0x7f);
+    t.tm_hour = UNBCD(p[2] & 0x3f);
+    t.tm_mday = UNBCD(p[(pType->bPCFOrder) ? 3 : 4] & 0x3f);
+    t.tm_mon = UNBCD(p[5] & 0x1f) - 1;
+    t.tm_year = 100 + UNBCD(p[6]);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    pDev->i64BaseNs = (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    pDev->u32BaseEpoch = (uint32_t)timegm(&t);
+} /* liveWrite() */
+#endif // __LINUX__
+
+//
+// Use up one of the injected failures
+//
+bool BBRTCSimTransport::fault(void)
+{
+    if (_iFaultCount == 0) return false;
+    if (_iFaultCount > 0) _iFaultCount--;
+    return true;
+} /* fault() */
+
+int BBRTCSimTransport::probe(uint8_t u8Addr)
+{
+    _u32Transactions++;
+    if (fault()) return -_iFault;
+    if (_u8MuxAddr && u8Addr == _u8MuxAddr) return 1;
+    return (findDevice(u8Addr) != NULL);
+} /* probe() */
+
+//
+// The first byte written sets the register pointer, the rest are data
+//
+int BBRTCSimTransport::write(uint8_t u8Addr, uint8_t *pData, int iLen)
+{
+SIMDEV *pDev = findDevice(u8Addr);
+int i;
+uint8_t u8Mask;
+
+    _u32Transactions++;
+    if (fault()) return -_iFault;
+    if (_u8MuxAddr && u8Addr == _u8MuxAddr && iLen >= 1) {
+        _u8MuxCtrl = pData[iLen-1]; // a single control register
+        return iLen;
+    }
+    if (pDev == NULL || iLen < 1) return 0; // NACK
+    pDev->u8Ptr = pData[0];
+    for (i=1; i<iLen; i++) {
+        u8Mask = writeMask(pDev, pDev->u8Ptr);
+        pDev->u8Regs[pDev->u8Ptr] = (pDev->u8Regs[pDev->u8Ptr] & ~u8Mask) | (pData[i] & u8Mask);
+        pDev->u8Ptr++;
+        if (pDev->u8Ptr >= pDev->iRegCount) pDev->u8Ptr = 0;
+    }
+    if (pDev->u8Type == RTC_MCP7940N) // OSCRUN follows ST
+        pDev->u8Regs[3] = (pDev->u8Regs[3] & ~0x20) | ((pDev->u8Regs[0] & 0x80) ? 0x20 : 0);
+    if (pDev->u8Type == RTC_RV3032 && (pDev->u8Regs[0x13] & 0x18)) { // THR, TLR
+        if (pDev->u8Regs[0x13] & 0x08) memset(&pDev->u8Regs[0x18], 0, 7);
+        if (pDev->u8Regs[0x13] & 0x10) memset(&pDev->u8Regs[0x1f], 0, 7);
+        pDev->u8Regs[0x13] &= ~0x18; // self clearing
+    }
+#ifdef __LINUX__
+    liveWrite(pDev, pData[0], iLen-1);
+#endif
+    return iLen;
+} /* write() */
+
+int BBRTCSimTransport::read(uint8_t u8Addr, uint8_t *pData, int iLen)
+{
+SIMDEV *pDev = findDevice(u8Addr);
+int i;
+
+    _u32Transactions++;
+    if (fault()) return -_iFault;
+    if (_u8MuxAddr && u8Addr == _u8MuxAddr) {
+        for (i=0; i<iLen; i++) pData[i] = _u8MuxCtrl;
+        return iLen;
+    }
+    if (pDev == NULL) return 0; // NACK
+#ifdef __LINUX__
+    liveRead(pDev);
+#endif
+    for (i=0; i<iLen; i++) {
+        pData[i] = (pDev->u8Ptr < pDev->iRegCount) ? pDev->u8Regs[pDev->u8Ptr] : 0;
+        pDev->u8Ptr++;
+        if (pDev->u8Ptr >= pDev->iRegCount) pDev->u8Ptr = 0;
+    }
+    return iLen;
+} /* read() */
+
+int BBRTCSimTransport::readRegister(uint8_t u8Addr, uint8_t u8Reg, uint8_t *pData, int iLen)
+{
+SIMDEV *pDev = findDevice(u8Addr);
+
+    if (pDev == NULL || _iFaultCount) {
+        _u32Transactions++;
+        return (fault()) ? -_iFault : 0;
+    }
+    pDev->u8Ptr = u8Reg;
+    return read(u8Addr, pData, iLen); // counted as one transaction
+} /* readRegister() */
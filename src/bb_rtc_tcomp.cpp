@@ -0,0 +1,171 @@
+//
+// BitBank RealTime Clock library (bb_rtc)
+// Temperature compensation for RTCs without a TCXO
+// written by Larry Bank (bitbank@pobox.com)
+//
+// SPDX-FileCopyrightText: 2025 BitBank Software, Inc.
+// SPDX-License-Identifier: Apache-2.0
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===========================================================================
+#include "bb_rtc_tcomp.h"
+#include <string.h>
+
+// Longest gap between updates which is integrated; anything longer (or
+// the RTC going backwards) means the time was set
+#define RTC_TCOMP_MAX_GAP (7L * 86400L)
+
+BBRTCTempComp::BBRTCTempComp()
+{
+    _pRTC = NULL;
+    _pfnTemp = NULL;
+    _pUser = NULL;
+    _bHardware = false;
+    _fTrimPPM = 0.0f;
+    setModel();
+    reset();
+} /* BBRTCTempComp() */
+
+//
+// Use the temperature callback to compensate the given (initialized) RTC
+// The offset register is used when the device has one
+// returns RTC_SUCCESS or RTC_ERROR
+//
+int BBRTCTempComp::init(BBRTC *pRTC, RTC_TEMP_CALLBACK *pfnTemp, void *pUser)
+{
+    if (pRTC == NULL || pfnTemp == NULL || !(pRTC->getCaps() & RTC_CAP_TIME)) return RTC_ERROR;
+    _pRTC = pRTC;
+    _pfnTemp = pfnTemp;
+    _pUser = pUser;
+    _bHardware = (pRTC->getCaps() & RTC_CAP_TRIM) != 0;
+    _fTrimPPM = 0.0f;
+    reset();
+    return RTC_SUCCESS;
+} /* init() */
+
+//
+// Set the crystal model: turnover temperature (C), parabolic coefficient
+// (ppm/C^2) and a fixed offset (ppm, + = fast) measured at the turnover
+//
+void BBRTCTempComp::setModel(float fTurnover, float fK, float fOffsetPPM)
+{
+    _fTurnover = fTurnover;
+    _fK = fK;
+    _fOffset = fOffsetPPM;
+} /* setModel() */
+
+//
+// Forget the accumulated error; call this after setting the RTC time
+//
+void BBRTCTempComp::reset(void)
+{
+    _fPPM = 0.0f;
+    _fErrUs = 0.0f;
+    _u32Last = 0;
+    _bStarted = false; // _fTrimPPM stays; the offset register still has it
+} /* reset() */
+
+float BBRTCTempComp::modelPPM(int iTemp)
+{
+float fDelta = (float)iTemp / 4.0f - _fTurnover;
+
+    return _fK * fDelta * fDelta + _fOffset;
+} /* modelPPM() */
+
+//
+// Read the RTC time; BBRTC::getEpoch() returns 0 on a bus error, which
+// would look like the time being set
+// returns RTC_SUCCESS or RTC_xxx
+//
+int BBRTCTempComp::readEpoch(uint32_t *pu32Now)
+{
+struct tm tmNow;
+int rc;
+
+    rc = _pRTC->getTime(&tmNow);
+    if (rc != RTC_SUCCESS) return rc;
+    *pu32Now = BBRTC::timeToEpoch(&tmNow);
+    return RTC_SUCCESS;
+} /* readEpoch() */
+
+//
+// Read the temperature and account for the time since the last call
+// Call it often enough to follow the temperature (e.g. every few minutes)
+// Nothing changes if the time can't be read
+// returns RTC_SUCCESS or RTC_ERROR
+//
+int BBRTCTempComp::update(void)
+{
+int iTemp;
+uint32_t u32Now;
+int32_t i32Elapsed, i32Applied;
+float fPPM, fWant;
+
+    if (_pRTC == NULL) return RTC_ERROR;
+    iTemp = (*_pfnTemp)(_pUser);
+    if (iTemp == RTC_TEMP_INVALID) return RTC_ERROR;
+    fPPM = modelPPM(iTemp);
+    if (readEpoch(&u32Now) != RTC_SUCCESS) return RTC_ERROR; // keep the error so far
+    i32Elapsed = (int32_t)(u32Now - _u32Last);
+    if (_bStarted && (i32Elapsed < 0 || i32Elapsed > RTC_TCOMP_MAX_GAP)) {
+        reset(); // the time was changed
+    }
+    if (_bStarted) {
+        // the crystal error over the interval (the temperature is assumed
+        // to have changed linearly) less the part already corrected
+        _fErrUs += ((_fPPM + fPPM) / 2.0f + _fTrimPPM) * (float)i32Elapsed;
+    } else {
+        i32Elapsed = 0;
+        _bStarted = true;
+    }
+    _fPPM = fPPM;
+    _u32Last = u32Now;
+    if (_bHardware) {
+        // cancel the crystal error and work off what's accumulated
+        // over the next interval (of at least an hour)
+        if (i32Elapsed < 3600) i32Elapsed = 3600;
+        fWant = -fPPM - _fErrUs / (float)i32Elapsed;
+        if (_pRTC->setTrim((int32_t)(fWant * 1000.0f), &i32Applied) != RTC_SUCCESS) return RTC_ERROR;
+        _fTrimPPM = (float)i32Applied / 1000.0f;
+    }
+    return RTC_SUCCESS;
+} /* update() */
+
+//
+// The accumulated error (+ = RTC ahead), including an estimate of the
+// error since the last update (left out if the time can't be read)
+//
+float BBRTCTempComp::getErrorMs(void)
+{
+uint32_t u32Now;
+
+    if (!_bStarted) return 0.0f;
+    if (readEpoch(&u32Now) != RTC_SUCCESS) return _fErrUs / 1000.0f;
+    return (_fErrUs + (_fPPM + _fTrimPPM) * (float)(int32_t)(u32Now - _u32Last)) / 1000.0f;
+} /* getErrorMs() */
+
+//
+// The RTC time less the accumulated error (0 if it can't be read)
+//
+uint32_t BBRTCTempComp::getEpoch(void)
+{
+uint32_t u32Now;
+float fErr;
+
+    if (_pRTC == NULL || readEpoch(&u32Now) != RTC_SUCCESS) return 0;
+    if (!_bStarted) return u32Now;
+    fErr = (_fErrUs + (_fPPM + _fTrimPPM) * (float)(int32_t)(u32Now - _u32Last)) / 1000000.0f;
+    return u32Now - (int32_t)((fErr >= 0.0f) ? fErr + 0.5f : fErr - 0.5f);
+} /* getEpoch() */
+
+void BBRTCTempComp::getTime(struct tm *pTime)
+{
+    BBRTC::epochToTime(getEpoch(), pTime);
+} /* getTime() */
@@ -0,0 +1,68 @@
+#ifndef __BB_RTC_TCOMP__
+#define __BB_RTC_TCOMP__
+//
+// BitBank Realtime Clock Library
+// Temperature compensation for RTCs without a TCXO
+// written by Larry Bank (bitbank@pobox.com)
+//
+// SPDX-FileCopyrightText: 2025 BitBank Software, Inc.
+// SPDX-License-Identifier: Apache-2.0
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===========================================================================
+//
+// 32.768kHz tuning fork crystals follow a parabola around their turnover
+// temperature: df/f = K * (T - T0)^2 + offset, with K around -0.034ppm/C^2.
+// update() reads the temperature from a callback, integrates the modeled
+// error over the time since the last call and either corrects it with the
+// digital offset register (setTrim(), e.g. PCF85063A) or, on devices
+// without one (e.g. PCF8563), keeps the accumulated error and applies it
+// to the time returned by getTime() and getEpoch().
+//
+#include "bb_rtc.h"
+
+#define RTC_TEMP_INVALID -32768
+
+//
+// Returns the temperature in 1/4 degrees C (the same units as
+// BBRTC::getTemp()) or RTC_TEMP_INVALID
+//
+typedef int (RTC_TEMP_CALLBACK)(void *pUser);
+
+class BBRTCTempComp
+{
+public:
+    BBRTCTempComp();
+    int init(BBRTC *pRTC, RTC_TEMP_CALLBACK *pfnTemp, void *pUser = NULL);
+    void setModel(float fTurnover = 25.0f, float fK = -0.034f, float fOffsetPPM = 0.0f);
+    int update(void);
+    void reset(void);
+    bool isHardware(void) { return _bHardware; }
+    float getPPM(void) { return _fPPM; }
+    float getTrimPPM(void) { return _fTrimPPM; }
+    float getErrorMs(void);
+    uint32_t getEpoch(void);
+    void getTime(struct tm *pTime);
+
+private:
+    float modelPPM(int iTemp);
+    int readEpoch(uint32_t *pu32Now);
+    BBRTC *_pRTC;
+    RTC_TEMP_CALLBACK *_pfnTemp;
+    void *_pUser;
+    float _fTurnover, _fK, _fOffset; // crystal model
+    float _fPPM; // modeled error at the last temperature (+ = fast)
+    float _fTrimPPM; // correction applied by the offset register
+    float _fErrUs; // accumulated RTC - true time
+    uint32_t _u32Last; // RTC time of the last update
+    bool _bHardware, _bStarted;
+}; // class BBRTCTempComp
+
+#endif // __BB_RTC_TCOMP__
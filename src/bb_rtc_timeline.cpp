@@ -0,0 +1,259 @@
+//
+// BitBank RealTime Clock library (bb_rtc)
+// Timeline which never goes backwards, even across reboots
+// written by Larry Bank (bitbank@pobox.com)
+//
+// SPDX-FileCopyrightText: 2025 BitBank Software, Inc.
+// SPDX-License-Identifier: Apache-2.0
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===========================================================================
+#include "bb_rtc_timeline.h"
+#include <string.h>
+
+#define RTC_TIMELINE_MAGIC 0xb7
+
+BBRTCTimeline::BBRTCTimeline()
+{
+    _pRTC = NULL;
+    _pfnStore = NULL;
+    _pUser = NULL;
+    _iRamOffset = 0;
+    _iReserve = RTC_TIMELINE_RESERVE;
+    _u32High = _u32Last = _u32Seq = 0;
+    _i32Offset = 0;
+    _u16Gen = 0;
+    _u32Bridges = 0;
+    _u32HoldRtc = 0;
+    _bHold = false;
+} /* BBRTCTimeline() */
+
+//
+// Keep the record in the RTC's user RAM at iRamOffset
+// The high-water mark is written every iReserve seconds
+// returns RTC_SUCCESS or RTC_ERROR
+//
+int BBRTCTimeline::init(BBRTC *pRTC, int iRamOffset, int iReserve)
+{
+    if (pRTC == NULL || !(pRTC->getCaps() & RTC_CAP_RAM)) return RTC_ERROR;
+    _pRTC = pRTC;
+    _pfnStore = NULL;
+    _pUser = NULL;
+    _iRamOffset = iRamOffset;
+    _iReserve = iReserve;
+    return start();
+} /* init() */
+
+//
+// Keep the record wherever the callback puts it (e.g. EEPROM or flash
+// for RTCs with little or no RAM); use a larger reserve to limit wear
+// returns RTC_SUCCESS or RTC_ERROR
+//
+int BBRTCTimeline::init(BBRTC *pRTC, RTC_STORE_CALLBACK *pfnStore, void *pUser, int iReserve)
+{
+    if (pRTC == NULL || pfnStore == NULL) return RTC_ERROR;
+    _pRTC = pRTC;
+    _pfnStore = pfnStore;
+    _pUser = pUser;
+    _iReserve = iReserve;
+    return start();
+} /* init() */
+
+//
+// Read the RTC as epoch seconds
+// returns RTC_SUCCESS or RTC_xxx
+//
+int BBRTCTimeline::rtcTime(uint32_t *pu32Rtc)
+{
+struct tm t;
+int rc;
+
+    rc = _pRTC->getTime(&t);
+    if (rc != RTC_SUCCESS) return rc; // don't take a failed read as a time
+    *pu32Rtc = BBRTC::timeToEpoch(&t);
+    return RTC_SUCCESS;
+} /* rtcTime() */
+
+//
+// Read the stored record
+// returns RTC_SUCCESS, RTC_ERROR if it's missing or damaged or the bus
+// error which stopped it being read
+//
+int BBRTCTimeline::load(void)
+{
+uint8_t u8Rec[RTC_TIMELINE_SIZE], u8Sum = 0;
+int i, rc;
+
+    if (_pfnStore) rc = (*_pfnStore)(false, u8Rec, _pUser);
+    else rc = _pRTC->readRAM(_iRamOffset, u8Rec, RTC_TIMELINE_SIZE);
+    if (rc != RTC_SUCCESS) return rc;
+    for (i=0; i<RTC_TIMELINE_SIZE; i++) u8Sum += u8Rec[i];
+    if (u8Rec[0] != RTC_TIMELINE_MAGIC || u8Sum != 0xff) return RTC_ERROR;
+    _u16Gen = u8Rec[1] | (u8Rec[2] << 8);
+    _u32High = u8Rec[3] | (u8Rec[4] << 8) | (u8Rec[5] << 16) | ((uint32_t)u8Rec[6] << 24);
+    _i32Offset = (int32_t)(u8Rec[7] | (u8Rec[8] << 8) | (u8Rec[9] << 16) | ((uint32_t)u8Rec[10] << 24));
+    return RTC_SUCCESS;
+} /* load() */
+
+//
+// Store a record with these values
+// returns RTC_SUCCESS or RTC_xxx
+//
+int BBRTCTimeline::save(uint16_t u16Gen, uint32_t u32High, int32_t i32Offset)
+{
+uint8_t u8Rec[RTC_TIMELINE_SIZE], u8Sum = 0;
+int i;
+
+    u8Rec[0] = RTC_TIMELINE_MAGIC;
+    u8Rec[1] = (uint8_t)u16Gen; u8Rec[2] = (uint8_t)(u16Gen >> 8);
+    u8Rec[3] = (uint8_t)u32High; u8Rec[4] = (uint8_t)(u32High >> 8);
+    u8Rec[5] = (uint8_t)(u32High >> 16); u8Rec[6] = (uint8_t)(u32High >> 24);
+    u8Rec[7] = (uint8_t)i32Offset; u8Rec[8] = (uint8_t)(i32Offset >> 8);
+    u8Rec[9] = (uint8_t)(i32Offset >> 16); u8Rec[10] = (uint8_t)(i32Offset >> 24);
+    for (i=0; i<RTC_TIMELINE_SIZE-1; i++) u8Sum += u8Rec[i];
+    u8Rec[RTC_TIMELINE_SIZE-1] = 0xff - u8Sum;
+    if (_pfnStore) return (*_pfnStore)(true, u8Rec, _pUser);
+    return _pRTC->writeRAM(_iRamOffset, u8Rec, RTC_TIMELINE_SIZE);
+} /* save() */
+
+//
+// Pick up where the last boot left off
+// Everything it may have stamped is at or below the stored mark
+// returns RTC_SUCCESS or RTC_xxx (the timeline is unusable until the
+// next init())
+//
+int BBRTCTimeline::start(void)
+{
+uint32_t u32Rtc;
+int rc;
+
+    if (_iReserve < 1) _iReserve = 1;
+    _u32Bridges = 0;
+    _u32Seq = 0;
+    _bHold = false; // a hold isn't stored; a step back at boot is bridged
+    rc = rtcTime(&u32Rtc);
+    if (rc != RTC_SUCCESS) {
+        _pRTC = NULL;
+        return rc;
+    }
+    rc = load();
+    if (rc == RTC_SUCCESS) {
+        _u16Gen++;
+        _u32Last = _u32High; // the next stamp is after the mark
+    } else if (rc != RTC_ERROR) { // the record is there but couldn't be read
+        _pRTC = NULL;
+        return rc;
+    } else { // first use (or the RAM lost power too)
+        _u16Gen = 0;
+        _i32Offset = 0;
+        _u32Last = _u32High = 0;
+    }
+    rc = advance(u32Rtc, NULL);
+    if (rc == RTC_SUCCESS) rc = save(_u16Gen, _u32High, _i32Offset);
+    if (rc != RTC_SUCCESS) _pRTC = NULL;
+    return rc;
+} /* start() */
+
+//
+// Move the timeline to the RTC time u32Rtc
+// Bridges a step back of more than the reserve (unless resync() is
+// holding the timeline for the RTC to catch up) and keeps the stored mark
+// ahead of the timeline. Nothing changes unless a record which has to
+// be written first was stored.
+// returns RTC_SUCCESS or RTC_xxx and the timeline seconds in *pu32Now
+//
+int BBRTCTimeline::advance(uint32_t u32Rtc, uint32_t *pu32Now)
+{
+uint32_t u32Now, u32High = _u32High;
+int32_t i32Offset = _i32Offset;
+uint16_t u16Gen = _u16Gen;
+bool bBridge = false, bHold = _bHold;
+int rc;
+
+    u32Now = u32Rtc + (uint32_t)i32Offset;
+    if (bHold && ((int32_t)(u32Now - _u32Last) >= 0 || (int32_t)(u32Rtc - _u32HoldRtc) < -_iReserve))
+        bHold = false; // caught up (or the RTC went back again, which is bridged)
+    if (!bHold && (int32_t)(u32Now - _u32Last) < -_iReserve) { // the RTC went back; continue from the last stamp
+        i32Offset += (int32_t)(_u32Last - u32Now);
+        u32Now = _u32Last;
+        u16Gen++;
+        bBridge = true; // store the new offset now
+    }
+    if ((int32_t)(u32Now - _u32Last) < 0) u32Now = _u32Last; // a small step back (or a hold) holds the timeline
+    if (bBridge || (int32_t)(u32Now - u32High) >= 0) {
+        u32High = u32Now + (uint32_t)_iReserve;
+        rc = save(u16Gen, u32High, i32Offset);
+        if (rc != RTC_SUCCESS) return rc;
+    }
+    if (bBridge) _u32Bridges++;
+    if (u32Now != _u32Last) { // a new second
+        _u32Last = u32Now;
+        _u32Seq = 0;
+    }
+    _u32High = u32High;
+    _i32Offset = i32Offset;
+    _u16Gen = u16Gen;
+    _bHold = bHold;
+    if (pu32Now) *pu32Now = u32Now;
+    return RTC_SUCCESS;
+} /* advance() */
+
+//
+// Timeline seconds (epoch time while the RTC hasn't been bridged)
+// returns 0 if the RTC can't be read or the record can't be stored
+//
+uint32_t BBRTCTimeline::getTime(void)
+{
+uint32_t u32Rtc, u32Now;
+
+    if (_pRTC == NULL || rtcTime(&u32Rtc) != RTC_SUCCESS) return 0;
+    if (advance(u32Rtc, &u32Now) != RTC_SUCCESS) return 0;
+    return u32Now;
+} /* getTime() */
+
+//
+// Unique, increasing stamp: timeline seconds in the upper 32 bits and
+// a sequence number within the second in the lower 32
+// returns 0 if the RTC can't be read or the record can't be stored
+//
+uint64_t BBRTCTimeline::getStamp(void)
+{
+uint32_t u32Rtc, u32Sec;
+
+    if (_pRTC == NULL || rtcTime(&u32Rtc) != RTC_SUCCESS) return 0;
+    if (advance(u32Rtc, &u32Sec) != RTC_SUCCESS) return 0;
+    return ((uint64_t)u32Sec << 32) | _u32Seq++;
+} /* getStamp() */
+
+//
+// Call this right after setting the RTC to the correct time (e.g. from
+// NTP), before the next getTime() or getStamp() takes it as a step forward
+// or back. The offset is dropped; if the RTC is now behind the timeline,
+// the timeline holds at its last second until the RTC catches up (a
+// reboot before then bridges the rest with a new offset)
+// returns RTC_SUCCESS or RTC_xxx
+//
+int BBRTCTimeline::resync(void)
+{
+uint32_t u32Rtc;
+int rc;
+
+    if (_pRTC == NULL) return RTC_ERROR;
+    rc = rtcTime(&u32Rtc);
+    if (rc != RTC_SUCCESS) return rc;
+    if (_i32Offset == 0 && (int32_t)(u32Rtc - _u32Last) >= 0) return RTC_SUCCESS; // nothing to drop or hold
+    rc = save(_u16Gen + 1, _u32High, 0);
+    if (rc != RTC_SUCCESS) return rc;
+    _u16Gen++;
+    _i32Offset = 0;
+    _bHold = ((int32_t)(u32Rtc - _u32Last) < 0);
+    _u32HoldRtc = u32Rtc;
+    return advance(u32Rtc, NULL);
+} /* resync() */
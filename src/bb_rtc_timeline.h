@@ -0,0 +1,78 @@
+#ifndef __BB_RTC_TIMELINE__
+#define __BB_RTC_TIMELINE__
+//
+// BitBank Realtime Clock Library
+// Timeline which never goes backwards, even across reboots
+// written by Larry Bank (bitbank@pobox.com)
+//
+// SPDX-FileCopyrightText: 2025 BitBank Software, Inc.
+// SPDX-License-Identifier: Apache-2.0
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===========================================================================
+//
+// The timeline is the RTC time plus an offset. A small record kept in the
+// RTC's battery backed RAM (or anywhere else through a callback) holds the
+// offset, a generation count and a high-water mark. The mark is written
+// ahead of the time handed out (by the reserve), so at the next boot the
+// timeline can start past everything stamped before without writing the
+// record on every read. When the RTC goes backwards (it lost power and
+// restarted at 2000-01-01, someone set it back, ...) by more than the
+// reserve, the offset is changed to bridge the gap; smaller steps back
+// hold the timeline until the RTC catches up, as does resync() when it
+// drops the offset after the RTC is set. The generation counts the boots,
+// bridges and resyncs. Stamps carry a sequence number in the low 32 bits,
+// so they're unique and ordered even within a second.
+//
+#include "bb_rtc.h"
+
+#define RTC_TIMELINE_SIZE 12 // bytes of storage used
+#define RTC_TIMELINE_RESERVE 10 // default seconds written ahead
+
+//
+// Read (bWrite = false) or write RTC_TIMELINE_SIZE bytes of non-volatile
+// storage (e.g. EEPROM)
+// returns RTC_SUCCESS or RTC_ERROR
+//
+typedef int (RTC_STORE_CALLBACK)(bool bWrite, uint8_t *pData, void *pUser);
+
+class BBRTCTimeline
+{
+public:
+    BBRTCTimeline();
+    int init(BBRTC *pRTC, int iRamOffset = 0, int iReserve = RTC_TIMELINE_RESERVE);
+    int init(BBRTC *pRTC, RTC_STORE_CALLBACK *pfnStore, void *pUser = NULL, int iReserve = 600);
+    uint32_t getTime(void);
+    uint64_t getStamp(void);
+    int resync(void);
+    uint16_t getGeneration(void) { return _u16Gen; }
+    int32_t getOffset(void) { return _i32Offset; }
+    uint32_t getBridges(void) { return _u32Bridges; }
+
+private:
+    int start(void);
+    int load(void);
+    int save(uint16_t u16Gen, uint32_t u32High, int32_t i32Offset);
+    int advance(uint32_t u32Rtc, uint32_t *pu32Now);
+    int rtcTime(uint32_t *pu32Rtc);
+    BBRTC *_pRTC;
+    RTC_STORE_CALLBACK *_pfnStore; // NULL = RTC RAM
+    void *_pUser;
+    int _iRamOffset, _iReserve;
+    uint32_t _u32High; // stored high-water mark
+    uint32_t _u32Last, _u32Seq; // last stamp handed out
+    int32_t _i32Offset; // timeline - RTC
+    uint16_t _u16Gen;
+    uint32_t _u32Bridges; // since init()
+    uint32_t _u32HoldRtc; // RTC time when resync() started the hold
+    bool _bHold; // resync() set the RTC behind the timeline; wait for it
+}; // class BBRTCTimeline
+
+#endif // __BB_RTC_TIMELINE__
@@ -0,0 +1,374 @@
+//
+// BitBang RealTime Clock library (bb_rtc)
+// Bus traffic tracer with pcap export
+// written by Larry Bank (bitbank@pobox.com)
+//
+// SPDX-FileCopyrightText: 2025 BitBank Software, Inc.
+// SPDX-License-Identifier: Apache-2.0
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===========================================================================
+//
+// Each ring entry is claimed with an atomic increment of the head and
+// published by storing its sequence number last. A reader copies an entry
+// and keeps it only if the sequence number is the expected one before and
+// after the copy, so a writer lapping the reader is detected instead of
+// producing a torn record.
+//
+// The pcap output uses LINKTYPE_I2C_LINUX (209): each packet starts with
+// a 1 byte bus number (0-127) and 4 byte (big-endian) i2c_msg flags, then the
+// address byte (with the R/W bit) and the data. A register read becomes a
+// write of the register number followed by a read. Transfers which were
+// not acknowledged have only the address byte.
+//
+#include "bb_rtc.h"
+#include <string.h>
+#if !defined(ARDUINO) && !defined(__LINUX__)
+#include "esp_timer.h"
+#endif
+
+#define PCAP_MAGIC 0xa1b2c3d4
+#define PCAP_LINKTYPE_I2C_LINUX 209
+#define PCAP_I2C_M_RD 0x0001
+
+//
+// Current time in seconds + microseconds
+// (wall clock on Linux, time since boot on MCUs)
+//
+static void traceTime(uint32_t *pu32Sec, uint32_t *pu32Usec)
+{
+#ifdef __LINUX__
+struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    *pu32Sec = (uint32_t)ts.tv_sec;
+    *pu32Usec = (uint32_t)(ts.tv_nsec / 1000);
+#else
+#ifdef ARDUINO
+uint32_t u32 = micros();
+#else
+int64_t u32 = esp_timer_get_time();
+#endif
+    *pu32Sec = (uint32_t)(u32 / 1000000);
+    *pu32Usec = (uint32_t)(u32 % 1000000);
+#endif
+} /* traceTime() */
+
+static uint32_t traceElapsed(uint32_t u32Sec, uint32_t u32Usec)
+{
+uint32_t u32NowSec, u32NowUsec;
+
+    traceTime(&u32NowSec, &u32NowUsec);
+    return (u32NowSec - u32Sec) * 1000000 + u32NowUsec - u32Usec;
+} /* traceElapsed() */
+
+//
+// Capture the traffic of pBus into the caller's ring of iCount entries
+// Recording starts disabled; call enable(true) to start it
+//
+void BBRTCTraceTransport::init(BBRTCTransport *pBus, RTC_TRACE *pRing, int iCount)
+{
+    _bEnabled = false;
+    _pBus = pBus;
+    _pRing = pRing;
+    _iCount = (pRing) ? iCount : 0;
+    clear();
+} /* init() */
+
+//
+// Discard everything recorded so far
+// (don't call this while another thread is recording)
+//
+void BBRTCTraceTransport::clear(void)
+{
+    if (_pRing && _iCount > 0) memset(_pRing, 0, _iCount * sizeof(RTC_TRACE));
+    __atomic_store_n(&_u32Head, 0, __ATOMIC_RELEASE);
+} /* clear() */
+
+void BBRTCTraceTransport::record(const RTC_XFER *pX, uint32_t u32Sec, uint32_t u32Usec, uint32_t u32DurUs)
+{
+uint32_t u32Pos;
+RTC_TRACE *pT;
+int iLen;
+
+    if (_iCount <= 0) return;
+    u32Pos = __atomic_fetch_add(&_u32Head, 1, __ATOMIC_ACQ_REL);
+    pT = &_pRing[u32Pos % _iCount];
+    __atomic_store_n(&pT->u32Seq, 0, __ATOMIC_RELAXED); // being written
+    __atomic_thread_fence(__ATOMIC_RELEASE); // ...before any of the fields change
+    pT->u32Sec = u32Sec;
+    pT->u32Usec = u32Usec;
+    pT->u32DurUs = u32DurUs;
+    pT->u8Type = pX->u8Type;
+    pT->u8Addr = pX->u8Addr;
+    pT->u8Reg = pX->u8Reg;
+    pT->i16Len = (int16_t)pX->iLen;
+    pT->i16Result = (int16_t)pX->iResult;
+    iLen = (pX->pData && pX->iResult > 0) ? pX->iLen : 0;
+    if (iLen > RTC_TRACE_DATA) iLen = RTC_TRACE_DATA;
+    if (iLen > 0) memcpy(pT->u8Data, pX->pData, iLen);
+    pT->u8Len = (uint8_t)iLen;
+    __atomic_store_n(&pT->u32Seq, u32Pos + 1, __ATOMIC_RELEASE);
+} /* record() */
+
+//
+// Copy the entry at the given position of the capture
+// returns false if it was overwritten or is still being written
+//
+bool BBRTCTraceTransport::getRecord(uint32_t u32Pos, RTC_TRACE *pOut)
+{
+RTC_TRACE *pT = &_pRing[u32Pos % _iCount];
+
+    if (__atomic_load_n(&pT->u32Seq, __ATOMIC_ACQUIRE) != u32Pos + 1) return false;
+    memcpy(pOut, pT, sizeof(RTC_TRACE));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return (__atomic_load_n(&pT->u32Seq, __ATOMIC_RELAXED) == u32Pos + 1 && pOut->u32Seq == u32Pos + 1);
+} /* getRecord() */
+
+//
+// Copy up to iMax of the newest entries, oldest first
+// returns the number of entries copied
+//
+int BBRTCTraceTransport::getRecords(RTC_TRACE *pOut, int iMax)
+{
+uint32_t u32Head, u32Pos;
+int iOut = 0;
+
+    if (pOut == NULL || iMax <= 0 || _iCount <= 0) return 0;
+    u32Head = getTotal();
+    u32Pos = (u32Head > (uint32_t)_iCount) ? u32Head - _iCount : 0;
+    if (u32Head - u32Pos > (uint32_t)iMax) u32Pos = u32Head - iMax;
+    for (; u32Pos != u32Head; u32Pos++) {
+        if (getRecord(u32Pos, &pOut[iOut])) iOut++;
+    }
+    return iOut;
+} /* getRecords() */
+
+//
+// Write one I2C message as a pcap packet
+//
+static int pcapPacket(RTC_WRITE_CALLBACK *pfnWrite, void *pUser, const RTC_TRACE *pT, uint8_t u8Bus, bool bRead, const uint8_t *pData, int iLen, int iOrigLen)
+{
+uint32_t u32Hdr[4];
+uint8_t u8Pkt[6 + RTC_TRACE_DATA];
+
+    u32Hdr[0] = pT->u32Sec;
+    u32Hdr[1] = pT->u32Usec;
+    u32Hdr[2] = 6 + iLen; // bytes in the file
+    u32Hdr[3] = 6 + iOrigLen; // bytes on the wire
+    u8Pkt[0] = u8Bus & 0x7f; // bit 7 marks bus events
+    u8Pkt[1] = u8Pkt[2] = u8Pkt[3] = 0;
+    u8Pkt[4] = (bRead) ? PCAP_I2C_M_RD : 0;
+    u8Pkt[5] = (uint8_t)((pT->u8Addr << 1) | ((bRead) ? 1 : 0));
+    if (iLen > 0) memcpy(&u8Pkt[6], pData, iLen);
+    if ((*pfnWrite)(pUser, (const uint8_t *)u32Hdr, sizeof(u32Hdr)) != sizeof(u32Hdr)) return RTC_ERROR;
+    if ((*pfnWrite)(pUser, u8Pkt, 6 + iLen) != 6 + iLen) return RTC_ERROR;
+    return RTC_SUCCESS;
+} /* pcapPacket() */
+
+//
+// Write the capture in pcap format through a callback
+// (e.g. to a file, a serial port or a network socket)
+// returns RTC_SUCCESS or RTC_ERROR
+//
+int BBRTCTraceTransport::writePcap(RTC_WRITE_CALLBACK *pfnWrite, void *pUser, uint8_t u8Bus)
+{
+uint32_t u32Hdr[6], u32Head, u32Pos;
+RTC_TRACE t;
+int rc = RTC_SUCCESS, iLen, iOrig;
+bool bOK;
+
+    if (pfnWrite == NULL) return RTC_ERROR;
+    u32Hdr[0] = PCAP_MAGIC; // native byte order
+    u32Hdr[1] = 2 | (4 << 16); // version 2.4
+    u32Hdr[2] = 0; // GMT
+    u32Hdr[3] = 0; // timestamp accuracy
+    u32Hdr[4] = 65535; // snapshot length
+    u32Hdr[5] = PCAP_LINKTYPE_I2C_LINUX;
+    if ((*pfnWrite)(pUser, (const uint8_t *)u32Hdr, sizeof(u32Hdr)) != sizeof(u32Hdr)) return RTC_ERROR;
+    if (_iCount <= 0) return RTC_SUCCESS;
+    u32Head = getTotal();
+    u32Pos = (u32Head > (uint32_t)_iCount) ? u32Head - _iCount : 0;
+    for (; u32Pos != u32Head && rc == RTC_SUCCESS; u32Pos++) {
+        if (!getRecord(u32Pos, &t)) continue; // overwritten while we were busy
+        bOK = (t.i16Result > 0);
+        iOrig = (bOK && t.i16Len > 0) ? t.i16Len : 0;
+        iLen = t.u8Len;
+        switch (t.u8Type) {
+            case RTC_XFER_WRITE:
+                rc = pcapPacket(pfnWrite, pUser, &t, u8Bus, false, t.u8Data, iLen, iOrig);
+                break;
+            case RTC_XFER_READ:
+                rc = pcapPacket(pfnWrite, pUser, &t, u8Bus, true, t.u8Data, iLen, iOrig);
+                break;
+            case RTC_XFER_READREG:
+                rc = pcapPacket(pfnWrite, pUser, &t, u8Bus, false, &t.u8Reg, (bOK) ? 1 : 0, (bOK) ? 1 : 0);
+                if (rc == RTC_SUCCESS && bOK)
+                    rc = pcapPacket(pfnWrite, pUser, &t, u8Bus, true, t.u8Data, iLen, iOrig);
+                break;
+            default: // RTC_XFER_PROBE (an empty write)
+                rc = pcapPacket(pfnWrite, pUser, &t, u8Bus, false, NULL, 0, 0);
+                break;
+        }
+    }
+    return rc;
+} /* writePcap() */
+
+#ifdef __LINUX__
+static int pcapFileWrite(void *pUser, const uint8_t *pData, int iLen)
+{
+    return (int)fwrite(pData, 1, iLen, (FILE *)pUser);
+} /* pcapFileWrite() */
+
+//
+// Save the capture as a pcap file which can be opened with Wireshark
+// returns RTC_SUCCESS or RTC_ERROR
+//
+int BBRTCTraceTransport::savePcap(const char *szFile, uint8_t u8Bus)
+{
+FILE *f;
+int rc;
+
+    f = fopen(szFile, "wb");
+    if (f == NULL) return RTC_ERROR;
+    rc = writePcap(pcapFileWrite, f, u8Bus);
+    if (fclose(f) != 0) rc = RTC_ERROR;
+    return rc;
+} /* savePcap() */
+
+//
+// Save the capture in the bb_rtc trace format (a header followed by the
+// RTC_TRACE entries) for playback with BBRTCReplayTransport
+// returns RTC_SUCCESS or RTC_ERROR
+//
+int BBRTCTraceTransport::saveTrace(const char *szFile)
+{
+FILE *f;
+uint32_t u32Hdr[4], u32Head, u32Pos, u32Count = 0;
+RTC_TRACE t;
+int rc = RTC_SUCCESS;
+
+    f = fopen(szFile, "wb");
+    if (f == NULL) return RTC_ERROR;
+    u32Hdr[0] = RTC_TRACE_MAGIC;
+    u32Hdr[1] = RTC_TRACE_VERSION;
+    u32Hdr[2] = sizeof(RTC_TRACE);
+    u32Hdr[3] = 0; // entry count, filled in below
+    if (fwrite(u32Hdr, sizeof(u32Hdr), 1, f) != 1) rc = RTC_ERROR;
+    if (_iCount > 0) {
+        u32Head = getTotal();
+        u32Pos = (u32Head > (uint32_t)_iCount) ? u32Head - _iCount : 0;
+        for (; u32Pos != u32Head && rc == RTC_SUCCESS; u32Pos++) {
+            if (!getRecord(u32Pos, &t)) continue;
+            if (fwrite(&t, sizeof(t), 1, f) != 1) rc = RTC_ERROR;
+            u32Count++;
+        }
+    }
+    u32Hdr[3] = u32Count;
+    if (rc == RTC_SUCCESS && (fseek(f, 0, SEEK_SET) != 0 || fwrite(u32Hdr, sizeof(u32Hdr), 1, f) != 1))
+        rc = RTC_ERROR;
+    if (fclose(f) != 0) rc = RTC_ERROR;
+    return rc;
+} /* saveTrace() */
+#endif // __LINUX__
+
+//
+// Transport methods; pass each call to the real bus and record it
+//
+int BBRTCTraceTransport::probe(uint8_t u8Addr)
+{
+RTC_XFER x;
+uint32_t u32Sec, u32Usec;
+
+    if (_pBus == NULL) return 0;
+    if (!_bEnabled) return _pBus->probe(u8Addr);
+    memset(&x, 0, sizeof(x));
+    x.u8Type = RTC_XFER_PROBE;
+    x.u8Addr = u8Addr;
+    traceTime(&u32Sec, &u32Usec);
+    x.iResult = _pBus->probe(u8Addr);
+    record(&x, u32Sec, u32Usec, traceElapsed(u32Sec, u32Usec));
+    return x.iResult;
+} /* probe() */
+
+int BBRTCTraceTransport::read(uint8_t u8Addr, uint8_t *pData, int iLen)
+{
+RTC_XFER x;
+uint32_t u32Sec, u32Usec;
+
+    if (_pBus == NULL) return 0;
+    if (!_bEnabled) return _pBus->read(u8Addr, pData, iLen);
+    memset(&x, 0, sizeof(x));
+    x.u8Type = RTC_XFER_READ;
+    x.u8Addr = u8Addr;
+    x.pData = pData;
+    x.iLen = iLen;
+    traceTime(&u32Sec, &u32Usec);
+    x.iResult = _pBus->read(u8Addr, pData, iLen);
+    record(&x, u32Sec, u32Usec, traceElapsed(u32Sec, u32Usec));
+    return x.iResult;
+} /* read() */
+
+int BBRTCTraceTransport::write(uint8_t u8Addr, uint8_t *pData, int iLen)
+{
+RTC_XFER x;
+uint32_t u32Sec, u32Usec;
+
+    if (_pBus == NULL) return 0;
+    if (!_bEnabled) return _pBus->write(u8Addr, pData, iLen);
+    memset(&x, 0, sizeof(x));
+    x.u8Type = RTC_XFER_WRITE;
+    x.u8Addr = u8Addr;
+    x.pData = pData;
+    x.iLen = iLen;
+    traceTime(&u32Sec, &u32Usec);
+    x.iResult = _pBus->write(u8Addr, pData, iLen);
+    record(&x, u32Sec, u32Usec, traceElapsed(u32Sec, u32Usec));
+    return x.iResult;
+} /* write() */
+
+int BBRTCTraceTransport::readRegister(uint8_t u8Addr, uint8_t u8Reg, uint8_t *pData, int iLen)
+{
+RTC_XFER x;
+uint32_t u32Sec, u32Usec;
+
+    if (_pBus == NULL) return 0;
+    if (!_bEnabled) return _pBus->readRegister(u8Addr, u8Reg, pData, iLen);
+    memset(&x, 0, sizeof(x));
+    x.u8Type = RTC_XFER_READREG;
+    x.u8Addr = u8Addr;
+    x.u8Reg = u8Reg;
+    x.pData = pData;
+    x.iLen = iLen;
+    traceTime(&u32Sec, &u32Usec);
+    x.iResult = _pBus->readRegister(u8Addr, u8Reg, pData, iLen);
+    record(&x, u32Sec, u32Usec, traceElapsed(u32Sec, u32Usec));
+    return x.iResult;
+} /* readRegister() */
+
+//
+// The list is passed on as a batch, so all of its entries get the start
+// time and duration of the whole batch
+//
+int BBRTCTraceTransport::transfer(RTC_XFER *pList, int iCount)
+{
+uint32_t u32Sec, u32Usec, u32Dur;
+int i, iGood;
+
+    if (_pBus == NULL) return 0;
+    if (!_bEnabled) return _pBus->transfer(pList, iCount);
+    traceTime(&u32Sec, &u32Usec);
+    iGood = _pBus->transfer(pList, iCount);
+    u32Dur = traceElapsed(u32Sec, u32Usec);
+    for (i=0; i<iCount; i++) {
+        record(&pList[i], u32Sec, u32Usec, u32Dur);
+    }
+    return iGood;
+} /* transfer() */
@@ -32,9 +32,10 @@
 #include "esp_timer.h"
 #include "rom/ets_sys.h"
 #include "driver/i2c.h"
+#include "hal/gpio_ll.h"
+#include "soc/gpio_struct.h"
+#include "bb_rtc_bitbang.h"
 #define I2C_MASTER_NUM              0
-static uint8_t u8SDA_Pin, u8SCL_Pin;
-static int iDelay = 1;
 
 // GPIO modes
 #define memcpy_P memcpy
@@ -70,175 +71,60 @@ static void delay(uint32_t ms)
     delayMicroseconds((ms % 10) * 1000);
 }
 
-static void rtcPinMode(int iPin, int iMode)
+//
+// Open drain GPIO pins for the bit banged I2C engine
+// The pins are configured once; after that each edge is a single
+// register write through the low level GPIO driver
+//
+class BBRTCEspGPIO
 {
-    gpio_config_t io_conf = {};
-
-    gpio_reset_pin((gpio_num_t)iPin);
-    if (iMode == DISABLED) return;
-    io_conf.intr_type = GPIO_INTR_DISABLE; //disable interrupt
-    //bit mask of the pins that you want to set,e.g.GPIO18/19
-    io_conf.pin_bit_mask = (1ULL << iPin);
-    io_conf.pull_down_en = (gpio_pulldown_t)(iMode == INPUT_PULLDOWN); // pull-down mode
-    io_conf.pull_up_en = (gpio_pullup_t)(iMode == INPUT_PULLUP); // pull-up mode
-    if (iMode == OUTPUT) {
-        io_conf.mode = GPIO_MODE_OUTPUT;
-    } else { // must be input
-        io_conf.mode = GPIO_MODE_INPUT;
+public:
+    int init(int iSDA, int iSCL)
+    {
+        gpio_config_t io_conf = {};
+        _u32SDA = (uint32_t)iSDA;
+        _u32SCL = (uint32_t)iSCL;
+        io_conf.intr_type = GPIO_INTR_DISABLE;
+        io_conf.pin_bit_mask = (1ULL << iSDA) | (1ULL << iSCL);
+        io_conf.mode = GPIO_MODE_INPUT_OUTPUT_OD;
+        io_conf.pull_up_en = GPIO_PULLUP_ENABLE; // weak; use external pull-ups above 100kHz
+        io_conf.pull_down_en = GPIO_PULLDOWN_DISABLE;
+        if (gpio_config(&io_conf) != ESP_OK) return RTC_ERROR;
+        sdaHigh();
+        sclHigh();
+        return RTC_SUCCESS;
     }
-    gpio_config(&io_conf); //configure GPIO with the given settings
-} /* rtcPinMode() */
+    inline void sdaLow(void) { gpio_ll_set_level(&GPIO, _u32SDA, 0); }
+    inline void sdaHigh(void) { gpio_ll_set_level(&GPIO, _u32SDA, 1); }
+    inline void sclLow(void) { gpio_ll_set_level(&GPIO, _u32SCL, 0); }
+    inline void sclHigh(void) { gpio_ll_set_level(&GPIO, _u32SCL, 1); }
+    inline int sdaRead(void) { return gpio_ll_get_level(&GPIO, _u32SDA); }
+    inline int sclRead(void) { return gpio_ll_get_level(&GPIO, _u32SCL); }
+    uint32_t micros(void) { return (uint32_t)esp_timer_get_time(); }
 
-static uint8_t SDA_READ(void)
-{
-    return gpio_get_level((gpio_num_t)u8SDA_Pin);
-}
-static void SDA_HIGH(void)
-{
-    rtcPinMode(u8SDA_Pin, INPUT_PULLDOWN);
-}
-static void SDA_LOW(void)
-{
-    rtcPinMode(u8SDA_Pin, OUTPUT);
-    gpio_set_level((gpio_num_t)u8SDA_Pin, 0);
-}
-static void SCL_HIGH(void)
-{
-    rtcPinMode(u8SCL_Pin, INPUT_PULLDOWN);
-}
-static void SCL_LOW(void)
-{
-    rtcPinMode(u8SCL_Pin, OUTPUT);
-    gpio_set_level((gpio_num_t)u8SCL_Pin, 0);
-}
-
-// Transmit a byte and read the ack bit
-// if we get a NACK (negative acknowledge) return 0
-// otherwise return 1 for success
-//
+private:
+    uint32_t _u32SDA, _u32SCL;
+}; // class BBRTCEspGPIO
 
-static int i2cByteOut(uint8_t b)
-{
-uint8_t i, ack;
+static BBRTCBitBang<BBRTCEspGPIO> bbI2C;
+static TickType_t i2cTimeout = 1000 / portTICK_PERIOD_MS; // longest wait for the I2C driver
 
-    for (i=0; i<8; i++) {
-//    delayMicroseconds(iDelay);
-        if (b & 0x80)
-            SDA_HIGH(); // set data line to 1
-        else
-            SDA_LOW(); // set data line to 0
-        b <<= 1;
-//    delayMicroseconds(iDelay);
-        SCL_HIGH(); // clock high (slave latches data)
-        delayMicroseconds(iDelay);
-        SCL_LOW(); // clock low
-        delayMicroseconds(iDelay);
-    } // for i
-    //delayMicroseconds(iDelay);
-    // read ack bit
-    SDA_HIGH(); // set data line for reading
-    //delayMicroseconds(iDelay);
-    SCL_HIGH(); // clock line high
-    delayMicroseconds(iDelay); // DEBUG - delay/2
-    ack = SDA_READ();
-    //delayMicroseconds(iDelay);
-    SCL_LOW(); // clock low
-    delayMicroseconds(iDelay); // DEBUG - delay/2
-    SDA_LOW(); // data low
-    return (ack == 0); // a low ACK bit means success
-} /* i2cByteOut() */
 //
-// Receive a byte and read the ack bit
-// if we get a NACK (negative acknowledge) return 0
-// otherwise return 1 for success
+// Turn an I2C driver result into the length or a negative RTC_xxx code
 //
-static uint8_t i2cByteIn(uint8_t bLast)
-{
-uint8_t i;
-uint8_t b = 0;
-
-     SDA_HIGH(); // set data line as input
-     for (i=0; i<8; i++)
-     {
-         delayMicroseconds(iDelay); // wait for data to settle
-         SCL_HIGH(); // clock high (slave latches data)
-         delayMicroseconds(iDelay);
-         b <<= 1;
-         if (SDA_READ() != 0) // read the data bit
-           b |= 1; // set data bit
-         SCL_LOW(); // clock low
-     } // for i
-     if (bLast)
-        SDA_HIGH(); // last byte sends a NACK
-     else
-     SDA_LOW();
-     //     delayMicroseconds(iDelay);
-          SCL_HIGH(); // clock high
-          delayMicroseconds(iDelay);
-          SCL_LOW(); // clock low to send ack
-          delayMicroseconds(iDelay);
-     //     SDA_HIGH();
-          SDA_LOW(); // data low
-       return b;
-} /* i2cByteIn() */
-//
-// Send I2C STOP condition
-//
-static void i2cEnd(void)
-{
-   SDA_LOW(); // data line low
-   delayMicroseconds(iDelay);
-   SCL_HIGH(); // clock high
-   delayMicroseconds(iDelay);
-   SDA_HIGH(); // data high
-   delayMicroseconds(iDelay);
-} /* i2cEnd() */
-
-static int i2cBegin(uint8_t addr, uint8_t bRead)
+static int I2CResult(esp_err_t ret, int iLen)
 {
-   int rc;
-//   SCL_HIGH();
-//   delayMicroseconds(iDelay);
-   SDA_LOW(); // data line low first
-   delayMicroseconds(iDelay);
-   SCL_LOW(); // then clock line low is a START signal
-   addr <<= 1;
-   if (bRead)
-      addr++; // set read bit
-   rc = i2cByteOut(addr); // send the slave address and R/W bit
-   return rc;
-} /* i2cBegin() */
-
-static void BBI2CWrite(uint8_t addr, uint8_t *pData, int iLen)
-{
-uint8_t b;
-int rc;
-     
-    i2cBegin(addr, 0);
-    rc = 1;
-    while (iLen && rc == 1)
-    {
-       b = *pData++;
-       rc = i2cByteOut(b);
-       if (rc == 1) // success
-       {
-          iLen--;
-       }
-    } // for each byte
-    i2cEnd();
-//return (rc == 1) ? (iOldLen - iLen) : 0; // 0 indicates bad ack from sending a byte
-} /* BBI2CWrite() */
-
-static int BBI2CRead(uint8_t addr, uint8_t *pData, int iLen)
-{
-    i2cBegin(addr, 1);
-    while (iLen--)
-    {
-       *pData++ = i2cByteIn(iLen == 0);
-    } // for each byte
-    i2cEnd();
-    return 1;
-} /* BBI2CRead() */
+    switch (ret) {
+        case ESP_OK:
+            return iLen;
+        case ESP_FAIL: // not acknowledged
+            return -RTC_NACK;
+        case ESP_ERR_TIMEOUT: // the bus stayed busy
+            return -RTC_TIMEOUT;
+        default:
+            return -RTC_ERROR;
+    }
+} /* I2CResult() */
 
 static int I2CTest(BBI2C *pI2C, uint8_t addr)
 {
@@ -252,15 +138,11 @@ static int I2CTest(BBI2C *pI2C, uint8_t addr)
       i2c_master_start(cmd);
       i2c_master_write_byte(cmd, (addr << 1) | I2C_MASTER_WRITE, true);
       i2c_master_stop(cmd);
-      esp_err_t ret = i2c_master_cmd_begin(I2C_NUM_0, cmd, 1000 / portTICK_PERIOD_MS);
+      esp_err_t ret = i2c_master_cmd_begin(I2C_NUM_0, cmd, i2cTimeout);
       i2c_cmd_link_delete(cmd);
       response = (ret == ESP_OK);
         } else {
-        if (i2cBegin(addr, 0)) // try to write to the given address
-        {
-           response = 1;
-        }
-        i2cEnd();
+           response = (bbI2C.doProbe(addr) > 0);
       }
      return response;
      } /* I2CTest() */
@@ -270,11 +152,7 @@ static int I2CTest(BBI2C *pI2C, uint8_t addr)
 static void I2CInit(BBI2C *pI2C, unsigned int iClock)
 {
     if (!pI2C->bWire) {
-        u8SDA_Pin = pI2C->iSDA;
-        u8SCL_Pin = pI2C->iSCL;
-//    if (iSpeed >= 400000) iDelay = 1;
-//    else if (iSpeed >= 100000) iDelay = 10;
-//    else iDelay = 20;
+        bbI2C.init(pI2C->iSDA, pI2C->iSCL, iClock);
     } else if (pI2C->iSDA != 0xff) { // -1 indicates that I2C is already initialized
         i2c_config_t conf;
         conf.mode = I2C_MODE_MASTER;
@@ -295,8 +173,7 @@ static int I2CWrite(BBI2C *pI2C, unsigned char iAddr, unsigned char *pData, int
 {
 
     if (!pI2C->bWire) {
-        BBI2CWrite(iAddr, pData, iLen);
-        return 1;
+        return bbI2C.doWrite(iAddr, pData, iLen);
     } else {
     i2c_cmd_handle_t cmd = i2c_cmd_link_create();
     if (cmd == NULL) {
@@ -306,9 +183,9 @@ static int I2CWrite(BBI2C *pI2C, unsigned char iAddr, unsigned char *pData, int
     i2c_master_write_byte(cmd, (iAddr << 1) | I2C_MASTER_WRITE, true);
     i2c_master_write(cmd, pData, iLen, true);
     i2c_master_stop(cmd);
-    esp_err_t ret = i2c_master_cmd_begin(I2C_NUM_0, cmd, 1000 / portTICK_PERIOD_MS);
+    esp_err_t ret = i2c_master_cmd_begin(I2C_NUM_0, cmd, i2cTimeout);
     i2c_cmd_link_delete(cmd);
-    return (ret == ESP_OK);
+    return I2CResult(ret, iLen);
     }
 } /* I2CWrite() */
 
@@ -317,7 +194,7 @@ static int I2CRead(BBI2C *pI2C, unsigned char iAddr, unsigned char *pData, int i
 int i = 0;
 
     if (!pI2C->bWire) {
-        i = I2CRead(pI2C, iAddr, pData, iLen);
+        i = bbI2C.doRead(iAddr, pData, iLen);
     } else {
     esp_err_t ret;
     i2c_cmd_handle_t cmd = i2c_cmd_link_create();
@@ -332,10 +209,8 @@ int i = 0;
     i2c_master_read_byte(cmd, pData + iLen - 1, I2C_MASTER_NACK);
     i2c_master_stop(cmd);
 
-    ret = i2c_master_cmd_begin(I2C_NUM_0, cmd, 1000 / portTICK_PERIOD_MS);
-    if (ret == ESP_OK) {
-        i = iLen;
-    }
+    ret = i2c_master_cmd_begin(I2C_NUM_0, cmd, i2cTimeout);
+    i = I2CResult(ret, iLen);
     i2c_cmd_link_delete(cmd);
     }
     return i;
@@ -343,14 +218,48 @@ int i = 0;
 
 static int I2CReadRegister(BBI2C *pI2C, unsigned char iAddr, unsigned char u8Register, unsigned char *pData, int iLen)
 {
+int rc;
+
     if (pI2C->bWire) {
-        I2CWrite(pI2C, iAddr, &u8Register, 1);
-        I2CRead(pI2C, iAddr, pData, iLen);
-    } else {
-        BBI2CWrite(iAddr, &u8Register, 1);
-        BBI2CRead(iAddr, pData, iLen);
+        rc = I2CWrite(pI2C, iAddr, &u8Register, 1);
+        if (rc <= 0) return rc;
+        return I2CRead(pI2C, iAddr, pData, iLen);
     }
-    return iLen;
+    return bbI2C.doReadRegister(iAddr, u8Register, pData, iLen);
 } /* I2CReadRegister() */
 
+//
+// Free a stuck bus. For the I2C driver, the driver is removed, the bit
+// banged engine takes the pins to clock out the slave and send a STOP,
+// then the driver is installed again. u32Speed is 0 when other code set
+// up the bus, in which case the driver is left alone.
+// returns RTC_SUCCESS, RTC_BUS_STUCK or RTC_ERROR
+//
+static int I2CRecover(BBI2C *pI2C, uint32_t u32Speed)
+{
+int rc = RTC_ERROR;
+
+    if (!pI2C->bWire) return bbI2C.doRecover();
+    if (u32Speed == 0 || pI2C->iSDA == 0xff) return RTC_ERROR; // not ours to reset
+    i2c_driver_delete(I2C_NUM_0);
+    if (bbI2C.init(pI2C->iSDA, pI2C->iSCL, u32Speed) == RTC_SUCCESS) {
+        rc = bbI2C.doRecover();
+    }
+    I2CInit(pI2C, u32Speed); // give the pins back to the I2C controller
+    return rc;
+} /* I2CRecover() */
+
+//
+// Longest a transfer may wait for the I2C driver (0 = the default 1s)
+// The bit banged engine is limited by its stretch timeout instead
+//
+static int I2CSetTimeout(BBI2C *pI2C, int iMs)
+{
+    (void)pI2C;
+    if (iMs <= 0) iMs = 1000;
+    i2cTimeout = iMs / portTICK_PERIOD_MS;
+    if (i2cTimeout == 0) i2cTimeout = 1;
+    return RTC_SUCCESS;
+} /* I2CSetTimeout() */
+
 #endif // __BB_RTC_IO__
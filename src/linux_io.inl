@@ -50,33 +50,83 @@ uint8_t response = 0;
     return response;
 } /* I2CTest() */
 
+//
+// Turn errno from a failed transfer into a negative RTC_xxx code
+// (see the kernel's Documentation/i2c/fault-codes.rst)
+//
+static int I2CError(void)
+{
+	switch (errno) {
+		case ENXIO: // address not acknowledged
+		case EREMOTEIO: // data not acknowledged
+			return -RTC_NACK;
+		case ETIMEDOUT:
+			return -RTC_TIMEOUT;
+		case EAGAIN: // lost arbitration
+		case EBUSY: // bus busy for too long
+			return -RTC_BUS_STUCK;
+		default:
+			return -RTC_ERROR;
+	}
+} /* I2CError() */
+
 int I2CRead(BBI2C *pI2C, uint8_t iAddr, uint8_t *pData, int iLen)
 {
 int rc;
-	ioctl(pI2C->file_i2c, I2C_SLAVE, iAddr);
+	if (ioctl(pI2C->file_i2c, I2C_SLAVE, iAddr) < 0) return -RTC_ERROR; // e.g. owned by a kernel driver
 	rc = read(pI2C->file_i2c, pData, iLen);
-	return rc;
+	return (rc < 0) ? I2CError() : rc;
 } /* I2CRead() */
 int I2CReadRegister(BBI2C *pI2C, uint8_t iAddr, uint8_t u8Register, uint8_t *pData, int iLen)
 {
 int rc;
         // Reading from an I2C device involves first writing the 8-bit register
         // followed by reading the data
-	ioctl(pI2C->file_i2c, I2C_SLAVE, iAddr);
+	if (ioctl(pI2C->file_i2c, I2C_SLAVE, iAddr) < 0) return -RTC_ERROR;
         rc = write(pI2C->file_i2c, &u8Register, 1); // write the register value
         if (rc == 1)
         {
                 rc = read(pI2C->file_i2c, pData, iLen);
         }
-        return rc;
+        return (rc < 0) ? I2CError() : rc;
 
 } /* I2CReadRegister() */
 
 int I2CWrite(BBI2C *pI2C, uint8_t iAddr, uint8_t *pData, int iLen)
 {
 int rc;
-	ioctl(pI2C->file_i2c, I2C_SLAVE, iAddr);
+	if (ioctl(pI2C->file_i2c, I2C_SLAVE, iAddr) < 0) return -RTC_ERROR;
 	rc = write(pI2C->file_i2c, pData, iLen);
-	return rc;
+	return (rc < 0) ? I2CError() : rc;
 } /* I2CWrite() */
+//
+// The adapter driver clocks out a stuck slave and sends a STOP itself
+// (when the controller can) as soon as it finds the bus held low; all we
+// can do from user space is reopen the adapter so nothing is left over
+// from the failed transfers. u32Speed is 0 when other code opened the
+// bus, in which case it's left alone.
+// returns RTC_SUCCESS or RTC_ERROR
+//
+int I2CRecover(BBI2C *pI2C, uint32_t u32Speed)
+{
+char filename[32];
+int iFile;
+
+	if (u32Speed == 0) return RTC_SUCCESS;
+	sprintf(filename, "/dev/i2c-%d", pI2C->iSDA);
+	iFile = open(filename, O_RDWR);
+	if (iFile < 0) return RTC_ERROR;
+	if (pI2C->file_i2c >= 0) close(pI2C->file_i2c);
+	pI2C->file_i2c = iFile;
+	return RTC_SUCCESS;
+} /* I2CRecover() */
+//
+// Limit how long the adapter waits on a transfer (0 = leave it)
+// This is an adapter setting, so it applies to every user of the bus
+//
+int I2CSetTimeout(BBI2C *pI2C, int iMs)
+{
+	if (iMs <= 0) return RTC_SUCCESS;
+	return (ioctl(pI2C->file_i2c, I2C_TIMEOUT, (iMs + 9) / 10) < 0) ? RTC_ERROR : RTC_SUCCESS; // units of 10ms
+} /* I2CSetTimeout() */
 #endif // __BB_RTC_IO__
@@ -0,0 +1,305 @@
+//
+// bb_rtc backend for RTCs owned by a Linux kernel driver (/dev/rtcN)
+// Written by Larry Bank (bitbank@pobox.com)
+//
+// SPDX-License-Identifier: Apache-2.0
+// SPDX-FileCopyrightText: 2025 BitBank Software, Inc.
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===========================================================================
+//
+// When rtc-ds1307, rtc-pcf8563 and friends are bound to the chip, the
+// kernel owns the I2C device and we must go through its character device.
+// Only the time, one absolute alarm and the update (1Hz) interrupt are
+// available this way; see getCaps() for what's missing compared to direct
+// register access.
+//
+#ifndef __BB_RTC_DEV__
+#define __BB_RTC_DEV__
+
+#include <linux/rtc.h>
+#include <sys/select.h>
+#include <poll.h>
+
+//
+// Map the kernel driver name (from sysfs) to one of our device types
+//
+static int rtcDevType(const char *szDevice)
+{
+char szPath[64], szName[64];
+const char *p;
+FILE *f;
+int iType = RTC_UNKNOWN;
+
+    p = strrchr(szDevice, '/');
+    p = (p) ? p+1 : szDevice;
+    snprintf(szPath, sizeof(szPath), "/sys/class/rtc/%s/name", p);
+    f = fopen(szPath, "r");
+    if (f) {
+        if (fgets(szName, sizeof(szName), f)) {
+            if (strstr(szName, "ds3231"))
+                iType = RTC_DS3231;
+            else if (strstr(szName, "ds3232"))
+                iType = RTC_DS3232;
+            else if (strstr(szName, "mcp794"))
+                iType = RTC_MCP7940N;
+            else if (strstr(szName, "ds1307"))
+                iType = RTC_DS1307;
+            else if (strstr(szName, "pcf2127") || strstr(szName, "pcf2129"))
+                iType = RTC_PCF2129;
+            else if (strstr(szName, "rv3032"))
+                iType = RTC_RV3032;
+            else if (strstr(szName, "pcf85063"))
+                iType = RTC_PCF85063A;
+            else if (strstr(szName, "pcf8563"))
+                iType = RTC_PCF8563;
+        }
+        fclose(f);
+    }
+    return iType;
+} /* rtcDevType() */
+
+//
+// Open an RTC which is managed by a kernel driver
+// returns RTC_SUCCESS or RTC_ERROR
+//
+int BBRTC::initRTCDev(const char *szDevice)
+{
+struct rtc_time rt;
+struct rtc_wkalrm wk;
+
+    if (_iRTCDev >= 0) close(_iRTCDev);
+    _iRTCDev = open(szDevice, O_RDONLY);
+    if (_iRTCDev < 0) {
+        logmsg("Failed to open the RTC device");
+        return RTC_ERROR;
+    }
+    if (ioctl(_iRTCDev, RTC_RD_TIME, &rt) < 0) {
+        close(_iRTCDev);
+        _iRTCDev = -1;
+        return RTC_ERROR;
+    }
+    _iRTCType = rtcDevType(szDevice);
+    _iRTCAddr = 0;
+    _iDevCaps = RTC_CAP_TIME; // repeating alarms become one-shots, so no RTC_CAP_ALARM_REPEAT
+    if (ioctl(_iRTCDev, RTC_WKALM_RD, &wk) == 0) // driver has alarm support
+        _iDevCaps |= RTC_CAP_ALARM | RTC_CAP_COUNTDOWN | RTC_CAP_IRQ_WAIT;
+    return RTC_SUCCESS;
+} /* initRTCDev() */
+
+int BBRTC::rtcDevGetTime(struct tm *pTime)
+{
+struct rtc_time rt;
+
+    memset(pTime, 0, sizeof(struct tm));
+    if (ioctl(_iRTCDev, RTC_RD_TIME, &rt) < 0) return RTC_ERROR;
+    pTime->tm_sec = rt.tm_sec;
+    pTime->tm_min = rt.tm_min;
+    pTime->tm_hour = rt.tm_hour;
+    pTime->tm_mday = rt.tm_mday;
+    pTime->tm_mon = rt.tm_mon;
+    pTime->tm_year = rt.tm_year;
+    pTime->tm_wday = rt.tm_wday;
+    return RTC_SUCCESS;
+} /* rtcDevGetTime() */
+
+int BBRTC::rtcDevSetTime(struct tm *pTime)
+{
+struct rtc_time rt;
+
+    memset(&rt, 0, sizeof(rt));
+    rt.tm_sec = pTime->tm_sec;
+    rt.tm_min = pTime->tm_min;
+    rt.tm_hour = pTime->tm_hour;
+    rt.tm_mday = pTime->tm_mday;
+    rt.tm_mon = pTime->tm_mon;
+    rt.tm_year = pTime->tm_year;
+    rt.tm_wday = pTime->tm_wday;
+    return (ioctl(_iRTCDev, RTC_SET_TIME, &rt) < 0) ? RTC_ERROR : RTC_SUCCESS;
+} /* rtcDevSetTime() */
+
+//
+// The kernel only supports a single absolute (one-shot) alarm, so the
+// repeating alarm types are converted into their next occurrence.
+// ALARM_SECOND uses the 1Hz update interrupt instead.
+//
+int BBRTC::rtcDevSetAlarm(uint8_t type, struct tm *pTime)
+{
+struct rtc_wkalrm wk;
+struct tm now, next;
+time_t tNow, tNext;
+int i;
+
+    if (type == ALARM_SECOND) {
+        return (ioctl(_iRTCDev, RTC_UIE_ON, 0) < 0) ? RTC_ERROR : RTC_SUCCESS;
+    }
+    if (pTime == NULL || rtcDevGetTime(&now) != RTC_SUCCESS) return RTC_ERROR;
+    tNow = timegm(&now);
+    memcpy(&next, &now, sizeof(next));
+    switch (type) {
+        case ALARM_MINUTE: // next time the minutes match
+        case ALARM2_MINUTE:
+            next.tm_sec = 0;
+            next.tm_min = pTime->tm_min;
+            tNext = timegm(&next);
+            if (tNext <= tNow) tNext += 3600;
+            break;
+        case ALARM_HOUR: // next time the hour starts
+        case ALARM2_HOUR:
+            next.tm_sec = next.tm_min = 0;
+            next.tm_hour = pTime->tm_hour;
+            tNext = timegm(&next);
+            if (tNext <= tNow) tNext += 24*3600;
+            break;
+        default: // time of day, optionally on a given day or date
+            next.tm_sec = pTime->tm_sec;
+            next.tm_min = pTime->tm_min;
+            next.tm_hour = pTime->tm_hour;
+            tNext = timegm(&next);
+            for (i=0; i<400; i++) { // search forward for a matching day
+                if (tNext > tNow) {
+                    gmtime_r(&tNext, &next);
+                    if ((type != ALARM_DAY && type != ALARM2_DAY) || next.tm_wday == pTime->tm_wday) {
+                        if ((type != ALARM_DATE && type != ALARM2_DATE) || next.tm_mday == pTime->tm_mday)
+                            break;
+                    }
+                }
+                tNext += 24*3600;
+            }
+            break;
+    } // switch on type
+    gmtime_r(&tNext, &next);
+    memset(&wk, 0, sizeof(wk));
+    wk.enabled = 1;
+    wk.time.tm_sec = next.tm_sec;
+    wk.time.tm_min = next.tm_min;
+    wk.time.tm_hour = next.tm_hour;
+    wk.time.tm_mday = next.tm_mday;
+    wk.time.tm_mon = next.tm_mon;
+    wk.time.tm_year = next.tm_year;
+    wk.time.tm_wday = wk.time.tm_yday = wk.time.tm_isdst = -1;
+    return (ioctl(_iRTCDev, RTC_WKALM_SET, &wk) < 0) ? RTC_ERROR : RTC_SUCCESS;
+} /* rtcDevSetAlarm() */
+
+//
+// The kernel alarm is always a full date and time match
+//
+int BBRTC::rtcDevGetAlarm(RTC_ALARM_INFO *pInfo)
+{
+struct rtc_wkalrm wk;
+
+    if (ioctl(_iRTCDev, RTC_WKALM_RD, &wk) < 0) return RTC_ERROR;
+    pInfo->u8Match = RTC_MATCH_SEC | RTC_MATCH_MIN | RTC_MATCH_HOUR | RTC_MATCH_MDAY | RTC_MATCH_MON | RTC_MATCH_YEAR;
+    pInfo->bEnabled = (wk.enabled != 0);
+    pInfo->bFired = (wk.pending != 0);
+    pInfo->tmMatch.tm_sec = wk.time.tm_sec;
+    pInfo->tmMatch.tm_min = wk.time.tm_min;
+    pInfo->tmMatch.tm_hour = wk.time.tm_hour;
+    pInfo->tmMatch.tm_mday = wk.time.tm_mday;
+    pInfo->tmMatch.tm_mon = wk.time.tm_mon;
+    pInfo->tmMatch.tm_year = wk.time.tm_year;
+    pInfo->tmMatch.tm_wday = wk.time.tm_wday;
+    return RTC_SUCCESS;
+} /* rtcDevGetAlarm() */
+
+int BBRTC::rtcDevGetStatus(void)
+{
+int iStatus = 0;
+unsigned int uVL = 0;
+struct rtc_time rt;
+struct pollfd pfd;
+
+    if (ioctl(_iRTCDev, RTC_RD_TIME, &rt) == 0) {
+        // not all drivers support RTC_VL_READ; treat that as valid
+        if (ioctl(_iRTCDev, RTC_VL_READ, &uVL) < 0 || !(uVL & RTC_VL_DATA_INVALID))
+            iStatus |= STATUS_RUNNING;
+    }
+    pfd.fd = _iRTCDev;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if (poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN))
+        iStatus |= STATUS_IRQ1_TRIGGERED; // an interrupt is waiting to be read
+    return iStatus;
+} /* rtcDevGetStatus() */
+
+//
+// Block until the driver reports an alarm or update interrupt
+//
+int BBRTC::rtcDevWait(int iTimeoutMs)
+{
+fd_set fds;
+struct timeval tv;
+unsigned long ulData;
+int rc;
+
+    FD_ZERO(&fds);
+    FD_SET(_iRTCDev, &fds);
+    tv.tv_sec = iTimeoutMs / 1000;
+    tv.tv_usec = (iTimeoutMs % 1000) * 1000;
+    rc = select(_iRTCDev+1, &fds, NULL, NULL, (iTimeoutMs < 0) ? NULL : &tv);
+    if (rc == 0) return RTC_TIMEOUT;
+    if (rc < 0) return RTC_ERROR;
+    if (read(_iRTCDev, &ulData, sizeof(ulData)) != sizeof(ulData)) return RTC_ERROR;
+    return RTC_SUCCESS;
+} /* rtcDevWait() */
+
+//
+// Drop any interrupt events already queued on the device
+//
+void BBRTC::rtcDevDrain(void)
+{
+unsigned long ulData;
+struct pollfd pfd;
+
+    pfd.fd = _iRTCDev;
+    pfd.events = POLLIN;
+    while (poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN)) {
+        if (read(_iRTCDev, &ulData, sizeof(ulData)) != sizeof(ulData)) break;
+    }
+} /* rtcDevDrain() */
+
+//
+// Disable the alarm and update interrupts and drop any pending event
+//
+void BBRTC::rtcDevClear(void)
+{
+    ioctl(_iRTCDev, RTC_AIE_OFF, 0);
+    ioctl(_iRTCDev, RTC_UIE_OFF, 0);
+    rtcDevDrain();
+} /* rtcDevClear() */
+
+//
+// Use the update (1Hz) interrupt to find the start of the next second
+// The host timestamp is taken as soon as read() returns, so the
+// uncertainty is the (nominal) interrupt to user space latency. Events
+// queued before the call are dropped (a stale one would give the wrong
+// edge) and the update interrupt is turned off again on the way out.
+//
+int BBRTC::rtcDevWaitSecond(RTC_EDGE *pEdge, int iTimeoutMs)
+{
+struct tm tmNow;
+int rc;
+
+    rtcDevDrain();
+    if (ioctl(_iRTCDev, RTC_UIE_ON, 0) < 0) return RTC_ERROR;
+    rc = rtcDevWait(iTimeoutMs);
+    if (rc == RTC_SUCCESS) {
+        pEdge->i64MonoNs = rtcClockNs(CLOCK_MONOTONIC);
+        pEdge->i64RealNs = rtcClockNs(CLOCK_REALTIME);
+        pEdge->i32UncertaintyNs = RTC_EDGE_IRQ_NS;
+    }
+    ioctl(_iRTCDev, RTC_UIE_OFF, 0);
+    if (rc != RTC_SUCCESS) return rc;
+    if (rtcDevGetTime(&tmNow) != RTC_SUCCESS) return RTC_ERROR;
+    pEdge->u32Epoch = (uint32_t)timegm(&tmNow);
+    return RTC_SUCCESS;
+} /* rtcDevWaitSecond() */
+
+#endif // __BB_RTC_DEV__